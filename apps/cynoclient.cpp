@@ -0,0 +1,49 @@
+#include <cynophobia/server.hpp>
+
+#include <climits>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+
+/*
+Usage: cynoclient SOCKET <cynocompiler arguments>
+
+The same as cynocompiler --connect SOCKET, without the compiler: it starts
+in a fraction of the time, since it links no sanitizer runtime and sets up
+no lexer tables. When no server is listening it runs the cynocompiler next
+to it instead.
+*/
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        return 1;
+    }
+    std::string socket_path(argv[1]);
+    std::vector<std::string> arguments(argv + 2, argv + argc);
+    char directory[PATH_MAX];
+    if (!getcwd(directory, sizeof(directory))) {
+        directory[0] = '\0';
+    }
+
+    int exit_code = 0;
+    ForwardStatus status = forward_to_server(socket_path, directory, arguments,
+        STDIN_FILENO, STDOUT_FILENO, exit_code);
+    if (status == FORWARDED) {
+        return exit_code;
+    } else if (status == CONNECTION_LOST) {
+        std::fprintf(stderr, "cynoclient: lost the connection to %s\n", socket_path.c_str());
+        return 1;
+    }
+
+    std::string self(argv[0]);
+    std::string compiler = self.find('/') == std::string::npos ? "cynocompiler"
+        : self.substr(0, self.rfind('/') + 1) + "cynocompiler";
+    argv[1] = &compiler[0];
+    execvp(compiler.c_str(), argv + 1);
+    std::fprintf(stderr, "cynoclient: no server at %s and cannot run %s\n",
+        socket_path.c_str(), compiler.c_str());
+    return 1;
+}
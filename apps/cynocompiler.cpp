@@ -1,83 +1,924 @@
+#include <cynophobia/allocations.hpp>
+#include <cynophobia/arena.hpp>
+#include <cynophobia/cache.hpp>
+#include <cynophobia/charstream.hpp>
+#include <cynophobia/codegen.hpp>
+#include <cynophobia/debugwriter.hpp>
 #include <cynophobia/lexer.hpp>
-#include <cynophobia/shared.hpp> 
+#include <cynophobia/object.hpp>
+#include <cynophobia/optimizer.hpp>
+#include <cynophobia/parser.hpp>
+#include <cynophobia/preprocessor.hpp>
+#include <cynophobia/server.hpp>
+#include <cynophobia/shared.hpp>
+#include <cynophobia/tacky.hpp>
+#include <cynophobia/trace.hpp>
 
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#define STDIN_FILENO 0
+#define STDOUT_FILENO 1
+#else
+#include <errno.h>
+#include <limits.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+#endif
 
 
 /*
-Expects argc at least 2 and up to 4. 
-First: name of the executable. 
-Second argument: filename for output of C program after GCC preprocessor. 
-Optional arguments must appear in this order: 
-- [if present] --debug, which will print intermediate outputs to stdout.
-- [if present] --lex | --parse | --codegen, which will halt compilation after lexer, parser, and code generationn
+Usage: cynocompiler <file>... [--debug [--binary-debug]] [--lex | --parse | --tacky | --codegen | -S | -c]
+                    [-O | --no-opt] [--max-nesting N] [-j N]
+                    [--preprocess [-I DIR]... [-D NAME[=VALUE]]...]
+                    [--cache-dir DIR [--cache-size BYTES] [--cache-stats]]
+                    [--stats] [--trace=FILE]
+       cynocompiler --connect SOCKET <any of the above>
+       cynocompiler --server SOCKET
+
+Each file is the output of the GCC preprocessor for one C program; - is
+standard input, so the preprocessor can write straight into the compiler:
+
+    gcc -E -P program.c | cynocompiler - --lex
+
+- --preprocess runs the built-in preprocessor (see preprocessor.hpp) on
+  each file first, so files are C source instead, and the same as the
+  pipeline above is
 
+    cynocompiler --preprocess program.c --lex
+
+  -I DIR adds a directory to search for #include, and -D NAME[=VALUE]
+  defines a macro, as they do for gcc. Without --preprocess they do
+  nothing.
+- --debug prints intermediate outputs and diagnostics to stdout.
+- --binary-debug makes --debug write each file's lexer output as a binary
+  dump instead (see write_lexer_dump in debugwriter.hpp), and nothing else.
+- --lex | --parse | --tacky | --codegen halt compilation after the lexer,
+  parser, lowering to TACKY (see tacky.hpp) and code generation. With
+  --debug, lowering prints the TACKY and code generation the assembly.
+- -S writes the assembly for each file to a .s file named after it (with
+  its extension replaced; a.s for -), and -c writes an x86-64 ELF object
+  (.o) instead, encoded directly (see codegen.hpp) rather than by running
+  an assembler. Without any of these, each file's object is linked into
+  an executable named after the file without its extension (a.out for -)
+  by the system's cc, and removed.
+- -O optimizes the TACKY before code generation (see optimizer.hpp):
+  constant folding, unreachable-code elimination, copy propagation and
+  dead-store elimination, repeated until nothing changes. --no-opt turns
+  it back off; the last of the two wins, and the default is off. With
+  --debug, the TACKY printed is the optimized one.
+- --max-nesting N sets how deeply expressions may nest (unary and binary
+  operators and parentheses waiting on each other) before parsing stops
+  with an error; the default is DEFAULT_MAX_NESTING in parser.hpp.
+- -j N compiles up to N files at once (default 1). With fewer files than
+  that, the spare threads lex large files in chunks.
+- --cache-dir DIR looks each file up in an on-disk cache of results keyed
+  by its contents (see cache.hpp), and stores what it had to compute.
+  --cache-size caps the cache (default 1 GiB); --cache-stats prints its
+  hit/miss counters as JSON after everything else, and is allowed without
+  files.
+- --stats prints, after the output of every file, one line of JSON with the
+  wall time and peak RSS of the whole run and, for each stage that ran,
+  the files it saw, time spent in it summed over files, bytes in, tokens
+  (or later nodes, instructions) out, throughput, heap allocations and
+  bytes allocated in it (only in a build configured with
+  -DCYNOPHOBIA_COUNT_ALLOCATIONS=ON), and the process's peak RSS when it
+  last finished.
+  The optimize stage adds, for each pass, how often it ran, the time it
+  took and the instructions it rewrote or removed.
+- --trace=FILE writes a Chrome trace-event timeline of the run to FILE
+  (open it in chrome://tracing or https://ui.perfetto.dev), with spans for
+  each file and for the passes inside each stage. A FILE that
+  cannot be created is a bad command line.
+
+Output is written one file at a time, in the order the files were given,
+whatever order they finish in. Each file gets an exit code: 255 if it could
+not be opened, 254 if reading it failed, 253 for unrecognized tokens, 251
+for preprocessing errors, 250 for a parse error, 249 if an output could
+not be written or linking failed, 0 otherwise (252, for stages not
+supported yet, is no longer used). The process exits with the code of the
+first file, in argument order, that did not get 0; 1 for a bad command
+line.
+
+The original form, one file then optional --debug then an optional stage
+flag, is still accepted.
+
+--server SOCKET keeps one process running on a Unix domain socket until it
+gets SIGINT or SIGTERM, and --connect SOCKET hands the rest of the command
+line to it (see server.hpp). The server opens files relative to the
+client's working directory and writes to the client's own stdout, so the
+output and exit code are those of running the command directly, which is
+what --connect does when no server is listening.
 */
-int main(int argc, char* argv[]) {
-    if (argc < 2 || argc > 4) {
-        return 1; 
-    }
-
-    std::string filename(argv[1]);  
-    bool debug = false; 
-    Target target = LinkStage; 
-    
-    if (argc > 2) {
-        std::string debug_flag{"--debug"};
-        std::unordered_map<std::string, Target> options = {
-            { "--lex", LexStage},
-            { "--parse", ParseStage},
-            { "--codegen", CodegenStage}
-        }; 
-
-        std::string second(argv[2]);
-
-        int stage_index = 0;
-        if (debug_flag.compare(second) == 0) {
-            debug = true; 
-            if (argc == 4) { stage_index = 3; }
+
+struct Options {
+    // Where relative paths are resolved; empty for the process's own.
+    std::string directory;
+    // What the filename - reads.
+    int in_fd;
+    std::vector<std::string> filenames;
+    bool debug;
+    bool binary_debug;
+    Target target;
+    // -S and -c, which stop after code generation like --codegen but
+    // write out what it made.
+    bool assembly_output;
+    bool object_output;
+    bool optimize;
+    std::size_t max_nesting;
+    unsigned int jobs;
+    bool preprocess;
+    PreprocessorOptions preprocessor;
+    std::string cache_directory;
+    std::uint64_t cache_size;
+    bool cache_stats;
+    bool stats;
+    std::string trace_file;
+};
+
+// Names everything besides the input that cached lexer output depends on.
+// Bump it whenever the lexer's output can change.
+const char* const LEXER_CACHE_CONFIG = "cynophobia tokens 2";
+
+bool parse_count(const std::string& text, unsigned long long& count) {
+    char* end = nullptr;
+    count = std::strtoull(text.c_str(), &end, 10);
+    return !text.empty() && *end == '\0' && count > 0;
+}
+
+bool parse_arguments(const std::vector<std::string>& arguments, Options& options) {
+    const std::unordered_map<std::string, Target> stages = {
+        { "--lex", LexStage},
+        { "--parse", ParseStage},
+        { "--tacky", TackyStage},
+        { "--codegen", CodegenStage}
+    };
+    options.debug = false;
+    options.binary_debug = false;
+    options.target = LinkStage;
+    options.assembly_output = false;
+    options.object_output = false;
+    options.optimize = false;
+    options.max_nesting = DEFAULT_MAX_NESTING;
+    options.jobs = 1;
+    options.preprocess = false;
+    options.cache_size = DEFAULT_CACHE_SIZE;
+    options.cache_stats = false;
+    options.stats = false;
+    std::size_t argc = arguments.size();
+    for (std::size_t i = 0; i < argc; i++) {
+        const std::string& argument = arguments[i];
+        auto stage = stages.find(argument);
+        if (argument == "--debug") {
+            options.debug = true;
+        } else if (argument == "--binary-debug") {
+            options.binary_debug = true;
+        } else if (stage != stages.end()) {
+            options.target = stage->second;
+            options.assembly_output = false;
+            options.object_output = false;
+        } else if (argument == "-S" || argument == "-c") {
+            options.target = CodegenStage;
+            options.assembly_output = argument == "-S";
+            options.object_output = argument == "-c";
+        } else if (argument == "-O" || argument == "--no-opt") {
+            options.optimize = argument == "-O";
+        } else if (argument == "--max-nesting") {
+            unsigned long long depth;
+            if (i + 1 >= argc || !parse_count(arguments[++i], depth)) {
+                return false;
+            }
+            options.max_nesting = (std::size_t)depth;
+        } else if (argument.compare(0, 2, "-j") == 0) {
+            std::string count = argument.size() > 2 ? argument.substr(2)
+                : (i + 1 < argc ? arguments[++i] : std::string());
+            unsigned long long jobs;
+            if (!parse_count(count, jobs)) {
+                return false;
+            }
+            options.jobs = (unsigned int)jobs;
+        } else if (argument == "--preprocess") {
+            options.preprocess = true;
+        } else if (argument.compare(0, 2, "-I") == 0 || argument.compare(0, 2, "-D") == 0) {
+            std::string value = argument.size() > 2 ? argument.substr(2)
+                : (i + 1 < argc ? arguments[++i] : std::string());
+            if (value.empty()) {
+                return false;
+            }
+            if (argument[1] == 'I') {
+                options.preprocessor.include_directories.push_back(value);
+            } else {
+                options.preprocessor.definitions.push_back(value);
+            }
+        } else if (argument == "--cache-dir" || argument == "--cache-size") {
+            if (i + 1 >= argc) {
+                return false;
+            }
+            const std::string& value = arguments[++i];
+            unsigned long long size;
+            if (argument == "--cache-dir") {
+                options.cache_directory = value;
+            } else if (parse_count(value, size)) {
+                options.cache_size = size;
+            } else {
+                return false;
+            }
+        } else if (argument == "--cache-stats") {
+            options.cache_stats = true;
+        } else if (argument == "--stats") {
+            options.stats = true;
+        } else if (argument.compare(0, 8, "--trace=") == 0 && argument.size() > 8) {
+            options.trace_file = argument.substr(8);
+        } else if (argument.compare(0, 2, "--") == 0) {
+            // Unknown options are ignored, as they always were.
         } else {
-            stage_index = 2;
+            options.filenames.push_back(argument);
+        }
+    }
+    if (options.cache_stats && options.cache_directory.empty()) {
+        return false;
+    }
+    return !options.filenames.empty() || options.cache_stats;
+}
+
+std::string resolve(const Options& options, const std::string& path) {
+    return options.directory.empty() || path.empty() || path[0] == '/' || path == "-"
+        ? path : options.directory + "/" + path;
+}
+
+long peak_rss_kb() {
+#ifdef _WIN32
+    return 0;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+#endif
+}
+
+double seconds_since(TraceClock::time_point start) {
+    return std::chrono::duration<double>(TraceClock::now() - start).count();
+}
+
+// What --stats reports for one stage, summed over files.
+struct StageStats {
+    unsigned long long files;
+    double seconds;
+    unsigned long long bytes_in;
+    unsigned long long items_out;
+    long peak_rss_kb;
+};
+
+// Indexed by Target; LinkStage is not a stage of its own.
+const char* const STAGE_NAMES[] = { "preprocess", "lex", "parse", "tacky", "optimize", "codegen" };
+const char* const STAGE_OUTPUTS[] = {
+    "bytes", "tokens", "nodes", "instructions", "instructions", "instructions"
+};
+
+class CompileStats {
+    public:
+        CompileStats() : start(TraceClock::now()), stages(), optimizer() {
+            for (int stage = PreprocessStage; stage < LinkStage; stage++) {
+                allocations_before[stage] = allocations_in((Target)stage);
+            }
+        }
+
+        // For a stage that ran from stage_start until now.
+        void add(Target stage, TraceClock::time_point stage_start,
+          std::size_t bytes_in, std::size_t items_out) {
+            double seconds = seconds_since(stage_start);
+            long rss = peak_rss_kb();
+            std::lock_guard<std::mutex> guard(lock);
+            StageStats& totals = stages[stage];
+            totals.files++;
+            totals.seconds += seconds;
+            totals.bytes_in += bytes_in;
+            totals.items_out += items_out;
+            totals.peak_rss_kb = rss;
+        }
+
+        void add_optimizer(const OptimizerStats& file_stats) {
+            std::lock_guard<std::mutex> guard(lock);
+            for (int pass = 0; pass < OPTIMIZATION_PASS_COUNT; pass++) {
+                optimizer.passes[pass].runs += file_stats.passes[pass].runs;
+                optimizer.passes[pass].seconds += file_stats.passes[pass].seconds;
+                optimizer.passes[pass].changes += file_stats.passes[pass].changes;
+            }
+            optimizer.rounds += file_stats.rounds;
+        }
+
+        void write(DebugWriter& out) {
+            std::lock_guard<std::mutex> guard(lock);
+            char text[256];
+            int size = snprintf(text, sizeof(text),
+                "{\"wall_seconds\": %.6f, \"peak_rss_bytes\": %lld, \"stages\": [",
+                seconds_since(start), (long long)peak_rss_kb() * 1024);
+            out.write(text, (std::size_t)size);
+            bool first = true;
+            for (int stage = PreprocessStage; stage < LinkStage; stage++) {
+                const StageStats& totals = stages[stage];
+                if (totals.files == 0) {
+                    continue;
+                }
+                double seconds = totals.seconds > 0 ? totals.seconds : 1e-9;
+                size = snprintf(text, sizeof(text),
+                    "%s{\"stage\": \"%s\", \"files\": %llu, \"seconds\": %.6f, "
+                    "\"bytes_in\": %llu, \"%s_out\": %llu, \"bytes_per_second\": %.0f, "
+                    "\"%s_per_second\": %.0f, ",
+                    first ? "" : ", ", STAGE_NAMES[stage], totals.files, totals.seconds,
+                    totals.bytes_in, STAGE_OUTPUTS[stage], totals.items_out,
+                    totals.bytes_in / seconds, STAGE_OUTPUTS[stage], totals.items_out / seconds);
+                out.write(text, (std::size_t)size);
+                if (counting_allocations()) {
+                    // Includes whatever else a compile server ran meanwhile.
+                    AllocationCount allocated = allocations_in((Target)stage)
+                        - allocations_before[stage];
+                    size = snprintf(text, sizeof(text),
+                        "\"allocations\": %llu, \"allocated_bytes\": %llu, ",
+                        allocated.allocations, allocated.bytes);
+                    out.write(text, (std::size_t)size);
+                }
+                size = snprintf(text, sizeof(text), "\"peak_rss_bytes\": %lld",
+                    (long long)totals.peak_rss_kb * 1024);
+                out.write(text, (std::size_t)size);
+                if (stage == OptimizeStage) {
+                    write_passes(out);
+                }
+                out.write_char('}');
+                first = false;
+            }
+            out.write("]}\n");
+        }
+
+    private:
+        void write_passes(DebugWriter& out) {
+            char text[256];
+            int size = snprintf(text, sizeof(text), ", \"rounds\": %llu, \"passes\": [",
+                optimizer.rounds);
+            out.write(text, (std::size_t)size);
+            for (int pass = 0; pass < OPTIMIZATION_PASS_COUNT; pass++) {
+                const PassStats& totals = optimizer.passes[pass];
+                size = snprintf(text, sizeof(text),
+                    "%s{\"pass\": \"%s\", \"runs\": %llu, \"seconds\": %.6f, "
+                    "\"changes\": %llu}",
+                    pass == 0 ? "" : ", ", pass_name((OptimizationPass)pass), totals.runs,
+                    totals.seconds, totals.changes);
+                out.write(text, (std::size_t)size);
+            }
+            out.write_char(']');
+        }
+
+        const TraceClock::time_point start;
+        std::mutex lock;
+        StageStats stages[LinkStage];
+        OptimizerStats optimizer;
+        AllocationCount allocations_before[LinkStage];
+};
+
+// Lexes a source, or reads back its tokens from the cache. Hits are
+// checked against the input, which the dump carries, so a hash collision
+// can only cost a miss. Failed reads are never stored.
+LexerOutput lex_cached(std::shared_ptr<const SourceBuffer> file, const ResultCache* cache,
+  unsigned int lex_jobs) {
+    if (!cache) {
+        return lex_source(std::move(file), false, lex_jobs);
+    }
+    CacheKey key = cache_key(file->data(), file->size(), LEXER_CACHE_CONFIG);
+    std::string dump;
+    {
+        TraceScope lookup_trace("cache lookup");
+        if (cache->load(key, "tokens", dump)) {
+            LexerOutput cached = {};
+            std::size_t consumed = 0;
+            if (read_lexer_dump(dump.data(), dump.size(), cached, consumed)
+                && consumed == dump.size()
+                && cached.tokens.source()->size() == file->size()
+                && std::memcmp(cached.tokens.source()->data(), file->data(), file->size()) == 0) {
+                return cached;
+            }
+        }
+    }
+    LexerOutput lexer_output = lex_source(file, false, lex_jobs);
+    if (!lexer_output.read_failed) {
+        TraceScope store_trace("cache store");
+        dump.clear();
+        {
+            DebugWriter writer(dump);
+            write_lexer_dump(writer, lexer_output);
+        }
+        cache->store(key, "tokens", dump);
+    }
+    return lexer_output;
+}
+
+// Lexes a file, or what - reads, through the cache if there is one.
+LexerOutput lex_input(const std::string& filename, int in_fd, const ResultCache* cache,
+  unsigned int lex_jobs) {
+    bool from_stdin = filename == "-";
+    if (!cache) {
+        if (from_stdin) {
+            return lex_fd(in_fd, false, lex_jobs);
+        }
+        return lex_jobs > 1
+            ? lex_file_parallel({ filename, false }, lex_jobs)
+            : lex_file({ filename, false });
+    }
+    std::shared_ptr<const SourceBuffer> file;
+    if (from_stdin) {
+        std::string text;
+        if (!read_whole_fd(in_fd, text)) {
+            LexerOutput failed = lex_string(std::move(text), false);
+            failed.read_failed = true;
+            return failed;
+        }
+        file = std::make_shared<OwnedString>(std::move(text));
+    } else {
+        std::shared_ptr<const MappedFile> mapped = std::make_shared<MappedFile>(filename);
+        if (!mapped->was_opened()) {
+            return lex_file({ filename, false });
+        }
+        file = mapped;
+    }
+    return lex_cached(std::move(file), cache, lex_jobs);
+}
+
+// Runs the built-in preprocessor on a file, or on what - reads.
+PreprocessorOutput preprocess_input(const std::string& filename, const Options& options,
+  bool& read_failed) {
+    read_failed = false;
+    if (filename != "-") {
+        return preprocess_file(filename, options.preprocessor);
+    }
+    std::string text;
+    read_failed = !read_whole_fd(options.in_fd, text);
+    return preprocess_string(std::move(text), "<stdin>", options.preprocessor);
+}
+
+// The file's path without its extension, which outputs are named after.
+std::string output_stem(const std::string& filename) {
+    if (filename == "-") {
+        return "a";
+    }
+    std::size_t slash = filename.rfind('/');
+    std::size_t dot = filename.rfind('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)
+        || dot == (slash == std::string::npos ? 0 : slash + 1)) {
+        return filename;
+    }
+    return filename.substr(0, dot);
+}
+
+// The name .file and the object's file symbol give the source, as gcc's.
+std::string source_name(const std::string& filename) {
+    if (filename == "-") {
+        return "<stdin>";
+    }
+    std::size_t slash = filename.rfind('/');
+    return slash == std::string::npos ? filename : filename.substr(slash + 1);
+}
+
+bool write_file(const std::string& path, const std::string& contents) {
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+    bool written = std::fwrite(contents.data(), 1, contents.size(), file) == contents.size();
+    return std::fclose(file) == 0 && written;
+}
+
+// Links an object into an executable with the system's compiler driver,
+// which knows where the C runtime and its startup files are.
+bool link_executable(const std::string& object_path, const std::string& output_path) {
+    TraceScope trace("link", output_path.c_str());
+#ifdef _WIN32
+    (void)object_path;
+    return false;
+#else
+    std::vector<std::string> arguments = { "cc", object_path, "-o", output_path };
+    std::vector<char*> argv;
+    for (std::string& argument : arguments) {
+        argv.push_back(&argument[0]);
+    }
+    argv.push_back(nullptr);
+    pid_t pid;
+    if (posix_spawnp(&pid, "cc", nullptr, nullptr, argv.data(), environ) != 0) {
+        return false;
+    }
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            return false;
         }
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+#endif
+}
 
-        if (stage_index != 0) {
-            std::string flag(argv[stage_index]); 
-            auto entry = options.find(flag); 
-            if (entry != options.end()) {
-                target = entry->second; 
+// Arenas for parsing, reused from one file, or server command, to the next.
+// Each compiling thread holds one at a time; one that grew past 64 MiB on
+// a huge file is not kept.
+ArenaPool parse_arenas(64, (std::size_t)64 << 20);
+
+// Compiles one file on up to lex_jobs threads, writing what it prints to
+// out, and returns its exit code. stats is null without --stats.
+int compile_file(const std::string& filename, const Options& options,
+  const ResultCache* cache, CompileStats* stats, unsigned int lex_jobs, DebugWriter& out) {
+    TraceScope trace("compile", filename.c_str());
+    bool debug = options.debug && !options.binary_debug;
+    std::shared_ptr<const SourceBuffer> preprocessed;
+    bool preprocess_open_failed = false;
+    bool preprocess_read_failed = false;
+    if (options.preprocess) {
+        TraceClock::time_point preprocess_start;
+        if (stats) {
+            preprocess_start = TraceClock::now();
+        }
+        PreprocessorOutput preprocessor_output = preprocess_input(resolve(options, filename),
+            options, preprocess_read_failed);
+        preprocess_open_failed = preprocessor_output.open_failed;
+        if (stats && !preprocess_open_failed) {
+            stats->add(PreprocessStage, preprocess_start, preprocessor_output.bytes_read,
+                preprocessor_output.text.size());
+        }
+        if (!preprocess_open_failed && !preprocess_read_failed
+            && !preprocessor_output.errors.empty()) {
+            if (debug) {
+                for (const PreprocessorError& error : preprocessor_output.errors) {
+                    out.write(error.debug_string());
+                    out.write_char('\n');
+                }
             }
+            return 251;
         }
+        preprocessed = std::make_shared<OwnedString>(std::move(preprocessor_output.text));
     }
 
-    const Config& config = { filename, debug };
-    LexerOutput lexer_output = lex_file(config);
+    TraceClock::time_point lex_start;
+    if (stats) {
+        lex_start = TraceClock::now();
+    }
+    LexerOutput lexer_output = {};
+    {
+        // Cache lookups count as lexing.
+        AllocationStage stage(LexStage);
+        if (!options.preprocess) {
+            lexer_output = lex_input(resolve(options, filename), options.in_fd, cache, lex_jobs);
+        } else if (preprocess_open_failed || preprocess_read_failed) {
+            lexer_output = lex_string(std::string(), false);
+            lexer_output.open_failed = preprocess_open_failed;
+            lexer_output.read_failed = preprocess_read_failed;
+        } else {
+            lexer_output = lex_cached(preprocessed, cache, lex_jobs);
+        }
+    }
+    if (stats && !lexer_output.open_failed) {
+        stats->add(LexStage, lex_start, lexer_output.tokens.source()->size(),
+            lexer_output.tokens.size());
+    }
+    if (options.debug && options.binary_debug) {
+        write_lexer_dump(out, lexer_output);
+    } else if (debug) {
+        write_debug(out, lexer_output);
+    }
     if (lexer_output.open_failed) {
         if (debug) {
-            printf("%s: error: file open failed\n", config.filename.c_str());
-        } 
-        
+            out.write(filename);
+            out.write(": error: file open failed\n");
+        }
         return 255;
     } else if (lexer_output.read_failed) {
         if (debug) {
-            printf("%s: error: reading file filed\n", config.filename.c_str());
-        } 
+            out.write(filename);
+            out.write(": error: reading file filed\n");
+        }
         return 254;
     } else if (lexer_output.unknown_tokens.size() != 0) {
         if (debug) {
             for (const UnknownToken& u: lexer_output.unknown_tokens) {
-                printf("%s:%s: error: unrecognized token %s\n", 
-                  config.filename.c_str(),
-                  u.position.debug_string().c_str(),
-                  u.text.c_str());
-            }   
+                out.write(filename);
+                out.write_char(':');
+                write_debug(out, u.position);
+                out.write(": error: unrecognized token ");
+                out.write(u.text);
+                out.write_char('\n');
+            }
         }
         return 253;
     }
 
-    if (target != LexStage) {
-        printf("Stage not supported yet\n");
-        return 252; 
+    if (options.target == LexStage) {
+        return 0;
+    }
+    if (debug) {
+        // Ends the token dump, ahead of what later stages print.
+        out.write_char('\n');
+    }
+
+    std::size_t source_size = lexer_output.tokens.source()->size();
+    TraceClock::time_point parse_start;
+    if (stats) {
+        parse_start = TraceClock::now();
+    }
+    ParserOutput parser_output = parse_program(lexer_output.tokens, parse_arenas.acquire(),
+        options.max_nesting);
+    if (stats) {
+        stats->add(ParseStage, parse_start, source_size,
+            parser_output.is_error ? 0 : node_count(*parser_output.program));
+    }
+    if (parser_output.is_error) {
+        if (debug) {
+            out.write(filename);
+            out.write_char(':');
+            write_debug(out, parser_output.error.position);
+            out.write(": error: ");
+            out.write(parser_output.error.message);
+            out.write_char('\n');
+        }
+        return 250;
+    }
+    if (options.target == ParseStage) {
+        return 0;
+    }
+
+    TraceClock::time_point tacky_start;
+    if (stats) {
+        tacky_start = TraceClock::now();
+    }
+    tacky::Program tacky_program = lower_program(*parser_output.program);
+    if (stats) {
+        stats->add(TackyStage, tacky_start, source_size, instruction_count(tacky_program));
+    }
+    if (options.optimize) {
+        TraceClock::time_point optimize_start;
+        if (stats) {
+            optimize_start = TraceClock::now();
+        }
+        OptimizerStats optimizer_stats = {};
+        optimize_program(tacky_program, optimizer_stats);
+        if (stats) {
+            stats->add(OptimizeStage, optimize_start, source_size,
+                instruction_count(tacky_program));
+            stats->add_optimizer(optimizer_stats);
+        }
+    }
+    if (debug) {
+        write_debug(out, tacky_program);
+    }
+    if (options.target == TackyStage) {
+        return 0;
+    }
+
+    TraceClock::time_point codegen_start;
+    if (stats) {
+        codegen_start = TraceClock::now();
+    }
+    assembly::Program assembly_program = generate_assembly(tacky_program);
+    std::string name = source_name(filename);
+    if (debug) {
+        write_assembly(out, assembly_program, name);
+    }
+    std::string output;
+    if (options.assembly_output) {
+        DebugWriter writer(output);
+        write_assembly(writer, assembly_program, name);
+    } else if (options.target == LinkStage || options.object_output) {
+        ObjectFile object = encode_object(assembly_program, name);
+        DebugWriter writer(output);
+        write_elf_object(writer, object);
+    }
+    if (stats) {
+        stats->add(CodegenStage, codegen_start, source_size,
+            instruction_count(assembly_program));
+    }
+    if (options.target == CodegenStage && !options.assembly_output && !options.object_output) {
+        return 0;
+    }
+
+    std::string stem = resolve(options, output_stem(filename));
+    std::string output_path = stem + (options.assembly_output ? ".s" : ".o");
+    if (!write_file(output_path, output)) {
+        if (debug) {
+            out.write(output_path);
+            out.write(": error: cannot write output\n");
+        }
+        return 249;
+    }
+    if (options.target == CodegenStage) {
+        return 0;
+    }
+    std::string executable_path = filename == "-" ? resolve(options, "a.out") : stem;
+    bool linked = link_executable(output_path, executable_path);
+    std::remove(output_path.c_str());
+    if (!linked) {
+        if (debug) {
+            out.write(executable_path);
+            out.write(": error: linking failed\n");
+        }
+        return 249;
     }
     return 0;
-}
\ No newline at end of file
+}
+
+struct FileResult {
+    std::string out;
+    int exit_code;
+    bool done;
+};
+
+// Workers take files in argument order; the calling thread writes each
+// file's output as soon as it and every file before it are done. A single
+// file is compiled on the calling thread, writing straight to stdout.
+int compile_all(const Options& options, const ResultCache* cache, CompileStats* stats,
+  DebugWriter& stdout_writer) {
+    if (options.filenames.size() == 1) {
+        return compile_file(options.filenames[0], options, cache, stats, options.jobs,
+            stdout_writer);
+    }
+
+    std::vector<FileResult> results(options.filenames.size(), FileResult { "", 0, false });
+    std::mutex lock;
+    std::condition_variable finished;
+    std::size_t next_file = 0;
+    unsigned int worker_count = options.jobs < results.size()
+        ? options.jobs : (unsigned int)results.size();
+    unsigned int lex_jobs = options.jobs / worker_count;
+
+    auto work = [&]() {
+        while (true) {
+            std::size_t index;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (next_file == results.size()) {
+                    return;
+                }
+                index = next_file++;
+            }
+            std::string out;
+            int exit_code;
+            {
+                DebugWriter writer(out);
+                exit_code = compile_file(options.filenames[index], options, cache, stats,
+                    lex_jobs, writer);
+            }
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                results[index].out = std::move(out);
+                results[index].exit_code = exit_code;
+                results[index].done = true;
+            }
+            finished.notify_one();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned int i = 0; i < worker_count; i++) {
+        workers.push_back(std::thread(work));
+    }
+
+    int exit_code = 0;
+    for (FileResult& result : results) {
+        std::string out;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            finished.wait(guard, [&]() { return result.done; });
+            out.swap(result.out);
+        }
+        stdout_writer.write(out);
+        stdout_writer.flush();
+        if (exit_code == 0) {
+            exit_code = result.exit_code;
+        }
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    return exit_code;
+}
+
+// Everything a direct run does, for a command line given without the
+// program name, reading - from in_fd and writing to out_fd.
+int run_command(const std::vector<std::string>& arguments, const std::string& directory,
+  int in_fd, int out_fd) {
+    Options options;
+    if (!parse_arguments(arguments, options)) {
+        return 1;
+    }
+    options.directory = directory;
+    options.in_fd = in_fd;
+    for (std::string& include_directory : options.preprocessor.include_directories) {
+        include_directory = resolve(options, include_directory);
+    }
+    std::unique_ptr<ResultCache> cache;
+    if (!options.cache_directory.empty()) {
+        cache.reset(new ResultCache(resolve(options, options.cache_directory),
+            options.cache_size));
+    }
+
+    std::FILE* trace_file = nullptr;
+    if (!options.trace_file.empty()) {
+        trace_file = std::fopen(resolve(options, options.trace_file).c_str(), "wb");
+        if (!trace_file) {
+            return 1;
+        }
+    }
+    // A compile server traces one command at a time; the timeline also
+    // shows whatever else it was doing meanwhile.
+    bool tracing = trace_file && Tracer::instance().start();
+    std::unique_ptr<CompileStats> stats(options.stats ? new CompileStats() : nullptr);
+
+    DebugWriter stdout_writer(out_fd);
+    int exit_code = options.filenames.empty() ? 0
+        : compile_all(options, cache.get(), stats.get(), stdout_writer);
+    if (trace_file) {
+        std::string trace = "{\"traceEvents\": []}\n";
+        if (tracing) {
+            trace.clear();
+            DebugWriter trace_writer(trace);
+            Tracer::instance().finish(trace_writer);
+        }
+        std::fwrite(trace.data(), 1, trace.size(), trace_file);
+        std::fclose(trace_file);
+    }
+    if (stats) {
+        stats->write(stdout_writer);
+    }
+    if (options.cache_stats) {
+        CacheStats stats;
+        cache->read_stats(stats);
+        stdout_writer.write(stats.debug_string());
+        stdout_writer.write_char('\n');
+    }
+    return exit_code;
+}
+
+CompileServer* running_server = nullptr;
+
+extern "C" void stop_server(int) {
+    running_server->stop();
+}
+
+int serve(const std::string& socket_path) {
+    CompileServer server([](const ServerRequest& request) {
+        return run_command(request.arguments, request.directory, request.in_fd,
+            request.out_fd);
+    });
+    if (!server.listen(socket_path)) {
+        return 1;
+    }
+#ifndef _WIN32
+    // A client going away must not take the server with it.
+    std::signal(SIGPIPE, SIG_IGN);
+#endif
+    running_server = &server;
+    std::signal(SIGINT, stop_server);
+    std::signal(SIGTERM, stop_server);
+    server.run();
+    return 0;
+}
+
+std::string working_directory() {
+#ifdef _WIN32
+    return std::string();
+#else
+    char path[PATH_MAX];
+    return getcwd(path, sizeof(path)) ? std::string(path) : std::string();
+#endif
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> arguments(argv + 1, argv + argc);
+    if (arguments.size() == 2 && arguments[0] == "--server") {
+        return serve(arguments[1]);
+    }
+    if (arguments.size() >= 2 && arguments[0] == "--connect") {
+        std::string socket_path = arguments[1];
+        arguments.erase(arguments.begin(), arguments.begin() + 2);
+        int exit_code = 0;
+        ForwardStatus status = forward_to_server(socket_path, working_directory(),
+            arguments, STDIN_FILENO, STDOUT_FILENO, exit_code);
+        if (status == FORWARDED) {
+            return exit_code;
+        } else if (status == CONNECTION_LOST) {
+            std::fprintf(stderr, "cynocompiler: lost the connection to %s\n",
+                socket_path.c_str());
+            return 1;
+        }
+    }
+    return run_command(arguments, std::string(), STDIN_FILENO, STDOUT_FILENO);
+}
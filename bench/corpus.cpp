@@ -0,0 +1,98 @@
+#include "corpus.hpp"
+
+#include <sstream>
+#include <string>
+
+namespace {
+    // xorshift32: fixed output on every platform, unlike <random>'s
+    // distributions.
+    class Generator {
+        public:
+            Generator(unsigned int seed) : state(seed == 0 ? 0x9E3779B9u : seed) {}
+
+            unsigned int next() {
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                return state;
+            }
+
+            unsigned int below(unsigned int bound) {
+                return bound == 0 ? 0 : next() % bound;
+            }
+
+        private:
+            unsigned int state;
+    };
+
+    void append_whitespace(std::string& out, Generator& generator,
+      const CorpusShape& shape) {
+        static const char blanks[] = { ' ', ' ', ' ', '\t', '\n' };
+        out.push_back(' ');
+        unsigned int extra = generator.below(shape.whitespace + 1);
+        for (unsigned int i = 0; i < extra; i++) {
+            out.push_back(blanks[generator.below(sizeof(blanks))]);
+        }
+    }
+
+    void append_identifier(std::string& out, Generator& generator,
+      const CorpusShape& shape) {
+        static const char first[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_";
+        static const char rest[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_0123456789";
+        unsigned int length = shape.identifier_length == 0 ? 1 : shape.identifier_length;
+        out.push_back(first[generator.below(sizeof(first) - 1)]);
+        for (unsigned int i = 1; i < length; i++) {
+            out.push_back(rest[generator.below(sizeof(rest) - 1)]);
+        }
+    }
+
+    void append_constant(std::string& out, Generator& generator,
+      const CorpusShape& shape) {
+        unsigned int digits = shape.constant_digits == 0 ? 1 : shape.constant_digits;
+        for (unsigned int i = 0; i < digits; i++) {
+            out.push_back((char)('0' + generator.below(10)));
+        }
+    }
+}
+
+std::string generate_corpus(const CorpusShape& shape) {
+    Generator generator(shape.seed);
+    std::string out;
+    for (unsigned int f = 0; f < shape.functions; f++) {
+        out += "int";
+        append_whitespace(out, generator, shape);
+        append_identifier(out, generator, shape);
+        out += "(void)";
+        append_whitespace(out, generator, shape);
+        out += "{";
+        for (unsigned int n = 0; n < shape.nesting; n++) {
+            append_whitespace(out, generator, shape);
+            out += "{";
+        }
+        append_whitespace(out, generator, shape);
+        out += "return";
+        append_whitespace(out, generator, shape);
+        out.append(shape.nesting, '(');
+        append_constant(out, generator, shape);
+        out.append(shape.nesting, ')');
+        out += ";";
+        for (unsigned int n = 0; n < shape.nesting; n++) {
+            append_whitespace(out, generator, shape);
+            out += "}";
+        }
+        append_whitespace(out, generator, shape);
+        out += "}\n";
+    }
+    return out;
+}
+
+std::string debug_string(const CorpusShape& shape) {
+    std::ostringstream oss;
+    oss << "{\"functions\": " << shape.functions
+        << ", \"identifier_length\": " << shape.identifier_length
+        << ", \"constant_digits\": " << shape.constant_digits
+        << ", \"whitespace\": " << shape.whitespace
+        << ", \"nesting\": " << shape.nesting
+        << ", \"seed\": " << shape.seed << "}";
+    return oss.str();
+}
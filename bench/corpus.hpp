@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+
+// Shape of a synthetic C program for benchmarking. The same shape and seed
+// always produce the same text.
+struct CorpusShape {
+    unsigned int functions;          // function definitions
+    unsigned int identifier_length;  // characters in each function name
+    unsigned int constant_digits;    // digits in each returned constant
+    unsigned int whitespace;         // up to this many extra blanks between tokens
+    unsigned int nesting;            // braces and parentheses around each return
+    unsigned int seed;
+};
+
+const CorpusShape DEFAULT_CORPUS_SHAPE = { 10000, 16, 6, 2, 0, 1 };
+
+// Programs with nesting 0 are valid chapter 1 programs (one function per
+// definition); deeper nesting only exercises the lexer for now.
+std::string generate_corpus(const CorpusShape& shape);
+
+std::string debug_string(const CorpusShape& shape);
@@ -0,0 +1,426 @@
+#include "corpus.hpp"
+
+#include <cynophobia/allocations.hpp>
+#include <cynophobia/arena.hpp>
+#include <cynophobia/lexer.hpp>
+#include <cynophobia/parser.hpp>
+#include <cynophobia/shared.hpp>
+#include <cynophobia/tacky.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+Benchmark harness. Generates a synthetic corpus (see corpus.hpp) and
+reports, for each benchmark, throughput, peak RSS and heap allocations as
+JSON, so results can be compared between releases.
+
+Each benchmark runs in a forked child so that peak RSS belongs to that
+benchmark alone. Times are the best of --repeat runs; allocation counts are
+for one run. Configure with -DCYNOPHOBIA_SANITIZE=OFF -DCMAKE_BUILD_TYPE=Release
+for meaningful numbers.
+
+Usage: cynobench [--functions N] [--identifier-length N] [--constant-digits N]
+                 [--whitespace N] [--nesting N] [--seed N] [--repeat N]
+                 [--benchmark NAME]... [--output FILE] [--emit-corpus FILE]
+*/
+
+//// Allocation counting (cynoallocations, see allocations.hpp)
+
+namespace {
+    AllocationCount counted = { 0, 0 };
+    AllocationCount counting_since = { 0, 0 };
+
+    void start_counting() {
+        counting_since = total_allocations();
+    }
+
+    void stop_counting() {
+        AllocationCount delta = total_allocations() - counting_since;
+        counted.allocations += delta.allocations;
+        counted.bytes += delta.bytes;
+    }
+}
+
+//// Benchmarks
+
+struct BenchInput {
+    std::string corpus;
+    std::string corpus_filename;
+};
+
+// Plain data so a forked child can send it back through a pipe.
+struct BenchResult {
+    double seconds;                        // best single run
+    unsigned long long bytes;              // source bytes per run
+    unsigned long long items;              // tokens (or what the benchmark names) per run
+    long peak_rss_kb;
+    unsigned long long allocations;        // per run
+    unsigned long long allocated_bytes;    // per run
+    double scaling;                        // see bench_parse_scaling
+    bool ok;
+};
+
+// Runs the measured operation once, returning its duration and filling in
+// bytes/items/ok. Allocation counting is on only while it runs.
+typedef double (*BenchFunction)(const BenchInput& input, BenchResult& result);
+
+typedef std::chrono::steady_clock BenchClock;
+
+double seconds_between(BenchClock::time_point start, BenchClock::time_point end) {
+    return std::chrono::duration<double>(end - start).count();
+}
+
+double bench_lex_string(const BenchInput& input, BenchResult& result) {
+    std::string program = input.corpus;
+    start_counting();
+    BenchClock::time_point start = BenchClock::now();
+    LexerOutput lexer_output = lex_string(std::move(program), false);
+    BenchClock::time_point end = BenchClock::now();
+    stop_counting();
+    result.bytes = input.corpus.size();
+    result.items = lexer_output.tokens.size();
+    result.ok = lexer_output.unknown_tokens.empty();
+    return seconds_between(start, end);
+}
+
+double bench_lex_file(const BenchInput& input, BenchResult& result) {
+    Config config = { input.corpus_filename, false };
+    start_counting();
+    BenchClock::time_point start = BenchClock::now();
+    LexerOutput lexer_output = lex_file(config);
+    BenchClock::time_point end = BenchClock::now();
+    stop_counting();
+    result.bytes = input.corpus.size();
+    result.items = lexer_output.tokens.size();
+    result.ok = !lexer_output.open_failed && lexer_output.unknown_tokens.empty();
+    return seconds_between(start, end);
+}
+
+// Pulls every token through a TokenSource reading the corpus file one
+// character at a time, as a streaming consumer would.
+double bench_token_source(const BenchInput& input, BenchResult& result) {
+    FileCharStream file_stream(input.corpus_filename);
+    start_counting();
+    BenchClock::time_point start = BenchClock::now();
+    TokenSource source(file_stream, 8);
+    std::size_t tokens = 0;
+    while (source.next_token() != nullptr) {
+        tokens++;
+    }
+    BenchClock::time_point end = BenchClock::now();
+    stop_counting();
+    result.bytes = input.corpus.size();
+    result.items = tokens;
+    result.ok = !source.open_failed() && !source.read_failed()
+        && source.unknown_tokens().empty();
+    return seconds_between(start, end);
+}
+
+double bench_parse_program(const BenchInput& input, BenchResult& result) {
+    LexerOutput lexer_output = lex_string(input.corpus, false);
+    start_counting();
+    BenchClock::time_point start = BenchClock::now();
+    ParserOutput parser_output = parse_program(lexer_output.tokens);
+    BenchClock::time_point end = BenchClock::now();
+    stop_counting();
+    result.bytes = input.corpus.size();
+    result.items = lexer_output.tokens.size();
+    result.ok = !parser_output.is_error;
+    return seconds_between(start, end);
+}
+
+// Parses the corpus into an arena a first parse left in the pool, as the
+// next file of a multi-file run or compile server would be, and frees the
+// tree again; both are timed.
+double bench_parse_recycled(const BenchInput& input, BenchResult& result) {
+    LexerOutput lexer_output = lex_string(input.corpus, false);
+    ArenaPool pool(1, (std::size_t)1 << 30);
+    parse_program(lexer_output.tokens, pool.acquire());
+    start_counting();
+    BenchClock::time_point start = BenchClock::now();
+    {
+        ParserOutput parser_output = parse_program(lexer_output.tokens, pool.acquire());
+        result.ok = !parser_output.is_error;
+    }
+    BenchClock::time_point end = BenchClock::now();
+    stop_counting();
+    result.bytes = input.corpus.size();
+    result.items = lexer_output.tokens.size();
+    return seconds_between(start, end);
+}
+
+// Lowers a parsed corpus to TACKY; items are the instructions made.
+double bench_lower_tacky(const BenchInput& input, BenchResult& result) {
+    LexerOutput lexer_output = lex_string(input.corpus, false);
+    ParserOutput parser_output = parse_program(lexer_output.tokens);
+    if (parser_output.is_error) {
+        result.ok = false;
+        return 0;
+    }
+    start_counting();
+    BenchClock::time_point start = BenchClock::now();
+    tacky::Program program = lower_program(*parser_output.program);
+    BenchClock::time_point end = BenchClock::now();
+    stop_counting();
+    result.bytes = input.corpus.size();
+    result.items = instruction_count(program);
+    result.ok = program.functions.size() == parser_output.program->functions.size();
+    return seconds_between(start, end);
+}
+
+struct Benchmark {
+    const char* name;
+    BenchFunction function;
+    // What BenchResult::items counts.
+    const char* items;
+};
+
+// Parses the first tenth of the functions and then all of them. scaling
+// is the time per token of the whole over the time per token of the tenth:
+// 1 for a parser linear in its input, 10 for a quadratic one.
+double bench_parse_scaling(const BenchInput& input, BenchResult& result) {
+    LexerOutput lexer_output = lex_string(input.corpus, false);
+    const TokenBuffer& tokens = lexer_output.tokens;
+    std::size_t functions = 0;
+    std::size_t tenth = 0;
+    for (std::size_t i = 0; i < tokens.size(); i++) {
+        if (tokens.kind(i) == Token::Int) {
+            functions++;
+        }
+    }
+    for (std::size_t i = 0, seen = 0; i < tokens.size(); i++) {
+        if (tokens.kind(i) == Token::Int && seen++ == functions / 10) {
+            tenth = i;
+            break;
+        }
+    }
+
+    BenchClock::time_point start = BenchClock::now();
+    ParserOutput tenth_output = parse_program(TokenSpan { &tokens, 0, tenth });
+    BenchClock::time_point middle = BenchClock::now();
+    start_counting();
+    ParserOutput whole_output = parse_program(tokens);
+    stop_counting();
+    BenchClock::time_point end = BenchClock::now();
+
+    double tenth_seconds = seconds_between(start, middle);
+    double whole_seconds = seconds_between(middle, end);
+    if (tenth > 0 && tenth_seconds > 0) {
+        result.scaling = (whole_seconds / tokens.size()) / (tenth_seconds / tenth);
+    }
+    result.bytes = input.corpus.size();
+    result.items = tokens.size();
+    result.ok = !whole_output.is_error && (tenth == 0 || !tenth_output.is_error);
+    return whole_seconds;
+}
+
+const Benchmark BENCHMARKS[] = {
+    { "lex_string", bench_lex_string, "tokens" },
+    { "lex_file", bench_lex_file, "tokens" },
+    { "token_source", bench_token_source, "tokens" },
+    { "parse_program", bench_parse_program, "tokens" },
+    { "parse_scaling", bench_parse_scaling, "tokens" },
+    { "parse_recycled", bench_parse_recycled, "tokens" },
+    { "lower_tacky", bench_lower_tacky, "instructions" },
+};
+
+BenchResult run_repeated(const Benchmark& benchmark, const BenchInput& input,
+  unsigned int repeat) {
+    BenchResult result = {};
+    result.seconds = -1;
+    for (unsigned int i = 0; i < repeat; i++) {
+        counted = AllocationCount { 0, 0 };
+        double seconds = benchmark.function(input, result);
+        if (result.seconds < 0 || seconds < result.seconds) {
+            result.seconds = seconds;
+        }
+        result.allocations = counted.allocations;
+        result.allocated_bytes = counted.bytes;
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    result.peak_rss_kb = usage.ru_maxrss;
+    return result;
+}
+
+// Runs the benchmark in a child process so its peak RSS is its own.
+bool run_isolated(const Benchmark& benchmark, const BenchInput& input,
+  unsigned int repeat, BenchResult& result) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return false;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    pid_t child = fork();
+    if (child < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (child == 0) {
+        close(fds[0]);
+        BenchResult child_result = run_repeated(benchmark, input, repeat);
+        ssize_t written = write(fds[1], &child_result, sizeof(child_result));
+        _exit(written == (ssize_t)sizeof(child_result) ? 0 : 1);
+    }
+    close(fds[1]);
+    ssize_t got = read(fds[0], &result, sizeof(result));
+    close(fds[0]);
+    int status = 0;
+    waitpid(child, &status, 0);
+    return got == (ssize_t)sizeof(result) && WIFEXITED(status)
+        && WEXITSTATUS(status) == 0;
+}
+
+//// Driver
+
+std::string json_result(const Benchmark& benchmark, const BenchResult& result) {
+    char buffer[512];
+    double seconds = result.seconds > 0 ? result.seconds : 1e-9;
+    snprintf(buffer, sizeof(buffer),
+        "{\"benchmark\": \"%s\", \"ok\": %s, \"seconds\": %.6f, "
+        "\"bytes\": %llu, \"%s\": %llu, "
+        "\"bytes_per_second\": %.0f, \"%s_per_second\": %.0f, "
+        "\"peak_rss_kb\": %ld, \"allocations\": %llu, \"allocated_bytes\": %llu}",
+        benchmark.name, result.ok ? "true" : "false", result.seconds,
+        result.bytes, benchmark.items, result.items,
+        result.bytes / seconds, benchmark.items, result.items / seconds,
+        result.peak_rss_kb, result.allocations, result.allocated_bytes);
+    std::string json(buffer);
+    if (result.scaling > 0) {
+        snprintf(buffer, sizeof(buffer), ", \"scaling\": %.3f", result.scaling);
+        json.insert(json.size() - 1, buffer);
+    }
+    return json;
+}
+
+bool parse_unsigned(const char* text, unsigned int& out) {
+    char* end = nullptr;
+    unsigned long value = std::strtoul(text, &end, 10);
+    if (end == text || *end != '\0') {
+        return false;
+    }
+    out = (unsigned int)value;
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    CorpusShape shape = DEFAULT_CORPUS_SHAPE;
+    unsigned int repeat = 5;
+    std::vector<std::string> selected;
+    std::string output_filename;
+    std::string emit_filename;
+
+    for (int i = 1; i < argc; i++) {
+        std::string flag(argv[i]);
+        if (i + 1 >= argc) {
+            fprintf(stderr, "cynobench: %s needs a value\n", flag.c_str());
+            return 2;
+        }
+        const char* value = argv[++i];
+        bool ok = true;
+        if (flag == "--functions") {
+            ok = parse_unsigned(value, shape.functions);
+        } else if (flag == "--identifier-length") {
+            ok = parse_unsigned(value, shape.identifier_length);
+        } else if (flag == "--constant-digits") {
+            ok = parse_unsigned(value, shape.constant_digits);
+        } else if (flag == "--whitespace") {
+            ok = parse_unsigned(value, shape.whitespace);
+        } else if (flag == "--nesting") {
+            ok = parse_unsigned(value, shape.nesting);
+        } else if (flag == "--seed") {
+            ok = parse_unsigned(value, shape.seed);
+        } else if (flag == "--repeat") {
+            ok = parse_unsigned(value, repeat) && repeat > 0;
+        } else if (flag == "--benchmark") {
+            selected.push_back(value);
+        } else if (flag == "--output") {
+            output_filename = value;
+        } else if (flag == "--emit-corpus") {
+            emit_filename = value;
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            fprintf(stderr, "cynobench: bad option %s %s\n", flag.c_str(), value);
+            return 2;
+        }
+    }
+
+    BenchInput input;
+    input.corpus = generate_corpus(shape);
+    if (!emit_filename.empty()) {
+        std::ofstream out(emit_filename, std::ios::binary);
+        out << input.corpus;
+        return out ? 0 : 1;
+    }
+
+    char corpus_filename[] = "/tmp/cynobench_corpus_XXXXXX";
+    int corpus_fd = mkstemp(corpus_filename);
+    if (corpus_fd < 0
+        || write(corpus_fd, input.corpus.data(), input.corpus.size())
+            != (ssize_t)input.corpus.size()) {
+        fprintf(stderr, "cynobench: could not write corpus file\n");
+        return 1;
+    }
+    close(corpus_fd);
+    input.corpus_filename = corpus_filename;
+
+    std::string json = "{\"cynobench\": 1, \"version\": \"" CYNOPHOBIA_VERSION "\"";
+    json += ", \"sanitized\": ";
+    json += CYNOPHOBIA_SANITIZED ? "true" : "false";
+    json += ", \"repeat\": " + std::to_string(repeat);
+    json += ", \"corpus\": " + debug_string(shape);
+    json += ", \"results\": [";
+    bool first = true;
+    int exit_code = 0;
+    for (const Benchmark& benchmark : BENCHMARKS) {
+        bool wanted = selected.empty();
+        for (const std::string& name : selected) {
+            wanted = wanted || name == benchmark.name;
+        }
+        if (!wanted) {
+            continue;
+        }
+        BenchResult result = {};
+        if (!run_isolated(benchmark, input, repeat, result)) {
+            fprintf(stderr, "cynobench: %s did not finish\n", benchmark.name);
+            exit_code = 1;
+            continue;
+        }
+        if (!first) {
+            json += ", ";
+        }
+        json += json_result(benchmark, result);
+        first = false;
+        fprintf(stderr, "%-14s %10.1f MB/s %12.0f %s/s %8ld KB peak %10llu allocs%s\n",
+            benchmark.name, result.bytes / result.seconds / 1e6,
+            result.items / result.seconds, benchmark.items, result.peak_rss_kb, result.allocations,
+            result.ok ? "" : "  (not ok)");
+    }
+    json += "]}\n";
+    unlink(corpus_filename);
+
+    if (output_filename.empty()) {
+        printf("%s", json.c_str());
+    } else {
+        std::ofstream out(output_filename, std::ios::binary);
+        out << json;
+        if (!out) {
+            exit_code = 1;
+        }
+    }
+    return exit_code;
+}
@@ -0,0 +1,99 @@
+#include <cynophobia/keywords.hpp>
+#include <cynophobia/shared.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+Microbenchmark for identifier classification: how long it takes to decide
+whether a lexed word is a keyword. Compares the map the lexer used to build
+for every word, a map built once, and keywords::classify.
+
+Usage: cynokeywordbench [rounds]
+*/
+
+// What lex() did before keywords.hpp: a fresh map per word.
+Token::TokenType classify_with_fresh_map(const std::string& word) {
+    std::unordered_map<std::string, Token::TokenType> keyword_tokens =
+    { { "int", Token::Int }, 
+    { "void",  Token::Void }, 
+    { "return", Token::Return }, }; 
+
+    auto keyword_it = keyword_tokens.find(word);
+    if (keyword_it != keyword_tokens.end()) {
+        return keyword_it->second; 
+    } 
+    return Token::Identifier;
+}
+
+// The map built once, covering every keyword.
+Token::TokenType classify_with_static_map(const std::string& word) {
+    static const std::unordered_map<std::string, Token::TokenType> keyword_tokens = [] {
+        std::unordered_map<std::string, Token::TokenType> all;
+        for (const keywords::Keyword& keyword : keywords::LIST) {
+            all.insert({ keyword.text, keyword.token_type });
+        }
+        return all;
+    }();
+
+    auto keyword_it = keyword_tokens.find(word);
+    if (keyword_it != keyword_tokens.end()) {
+        return keyword_it->second; 
+    } 
+    return Token::Identifier;
+}
+
+Token::TokenType classify_with_perfect_hash(const std::string& word) {
+    Token::TokenType token_type = Token::Identifier;
+    keywords::classify(word.data(), word.size(), token_type);
+    return token_type;
+}
+
+// Roughly the mix of a typical C file: mostly identifiers, a third keywords.
+std::vector<std::string> make_words() {
+    std::vector<std::string> words;
+    unsigned int state = 12345;
+    for (int i = 0; i < 4096; i++) {
+        state = state * 1103515245u + 12345u;
+        if (state % 3 == 0) {
+            words.push_back(keywords::LIST[(state >> 8) % keywords::COUNT].text);
+        } else {
+            std::string word = "v";
+            std::size_t size = 1 + (state >> 8) % 16;
+            for (std::size_t j = 0; j < size; j++) {
+                state = state * 1103515245u + 12345u;
+                word.push_back("abcdefghijklmnopqrstuvwxyz_0123456789"[(state >> 16) % 37]);
+            }
+            words.push_back(word);
+        }
+    }
+    return words;
+}
+
+template <typename Classifier>
+void run(const char* name, Classifier classify, const std::vector<std::string>& words,
+  int rounds) {
+    unsigned long checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++) {
+        for (const std::string& word : words) {
+            checksum += (unsigned long)classify(word);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+    double per_word = seconds * 1e9 / ((double)words.size() * rounds);
+    printf("%-14s %8.2f ns/word  (checksum %lu)\n", name, per_word, checksum);
+}
+
+int main(int argc, char* argv[]) {
+    int rounds = argc > 1 ? std::stoi(argv[1]) : 200;
+    std::vector<std::string> words = make_words();
+    run("fresh_map", classify_with_fresh_map, words, rounds / 10 + 1);
+    run("static_map", classify_with_static_map, words, rounds);
+    run("perfect_hash", classify_with_perfect_hash, words, rounds);
+    return 0;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cynophobia/shared.hpp>
+
+#include <cstddef>
+
+// Heap allocation accounting by compiler stage. Programs that link the
+// cynoallocations object library get a global operator new that counts
+// every allocation against the stage its thread is in; elsewhere nothing
+// is counted and every count stays 0. It costs every allocation two atomic
+// adds and hides new/delete mismatches from ASan, so only the allocation
+// tests, the benchmarks and a cynocompiler configured with
+// CYNOPHOBIA_COUNT_ALLOCATIONS link it.
+struct AllocationCount {
+    unsigned long long allocations;
+    unsigned long long bytes;
+};
+
+// Whether this program counts allocations at all.
+bool counting_allocations();
+
+// Counts since the program started, across all threads: for one stage, or
+// for everything, in a stage or not.
+AllocationCount allocations_in(Target stage);
+AllocationCount total_allocations();
+
+AllocationCount operator-(const AllocationCount& after, const AllocationCount& before);
+
+// Attributes allocations made on this thread to stage while it lives, then
+// restores whatever stage came before. Threads start outside any stage, so
+// work handed to another thread needs a scope of its own there.
+class AllocationStage {
+    public:
+        explicit AllocationStage(Target stage);
+        ~AllocationStage();
+
+    private:
+        AllocationStage(const AllocationStage&);
+        AllocationStage& operator=(const AllocationStage&);
+
+        const int previous;
+};
+
+// Called by the counting operator new.
+void note_allocation(std::size_t size);
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cynophobia/shared.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// A bump allocator for what lives exactly as long as one translation
+// unit: the parser's tree nodes and its diagnostic. Allocating is a
+// pointer bump in the current block. Nothing is freed on its own, so only
+// types with nothing to destroy may be made here, and a whole tree goes
+// at once when the arena does. reset() keeps the blocks, so an arena
+// reused from one translation unit to the next stops allocating once it
+// has grown to fit. Not for use from several threads at once.
+class Arena {
+    public:
+        Arena();
+        ~Arena();
+
+        // alignment is a power of two.
+        void* allocate(std::size_t size, std::size_t alignment) {
+            void* allocated = bump(size, alignment);
+            return allocated ? allocated : allocate_slow(size, alignment);
+        }
+
+        template<typename T, typename... Arguments>
+        T* make(Arguments&&... arguments) {
+            static_assert(std::is_trivially_destructible<T>::value,
+                "arena objects are never destroyed");
+            return new (allocate(sizeof(T), alignof(T))) T(std::forward<Arguments>(arguments)...);
+        }
+
+        // A copy of count items, one array in the arena.
+        template<typename T>
+        T* copy_array(const T* items, std::size_t count) {
+            static_assert(std::is_trivially_copyable<T>::value && std::is_trivially_destructible<T>::value,
+                "arena arrays are copied bytewise and never destroyed");
+            if (count == 0) {
+                return nullptr;
+            }
+            T* copied = (T*)allocate(sizeof(T) * count, alignof(T));
+            std::memcpy(copied, items, sizeof(T) * count);
+            return copied;
+        }
+
+        // A copy of text that lives as long as the arena.
+        TextView copy(const char* text, std::size_t size);
+        TextView copy(const std::string& text) { return copy(text.data(), text.size()); }
+
+        // Frees everything made since the last reset, keeping the blocks.
+        // Nothing made in the arena may be in use any more.
+        void reset();
+
+        // Bytes handed out since the last reset, and held in blocks.
+        std::size_t bytes_used() const { return used; }
+        std::size_t bytes_reserved() const { return reserved; }
+
+    private:
+        Arena(const Arena&);
+        Arena& operator=(const Arena&);
+
+        // A block's header; its memory follows.
+        struct Block {
+            Block* next;
+            std::size_t size;
+        };
+
+        // Null if it does not fit in the current block.
+        void* bump(std::size_t size, std::size_t alignment) {
+            if (position == nullptr) {
+                return nullptr;
+            }
+            std::uintptr_t start = ((std::uintptr_t)position + alignment - 1)
+                & ~(std::uintptr_t)(alignment - 1);
+            if (start > (std::uintptr_t)limit || size > (std::uintptr_t)limit - start) {
+                return nullptr;
+            }
+            position = (char*)(start + size);
+            used += size;
+            return (void*)start;
+        }
+
+        void* allocate_slow(std::size_t size, std::size_t alignment);
+        void enter(Block* block);
+
+        Block* first;
+        Block* current;
+        char* position;
+        char* limit;
+        std::size_t used;
+        std::size_t reserved;
+};
+
+// Arenas kept between translation units, for a process that compiles
+// many: a compile server, or one run given several files. An acquired
+// arena comes back reset when the last reference to it goes, that is once
+// the ParserOutput and Program placed in it are both gone, so nothing can
+// be recycled while it is in use. Safe to use from several threads.
+class ArenaPool {
+    public:
+        // Keeps up to capacity idle arenas of up to max_bytes each; larger
+        // ones are freed rather than held on to.
+        ArenaPool(std::size_t capacity, std::size_t max_bytes);
+        ~ArenaPool();
+
+        std::shared_ptr<Arena> acquire();
+
+    private:
+        ArenaPool(const ArenaPool&);
+        ArenaPool& operator=(const ArenaPool&);
+
+        void recycle(Arena* arena);
+
+        std::mutex lock;
+        std::vector<Arena*> idle;
+        const std::size_t capacity;
+        const std::size_t max_bytes;
+};
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// 128-bit content address of a compiler input under some configuration.
+struct CacheKey {
+    std::uint64_t high;
+    std::uint64_t low;
+    std::string hex() const;
+};
+
+// Hashes data together with config, a string naming everything else the
+// cached result depends on (compiler and format versions, options). Fast
+// rather than cryptographic: callers should check a hit against the input
+// where they can.
+CacheKey cache_key(const char* data, std::size_t size, const std::string& config);
+
+struct CacheStats {
+    std::uint64_t hits;
+    std::uint64_t misses;
+    std::uint64_t stores;
+    std::uint64_t evictions;
+    // Approximate size of everything stored; exact after each eviction.
+    std::uint64_t bytes;
+    std::string debug_string() const;
+};
+
+// An on-disk cache of compilation results, shared by any number of
+// compiler processes and threads:
+//
+//   <directory>/objects/<2 hex digits>/<key>.<kind>   one result each
+//   <directory>/stats                                 counters, see CacheStats
+//   <directory>/lock                                  held while evicting
+//
+// kind names what is stored ("tokens", later "ast" or "asm"). Entries are
+// written to a temporary file and renamed into place, so readers only ever
+// see whole entries. Every hit refreshes the entry's modification time.
+// Loads take no lock. Each instance counts in memory and appends its
+// counts to the stats file once, when it is destroyed. A store that takes
+// the total past max_bytes removes the least recently used entries down
+// to 90% of it, unless another process is already evicting. Eviction, or a
+// store once the stats file has grown long, also folds the stats file into
+// one line and removes temporary files that a crash left behind. Without
+// POSIX file APIs the cache is never usable and every operation misses.
+class ResultCache {
+    public:
+        ResultCache(std::string directory, std::uint64_t max_bytes);
+        ~ResultCache();
+
+        // Whether the directory exists or could be created.
+        bool usable() const { return is_usable; }
+
+        // Reads the entry for key into bytes. Counts a hit or a miss.
+        bool load(const CacheKey& key, const char* kind, std::string& bytes) const;
+
+        // Adds or replaces the entry for key, evicting if over the limit.
+        // Entries bigger than the whole cache are not stored.
+        bool store(const CacheKey& key, const char* kind, const std::string& bytes) const;
+
+        // The shared counters, plus what this instance has not yet added.
+        bool read_stats(CacheStats& stats) const;
+
+        // Adds this instance's counts to the shared ones now.
+        void flush_stats() const;
+
+    private:
+        ResultCache(const ResultCache&);
+        ResultCache& operator=(const ResultCache&);
+
+        std::string path_of(const CacheKey& key, const char* kind) const;
+        // Sums the stats file into stats; false if it is unreadable.
+        bool read_shared_stats(CacheStats& stats, std::size_t& records) const;
+        // Takes this instance's counts, leaving 0 behind.
+        CacheStats take_pending() const;
+        // Evicts if over_budget, and folds the stats file into one line, if
+        // no other process is doing so already.
+        void maintain(bool over_budget) const;
+        void evict(CacheStats& evicted) const;
+        void rewrite_stats(const CacheStats* evicted) const;
+
+        const std::string directory;
+        const std::uint64_t max_bytes;
+        bool is_usable;
+
+        mutable std::atomic<std::uint64_t> pending_hits;
+        mutable std::atomic<std::uint64_t> pending_misses;
+        mutable std::atomic<std::uint64_t> pending_stores;
+        mutable std::atomic<std::uint64_t> pending_bytes;
+};
+
+const std::uint64_t DEFAULT_CACHE_SIZE = 1ULL << 30;
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <cstddef>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define CYNOPHOBIA_SCAN_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CYNOPHOBIA_SCAN_SSE2 1
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Character classification for the lexer: a 256-entry table built at
+// compile time, plus scanners that find the end of a run of characters in
+// some set of classes or visit every character in them. The scanners use
+// AVX2 when the compiler targets it, SSE2 on any other x86-64 build, and
+// the table everywhere else.
+namespace charclass {
+    enum Class : unsigned char {
+        DIGIT      = 1,  // [0-9]
+        WORD_START = 2,  // [a-zA-Z_]
+        WHITESPACE = 4,  // [ \t\n\v\f\r]
+        LINE_BREAK = 8,  // [\n\v\f\r], also WHITESPACE
+        WORD       = DIGIT | WORD_START
+    };
+
+    constexpr unsigned char classify(unsigned char c) {
+        return ('0' <= c && c <= '9') ? DIGIT
+            : (('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || c == '_')
+                ? WORD_START
+            : (c == '\n' || c == '\v' || c == '\f' || c == '\r')
+                ? WHITESPACE | LINE_BREAK
+            : (c == ' ' || c == '\t') ? WHITESPACE
+            : 0;
+    }
+
+#define CYNO_CLASSIFY4(n) \
+    classify(n), classify(n + 1), classify(n + 2), classify(n + 3)
+#define CYNO_CLASSIFY16(n) \
+    CYNO_CLASSIFY4(n), CYNO_CLASSIFY4(n + 4), CYNO_CLASSIFY4(n + 8), CYNO_CLASSIFY4(n + 12)
+#define CYNO_CLASSIFY64(n) \
+    CYNO_CLASSIFY16(n), CYNO_CLASSIFY16(n + 16), CYNO_CLASSIFY16(n + 32), CYNO_CLASSIFY16(n + 48)
+    constexpr unsigned char TABLE[256] = {
+        CYNO_CLASSIFY64(0), CYNO_CLASSIFY64(64),
+        CYNO_CLASSIFY64(128), CYNO_CLASSIFY64(192)
+    };
+#undef CYNO_CLASSIFY64
+#undef CYNO_CLASSIFY16
+#undef CYNO_CLASSIFY4
+
+    inline unsigned char of(char c) {
+        return TABLE[(unsigned char)c];
+    }
+
+    inline bool is(char c, unsigned char mask) {
+        return (of(c) & mask) != 0;
+    }
+
+    // Returns the first character in [p, end) whose class is not in Mask,
+    // or end.
+    template <unsigned char Mask>
+    inline const char* scan_scalar(const char* p, const char* end) {
+        while (p != end && is(*p, Mask)) {
+            p++;
+        }
+        return p;
+    }
+
+    inline unsigned int lowest_set_bit(unsigned int bits) {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward(&index, bits);
+        return (unsigned int)index;
+#else
+        return (unsigned int)__builtin_ctz(bits);
+#endif
+    }
+
+#if defined(CYNOPHOBIA_SCAN_AVX2)
+    // Bytes are compared as signed, so anything >= 0x80 is below every
+    // ASCII bound and falls outside all classes, as in TABLE.
+    inline __m256i in_range(__m256i v, char low, char high) {
+        return _mm256_and_si256(
+            _mm256_cmpgt_epi8(v, _mm256_set1_epi8((char)(low - 1))),
+            _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(high + 1)), v));
+    }
+
+    template <unsigned char Mask>
+    inline unsigned int block_mask(const char* p) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i m = _mm256_setzero_si256();
+        if (Mask & DIGIT) {
+            m = _mm256_or_si256(m, in_range(v, '0', '9'));
+        }
+        if (Mask & WORD_START) {
+            __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+            m = _mm256_or_si256(m, in_range(lower, 'a', 'z'));
+            m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+        }
+        if (Mask & WHITESPACE) {
+            m = _mm256_or_si256(m, in_range(v, '\t', '\r'));
+            m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+        }
+        if (Mask & LINE_BREAK) {
+            m = _mm256_or_si256(m, in_range(v, '\n', '\r'));
+        }
+        return (unsigned int)_mm256_movemask_epi8(m);
+    }
+
+    const std::size_t BLOCK = 32;
+    const unsigned int FULL_BLOCK = 0xFFFFFFFFu;
+#elif defined(CYNOPHOBIA_SCAN_SSE2)
+    // Bytes are compared as signed, so anything >= 0x80 is below every
+    // ASCII bound and falls outside all classes, as in TABLE.
+    inline __m128i in_range(__m128i v, char low, char high) {
+        return _mm_and_si128(
+            _mm_cmpgt_epi8(v, _mm_set1_epi8((char)(low - 1))),
+            _mm_cmplt_epi8(v, _mm_set1_epi8((char)(high + 1))));
+    }
+
+    template <unsigned char Mask>
+    inline unsigned int block_mask(const char* p) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i m = _mm_setzero_si128();
+        if (Mask & DIGIT) {
+            m = _mm_or_si128(m, in_range(v, '0', '9'));
+        }
+        if (Mask & WORD_START) {
+            __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+            m = _mm_or_si128(m, in_range(lower, 'a', 'z'));
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+        }
+        if (Mask & WHITESPACE) {
+            m = _mm_or_si128(m, in_range(v, '\t', '\r'));
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+        }
+        if (Mask & LINE_BREAK) {
+            m = _mm_or_si128(m, in_range(v, '\n', '\r'));
+        }
+        return (unsigned int)_mm_movemask_epi8(m);
+    }
+
+    const std::size_t BLOCK = 16;
+    const unsigned int FULL_BLOCK = 0xFFFFu;
+#endif
+
+    // Returns the first character in [p, end) whose class is not in Mask,
+    // or end.
+    template <unsigned char Mask>
+    inline const char* scan(const char* p, const char* end) {
+#if defined(CYNOPHOBIA_SCAN_AVX2) || defined(CYNOPHOBIA_SCAN_SSE2)
+        // Most runs are short, so look at the first few characters before
+        // paying for a vector load.
+        for (int i = 0; i < 4; i++) {
+            if (p == end || !is(*p, Mask)) {
+                return p;
+            }
+            p++;
+        }
+        while ((std::size_t)(end - p) >= BLOCK) {
+            unsigned int bits = block_mask<Mask>(p);
+            if (bits != FULL_BLOCK) {
+                return p + lowest_set_bit(~bits & FULL_BLOCK);
+            }
+            p += BLOCK;
+        }
+#endif
+        return scan_scalar<Mask>(p, end);
+    }
+
+    // Calls visit(p) for every character p in [begin, end) whose class is
+    // in Mask, in order. Meant for sparse classes such as LINE_BREAK.
+    template <unsigned char Mask, typename Visitor>
+    inline void for_each(const char* begin, const char* end, Visitor visit) {
+        const char* p = begin;
+#if defined(CYNOPHOBIA_SCAN_AVX2) || defined(CYNOPHOBIA_SCAN_SSE2)
+        while ((std::size_t)(end - p) >= BLOCK) {
+            unsigned int bits = block_mask<Mask>(p);
+            while (bits != 0) {
+                visit(p + lowest_set_bit(bits));
+                bits &= bits - 1;
+            }
+            p += BLOCK;
+        }
+#endif
+        for (; p != end; p++) {
+            if (is(*p, Mask)) {
+                visit(p);
+            }
+        }
+    }
+}
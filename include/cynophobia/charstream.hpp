@@ -1,9 +1,58 @@
 #pragma once
+#include <cynophobia/charclass.hpp>
 #include <cynophobia/shared.hpp>
 
+#include <cstddef>
+#include <cstdint>
 #include <fstream>
-#include <unordered_set>
+#include <memory>
+#include <type_traits>
+#include <vector>
 
+// Token spans are 32-bit byte offsets, so larger sources are refused where
+// they are opened or read rather than lexed into spans that wrap.
+const std::size_t MAX_SOURCE_SIZE = UINT32_MAX;
+
+// Read-only memory mapping of a whole file. Falls back to reading the file
+// into memory where mmap is unavailable. A file larger than MAX_SOURCE_SIZE
+// is not opened. Shared by the stream and every
+// LexerOutput built from it, so the mapping lives as long as any token does.
+class MappedFile : public SourceBuffer {
+    public:
+        explicit MappedFile(const std::string& filename);
+        ~MappedFile();
+
+        const char* data() const override { return begin; }
+        std::size_t size() const override { return length; }
+        bool was_opened() const { return opened; }
+
+    private:
+        MappedFile(const MappedFile&);
+        MappedFile& operator=(const MappedFile&);
+
+        const char* begin;
+        std::size_t length;
+        bool opened;
+        bool mapped;
+        std::vector<char> fallback;
+};
+
+class OwnedString : public SourceBuffer {
+    public:
+        explicit OwnedString(std::string input_string) :
+            text(std::move(input_string)) {}
+
+        const char* data() const override { return text.data(); }
+        std::size_t size() const override { return text.size(); }
+
+    private:
+        const std::string text;
+};
+
+// Character source for the lexer. The lexer is a template over the stream
+// type: concrete streams provide non-virtual get_char/peek_char that the
+// hot loop inlines, while this base's get_char/peek_char forward to the
+// virtual tuple interface so any custom stream still works (lex_stream).
 class FallibleCharStream {
     public:
         virtual ~FallibleCharStream() {}
@@ -15,190 +64,370 @@ class FallibleCharStream {
         virtual std::tuple<char, StreamStatus> peek() = 0; 
         virtual std::tuple<char, StreamStatus> get() = 0; 
         virtual bool was_opened() const = 0; 
+        // Streams reading from one in-memory buffer return it, starting
+        // at the first character the stream yields; for others the lexer
+        // keeps its own copy of what it reads.
+        virtual std::shared_ptr<const SourceBuffer> contiguous_source() const {
+            return nullptr;
+        }
+
+        // Whether every stream of this static type has a contiguous_source.
+        static const bool always_contiguous = false;
+
+        StreamStatus get_char(char& next_char) {
+            StreamStatus status;
+            std::tie(next_char, status) = get();
+            return status;
+        }
+
+        StreamStatus peek_char(char& next_char) {
+            StreamStatus status;
+            std::tie(next_char, status) = peek();
+            return status;
+        }
 };
 
 
-class FileCharStream : public FallibleCharStream {
+// Reads a file descriptor (a file, a pipe, stdin) in large blocks, so a
+// character costs a bounds check and a syscall comes once per block. peek
+// sees across block edges; a read error is reported where it happened,
+// after every character read before it.
+class FdCharStream : public FallibleCharStream {
     public:
-        FileCharStream(std::string filename) {
-            istream.open(filename); 
-            input_was_opened = istream.is_open();
-        }
+        static const std::size_t BLOCK_SIZE = 1 << 16;
 
+        // Borrows fd, which must stay open as long as the stream.
+        explicit FdCharStream(int fd) : FdCharStream(fd, false) {}
+        ~FdCharStream();
 
         bool was_opened() const override {
-            return input_was_opened;
+            return fd >= 0;
         }
 
-        std::tuple<char, FallibleCharStream::StreamStatus> get() {
-            char next_char = istream.get();  
-            if (istream.eof()) {
-                return { (char)0, FallibleCharStream::STREAM_END };
-            } else if (istream.bad() || istream.fail()) {
-                return { (char)0, FallibleCharStream::STREAM_ERROR }; 
+        StreamStatus get_char(char& next_char) {
+            if (index == filled && !refill()) {
+                next_char = (char)0;
+                return end_status;
             }
-            return { next_char, FallibleCharStream::STREAM_GOOD };
+            next_char = buffer[index++];
+            return FallibleCharStream::STREAM_GOOD;
         }
 
-        std::tuple<char, FallibleCharStream::StreamStatus> peek() {
-            char next_char = istream.peek();  
-            if (istream.eof()) {
-                return { (char)0, FallibleCharStream::STREAM_END };
-            } else if (istream.bad() || istream.fail()) {
-                return { (char)0, FallibleCharStream::STREAM_ERROR }; 
+        StreamStatus peek_char(char& next_char) {
+            if (index == filled && !refill()) {
+                next_char = (char)0;
+                return end_status;
             }
-            return { next_char, FallibleCharStream::STREAM_GOOD };
+            next_char = buffer[index];
+            return FallibleCharStream::STREAM_GOOD;
+        }
+
+        std::tuple<char, FallibleCharStream::StreamStatus> get() final {
+            char next_char;
+            StreamStatus status = get_char(next_char);
+            return { next_char, status };
         }
 
+        std::tuple<char, FallibleCharStream::StreamStatus> peek() final {
+            char next_char;
+            StreamStatus status = peek_char(next_char);
+            return { next_char, status };
+        }
+
+    protected:
+        // Closes fd on destruction if owned.
+        FdCharStream(int fd, bool owned);
+
     private:
-        std::ifstream istream;
-        bool input_was_opened; 
+        FdCharStream(const FdCharStream&);
+        FdCharStream& operator=(const FdCharStream&);
+
+        // Reads the next block; false at the end of input or on an error,
+        // which end_status then tells apart.
+        bool refill();
+
+        const int fd;
+        const bool owns_fd;
+        std::vector<char> buffer;
+        std::size_t index;
+        std::size_t filled;
+        bool finished;
+        StreamStatus end_status;
 };
 
-class StringCharStream : public FallibleCharStream {
+class FileCharStream final : public FdCharStream {
     public:
-        StringCharStream(const std::string input_string) : 
-          text(input_string), index(0), length(input_string.size())
-        {} 
-             
+        FileCharStream(std::string filename);
+};
 
-        bool was_opened() const override {
-            // If a string manages to fail I will be gobsmacked. 
-            return true; 
+// Reads fd to its end in large blocks, appending to text. Returns false if
+// a read failed or text would outgrow MAX_SOURCE_SIZE; text then holds
+// everything read before that.
+bool read_whole_fd(int fd, std::string& text);
+
+// Stream over a SourceBuffer that is already fully in memory. Reads
+// cannot fail, so get_char/peek_char reduce to a bounds check.
+class BufferCharStream : public FallibleCharStream {
+    public:
+        static const bool always_contiguous = true;
+
+        std::shared_ptr<const SourceBuffer> contiguous_source() const final {
+            return source;
         }
 
-        std::tuple<char,  FallibleCharStream::StreamStatus> get() override {
+        StreamStatus get_char(char& next_char) {
             if (index >= length) {
-                return { (char)0, FallibleCharStream::STREAM_END };
+                next_char = (char)0;
+                return FallibleCharStream::STREAM_END;
             } 
-            std::tuple<char, StreamStatus> result =
-              { text[index], FallibleCharStream::STREAM_GOOD }; 
-            index += 1;
-            return result; 
+            next_char = text[index++];
+            return FallibleCharStream::STREAM_GOOD;
         }
 
-        std::tuple<char,  FallibleCharStream::StreamStatus> peek() override {
+        StreamStatus peek_char(char& next_char) {
             if (index >= length) {
-                return { (char)0, FallibleCharStream::STREAM_END };
+                next_char = (char)0;
+                return FallibleCharStream::STREAM_END;
             } 
-            std::tuple<char, StreamStatus> result =
-              { text[index], FallibleCharStream::STREAM_GOOD };  
-            return result; 
+            next_char = text[index];
+            return FallibleCharStream::STREAM_GOOD;
         }
 
+        // Direct access to the unread part of the buffer, for scanning runs
+        // of characters without going through get_char.
+        const char* cursor() const { return text + index; }
+        const char* end() const { return text + length; }
+        void advance_to(const char* p) { index = p - text; }
+
+        std::tuple<char,  FallibleCharStream::StreamStatus> get() final {
+            char next_char;
+            StreamStatus status = get_char(next_char);
+            return { next_char, status };
+        }
+
+        std::tuple<char,  FallibleCharStream::StreamStatus> peek() final {
+            char next_char;
+            StreamStatus status = peek_char(next_char);
+            return { next_char, status };
+        }
+
+    protected:
+        BufferCharStream(std::shared_ptr<const SourceBuffer> buffer) :
+          source(std::move(buffer)),
+          text(source->data()), index(0), length(source->size())
+        {}
+
     private:
-        const std::string text;
+        const std::shared_ptr<const SourceBuffer> source;
+        const char* text;
         std::size_t index; 
         std::size_t length; 
 };
 
-class PositionedStream {
+// Memory-mapped input; the default for lex_file.
+class MappedCharStream final : public BufferCharStream {
+    public:
+        MappedCharStream(std::string filename) :
+          BufferCharStream(std::make_shared<MappedFile>(filename)),
+          file(std::static_pointer_cast<const MappedFile>(contiguous_source()))
+        {}
+
+        bool was_opened() const override {
+            return file->was_opened();
+        }
+
+    private:
+        const std::shared_ptr<const MappedFile> file;
+};
+
+class StringCharStream final : public BufferCharStream {
+    public:
+        StringCharStream(std::string input_string) : 
+          BufferCharStream(std::make_shared<OwnedString>(std::move(input_string)))
+        {} 
+             
+
+        bool was_opened() const override {
+            // If a string manages to fail I will be gobsmacked. 
+            return true; 
+        }
+};
+
+// The part of a SourceBuffer from some offset to its end.
+class SourceSlice : public SourceBuffer {
+    public:
+        SourceSlice(std::shared_ptr<const SourceBuffer> whole, std::size_t offset) :
+            parent(std::move(whole)), start(offset) {}
+
+        const char* data() const override { return parent->data() + start; }
+        std::size_t size() const override { return parent->size() - start; }
+
+    private:
+        const std::shared_ptr<const SourceBuffer> parent;
+        const std::size_t start;
+};
+
+// Reads a SourceBuffer from some offset on; the chunks of a parallel lex.
+// Offsets the lexer records are relative to that offset.
+class SliceCharStream final : public BufferCharStream {
+    public:
+        SliceCharStream(std::shared_ptr<const SourceBuffer> whole, std::size_t offset) :
+          BufferCharStream(std::make_shared<SourceSlice>(std::move(whole), offset))
+        {}
+
+        bool was_opened() const override {
+            return true;
+        }
+};
+
+// Tracks the byte offset of the characters the lexer consumes from a
+// Stream (FallibleCharStream or one of its concrete subclasses, see
+// FallibleCharStream). Lines and columns are left to LineIndex.
+template <typename Stream>
+class BasicPositionedStream {
     public: 
-        PositionedStream(FallibleCharStream& char_stream) : 
+        BasicPositionedStream(Stream& char_stream) : 
             fcstream(char_stream), 
-            next_char_position({0,0}),
-            read_has_failed(false) {} 
+            read_has_failed(false),
+            contiguous(char_stream.contiguous_source()),
+            text_base(contiguous ? contiguous->data() : nullptr),
+            next_offset(0),
+            text_start(0),
+            retained_start(0) {
+            if (contiguous && contiguous->size() > MAX_SOURCE_SIZE) {
+                read_has_failed = true;
+            }
+        } 
 
-        FilePosition get_next_position() const {
-            return next_char_position;
+        // Everything consumed: the stream's own buffer, or for streams
+        // without one, the copy kept while reading. Call once, at the end,
+        // and only if release_text was never called.
+        std::shared_ptr<const SourceBuffer> text_source() {
+            if (contiguous) {
+                return contiguous;
+            }
+            return std::make_shared<OwnedString>(std::move(retained));
         }
 
+        // Whether a read has failed, or the source was too large to lex.
+        bool read_failed() const {
+            return read_has_failed;
+        }
 
-        std::tuple<char, FallibleCharStream::StreamStatus> get_next_char() {
-            char next_char; 
-            FallibleCharStream::StreamStatus next_status; 
-            auto next_result = fcstream.get(); 
-            std::tie(next_char, next_status) = next_result;
+        // Marks the start of a token at the next character to be consumed.
+        void begin_text() {
+            text_start = next_offset;
+        }
+
+        // The span of everything consumed since begin_text.
+        TextSpan end_text() const {
+            return { (std::uint32_t)text_start, (std::uint32_t)(next_offset - text_start) };
+        }
+
+        // The text of an already consumed span, valid until more is read.
+        const char* text_at(TextSpan span) const {
+            if (Stream::always_contiguous || contiguous) {
+                return text_base + span.offset;
+            }
+            return retained.data() + (span.offset - retained_start);
+        }
+
+        // Drops the copy of everything consumed so far; only text consumed
+        // afterwards can be looked up. Keeps memory bounded when the
+        // caller copies out what it needs as it goes.
+        void release_text() {
+            retained.clear();
+            retained_start = next_offset;
+        }
+
+
+        FallibleCharStream::StreamStatus get_next_char(char& next_char) {
+            FallibleCharStream::StreamStatus next_status
+                = fcstream.get_char(next_char); 
 
             if (next_status == FallibleCharStream::STREAM_ERROR) {
                 read_has_failed = true; 
-                return { char(0), FallibleCharStream::STREAM_ERROR }; 
+                next_char = char(0);
+                return FallibleCharStream::STREAM_ERROR; 
             }
 
-            update_next_char_position(next_char);
+            if (next_status == FallibleCharStream::STREAM_GOOD) {
+                next_offset += 1;
+                if (!Stream::always_contiguous && !contiguous) {
+                    retained.push_back(next_char);
+                    if (next_offset > MAX_SOURCE_SIZE) {
+                        read_has_failed = true;
+                    }
+                }
+            }
              
             if (read_has_failed) {
-                return { char(0), FallibleCharStream::STREAM_ERROR };
+                next_char = char(0);
+                return FallibleCharStream::STREAM_ERROR;
             }
-            return next_result; 
+            return next_status; 
         }
 
-        std::tuple<char, FallibleCharStream::StreamStatus>
-          peek_next_char() { 
-            FallibleCharStream::StreamStatus next_status; 
-            auto next_result = fcstream.peek(); 
-            std::tie(std::ignore, next_status) = next_result;
+        FallibleCharStream::StreamStatus peek_next_char(char& next_char) { 
+            FallibleCharStream::StreamStatus next_status
+                = fcstream.peek_char(next_char); 
 
             if (next_status == FallibleCharStream::STREAM_ERROR) {
                 read_has_failed = true; 
             }
-            return next_result; 
+            return next_status; 
+        }
+
+        // Consumes the run of characters whose charclass is in Mask.
+        template <unsigned char Mask>
+        FallibleCharStream::StreamStatus take_while_class() {
+            return take_while_class<Mask>(
+                std::integral_constant<bool, Stream::always_contiguous>());
         }
 
-        std::tuple<std::string, FallibleCharStream::StreamStatus> 
-          get_while_in(const std::unordered_set<char> &charset) {
-            std::string built = ""; 
+    
+    private: 
+        Stream& fcstream;
+        bool read_has_failed; 
+        const std::shared_ptr<const SourceBuffer> contiguous;
+        const char* const text_base;
+        std::string retained;
+        std::size_t next_offset;
+        std::size_t text_start;
+        std::size_t retained_start;
+        
+        // Buffer streams: scan the run in place.
+        template <unsigned char Mask>
+        FallibleCharStream::StreamStatus take_while_class(std::true_type) {
+            const char* begin = fcstream.cursor();
+            const char* end = fcstream.end();
+            const char* stop = charclass::scan<Mask>(begin, end);
+            next_offset += stop - begin;
+            fcstream.advance_to(stop);
+            return stop == end ? FallibleCharStream::STREAM_END
+                : FallibleCharStream::STREAM_GOOD;
+        }
+
+        // Any other stream: one character at a time.
+        template <unsigned char Mask>
+        FallibleCharStream::StreamStatus take_while_class(std::false_type) {
             while (true) {  
                 char peek_char;
-                 FallibleCharStream::StreamStatus peek_result; 
-                std::tie(peek_char, peek_result) = peek_next_char();
-                switch (peek_result) {
-                    case FallibleCharStream::STREAM_ERROR:
-                        return { built, peek_result }; 
-                    case FallibleCharStream::STREAM_END:
-                        return { built, peek_result }; 
-                    case FallibleCharStream::STREAM_GOOD:
-                        if (charset.find(peek_char) == charset.end()) {
-                            return { built, peek_result }; 
-                        }
-                        break; 
+                FallibleCharStream::StreamStatus peek_result
+                    = peek_next_char(peek_char);
+                if (peek_result != FallibleCharStream::STREAM_GOOD
+                    || !charclass::is(peek_char, Mask)) {
+                    return peek_result; 
                 }
                 char take_char;
-                 FallibleCharStream::StreamStatus take_result;
-                std::tie(take_char, take_result) = get_next_char(); 
+                get_next_char(take_char); 
                 if (take_char != peek_char) {
                     // The file changed from under us.
                     read_has_failed = true; 
-                    return { built, FallibleCharStream::STREAM_ERROR };
+                    return FallibleCharStream::STREAM_ERROR;
                 }
-                // We know that the char is in charset from the earlier peek.
-                built.push_back(take_char);  
-            }
-          }
-
-    
-    private: 
-        FallibleCharStream& fcstream;
-        FilePosition next_char_position;
-        bool read_has_failed; 
-        
-        void update_next_char_position(char next_char) {
-            switch (next_char) {
-                case '\n': 
-                case '\v':
-                case '\f':
-                    next_char_position = next_char_position.start_next_line(); 
-                    break; 
-                case '\r': { //  error: jump to case label
-                    char follow_char; 
-                    FallibleCharStream::StreamStatus follow_result; 
-                    std::tie(follow_char, follow_result) = fcstream.peek();  
-                    if (follow_result != FallibleCharStream::STREAM_GOOD
-                        || (follow_char != '\n')) {
-                        next_char_position = 
-                          next_char_position.start_next_line(); 
-                    } else {
-                        next_char_position = next_char_position.next_column();
-                    }
-
-                    if (follow_result == FallibleCharStream::STREAM_ERROR) {
-                        read_has_failed = true; 
-                    }
-                    break; 
-                }
-                default:
-                    next_char_position = next_char_position.next_column();
             }
         }
+};
 
-};
\ No newline at end of file
+typedef BasicPositionedStream<FallibleCharStream> PositionedStream;
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cynophobia/debugwriter.hpp>
+#include <cynophobia/object.hpp>
+#include <cynophobia/shared.hpp>
+#include <cynophobia/tacky.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// x86-64 code generation. A TACKY program becomes assembly instructions,
+// which are either printed as AT&T assembly (a .s file, for reading and
+// debugging) or encoded straight into an ObjectFile, so compiling to a .o
+// never runs the assembler. Both give the same code and symbols: the
+// encoder picks the encodings GNU as does, down to relaxing each jump to
+// the short form where it reaches.
+namespace assembly {
+    // Hardware register numbers. Temporaries live on the stack; R10 and
+    // R11 are scratch for operands an instruction cannot take directly.
+    enum Register { AX = 0, DX = 2, R10 = 10, R11 = 11 };
+
+    // Condition-code numbers, as they appear in jcc and setcc opcodes.
+    enum Condition { E = 0x4, NE = 0x5, L = 0xC, GE = 0xD, LE = 0xE, G = 0xF };
+
+    struct Operand {
+        enum Type { Immediate, Register, Stack };
+        Type type;
+        // The immediate's value, an assembly::Register, or the stack
+        // slot's offset from %rbp.
+        std::int64_t value;
+    };
+
+    // 32-bit operations, in AT&T order: the destination is the second
+    // operand (for cmp, the left-hand side). Jmp, JmpCC and Label keep
+    // their label, numbered across the whole program, in source.value.
+    struct Instruction {
+        enum Type { Mov, Neg, Not, Add, Sub, Imul, Cmp, Idiv, Cdq, Jmp, JmpCC, SetCC, Label, Ret };
+        Type type;
+        Condition condition;
+        Operand source;
+        Operand destination;
+    };
+
+    struct Function {
+        std::string name;
+        std::vector<Instruction> instructions;
+        // Bytes below %rbp for temporaries, a multiple of 16. With none,
+        // the function sets up no frame.
+        std::uint32_t stack_size;
+    };
+
+    struct Program {
+        std::vector<Function> functions;
+    };
+}
+
+assembly::Program generate_assembly(const tacky::Program& program);
+
+// One instruction per line, with the directives gcc emits for a function;
+// source_name goes in .file, unless it is empty.
+void write_assembly(DebugWriter& out, const assembly::Program& program,
+    const std::string& source_name);
+
+ObjectFile encode_object(const assembly::Program& program, const std::string& source_name);
+
+// Instructions over all functions, as --stats counts them.
+std::size_t instruction_count(const assembly::Program& program);
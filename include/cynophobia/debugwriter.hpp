@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cynophobia/shared.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+
+// Buffered output for debug dumps, so a dump of any size needs no heap
+// allocation per token. Writing to a file descriptor, bytes collect in a
+// 64 KiB buffer, allocated once, and are written whenever it fills.
+// Writing to a string, the spare room the writer keeps at the string's
+// end is the buffer: the writer itself stays a few words, so one can be
+// made for a short diagnostic on any thread. The string has that room
+// trimmed off by flush() and by the writer's end.
+class DebugWriter {
+    public:
+        explicit DebugWriter(int fd);
+        explicit DebugWriter(std::string& out);
+        ~DebugWriter();
+
+        void write(const char* text, std::size_t size) {
+            if (size > capacity - used) {
+                write_through(text, size);
+                return;
+            }
+            std::memcpy(buffer + used, text, size);
+            used += size;
+        }
+
+        void write(const char* text);
+        void write(TextView text) { write(text.data, text.size); }
+        void write(const std::string& text) { write(text.data(), text.size()); }
+
+        void write_char(char c) {
+            if (used == capacity) {
+                write_through(&c, 1);
+                return;
+            }
+            buffer[used++] = c;
+        }
+
+        void write_unsigned(unsigned long long value);
+
+        // Fixed-width little-endian integers, for binary dumps.
+        void write_u8(std::uint8_t value) { write_char((char)value); }
+        void write_u16(std::uint16_t value);
+        void write_u32(std::uint32_t value);
+        void write_u64(std::uint64_t value);
+
+        // Hands the buffer to the sink. Returns false once any write to a
+        // file descriptor has failed.
+        bool flush();
+        bool failed() const { return write_failed; }
+
+    private:
+        DebugWriter(const DebugWriter&);
+        DebugWriter& operator=(const DebugWriter&);
+
+        void write_through(const char* text, std::size_t size);
+        void emit(const char* text, std::size_t size);
+
+        int fd;
+        std::string* out;
+        bool write_failed;
+        // Where the string's spare room starts.
+        std::size_t out_size;
+        std::unique_ptr<char[]> fd_buffer;
+        char* buffer;
+        std::size_t capacity;
+        std::size_t used;
+};
+
+// The --debug text format; debug_string() on each of these writes the
+// same bytes to a string.
+void write_debug(DebugWriter& writer, const FilePosition& position);
+void write_debug(DebugWriter& writer, const Token& token);
+void write_debug(DebugWriter& writer, const UnknownToken& unknown_token);
+void write_debug(DebugWriter& writer, const LexerOutput& lexer_output);
+void write_debug(DebugWriter& writer, const ParserOutput::Error& error);
+
+// Compact binary dump of a LexerOutput, for tools. Little-endian:
+//
+//   "CYNOTOK1"                       8-byte magic, then a u32 format version
+//   u8  flags                        1 = open_failed, 2 = read_failed
+//   u32 source_size, token_count, unknown_count
+//   source_size bytes of source
+//   token_count x   u8 token_type, u32 offset, u32 length, u32 line, u32 column
+//   unknown_count x u32 offset, u32 length, u32 line, u32 column
+//
+// Offsets index into the source. Token types are Token::TokenType values.
+// Dumps are self-delimiting, so several can be written back to back.
+const std::uint32_t LEXER_DUMP_VERSION = 1;
+
+void write_lexer_dump(DebugWriter& writer, const LexerOutput& lexer_output);
+
+// Reads one dump from the start of [data, data + size) into output and
+// sets consumed to its length. Returns false for anything that is not a
+// whole, well-formed dump.
+bool read_lexer_dump(const char* data, std::size_t size, LexerOutput& output,
+    std::size_t& consumed);
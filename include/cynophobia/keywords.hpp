@@ -0,0 +1,126 @@
+#pragma once
+#include <cynophobia/shared.hpp>
+
+#include <cstddef>
+#include <cstring>
+
+// Keyword recognition without allocation: a perfect hash over the C17
+// keywords. The slot table is generated at compile time from LIST, and a
+// static_assert rejects the hash if two keywords ever share a slot, so a
+// word is compared against at most one keyword.
+namespace keywords {
+    struct Keyword {
+        const char* text;
+        std::size_t size;
+        Token::TokenType token_type;
+    };
+
+#define CYNO_KEYWORD(text, type) { text, sizeof(text) - 1, Token::type }
+    constexpr Keyword LIST[] = {
+        CYNO_KEYWORD("auto", Auto),
+        CYNO_KEYWORD("break", Break),
+        CYNO_KEYWORD("case", Case),
+        CYNO_KEYWORD("char", Char),
+        CYNO_KEYWORD("const", Const),
+        CYNO_KEYWORD("continue", Continue),
+        CYNO_KEYWORD("default", Default),
+        CYNO_KEYWORD("do", Do),
+        CYNO_KEYWORD("double", Double),
+        CYNO_KEYWORD("else", Else),
+        CYNO_KEYWORD("enum", Enum),
+        CYNO_KEYWORD("extern", Extern),
+        CYNO_KEYWORD("float", Float),
+        CYNO_KEYWORD("for", For),
+        CYNO_KEYWORD("goto", Goto),
+        CYNO_KEYWORD("if", If),
+        CYNO_KEYWORD("inline", Inline),
+        CYNO_KEYWORD("int", Int),
+        CYNO_KEYWORD("long", Long),
+        CYNO_KEYWORD("register", Register),
+        CYNO_KEYWORD("restrict", Restrict),
+        CYNO_KEYWORD("return", Return),
+        CYNO_KEYWORD("short", Short),
+        CYNO_KEYWORD("signed", Signed),
+        CYNO_KEYWORD("sizeof", Sizeof),
+        CYNO_KEYWORD("static", Static),
+        CYNO_KEYWORD("struct", Struct),
+        CYNO_KEYWORD("switch", Switch),
+        CYNO_KEYWORD("typedef", Typedef),
+        CYNO_KEYWORD("union", Union),
+        CYNO_KEYWORD("unsigned", Unsigned),
+        CYNO_KEYWORD("void", Void),
+        CYNO_KEYWORD("volatile", Volatile),
+        CYNO_KEYWORD("while", While),
+        CYNO_KEYWORD("_Alignas", Alignas),
+        CYNO_KEYWORD("_Alignof", Alignof),
+        CYNO_KEYWORD("_Atomic", Atomic),
+        CYNO_KEYWORD("_Bool", Bool),
+        CYNO_KEYWORD("_Complex", Complex),
+        CYNO_KEYWORD("_Generic", Generic),
+        CYNO_KEYWORD("_Imaginary", Imaginary),
+        CYNO_KEYWORD("_Noreturn", Noreturn),
+        CYNO_KEYWORD("_Static_assert", StaticAssert),
+        CYNO_KEYWORD("_Thread_local", ThreadLocal),
+    };
+#undef CYNO_KEYWORD
+
+    const int COUNT = sizeof(LIST) / sizeof(LIST[0]);
+    const std::size_t MIN_SIZE = 2;    // do, if
+    const std::size_t MAX_SIZE = 14;   // _Static_assert
+    const unsigned int SLOT_COUNT = 128;
+
+    // Multipliers found by search; any set works as long as the
+    // static_assert below holds. Requires MIN_SIZE <= size.
+    constexpr unsigned int hash(const char* text, std::size_t size) {
+        return ((unsigned int)size
+            + 13u * (unsigned char)text[0]
+            + (unsigned char)text[1]
+            + 15u * (unsigned char)text[size - 1]) % SLOT_COUNT;
+    }
+
+    // Index in LIST of the keyword hashing to slot (searching from index),
+    // or -1.
+    constexpr int keyword_in_slot(unsigned int slot, int index) {
+        return index == COUNT ? -1
+            : hash(LIST[index].text, LIST[index].size) == slot ? index
+            : keyword_in_slot(slot, index + 1);
+    }
+
+    constexpr bool collision_free(int index) {
+        return index == COUNT
+            || (keyword_in_slot(hash(LIST[index].text, LIST[index].size), 0) == index
+                && collision_free(index + 1));
+    }
+
+    static_assert(collision_free(0), "keyword hash collides; pick new multipliers");
+
+#define CYNO_SLOT4(n) \
+    keyword_in_slot(n, 0), keyword_in_slot(n + 1, 0), \
+    keyword_in_slot(n + 2, 0), keyword_in_slot(n + 3, 0)
+#define CYNO_SLOT16(n) \
+    CYNO_SLOT4(n), CYNO_SLOT4(n + 4), CYNO_SLOT4(n + 8), CYNO_SLOT4(n + 12)
+#define CYNO_SLOT64(n) \
+    CYNO_SLOT16(n), CYNO_SLOT16(n + 16), CYNO_SLOT16(n + 32), CYNO_SLOT16(n + 48)
+    constexpr signed char SLOTS[SLOT_COUNT] = { CYNO_SLOT64(0), CYNO_SLOT64(64) };
+#undef CYNO_SLOT64
+#undef CYNO_SLOT16
+#undef CYNO_SLOT4
+
+    // If text is a keyword, stores its token type and returns true.
+    inline bool classify(const char* text, std::size_t size,
+      Token::TokenType& token_type) {
+        if (size < MIN_SIZE || size > MAX_SIZE) {
+            return false;
+        }
+        int index = SLOTS[hash(text, size)];
+        if (index < 0) {
+            return false;
+        }
+        const Keyword& keyword = LIST[index];
+        if (keyword.size != size || std::memcmp(keyword.text, text, size) != 0) {
+            return false;
+        }
+        token_type = keyword.token_type;
+        return true;
+    }
+}
@@ -1,6 +1,13 @@
 #pragma once
+#include <cynophobia/charstream.hpp>
 #include <cynophobia/shared.hpp>
 
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
 
 LexerOutput lex_file(
     const Config& config
@@ -11,3 +18,104 @@ LexerOutput lex_string(
     bool debug
 );
 
+// Lexes any FallibleCharStream through its virtual interface. lex_file and
+// lex_string use specialized instantiations instead.
+LexerOutput lex_stream(
+    FallibleCharStream& fcs,
+    bool debug
+);
+
+// Inputs smaller than this per chunk are split into fewer chunks.
+const std::size_t PARALLEL_LEX_MIN_CHUNK = 1 << 20;
+
+// Lex in chunks on up to `jobs` threads. The output is the same as
+// lex_file's or lex_string's, byte for byte.
+LexerOutput lex_file_parallel(
+    const Config& config,
+    unsigned int jobs,
+    std::size_t min_chunk_size = PARALLEL_LEX_MIN_CHUNK
+);
+
+LexerOutput lex_string_parallel(
+    std::string program_string,
+    bool debug,
+    unsigned int jobs,
+    std::size_t min_chunk_size = PARALLEL_LEX_MIN_CHUNK
+);
+
+// Lexes a source already in memory, in chunks on up to `jobs` threads.
+LexerOutput lex_source(
+    std::shared_ptr<const SourceBuffer> source,
+    bool debug,
+    unsigned int jobs = 1
+);
+
+// Reads fd (stdin, a pipe, a file) to its end in large blocks and lexes
+// what it read, in chunks on up to `jobs` threads. A read error is
+// reported as read_failed, with everything read before it lexed; a
+// negative fd as open_failed.
+LexerOutput lex_fd(
+    int fd,
+    bool debug,
+    unsigned int jobs = 1
+);
+
+// Pull-based lexing over any FallibleCharStream: tokens are lexed as they
+// are asked for, with at most `lookahead` of them buffered in a ring, and
+// only the text of buffered tokens kept. Memory stays proportional to the
+// lookahead, not to the size of the input. Positions are tracked as the
+// input is read; unknown tokens are collected as they are met.
+class TokenSource {
+    public:
+        TokenSource(FallibleCharStream& fcs, std::size_t lookahead);
+
+        // The token k places after the next one to be consumed (0 is the
+        // next one), or null past the end of the input. k must be less
+        // than the lookahead. Valid until the next call to next_token.
+        const Token* peek_token(std::size_t k = 0);
+
+        // Consumes the next token, or returns null past the end of the
+        // input. Valid until the next call to either function.
+        const Token* next_token();
+
+        const std::vector<UnknownToken>& unknown_tokens() const {
+            return unknown;
+        }
+        // Where the symbols of Identifier tokens were interned.
+        const SymbolTable& symbols() const { return symbol_table; }
+        bool read_failed() const { return input_read_failed; }
+        bool open_failed() const { return input_open_failed; }
+
+    private:
+        TokenSource(const TokenSource&);
+        TokenSource& operator=(const TokenSource&);
+
+        struct Slot {
+            Token token;
+            std::string text;
+        };
+
+        // Lexes until k + 1 tokens are buffered or the input is done.
+        void fill(std::size_t k);
+        FilePosition consume_line_breaks(TextSpan span);
+
+        BasicPositionedStream<FallibleCharStream> pfs;
+        std::vector<Slot> ring;
+        std::size_t head;
+        std::size_t count;
+        bool finished;
+        bool input_read_failed;
+        bool input_open_failed;
+
+        // Line tracking: the current line, the offset it starts at, and
+        // whether the last character consumed was a \r (a \n right after
+        // it does not start another line).
+        unsigned int line;
+        std::uint32_t line_start;
+        bool after_cr;
+
+        SymbolTable symbol_table;
+        std::vector<UnknownToken> unknown;
+        // Unknown token text; a deque so earlier TextViews stay valid.
+        std::deque<std::string> unknown_text;
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cynophobia/debugwriter.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A relocatable object with one code section, as the assembler would have
+// produced it, written straight to an ELF64 x86-64 .o file that the system
+// linker accepts.
+
+// Relocation types from the x86-64 psABI.
+const std::uint32_t R_X86_64_PC32 = 2;
+const std::uint32_t R_X86_64_PLT32 = 4;
+
+struct ObjectSymbol {
+    std::string name;
+    // Defined at offset in .text, or undefined and left to the linker.
+    bool defined;
+    bool global;
+    bool function;
+    std::uint64_t offset;
+    std::uint64_t size;
+};
+
+struct ObjectRelocation {
+    // Of the field to patch, in .text.
+    std::uint64_t offset;
+    // Index into ObjectFile::symbols.
+    std::uint32_t symbol;
+    std::uint32_t type;
+    std::int64_t addend;
+};
+
+struct ObjectFile {
+    // Named by an STT_FILE symbol, as .file names it; may be empty.
+    std::string source_name;
+    std::string text;
+    // In any order: the writer puts local symbols first, as ELF requires.
+    std::vector<ObjectSymbol> symbols;
+    std::vector<ObjectRelocation> relocations;
+};
+
+// Sections: .text, .rela.text when there are relocations, an empty
+// .note.GNU-stack (so the stack is not made executable), .symtab,
+// .strtab and .shstrtab.
+void write_elf_object(DebugWriter& out, const ObjectFile& object);
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cynophobia/tacky.hpp>
+
+// TACKY optimization, run by cynocompiler -O. Each function goes through
+// constant folding, unreachable-code elimination, copy propagation and
+// dead-store elimination, over and over until a round changes nothing.
+// The last three work on the function's control-flow graph, with
+// dataflow sets kept as bit vectors.
+enum OptimizationPass {
+    ConstantFolding,
+    UnreachableCode,
+    CopyPropagation,
+    DeadStores,
+    OPTIMIZATION_PASS_COUNT
+};
+
+// As --stats prints it.
+const char* pass_name(OptimizationPass pass);
+
+struct PassStats {
+    unsigned long long runs;
+    double seconds;
+    // Instructions the pass rewrote or removed.
+    unsigned long long changes;
+};
+
+struct OptimizerStats {
+    PassStats passes[OPTIMIZATION_PASS_COUNT];
+    // Rounds of all four passes, summed over functions.
+    unsigned long long rounds;
+};
+
+void optimize_program(tacky::Program& program, OptimizerStats& stats);
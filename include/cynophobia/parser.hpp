@@ -2,6 +2,42 @@
 
 #include <cynophobia/shared.hpp>
 
+#include <cstddef>
+#include <memory>
+
+// Unary operators, binary operators and open parentheses an expression
+// may have waiting on each other at once, unless parse_program is told
+// otherwise. Deeper expressions are a parse error rather than a crash.
+const std::size_t DEFAULT_MAX_NESTING = 65536;
+
+// Parses tokens borrowed from a TokenBuffer. Of the tokens, only the
+// spans of those the tree refers to are copied, into the arena with the
+// tree; the Program keeps their source alive. The tree, or the error
+// message, is made in a new arena.
 ParserOutput parse_program(
-    const std::vector<Token> tokens
-);
\ No newline at end of file
+    const TokenBuffer& tokens,
+    std::size_t max_nesting = DEFAULT_MAX_NESTING
+);
+
+ParserOutput parse_program(
+    TokenSpan tokens,
+    std::size_t max_nesting = DEFAULT_MAX_NESTING
+);
+
+// As above, in an arena of the caller's, such as one from an ArenaPool
+// (see arena.hpp). The output and the Program hold on to it.
+ParserOutput parse_program(
+    const TokenBuffer& tokens,
+    std::shared_ptr<Arena> arena,
+    std::size_t max_nesting = DEFAULT_MAX_NESTING
+);
+
+ParserOutput parse_program(
+    TokenSpan tokens,
+    std::shared_ptr<Arena> arena,
+    std::size_t max_nesting = DEFAULT_MAX_NESTING
+);
+
+// The program, its functions and statements, and every expression node,
+// as --stats counts them.
+std::size_t node_count(const parsing::Program& program);
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cynophobia/shared.hpp>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// The built-in C17 preprocessor: #include, object-like and function-like
+// macros (with #, ## and __VA_ARGS__), conditional inclusion, #line,
+// #error and #pragma once. Its output is the translation unit as text, as
+// gcc -E -P would print it, so the lexer reads it like any other source
+// and nothing runs in a separate process or goes through a temp file.
+//
+// A header is read and tokenized once per translation unit. When it is
+// guarded by #pragma once, or wholly by #ifndef X / #define X ... #endif,
+// including it again is decided from the cache alone: it is not opened,
+// not even looked for in the include directories again.
+
+struct PreprocessorOptions {
+    // Searched in order for #include <...>, and after the directory of
+    // the including file for #include "...".
+    std::vector<std::string> include_directories;
+    // NAME or NAME=VALUE, as for gcc -D; NAME alone defines it as 1.
+    std::vector<std::string> definitions;
+};
+
+struct PreprocessorError {
+    // As named by #include or #line, and 1-based, as in gcc's messages.
+    std::string filename;
+    unsigned int line;
+    std::string message;
+    // filename:line: error: message
+    std::string debug_string() const;
+};
+
+struct PreprocessorOutput {
+    std::string text;
+    // Preprocessing goes on after an error, as far as it sensibly can; the
+    // text is only meant to be compiled when there are none.
+    std::vector<PreprocessorError> errors;
+    // Of the main file; a header that cannot be opened is an error.
+    bool open_failed;
+    // Files read and tokenized, including the main file, their total
+    // size, and #includes answered from the include guard cache without
+    // reading anything.
+    unsigned int files_read;
+    std::size_t bytes_read;
+    unsigned int includes_skipped;
+};
+
+PreprocessorOutput preprocess_file(
+    const std::string& filename,
+    const PreprocessorOptions& options
+);
+
+// Preprocesses text as if it were the contents of a file called filename,
+// which #include "..." and __FILE__ go by.
+PreprocessorOutput preprocess_string(
+    std::string text,
+    const std::string& filename,
+    const PreprocessorOptions& options
+);
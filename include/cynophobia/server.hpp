@@ -0,0 +1,87 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// One forwarded command line. in_fd and out_fd are the client's own
+// standard input and output, passed over the socket, so the handler reads
+// and writes exactly what a direct run would have.
+struct ServerRequest {
+    std::string directory;
+    std::vector<std::string> arguments;
+    int in_fd;
+    int out_fd;
+};
+
+// Runs a request and returns its exit code. Called on a separate thread
+// for each client, so it must be safe to run concurrently.
+typedef std::function<int(const ServerRequest&)> RequestHandler;
+
+// A long-running process serving command lines over a Unix domain socket:
+//
+//   client -> server   u32 version, u32 argument_count, with the client's
+//                      stdin and stdout attached (SCM_RIGHTS), then the
+//                      working directory and each argument as u32 size
+//                      + bytes
+//   server -> client   u32 exit code, once the handler has returned
+//
+// Integers are little-endian. The socket is only accessible to its owner,
+// from the moment it exists, and connections from any other user are
+// closed unanswered. A client that has not sent its whole command line
+// within the receive timeout is dropped, so none can keep the server from
+// stopping. Without Unix domain sockets listen() always fails.
+class CompileServer {
+    public:
+        explicit CompileServer(RequestHandler handler);
+        ~CompileServer();
+
+        // Binds and listens at path, replacing whatever socket was left
+        // there by a server that did not shut down cleanly.
+        bool listen(const std::string& path);
+
+        // Serves clients until stop(), then waits for those in progress
+        // and removes the socket.
+        void run();
+
+        // Safe from any thread and from a signal handler.
+        void stop();
+
+        // How long a client may take to send each part of its command
+        // line; DEFAULT_RECEIVE_TIMEOUT_MS unless set before run(), and 0
+        // waits forever.
+        void set_receive_timeout(unsigned int milliseconds) { receive_timeout_ms = milliseconds; }
+
+    private:
+        CompileServer(const CompileServer&);
+        CompileServer& operator=(const CompileServer&);
+
+        void serve(int connection);
+
+        RequestHandler handler;
+        std::string path;
+        int listen_fd;
+        int wake_fds[2];
+        std::mutex lock;
+        std::condition_variable idle;
+        unsigned int active;
+        unsigned int receive_timeout_ms;
+};
+
+const unsigned int DEFAULT_RECEIVE_TIMEOUT_MS = 10000;
+
+enum ForwardStatus {
+    FORWARDED,
+    NO_SERVER,
+    CONNECTION_LOST
+};
+
+const unsigned int SERVER_PROTOCOL_VERSION = 2;
+
+// Sends a command line to the server at path with in_fd and out_fd as its
+// standard input and output, and waits for the exit code. NO_SERVER means
+// nothing was sent, so the caller can still run the command itself.
+ForwardStatus forward_to_server(const std::string& path, const std::string& directory,
+    const std::vector<std::string>& arguments, int in_fd, int out_fd, int& exit_code);
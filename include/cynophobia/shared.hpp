@@ -1,6 +1,11 @@
 #pragma once 
 
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
 #include <memory>
+#include <new>
+#include <ostream>
 #include <sstream>
 #include <string>
 #include <tuple>
@@ -9,9 +14,11 @@
 #include <unordered_map>
 #include <vector>
 
+#include <cynophobia/symbols.hpp>
+
 //// Cross-cutting
 
-enum Target { LexStage, ParseStage, CodegenStage, LinkStage };
+enum Target { PreprocessStage, LexStage, ParseStage, TackyStage, OptimizeStage, CodegenStage, LinkStage };
 
 struct Config {
     std::string filename; 
@@ -20,6 +27,36 @@ struct Config {
 
 //// Lexing-related 
 
+// Non-owning view of a run of source text (std::string_view is C++17).
+// Token text points into the SourceBuffer the lexer read from, which the
+// TokenBuffer keeps alive.
+struct TextView {
+    const char* data;
+    std::size_t size;
+    std::string str() const;
+};
+
+bool operator==(const TextView& view, const std::string& s);
+bool operator!=(const TextView& view, const std::string& s);
+std::ostream& operator<<(std::ostream& os, const TextView& view);
+
+// The complete text a LexerOutput was lexed from: a memory-mapped file or
+// an owned string (see charstream.hpp). Token text and positions are
+// recovered from it on demand.
+class SourceBuffer {
+    public:
+        virtual ~SourceBuffer() {}
+        virtual const char* data() const = 0;
+        virtual std::size_t size() const = 0;
+};
+
+// A token's place in the source, in bytes. Sources over 4 GiB are refused
+// (see MAX_SOURCE_SIZE in charstream.hpp).
+struct TextSpan {
+    std::uint32_t offset;
+    std::uint32_t length;
+};
+
 struct FilePosition {
     unsigned int line; 
     unsigned int column;
@@ -28,6 +65,19 @@ struct FilePosition {
     FilePosition start_next_line();
 };
 
+// Offsets at which each line of a source starts, for turning byte offsets
+// into FilePositions only when something needs them: \n, \v, \f and a \r
+// not followed by \n end a line. build scans for line breaks with SIMD;
+// position is a binary search.
+class LineIndex {
+    public:
+        void build(const char* text, std::size_t size);
+        FilePosition position(std::uint32_t offset) const;
+
+    private:
+        std::vector<std::uint32_t> line_starts;
+};
+
 struct Token {
         // [a-zA-Z_] means any a to z character, A to Z character, or an underscore 
     // \w is [a-zA-Z0-9_]
@@ -44,100 +94,284 @@ struct Token {
         CloseParen,   // \)
         OpenBrace,    // \{
         CloseBrace,   // \}
+        // The remaining C17 keywords, see keywords.hpp
+        Auto,         // auto\b
+        Break,        // break\b
+        Case,         // case\b
+        Char,         // char\b
+        Const,        // const\b
+        Continue,     // continue\b
+        Default,      // default\b
+        Do,           // do\b
+        Double,       // double\b
+        Else,         // else\b
+        Enum,         // enum\b
+        Extern,       // extern\b
+        Float,        // float\b
+        For,          // for\b
+        Goto,         // goto\b
+        If,           // if\b
+        Inline,       // inline\b
+        Long,         // long\b
+        Register,     // register\b
+        Restrict,     // restrict\b
+        Short,        // short\b
+        Signed,       // signed\b
+        Sizeof,       // sizeof\b
+        Static,       // static\b
+        Struct,       // struct\b
+        Switch,       // switch\b
+        Typedef,      // typedef\b
+        Union,        // union\b
+        Unsigned,     // unsigned\b
+        Volatile,     // volatile\b
+        While,        // while\b
+        Alignas,      // _Alignas\b
+        Alignof,      // _Alignof\b
+        Atomic,       // _Atomic\b
+        Bool,         // _Bool\b
+        Complex,      // _Complex\b
+        Generic,      // _Generic\b
+        Imaginary,    // _Imaginary\b
+        Noreturn,     // _Noreturn\b
+        StaticAssert, // _Static_assert\b
+        ThreadLocal,  // _Thread_local\b
+        // Operators
+        Tilde,        // ~
+        Hyphen,       // -
+        Decrement,    // --
+        Plus,         // +
+        Asterisk,     // \*
+        Slash,        // /
+        Percent,      // %
+        Bang,         // !
+        LogicalAnd,   // &&
+        LogicalOr,    // \|\|
+        EqualEqual,   // ==
+        BangEqual,    // !=
+        Less,         // <
+        Greater,      // >
+        LessEqual,    // <=
+        GreaterEqual, // >=
     };
 
     FilePosition position; 
-    std::string  text;
+    TextView     text;
     TokenType    token_type;  
+    // The interned name of an Identifier, NO_SYMBOL for anything else.
+    SymbolId     symbol;
     std::string debug_string() const; 
 };
 
-const Token DEFAULT_TOKEN = { { 0, 0 }, "", Token::Semicolon }; 
+// The enumerator's name, as the debug dump prints it.
+const char* token_type_name(Token::TokenType token_type);
+
+const Token DEFAULT_TOKEN = { { 0, 0 }, { "", 0 }, Token::Semicolon, NO_SYMBOL }; 
+
+// The lexer's output tokens as parallel arrays of kinds, offsets, lengths
+// and symbols (13 bytes a token). Text and positions are derived from the
+// source on request; operator[] and iteration build full Tokens.
+class TokenBuffer {
+    public:
+        class const_iterator {
+            public:
+                typedef std::forward_iterator_tag iterator_category;
+                typedef Token value_type;
+                typedef std::ptrdiff_t difference_type;
+                typedef const Token* pointer;
+                typedef Token reference;
+
+                const_iterator(const TokenBuffer* buffer, std::size_t index) :
+                    buffer(buffer), index(index) {}
+                Token operator*() const { return (*buffer)[index]; }
+                const_iterator& operator++() { index++; return *this; }
+                bool operator==(const const_iterator& other) const { return index == other.index; }
+                bool operator!=(const const_iterator& other) const { return index != other.index; }
+
+            private:
+                const TokenBuffer* buffer;
+                std::size_t index;
+        };
+
+        static_assert(Token::GreaterEqual < 256, "token kinds are stored in 8 bits");
+
+        TokenBuffer() : lines_built(false) {}
+
+        void push_back(Token::TokenType token_type, TextSpan span,
+          SymbolId symbol = NO_SYMBOL) {
+            kinds.push_back((std::uint8_t)token_type);
+            offsets.push_back(span.offset);
+            lengths.push_back(span.length);
+            symbol_ids.push_back(symbol);
+        }
+
+        // Must be set before text or positions are asked for.
+        void set_source(std::shared_ptr<const SourceBuffer> text_source) {
+            source_buffer = std::move(text_source);
+            lines_built = false;
+        }
+
+        // The table Identifier symbols were interned in.
+        void set_symbols(std::shared_ptr<const SymbolTable> table) {
+            symbol_table = std::move(table);
+        }
+
+        const std::shared_ptr<const SourceBuffer>& source() const { return source_buffer; }
+        const std::shared_ptr<const SymbolTable>& symbols() const { return symbol_table; }
+        std::size_t size() const { return kinds.size(); }
+        bool empty() const { return kinds.empty(); }
+
+        Token::TokenType kind(std::size_t index) const {
+            return (Token::TokenType)kinds[index];
+        }
+
+        SymbolId symbol(std::size_t index) const {
+            return symbol_ids[index];
+        }
+
+        TextSpan span(std::size_t index) const {
+            return { offsets[index], lengths[index] };
+        }
+
+        TextView text(std::size_t index) const {
+            return text_of(span(index));
+        }
+
+        TextView text_of(TextSpan span) const {
+            return { source_buffer->data() + span.offset, span.length };
+        }
+
+        FilePosition position(std::size_t index) const {
+            return position_of(offsets[index]);
+        }
+
+        // Builds the line index on first use, so this is not safe to call
+        // concurrently on a buffer no one has asked for positions yet.
+        FilePosition position_of(std::uint32_t offset) const;
+
+        Token operator[](std::size_t index) const {
+            return { position(index), text(index), kind(index), symbol(index) };
+        }
+
+        const_iterator begin() const { return const_iterator(this, 0); }
+        const_iterator end() const { return const_iterator(this, size()); }
+
+    private:
+        std::shared_ptr<const SourceBuffer> source_buffer;
+        std::vector<std::uint8_t> kinds;
+        std::vector<std::uint32_t> offsets;
+        std::vector<std::uint32_t> lengths;
+        std::vector<SymbolId> symbol_ids;
+        std::shared_ptr<const SymbolTable> symbol_table;
+        mutable LineIndex lines;
+        mutable bool lines_built;
+};
+
+// A borrowed range [begin, end) of a TokenBuffer's tokens. The buffer must
+// outlive the span.
+struct TokenSpan {
+    const TokenBuffer* tokens;
+    std::size_t begin;
+    std::size_t end;
+};
 
 struct UnknownToken {
     FilePosition position; 
-    std::string  text; 
+    TextView     text; 
     std::string debug_string() const;
 };
 
+// Movable end to end: the tokens and their source move along with it.
 struct LexerOutput { 
-    const std::vector<Token> tokens; 
-    const std::vector<UnknownToken> unknown_tokens; 
-    const bool read_failed;
-    const bool open_failed;
+    TokenBuffer tokens; 
+    std::vector<UnknownToken> unknown_tokens; 
+    bool read_failed;
+    bool open_failed;
     std::string debug_string() const; 
 };
  
 //// Parsing-related
 
+// See arena.hpp.
+class Arena;
 
 
 namespace parsing {
-    struct IntConstant {
-        Token value; 
-    };
+    // A node's place in its function's node array, and a token's in its
+    // Program's token table.
+    typedef std::uint32_t NodeIndex;
+    typedef std::uint32_t TokenIndex;
 
-    struct Expression {
-        enum Type { IntConstant }; 
-        Type type; 
-        union {
-            parsing::IntConstant int_constant;
-        };
+    const NodeIndex NO_NODE = 0xFFFFFFFFu;
 
-        Expression(parsing::IntConstant&& subtree) {
-            type = IntConstant;
-            new (&int_constant) parsing::IntConstant(std::move(subtree));
-        }
-        
-        ~Expression() {
-            switch (type) {
-                case IntConstant:
-                    int_constant.~IntConstant(); 
-            }
-        }
+    enum UnaryOperator { Complement, Negate, Not };
+
+    // In order of the TACKY opcodes they lower to.
+    enum BinaryOperator {
+        Add, Subtract, Multiply, Divide, Remainder,
+        Equal, NotEqual, Less, LessOrEqual, Greater, GreaterOrEqual,
+        And, Or
     };
 
-    struct ReturnStatement {
-        Token return_token; 
-        std::unique_ptr<Expression> expression;  
-        Token semicolon_token;
+    // One node of a function's tree, in 16 bytes. Children are indices
+    // into the function's node array and tokens are indices into the
+    // Program's token table, so a node embeds no Token and no pointer.
+    // Parenthesized expressions are the expression inside; the tree has
+    // no node for the parentheses.
+    struct Node {
+        enum Kind : std::uint8_t { IntConstant, Unary, Binary, Return };
+        Kind kind;
+        // A UnaryOperator or BinaryOperator.
+        std::uint8_t operation;
+        // The constant, the operator, or the return keyword.
+        TokenIndex token;
+        // Unary's operand, Binary's left operand or Return's expression.
+        NodeIndex first;
+        // Binary's right operand, whose subtree starts at first + 1.
+        NodeIndex second;
     };
 
-    struct Statement {
-        enum Type { Return };
-        Type type; 
-        union {
-            ReturnStatement statement_return;
-        };
+    static_assert(sizeof(Node) == 16, "tree nodes are 16 bytes");
 
-        Statement(ReturnStatement&& subtree) {
-            type = Return;
-            new (&statement_return) ReturnStatement(std::move(subtree));
-        }
- 
-        ~Statement() {
-            switch (type) {
-                case Return:
-                    statement_return.~ReturnStatement(); 
-            }
-        }
-    }; 
-    
+    // A function's nodes are one array in its Program's arena, in
+    // post-order: every child comes before its parent and the body, its
+    // return statement, comes last. Passes walk the tree by scanning the
+    // array from the front.
     struct Function {
-        Token type;
-        Token identifier; 
-        std::unique_ptr<parsing::Statement> statement;
-    }; 
+        TokenIndex type;
+        TokenIndex identifier;
+        // The identifier's interned name.
+        SymbolId symbol;
+        const Node* nodes;
+        std::uint32_t node_count;
+
+        const Node& body() const { return nodes[node_count - 1]; }
+    };
 
+    // Chapter 1 programs are a single function; any number of function
+    // definitions are accepted ahead of later chapters.
     struct Program {
-        Function function;  
+        std::vector<Function> functions;  
+        // Where each token the tree refers to is in the source, by
+        // TokenIndex, in the arena; with the source, this gives token text
+        // once the lexer's output is gone.
+        const TextSpan* tokens;
+        std::uint32_t token_count;
+        std::shared_ptr<const SourceBuffer> source;
+        // Holds the functions' node arrays.
+        std::shared_ptr<Arena> arena;
+
+        TextView text(TokenIndex token) const {
+            return { source->data() + tokens[token].offset, tokens[token].length };
+        }
     }; 
 }
 struct ParserOutput { 
     
     struct Error {
         FilePosition position; 
-        std::string  message;
+        // In the output's arena.
+        TextView     message;
     };
 
     bool is_error; 
@@ -146,12 +380,27 @@ struct ParserOutput {
         Error error;
     };
 
-    ParserOutput(ParserOutput::Error parse_error) : is_error(true) {
-        error = parse_error;
+    // The arena the tree or the error message was made in. The Program
+    // holds it too, so the tree may outlive the output.
+    std::shared_ptr<Arena> arena;
+
+    ParserOutput(ParserOutput::Error parse_error, std::shared_ptr<Arena> message_arena = nullptr) :
+        is_error(true), arena(std::move(message_arena)) {
+        new (&error) Error(std::move(parse_error));
+    }
+
+    ParserOutput(std::unique_ptr<parsing::Program> parsed_program) :
+        is_error(false), arena(parsed_program->arena) {
+        new (&program) std::unique_ptr<parsing::Program>(std::move(parsed_program));
     }
 
-    ParserOutput(std::unique_ptr<parsing::Program> parsed_program) : is_error(false) {
-        program = std::move(parsed_program);
+    ParserOutput(ParserOutput&& other) noexcept :
+        is_error(other.is_error), arena(std::move(other.arena)) {
+        if (other.is_error) {
+            new (&error) Error(std::move(other.error));
+        } else {
+            new (&program) std::unique_ptr<parsing::Program>(std::move(other.program));
+        }
     }
 
     ~ParserOutput() { 
@@ -165,14 +414,9 @@ struct ParserOutput {
     
 };
 
-std::string debug_string(const ParserOutput::Error& error) {
-        std::stringstream ss;
-        ss << "{'position': " << error.position.debug_string() 
-            << ",'message': " << error.message << "}";
-        return ss.str(); 
-    }
+std::string debug_string(const ParserOutput::Error& error);
 
-const ParserOutput::Error DEFAULT_PARSER_ERROR = { { 0, 0 }, "internal_compilation_error" };
+const ParserOutput::Error DEFAULT_PARSER_ERROR = { { 0, 0 }, { "internal_compilation_error", 26 } };
 const ParserOutput DEFAULT_PARSER_OUTPUT =
     { DEFAULT_PARSER_ERROR };
 
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Dense ids for interned names: 0, 1, 2, ... in order of first appearance.
+typedef std::uint32_t SymbolId;
+
+// Tokens that are not identifiers have no symbol.
+const SymbolId NO_SYMBOL = 0xFFFFFFFFu;
+
+// Interns names for one compilation. The text of every symbol is stored
+// once, back to back in a single pool, and looked up through an open
+// addressing hash table, so that equal names get equal ids and later
+// stages can compare and hash names as integers.
+class SymbolTable {
+    public:
+        SymbolTable();
+
+        // Returns the id of text, adding it if it is new.
+        SymbolId intern(const char* text, std::size_t size);
+
+        // Returns the id of text, or NO_SYMBOL if it was never interned.
+        SymbolId find(const char* text, std::size_t size) const;
+
+        // Valid until the next intern.
+        const char* text(SymbolId symbol) const {
+            return pool.data() + offsets[symbol];
+        }
+
+        std::size_t text_size(SymbolId symbol) const {
+            return offsets[symbol + 1] - offsets[symbol];
+        }
+
+        std::string str(SymbolId symbol) const {
+            return std::string(text(symbol), text_size(symbol));
+        }
+
+        // Number of symbols; ids are below this.
+        std::size_t size() const { return hashes.size(); }
+
+    private:
+        std::size_t slot_of(const char* text, std::size_t size, std::uint32_t hash) const;
+        void grow();
+
+        std::string pool;
+        // offsets[id] to offsets[id + 1] is the text of id in pool.
+        std::vector<std::uint32_t> offsets;
+        std::vector<std::uint32_t> hashes;
+        // id + 1 of the symbol in each slot, 0 for an empty slot; the size
+        // is a power of two kept at least twice the number of symbols.
+        std::vector<std::uint32_t> slots;
+};
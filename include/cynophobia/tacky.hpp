@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cynophobia/debugwriter.hpp>
+#include <cynophobia/shared.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// TACKY, the three-address IR between the parser and code generation.
+// Each function keeps its instructions in one contiguous array of 16-byte
+// records whose operands are 32-bit indices, so building, scanning and
+// rewriting a function touches no memory but its own arrays, and nothing
+// is allocated per instruction.
+namespace tacky {
+    // A function's temporary, numbered from 0, or, with CONSTANT set, an
+    // index into its constant pool. Labels are numbered separately.
+    typedef std::uint32_t Value;
+
+    const Value CONSTANT = 0x80000000u;
+    const Value NO_VALUE = 0xFFFFFFFFu;
+
+    inline bool is_constant(Value value) { return (value & CONSTANT) != 0 && value != NO_VALUE; }
+    inline std::uint32_t index_of(Value value) { return value & ~CONSTANT; }
+
+    enum Opcode : std::uint8_t {
+        Return,          // return a
+        Copy,            // dst = a
+        Complement,      // dst = ~a
+        Negate,          // dst = -a
+        Not,             // dst = !a
+        Add,             // dst = a + b
+        Subtract,        // dst = a - b
+        Multiply,        // dst = a * b
+        Divide,          // dst = a / b
+        Remainder,       // dst = a % b
+        Equal,           // dst = a == b
+        NotEqual,        // dst = a != b
+        Less,            // dst = a < b
+        LessOrEqual,     // dst = a <= b
+        Greater,         // dst = a > b
+        GreaterOrEqual,  // dst = a >= b
+        Jump,            // goto label dst
+        JumpIfZero,      // if (a == 0) goto label dst
+        JumpIfNotZero,   // if (a != 0) goto label dst
+        Label,           // label dst:
+    };
+
+    // Operands an instruction does not use are NO_VALUE.
+    struct Instruction {
+        Opcode opcode;
+        Value dst;
+        Value a;
+        Value b;
+    };
+
+    static_assert(sizeof(Instruction) == 16, "instructions are 16 bytes");
+
+    // Whether dst is a temporary the instruction writes, rather than a
+    // label or unused.
+    inline bool writes_dst(Opcode opcode) { return opcode >= Copy && opcode <= GreaterOrEqual; }
+    inline bool is_binary(Opcode opcode) { return opcode >= Add && opcode <= GreaterOrEqual; }
+
+    struct Function {
+        // Points into the Program's source.
+        TextView name;
+        std::vector<Instruction> instructions;
+        std::vector<std::int32_t> constants;
+        std::uint32_t temporaries;
+        std::uint32_t labels;
+
+        Value constant(std::int32_t value) {
+            constants.push_back(value);
+            return CONSTANT | (Value)(constants.size() - 1);
+        }
+
+        std::int32_t constant_value(Value value) const { return constants[index_of(value)]; }
+        Value temporary() { return temporaries++; }
+        Value label() { return labels++; }
+
+        void emit(Opcode opcode, Value dst, Value a = NO_VALUE, Value b = NO_VALUE) {
+            instructions.push_back(Instruction { opcode, dst, a, b });
+        }
+    };
+
+    struct Program {
+        std::vector<Function> functions;
+        // Keeps function names alive once the parser's output is gone.
+        std::shared_ptr<const SourceBuffer> source;
+    };
+}
+
+tacky::Program lower_program(const parsing::Program& program);
+
+// Instructions over all functions, as --stats counts them.
+std::size_t instruction_count(const tacky::Program& program);
+
+// The --debug text form, one instruction per line:
+//
+//   main:
+//       t0 = 2 + 3
+//       return t0
+void write_debug(DebugWriter& writer, const tacky::Program& program);
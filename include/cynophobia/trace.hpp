@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cynophobia/debugwriter.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+typedef std::chrono::steady_clock TraceClock;
+
+// Records timed spans from any thread of the process and writes them as
+// Chrome trace events (chrome://tracing, https://ui.perfetto.dev). Spans
+// are only recorded between start() and finish(); the rest of the time a
+// TraceScope costs one relaxed atomic load, so scopes belong around whole
+// passes and chunks, not in per-token loops.
+class Tracer {
+    public:
+        static Tracer& instance();
+
+        static bool enabled() { return is_enabled.load(std::memory_order_relaxed); }
+
+        // Drops anything recorded before and starts recording. Returns
+        // false, and changes nothing, if something else is already tracing.
+        bool start();
+
+        // Stops recording and writes {"traceEvents": [...]}: complete ("X")
+        // events in microseconds since start().
+        void finish(DebugWriter& writer);
+
+        // name must be a literal; detail is copied.
+        void record(const char* name, const char* detail,
+            TraceClock::time_point start, TraceClock::time_point end);
+
+    private:
+        Tracer() {}
+        Tracer(const Tracer&);
+        Tracer& operator=(const Tracer&);
+
+        struct Event {
+            const char* name;
+            std::string detail;
+            unsigned int thread;
+            TraceClock::time_point start;
+            TraceClock::time_point end;
+        };
+
+        static std::atomic<bool> is_enabled;
+
+        std::mutex lock;
+        TraceClock::time_point origin;
+        std::vector<Event> events;
+};
+
+// Times its own lifetime as a span, while tracing.
+class TraceScope {
+    public:
+        explicit TraceScope(const char* name, const char* detail = nullptr) :
+            active(Tracer::enabled()), name(name), detail(detail) {
+            if (active) {
+                start = TraceClock::now();
+            }
+        }
+
+        ~TraceScope() {
+            if (active) {
+                Tracer::instance().record(name, detail, start, TraceClock::now());
+            }
+        }
+
+    private:
+        TraceScope(const TraceScope&);
+        TraceScope& operator=(const TraceScope&);
+
+        const bool active;
+        const char* const name;
+        const char* const detail;
+        TraceClock::time_point start;
+};
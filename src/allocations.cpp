@@ -0,0 +1,63 @@
+#include <cynophobia/allocations.hpp>
+
+#include <atomic>
+
+namespace {
+    // One slot per Target below LinkStage, then one for everything else.
+    const int OUTSIDE = LinkStage;
+    const int SLOTS = LinkStage + 1;
+
+    std::atomic<unsigned long long> allocation_counts[SLOTS];
+    std::atomic<unsigned long long> allocated_bytes[SLOTS];
+
+    thread_local int current_stage = OUTSIDE;
+
+    int slot_of(Target stage) {
+        return stage < LinkStage ? (int)stage : OUTSIDE;
+    }
+
+    AllocationCount count_of(int slot) {
+        return { allocation_counts[slot].load(std::memory_order_relaxed),
+            allocated_bytes[slot].load(std::memory_order_relaxed) };
+    }
+}
+
+// Set when the counting operator new is linked in (countingnew.cpp).
+extern bool allocation_counting_linked;
+bool allocation_counting_linked = false;
+
+bool counting_allocations() {
+    return allocation_counting_linked;
+}
+
+AllocationCount allocations_in(Target stage) {
+    return count_of(slot_of(stage));
+}
+
+AllocationCount total_allocations() {
+    AllocationCount total = { 0, 0 };
+    for (int slot = 0; slot < SLOTS; slot++) {
+        AllocationCount count = count_of(slot);
+        total.allocations += count.allocations;
+        total.bytes += count.bytes;
+    }
+    return total;
+}
+
+AllocationCount operator-(const AllocationCount& after, const AllocationCount& before) {
+    return { after.allocations - before.allocations, after.bytes - before.bytes };
+}
+
+AllocationStage::AllocationStage(Target stage) : previous(current_stage) {
+    current_stage = slot_of(stage);
+}
+
+AllocationStage::~AllocationStage() {
+    current_stage = previous;
+}
+
+void note_allocation(std::size_t size) {
+    int slot = current_stage;
+    allocation_counts[slot].fetch_add(1, std::memory_order_relaxed);
+    allocated_bytes[slot].fetch_add(size, std::memory_order_relaxed);
+}
@@ -0,0 +1,107 @@
+#include <cynophobia/arena.hpp>
+
+#include <cstring>
+
+namespace {
+    // Blocks double from the first size up to the largest, so that a small
+    // translation unit stays small and a large one takes few allocations.
+    const std::size_t FIRST_BLOCK_SIZE = 4096;
+    const std::size_t LARGEST_BLOCK_SIZE = 1 << 16;
+}
+
+Arena::Arena() :
+    first(nullptr), current(nullptr), position(nullptr), limit(nullptr), used(0), reserved(0) {}
+
+Arena::~Arena() {
+    Block* block = first;
+    while (block) {
+        Block* next = block->next;
+        ::operator delete(block);
+        block = next;
+    }
+}
+
+void Arena::enter(Block* block) {
+    current = block;
+    position = (char*)(block + 1);
+    limit = position + block->size;
+}
+
+void* Arena::allocate_slow(std::size_t size, std::size_t alignment) {
+    // After a reset, the blocks already held are used again in order.
+    while (current && current->next) {
+        enter(current->next);
+        void* allocated = bump(size, alignment);
+        if (allocated) {
+            return allocated;
+        }
+    }
+    std::size_t block_size = current == nullptr ? FIRST_BLOCK_SIZE
+        : current->size < LARGEST_BLOCK_SIZE ? current->size * 2 : LARGEST_BLOCK_SIZE;
+    if (block_size < size + alignment) {
+        block_size = size + alignment;
+    }
+    Block* block = (Block*)::operator new(sizeof(Block) + block_size);
+    block->next = nullptr;
+    block->size = block_size;
+    reserved += block_size;
+    if (current) {
+        current->next = block;
+    } else {
+        first = block;
+    }
+    enter(block);
+    return bump(size, alignment);
+}
+
+TextView Arena::copy(const char* text, std::size_t size) {
+    if (size == 0) {
+        return { "", 0 };
+    }
+    char* copied = (char*)allocate(size, 1);
+    std::memcpy(copied, text, size);
+    return { copied, size };
+}
+
+void Arena::reset() {
+    used = 0;
+    if (first) {
+        enter(first);
+    }
+}
+
+ArenaPool::ArenaPool(std::size_t capacity, std::size_t max_bytes) :
+    capacity(capacity), max_bytes(max_bytes) {}
+
+ArenaPool::~ArenaPool() {
+    for (Arena* arena : idle) {
+        delete arena;
+    }
+}
+
+std::shared_ptr<Arena> ArenaPool::acquire() {
+    Arena* arena = nullptr;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!idle.empty()) {
+            arena = idle.back();
+            idle.pop_back();
+        }
+    }
+    if (!arena) {
+        arena = new Arena();
+    }
+    return std::shared_ptr<Arena>(arena, [this](Arena* released) { recycle(released); });
+}
+
+void ArenaPool::recycle(Arena* arena) {
+    if (arena->bytes_reserved() <= max_bytes) {
+        arena->reset();
+        std::lock_guard<std::mutex> guard(lock);
+        if (idle.size() < capacity) {
+            idle.push_back(arena);
+            return;
+        }
+    }
+    delete arena;
+}
@@ -0,0 +1,469 @@
+#include <cynophobia/cache.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    const std::uint64_t PRIME_A = 0x9E3779B185EBCA87ULL;
+    const std::uint64_t PRIME_B = 0xC2B2AE3D27D4EB4FULL;
+
+    std::uint64_t rotate_left(std::uint64_t value, int bits) {
+        return (value << bits) | (value >> (64 - bits));
+    }
+
+    std::uint64_t finish(std::uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 33;
+        h *= 0xC4CEB9FE1A85EC53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    // Two independent 64-bit lanes over 8-byte words.
+    void hash_into(const char* data, std::size_t size, std::uint64_t& a, std::uint64_t& b) {
+        std::size_t i = 0;
+        for (; i + 8 <= size; i += 8) {
+            std::uint64_t word;
+            std::memcpy(&word, data + i, 8);
+            a = rotate_left(a ^ word, 31) * PRIME_A;
+            b = rotate_left(b ^ word, 27) * PRIME_B;
+        }
+        std::uint64_t tail = 0;
+        std::memcpy(&tail, data + i, size - i);
+        a = rotate_left(a ^ tail ^ size, 31) * PRIME_A;
+        b = rotate_left(b ^ tail ^ size, 27) * PRIME_B;
+    }
+}
+
+std::string CacheKey::hex() const {
+    char text[33];
+    snprintf(text, sizeof(text), "%016llx%016llx",
+        (unsigned long long)high, (unsigned long long)low);
+    return text;
+}
+
+CacheKey cache_key(const char* data, std::size_t size, const std::string& config) {
+    std::uint64_t a = PRIME_B;
+    std::uint64_t b = PRIME_A;
+    hash_into(config.data(), config.size(), a, b);
+    hash_into(data, size, a, b);
+    std::uint64_t high = finish(a ^ rotate_left(b, 17));
+    std::uint64_t low = finish(b ^ rotate_left(a, 41));
+    return { high, low };
+}
+
+std::string CacheStats::debug_string() const {
+    std::ostringstream oss;
+    oss << "{\"hits\": " << hits << ", \"misses\": " << misses
+        << ", \"stores\": " << stores << ", \"evictions\": " << evictions
+        << ", \"bytes\": " << bytes << "}";
+    return oss.str();
+}
+
+#ifndef _WIN32
+
+namespace {
+    bool make_directory(const std::string& path) {
+        return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+    }
+
+    bool read_whole(int fd, std::string& bytes) {
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            return false;
+        }
+        bytes.resize((std::size_t)info.st_size);
+        std::size_t done = 0;
+        while (done < bytes.size()) {
+            ssize_t count = pread(fd, &bytes[done], bytes.size() - done, (off_t)done);
+            if (count <= 0) {
+                return false;
+            }
+            done += (std::size_t)count;
+        }
+        return true;
+    }
+
+    bool write_whole(int fd, const std::string& bytes) {
+        std::size_t done = 0;
+        while (done < bytes.size()) {
+            ssize_t count = write(fd, bytes.data() + done, bytes.size() - done);
+            if (count <= 0) {
+                return false;
+            }
+            done += (std::size_t)count;
+        }
+        return true;
+    }
+
+    // What each line of the stats file holds: counts to add up. The line
+    // an eviction leaves has the exact size in bytes; later ones add to it.
+    std::string stats_record(const CacheStats& stats) {
+        char record[160];
+        int size = snprintf(record, sizeof(record),
+            "hits %llu misses %llu stores %llu evictions %llu bytes %llu\n",
+            (unsigned long long)stats.hits, (unsigned long long)stats.misses,
+            (unsigned long long)stats.stores, (unsigned long long)stats.evictions,
+            (unsigned long long)stats.bytes);
+        return std::string(record, (std::size_t)size);
+    }
+
+    // Adds up the stats file's lines; false if one is malformed.
+    bool sum_records(int fd, CacheStats& stats, std::size_t& records) {
+        stats = CacheStats {};
+        records = 0;
+        std::string text;
+        if (!read_whole(fd, text)) {
+            return false;
+        }
+        std::size_t start = 0;
+        std::size_t end;
+        while ((end = text.find('\n', start)) != std::string::npos) {
+            unsigned long long hits, misses, stores, evictions, bytes;
+            if (sscanf(text.c_str() + start,
+                "hits %llu misses %llu stores %llu evictions %llu bytes %llu",
+                &hits, &misses, &stores, &evictions, &bytes) != 5) {
+                return false;
+            }
+            stats.hits += hits;
+            stats.misses += misses;
+            stats.stores += stores;
+            stats.evictions += evictions;
+            stats.bytes += bytes;
+            records++;
+            start = end + 1;
+        }
+        return true;
+    }
+
+    // Appends under a shared lock, which only a rewrite of the file
+    // excludes. A rewrite replaces the file, so this appends to whichever
+    // one is in place once it holds the lock.
+    void append_record(const std::string& path, const std::string& record) {
+        for (int attempt = 0; attempt < 8; attempt++) {
+            int fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+            if (fd < 0) {
+                return;
+            }
+            struct stat opened;
+            struct stat current;
+            bool in_place = flock(fd, LOCK_SH) == 0 && fstat(fd, &opened) == 0
+                && stat(path.c_str(), &current) == 0
+                && opened.st_dev == current.st_dev && opened.st_ino == current.st_ino;
+            if (in_place && !write_whole(fd, record)) {
+                // The counters are advisory; the entries are what matter.
+            }
+            close(fd);
+            if (in_place) {
+                return;
+            }
+        }
+    }
+
+    // store() writes entries to objects/tmp.XXXXXX first; one this old was
+    // left by a process that died before renaming it into place.
+    const time_t STALE_TEMPORARY_SECONDS = 60 * 60;
+
+    void remove_stale_temporaries(const std::string& objects) {
+        DIR* top = opendir(objects.c_str());
+        if (!top) {
+            return;
+        }
+        time_t now = time(nullptr);
+        while (struct dirent* file = readdir(top)) {
+            if (std::strncmp(file->d_name, "tmp.", 4) != 0) {
+                continue;
+            }
+            std::string path = objects + "/" + file->d_name;
+            struct stat info;
+            if (stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode)
+                && now - info.st_mtime > STALE_TEMPORARY_SECONDS) {
+                unlink(path.c_str());
+            }
+        }
+        closedir(top);
+    }
+
+    // Lines appended to the stats file, past which a store folds it into
+    // one even when nothing needs evicting.
+    const std::size_t MAX_STATS_RECORDS = 1024;
+
+    struct Entry {
+        std::string path;
+        struct timespec modified;
+        std::uint64_t size;
+    };
+
+    bool older(const Entry& left, const Entry& right) {
+        return left.modified.tv_sec != right.modified.tv_sec
+            ? left.modified.tv_sec < right.modified.tv_sec
+            : left.modified.tv_nsec < right.modified.tv_nsec;
+    }
+}
+
+ResultCache::ResultCache(std::string cache_directory, std::uint64_t max_bytes) :
+    directory(std::move(cache_directory)), max_bytes(max_bytes), is_usable(false),
+    pending_hits(0), pending_misses(0), pending_stores(0), pending_bytes(0) {
+    is_usable = make_directory(directory) && make_directory(directory + "/objects");
+}
+
+ResultCache::~ResultCache() {
+    flush_stats();
+}
+
+std::string ResultCache::path_of(const CacheKey& key, const char* kind) const {
+    std::string hex = key.hex();
+    return directory + "/objects/" + hex.substr(0, 2) + "/" + hex + "." + kind;
+}
+
+bool ResultCache::load(const CacheKey& key, const char* kind, std::string& bytes) const {
+    if (!is_usable) {
+        return false;
+    }
+    std::string path = path_of(key, kind);
+    int fd = open(path.c_str(), O_RDONLY);
+    bool hit = fd >= 0 && read_whole(fd, bytes);
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (hit) {
+        // Most recently used now.
+        utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+        pending_hits++;
+    } else {
+        pending_misses++;
+    }
+    return hit;
+}
+
+bool ResultCache::store(const CacheKey& key, const char* kind, const std::string& bytes) const {
+    if (!is_usable || bytes.size() > max_bytes) {
+        return false;
+    }
+    std::string path = path_of(key, kind);
+    std::string temporary = directory + "/objects/tmp.XXXXXX";
+    int fd = mkstemp(&temporary[0]);
+    if (fd < 0) {
+        return false;
+    }
+    bool written = write_whole(fd, bytes);
+    written = close(fd) == 0 && written;
+    std::string subdirectory = path.substr(0, path.rfind('/'));
+    if (!written || !make_directory(subdirectory)) {
+        unlink(temporary.c_str());
+        return false;
+    }
+    // Another process that missed on the same key, or a store of the same
+    // result again, may have put it there already: count only the change.
+    struct stat replaced;
+    std::uint64_t replaced_size = lstat(path.c_str(), &replaced) == 0
+        ? (std::uint64_t)replaced.st_size : 0;
+    if (rename(temporary.c_str(), path.c_str()) != 0) {
+        unlink(temporary.c_str());
+        return false;
+    }
+    pending_stores++;
+    // Unsigned: a smaller replacement wraps, and still sums to the total.
+    pending_bytes += (std::uint64_t)bytes.size() - replaced_size;
+
+    CacheStats shared;
+    std::size_t records;
+    if (read_shared_stats(shared, records)) {
+        bool over_budget = shared.bytes + pending_bytes.load() > max_bytes;
+        if (over_budget || records > MAX_STATS_RECORDS) {
+            maintain(over_budget);
+        }
+    }
+    return true;
+}
+
+bool ResultCache::read_stats(CacheStats& stats) const {
+    stats = CacheStats {};
+    std::size_t records;
+    if (!is_usable || !read_shared_stats(stats, records)) {
+        return false;
+    }
+    stats.hits += pending_hits.load();
+    stats.misses += pending_misses.load();
+    stats.stores += pending_stores.load();
+    stats.bytes += pending_bytes.load();
+    return true;
+}
+
+void ResultCache::flush_stats() const {
+    CacheStats pending = take_pending();
+    if (is_usable && (pending.hits || pending.misses || pending.stores || pending.bytes)) {
+        append_record(directory + "/stats", stats_record(pending));
+    }
+}
+
+bool ResultCache::read_shared_stats(CacheStats& stats, std::size_t& records) const {
+    std::string path = directory + "/stats";
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        // Nothing has been counted yet.
+        stats = CacheStats {};
+        records = 0;
+        return errno == ENOENT;
+    }
+    bool ok = sum_records(fd, stats, records);
+    close(fd);
+    return ok;
+}
+
+CacheStats ResultCache::take_pending() const {
+    CacheStats pending = { pending_hits.exchange(0), pending_misses.exchange(0),
+        pending_stores.exchange(0), 0, pending_bytes.exchange(0) };
+    return pending;
+}
+
+void ResultCache::maintain(bool over_budget) const {
+    std::string lock_path = directory + "/lock";
+    int lock_fd = open(lock_path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (lock_fd < 0) {
+        return;
+    }
+    // Whoever holds it is doing this already.
+    if (flock(lock_fd, LOCK_EX | LOCK_NB) == 0) {
+        remove_stale_temporaries(directory + "/objects");
+        CacheStats evicted = {};
+        if (over_budget) {
+            evict(evicted);
+        }
+        rewrite_stats(over_budget ? &evicted : nullptr);
+    }
+    close(lock_fd);
+}
+
+// Folds the stats file and this instance's counts into one line, adding
+// what evicted says was removed and taking its size as exact.
+void ResultCache::rewrite_stats(const CacheStats* evicted) const {
+    std::string path = directory + "/stats";
+    int fd = open(path.c_str(), O_RDONLY | O_CREAT, 0644);
+    if (fd < 0) {
+        return;
+    }
+    // Waits only for appends already under way.
+    if (flock(fd, LOCK_EX) == 0) {
+        CacheStats stats;
+        std::size_t records;
+        if (!sum_records(fd, stats, records)) {
+            // Start the counters over rather than keep a broken file.
+            stats = CacheStats {};
+        }
+        CacheStats pending = take_pending();
+        stats.hits += pending.hits;
+        stats.misses += pending.misses;
+        stats.stores += pending.stores;
+        stats.bytes += pending.bytes;
+        if (evicted) {
+            stats.evictions += evicted->evictions;
+            stats.bytes = evicted->bytes;
+        }
+        std::string temporary = directory + "/objects/tmp.XXXXXX";
+        int temporary_fd = mkstemp(&temporary[0]);
+        if (temporary_fd >= 0) {
+            bool written = write_whole(temporary_fd, stats_record(stats));
+            written = close(temporary_fd) == 0 && written;
+            if (!written || rename(temporary.c_str(), path.c_str()) != 0) {
+                unlink(temporary.c_str());
+            }
+        }
+    }
+    close(fd);
+}
+
+void ResultCache::evict(CacheStats& stats) const {
+    std::vector<Entry> entries;
+    std::uint64_t total = 0;
+    std::string objects = directory + "/objects";
+    DIR* top = opendir(objects.c_str());
+    if (!top) {
+        return;
+    }
+    while (struct dirent* bucket = readdir(top)) {
+        if (bucket->d_name[0] == '.' || std::strlen(bucket->d_name) != 2) {
+            continue;
+        }
+        std::string bucket_path = objects + "/" + bucket->d_name;
+        DIR* inner = opendir(bucket_path.c_str());
+        if (!inner) {
+            continue;
+        }
+        while (struct dirent* file = readdir(inner)) {
+            if (file->d_name[0] == '.') {
+                continue;
+            }
+            Entry entry;
+            entry.path = bucket_path + "/" + file->d_name;
+            struct stat info;
+            if (stat(entry.path.c_str(), &info) != 0 || !S_ISREG(info.st_mode)) {
+                continue;
+            }
+            entry.modified = info.st_mtim;
+            entry.size = (std::uint64_t)info.st_size;
+            total += entry.size;
+            entries.push_back(entry);
+        }
+        closedir(inner);
+    }
+    closedir(top);
+
+    std::sort(entries.begin(), entries.end(), older);
+    std::uint64_t target = max_bytes / 10 * 9;
+    for (const Entry& entry : entries) {
+        if (total <= target) {
+            break;
+        }
+        if (unlink(entry.path.c_str()) == 0) {
+            total -= entry.size;
+            stats.evictions++;
+        }
+    }
+    stats.bytes = total;
+}
+
+#else
+
+ResultCache::ResultCache(std::string cache_directory, std::uint64_t max_bytes) :
+    directory(std::move(cache_directory)), max_bytes(max_bytes), is_usable(false),
+    pending_hits(0), pending_misses(0), pending_stores(0), pending_bytes(0) {}
+
+ResultCache::~ResultCache() {}
+
+std::string ResultCache::path_of(const CacheKey& key, const char* kind) const {
+    return directory + "/" + key.hex() + "." + kind;
+}
+
+bool ResultCache::load(const CacheKey&, const char*, std::string&) const {
+    return false;
+}
+
+bool ResultCache::store(const CacheKey&, const char*, const std::string&) const {
+    return false;
+}
+
+bool ResultCache::read_stats(CacheStats& stats) const {
+    stats = CacheStats {};
+    return false;
+}
+
+void ResultCache::flush_stats() const {}
+
+#endif
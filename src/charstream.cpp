@@ -0,0 +1,150 @@
+#include <cynophobia/charstream.hpp>
+
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    // One read(2), retried if interrupted: the count read, 0 at the end,
+    // negative on an error.
+    long read_some(int fd, char* into, std::size_t size) {
+#ifdef _WIN32
+        return _read(fd, into, (unsigned int)size);
+#else
+        while (true) {
+            ssize_t count = read(fd, into, size);
+            if (count >= 0 || errno != EINTR) {
+                return (long)count;
+            }
+        }
+#endif
+    }
+
+    int open_for_reading(const std::string& filename) {
+#ifdef _WIN32
+        return _open(filename.c_str(), _O_RDONLY | _O_BINARY);
+#else
+        return open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+#endif
+    }
+}
+
+MappedFile::MappedFile(const std::string& filename) :
+    begin(""), length(0), opened(false), mapped(false) {
+#ifndef _WIN32
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode)) {
+        if ((unsigned long long)file_stat.st_size > MAX_SOURCE_SIZE) {
+            close(fd);
+            return;
+        }
+        opened = true;
+        length = (std::size_t)file_stat.st_size;
+        // mmap rejects empty mappings; an empty file is just "".
+        if (length > 0) {
+            void* region = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (region != MAP_FAILED) {
+                madvise(region, length, MADV_SEQUENTIAL);
+                begin = static_cast<const char*>(region);
+                mapped = true;
+            } else {
+                opened = false;
+                length = 0;
+            }
+        }
+        close(fd);
+        return;
+    }
+    close(fd);
+#endif
+    // Not mappable (no mmap, or a pipe/device): read it into memory instead.
+    std::ifstream istream(filename, std::ios::binary);
+    if (!istream.is_open()) {
+        return;
+    }
+    fallback.assign(std::istreambuf_iterator<char>(istream),
+        std::istreambuf_iterator<char>());
+    opened = !istream.bad() && fallback.size() <= MAX_SOURCE_SIZE;
+    if (!opened) {
+        std::vector<char>().swap(fallback);
+    }
+    length = opened ? fallback.size() : 0;
+    begin = length > 0 ? fallback.data() : "";
+}
+
+MappedFile::~MappedFile() {
+#ifndef _WIN32
+    if (mapped) {
+        munmap(const_cast<char*>(begin), length);
+    }
+#endif
+}
+
+FdCharStream::FdCharStream(int fd, bool owned) :
+    fd(fd), owns_fd(owned), buffer(fd >= 0 ? BLOCK_SIZE : 0),
+    index(0), filled(0), finished(false), end_status(FallibleCharStream::STREAM_END) {}
+
+FdCharStream::~FdCharStream() {
+    if (owns_fd && fd >= 0) {
+#ifdef _WIN32
+        _close(fd);
+#else
+        close(fd);
+#endif
+    }
+}
+
+bool FdCharStream::refill() {
+    if (fd < 0 || finished) {
+        return false;
+    }
+    long count = read_some(fd, buffer.data(), buffer.size());
+    if (count <= 0) {
+        // Sticky, so that a terminal is not asked for a second end.
+        finished = true;
+        end_status = count == 0 ? FallibleCharStream::STREAM_END
+            : FallibleCharStream::STREAM_ERROR;
+        return false;
+    }
+    index = 0;
+    filled = (std::size_t)count;
+    return true;
+}
+
+FileCharStream::FileCharStream(std::string filename) :
+    FdCharStream(open_for_reading(filename), true) {}
+
+bool read_whole_fd(int fd, std::string& text) {
+    std::size_t size = text.size();
+    while (true) {
+        // Grow geometrically, reading straight into the string.
+        if (text.size() - size < FdCharStream::BLOCK_SIZE) {
+            text.resize(size + (size < FdCharStream::BLOCK_SIZE ? FdCharStream::BLOCK_SIZE : size));
+        }
+        long count = read_some(fd, &text[size], text.size() - size);
+        if (count <= 0) {
+            text.resize(size);
+            return count == 0;
+        }
+        size += (std::size_t)count;
+        if (size > MAX_SOURCE_SIZE) {
+            text.resize(MAX_SOURCE_SIZE);
+            return false;
+        }
+    }
+}
@@ -0,0 +1,687 @@
+#include <cynophobia/allocations.hpp>
+#include <cynophobia/codegen.hpp>
+#include <cynophobia/debugwriter.hpp>
+#include <cynophobia/object.hpp>
+#include <cynophobia/shared.hpp>
+#include <cynophobia/tacky.hpp>
+#include <cynophobia/trace.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace {
+    const std::uint32_t NO_SLOT = 0xFFFFFFFFu;
+
+    assembly::Operand immediate(std::int64_t value) {
+        return { assembly::Operand::Immediate, value };
+    }
+
+    assembly::Operand register_operand(assembly::Register reg) {
+        return { assembly::Operand::Register, reg };
+    }
+
+    assembly::Operand stack_operand(std::int64_t offset) {
+        return { assembly::Operand::Stack, offset };
+    }
+
+    bool is_memory(const assembly::Operand& operand) {
+        return operand.type == assembly::Operand::Stack;
+    }
+
+    bool same_operand(const assembly::Operand& a, const assembly::Operand& b) {
+        return a.type == b.type && a.value == b.value;
+    }
+
+    bool fits_in_byte(std::int64_t value) {
+        return value >= -128 && value <= 127;
+    }
+
+    // Lowers one TACKY function, giving each temporary a stack slot the
+    // first time it appears and rewriting operand combinations x86 has no
+    // encoding for through %r10d and %r11d.
+    class FunctionGenerator {
+        public:
+            FunctionGenerator(const tacky::Function& function, assembly::Function& out,
+              std::vector<std::uint32_t>& slots, std::uint32_t label_base)
+              : function(function), out(out), slots(slots), slot_count(0),
+                label_base(label_base) {
+                slots.assign(function.temporaries, NO_SLOT);
+            }
+
+            void generate() {
+                typedef assembly::Instruction Asm;
+                out.instructions.reserve(function.instructions.size() * 2);
+                for (const tacky::Instruction& instruction : function.instructions) {
+                    switch (instruction.opcode) {
+                        case tacky::Return:
+                            emit(Asm::Mov, operand(instruction.a), register_operand(assembly::AX));
+                            emit(Asm::Ret, immediate(0), immediate(0));
+                            break;
+                        case tacky::Copy:
+                            emit(Asm::Mov, operand(instruction.a), operand(instruction.dst));
+                            break;
+                        case tacky::Complement:
+                        case tacky::Negate: {
+                            assembly::Operand dst = operand(instruction.dst);
+                            emit(Asm::Mov, operand(instruction.a), dst);
+                            emit(instruction.opcode == tacky::Negate ? Asm::Neg : Asm::Not,
+                                immediate(0), dst);
+                            break;
+                        }
+                        case tacky::Not:
+                            set_condition(assembly::E, immediate(0), operand(instruction.a),
+                                operand(instruction.dst));
+                            break;
+                        case tacky::Add:
+                        case tacky::Subtract:
+                        case tacky::Multiply:
+                            arithmetic(instruction.opcode == tacky::Add ? Asm::Add
+                                : instruction.opcode == tacky::Subtract ? Asm::Sub : Asm::Imul,
+                                instruction);
+                            break;
+                        case tacky::Divide:
+                        case tacky::Remainder:
+                            emit(Asm::Mov, operand(instruction.a), register_operand(assembly::AX));
+                            emit(Asm::Cdq, immediate(0), immediate(0));
+                            emit(Asm::Idiv, operand(instruction.b), immediate(0));
+                            emit(Asm::Mov, register_operand(instruction.opcode == tacky::Divide
+                                ? assembly::AX : assembly::DX), operand(instruction.dst));
+                            break;
+                        case tacky::Equal:
+                        case tacky::NotEqual:
+                        case tacky::Less:
+                        case tacky::LessOrEqual:
+                        case tacky::Greater:
+                        case tacky::GreaterOrEqual: {
+                            static const assembly::Condition CONDITIONS[] = {
+                                assembly::E, assembly::NE, assembly::L, assembly::LE,
+                                assembly::G, assembly::GE
+                            };
+                            set_condition(CONDITIONS[instruction.opcode - tacky::Equal],
+                                operand(instruction.b), operand(instruction.a),
+                                operand(instruction.dst));
+                            break;
+                        }
+                        case tacky::Jump:
+                            label_instruction(Asm::Jmp, instruction.dst, assembly::E);
+                            break;
+                        case tacky::JumpIfZero:
+                        case tacky::JumpIfNotZero:
+                            emit(Asm::Cmp, immediate(0), operand(instruction.a));
+                            label_instruction(Asm::JmpCC, instruction.dst,
+                                instruction.opcode == tacky::JumpIfZero ? assembly::E : assembly::NE);
+                            break;
+                        case tacky::Label:
+                            label_instruction(Asm::Label, instruction.dst, assembly::E);
+                            break;
+                    }
+                }
+                out.stack_size = (slot_count * 4 + 15) / 16 * 16;
+            }
+
+        private:
+            assembly::Operand operand(tacky::Value value) {
+                if (tacky::is_constant(value)) {
+                    return immediate(function.constant_value(value));
+                }
+                if (slots[value] == NO_SLOT) {
+                    slots[value] = slot_count++;
+                }
+                return stack_operand(-4 * ((std::int64_t)slots[value] + 1));
+            }
+
+            void push(assembly::Instruction::Type type, assembly::Operand source,
+              assembly::Operand destination, assembly::Condition condition = assembly::E) {
+                out.instructions.push_back(assembly::Instruction { type, condition, source,
+                    destination });
+            }
+
+            void label_instruction(assembly::Instruction::Type type, tacky::Value label,
+              assembly::Condition condition) {
+                push(type, immediate(label_base + label), immediate(0), condition);
+            }
+
+            void emit(assembly::Instruction::Type type, assembly::Operand source,
+              assembly::Operand destination) {
+                typedef assembly::Instruction Asm;
+                assembly::Operand r10 = register_operand(assembly::R10);
+                assembly::Operand r11 = register_operand(assembly::R11);
+                switch (type) {
+                    case Asm::Mov:
+                    case Asm::Add:
+                    case Asm::Sub:
+                    case Asm::Cmp:
+                        if (is_memory(source) && is_memory(destination)) {
+                            push(Asm::Mov, source, r10);
+                            source = r10;
+                        }
+                        if (type == Asm::Cmp && destination.type == assembly::Operand::Immediate) {
+                            push(Asm::Mov, destination, r11);
+                            destination = r11;
+                        }
+                        break;
+                    case Asm::Imul:
+                        if (is_memory(destination)) {
+                            push(Asm::Mov, destination, r11);
+                            push(Asm::Imul, source, r11);
+                            push(Asm::Mov, r11, destination);
+                            return;
+                        }
+                        break;
+                    case Asm::Idiv:
+                        if (source.type == assembly::Operand::Immediate) {
+                            push(Asm::Mov, source, r10);
+                            source = r10;
+                        }
+                        break;
+                    default:
+                        break;
+                }
+                push(type, source, destination);
+            }
+
+            // dst = a op b, as mov a, dst; op b, dst, unless dst is b.
+            void arithmetic(assembly::Instruction::Type type, const tacky::Instruction& instruction) {
+                assembly::Operand a = operand(instruction.a);
+                assembly::Operand b = operand(instruction.b);
+                assembly::Operand dst = operand(instruction.dst);
+                if (same_operand(b, dst) && !same_operand(a, dst)) {
+                    assembly::Operand r11 = register_operand(assembly::R11);
+                    emit(assembly::Instruction::Mov, a, r11);
+                    emit(type, b, r11);
+                    emit(assembly::Instruction::Mov, r11, dst);
+                    return;
+                }
+                emit(assembly::Instruction::Mov, a, dst);
+                emit(type, b, dst);
+            }
+
+            // dst = left condition right, through cmp and setcc.
+            void set_condition(assembly::Condition condition, assembly::Operand right,
+              assembly::Operand left, assembly::Operand dst) {
+                emit(assembly::Instruction::Cmp, right, left);
+                emit(assembly::Instruction::Mov, immediate(0), dst);
+                push(assembly::Instruction::SetCC, immediate(0), dst, condition);
+            }
+
+            const tacky::Function& function;
+            assembly::Function& out;
+            std::vector<std::uint32_t>& slots;
+            std::uint32_t slot_count;
+            std::uint32_t label_base;
+    };
+
+    const char* const REGISTER_NAMES[] = {
+        "%eax", "%ecx", "%edx", "%ebx", "%esp", "%ebp", "%esi", "%edi",
+        "%r8d", "%r9d", "%r10d", "%r11d", "%r12d", "%r13d", "%r14d", "%r15d"
+    };
+
+    const char* const BYTE_REGISTER_NAMES[] = {
+        "%al", "%cl", "%dl", "%bl", "%spl", "%bpl", "%sil", "%dil",
+        "%r8b", "%r9b", "%r10b", "%r11b", "%r12b", "%r13b", "%r14b", "%r15b"
+    };
+
+    const char* condition_suffix(assembly::Condition condition) {
+        switch (condition) {
+            case assembly::E: return "e";
+            case assembly::NE: return "ne";
+            case assembly::L: return "l";
+            case assembly::GE: return "ge";
+            case assembly::LE: return "le";
+            case assembly::G: return "g";
+        }
+        return "";
+    }
+
+    void write_signed(DebugWriter& out, std::int64_t value) {
+        if (value < 0) {
+            out.write_char('-');
+            out.write_unsigned(0 - (unsigned long long)value);
+        } else {
+            out.write_unsigned((unsigned long long)value);
+        }
+    }
+
+    void write_operand(DebugWriter& out, const assembly::Operand& operand, bool byte = false) {
+        switch (operand.type) {
+            case assembly::Operand::Immediate:
+                out.write_char('$');
+                write_signed(out, operand.value);
+                break;
+            case assembly::Operand::Register:
+                out.write(byte ? BYTE_REGISTER_NAMES[operand.value] : REGISTER_NAMES[operand.value]);
+                break;
+            case assembly::Operand::Stack:
+                write_signed(out, operand.value);
+                out.write("(%rbp)");
+                break;
+        }
+    }
+
+    void write_label(DebugWriter& out, std::int64_t label) {
+        out.write(".L");
+        out.write_unsigned((unsigned long long)label);
+    }
+
+    // Inside the quotes of a directive.
+    void write_quoted(DebugWriter& out, const std::string& text) {
+        out.write_char('"');
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                out.write_char('\\');
+            }
+            out.write_char(c);
+        }
+        out.write_char('"');
+    }
+
+    void append_u32(std::string& code, std::uint32_t value) {
+        for (int shift = 0; shift < 32; shift += 8) {
+            code += (char)((value >> shift) & 0xFF);
+        }
+    }
+
+    // Opcodes of add, sub and cmp: the /digit of the immediate forms, then
+    // r/m <- reg, reg <- r/m and %eax <- imm32.
+    struct AluOpcodes {
+        std::uint8_t extension;
+        std::uint8_t to_rm;
+        std::uint8_t to_register;
+        std::uint8_t to_eax;
+    };
+
+    const AluOpcodes ADD_OPCODES = { 0, 0x01, 0x03, 0x05 };
+    const AluOpcodes SUB_OPCODES = { 5, 0x29, 0x2B, 0x2D };
+    const AluOpcodes CMP_OPCODES = { 7, 0x39, 0x3B, 0x3D };
+
+    // A jump whose size is not settled until every label's place is.
+    struct PendingJump {
+        // Where the jump goes in the function's code without jumps.
+        std::uint32_t offset;
+        std::uint32_t label;
+        bool conditional;
+        assembly::Condition condition;
+        bool near;
+    };
+
+    struct LabelPlace {
+        std::uint32_t offset;
+        // Jumps that come before the label.
+        std::uint32_t jumps;
+    };
+
+    // Encodes one function at a time. Everything but jumps is encoded
+    // into code as it comes; jumps start short and become near jumps
+    // until every one reaches its label, as the assembler relaxes them.
+    class FunctionEncoder {
+        public:
+            void encode(const assembly::Function& function, std::string& text) {
+                code.clear();
+                jumps.clear();
+                frame = function.stack_size > 0;
+                if (frame) {
+                    // push %rbp; mov %rsp, %rbp; sub $n, %rsp
+                    code += "\x55\x48\x89\xE5";
+                    if (fits_in_byte(function.stack_size)) {
+                        code += "\x48\x83\xEC";
+                        code += (char)function.stack_size;
+                    } else {
+                        code += "\x48\x81\xEC";
+                        append_u32(code, function.stack_size);
+                    }
+                }
+                for (const assembly::Instruction& instruction : function.instructions) {
+                    encode_instruction(instruction);
+                }
+                relax();
+                std::uint32_t copied = 0;
+                for (std::size_t j = 0; j < jumps.size(); j++) {
+                    const PendingJump& jump = jumps[j];
+                    text.append(code, copied, jump.offset - copied);
+                    copied = jump.offset;
+                    std::int64_t displacement = (std::int64_t)label_position(jump.label)
+                        - (jump_position(j) + jump_size(jump));
+                    if (!jump.near) {
+                        text += (char)(jump.conditional ? 0x70 + jump.condition : 0xEB);
+                        text += (char)displacement;
+                    } else {
+                        if (jump.conditional) {
+                            text += (char)0x0F;
+                            text += (char)(0x80 + jump.condition);
+                        } else {
+                            text += (char)0xE9;
+                        }
+                        append_u32(text, (std::uint32_t)displacement);
+                    }
+                }
+                text.append(code, copied, std::string::npos);
+            }
+
+        private:
+            static std::uint32_t jump_size(const PendingJump& jump) {
+                if (!jump.near) {
+                    return 2;
+                }
+                return jump.conditional ? 6 : 5;
+            }
+
+            std::uint32_t jump_position(std::size_t j) const {
+                return jumps[j].offset + jump_bytes_before[j];
+            }
+
+            std::uint32_t label_position(std::uint32_t label) const {
+                const LabelPlace& place = labels[label];
+                return place.offset + jump_bytes_before[place.jumps];
+            }
+
+            void relax() {
+                jump_bytes_before.resize(jumps.size() + 1);
+                bool changed = true;
+                while (changed) {
+                    changed = false;
+                    jump_bytes_before[0] = 0;
+                    for (std::size_t j = 0; j < jumps.size(); j++) {
+                        jump_bytes_before[j + 1] = jump_bytes_before[j] + jump_size(jumps[j]);
+                    }
+                    for (std::size_t j = 0; j < jumps.size(); j++) {
+                        if (jumps[j].near) {
+                            continue;
+                        }
+                        std::int64_t displacement = (std::int64_t)label_position(jumps[j].label)
+                            - (jump_position(j) + 2);
+                        if (!fits_in_byte(displacement)) {
+                            jumps[j].near = true;
+                            changed = true;
+                        }
+                    }
+                }
+                jump_bytes_before[0] = 0;
+                for (std::size_t j = 0; j < jumps.size(); j++) {
+                    jump_bytes_before[j + 1] = jump_bytes_before[j] + jump_size(jumps[j]);
+                }
+            }
+
+            // REX, when reg or a register r/m is r8-r15, or wide is set.
+            void prefix(int reg, const assembly::Operand& rm, bool wide = false) {
+                int rex = 0x40 | (wide ? 8 : 0) | ((reg >> 3) & 1) << 2;
+                if (rm.type == assembly::Operand::Register) {
+                    rex |= (rm.value >> 3) & 1;
+                }
+                if (rex != 0x40) {
+                    code += (char)rex;
+                }
+            }
+
+            // Stack slots are disp8 or disp32 off %rbp.
+            void modrm(int reg, const assembly::Operand& rm) {
+                int field = (reg & 7) << 3;
+                if (rm.type == assembly::Operand::Register) {
+                    code += (char)(0xC0 | field | (rm.value & 7));
+                } else if (fits_in_byte(rm.value)) {
+                    code += (char)(0x45 | field);
+                    code += (char)rm.value;
+                } else {
+                    code += (char)(0x85 | field);
+                    append_u32(code, (std::uint32_t)rm.value);
+                }
+            }
+
+            void encode_rm(std::uint8_t opcode, int reg, const assembly::Operand& rm) {
+                prefix(reg, rm);
+                code += (char)opcode;
+                modrm(reg, rm);
+            }
+
+            void encode_rm_0f(std::uint8_t opcode, int reg, const assembly::Operand& rm) {
+                prefix(reg, rm);
+                code += (char)0x0F;
+                code += (char)opcode;
+                modrm(reg, rm);
+            }
+
+            void encode_alu(const AluOpcodes& opcodes, const assembly::Operand& source,
+              const assembly::Operand& destination) {
+                switch (source.type) {
+                    case assembly::Operand::Immediate:
+                        if (fits_in_byte(source.value)) {
+                            encode_rm(0x83, opcodes.extension, destination);
+                            code += (char)source.value;
+                        } else {
+                            if (destination.type == assembly::Operand::Register
+                                && destination.value == assembly::AX) {
+                                code += (char)opcodes.to_eax;
+                            } else {
+                                encode_rm(0x81, opcodes.extension, destination);
+                            }
+                            append_u32(code, (std::uint32_t)source.value);
+                        }
+                        break;
+                    case assembly::Operand::Register:
+                        encode_rm(opcodes.to_rm, (int)source.value, destination);
+                        break;
+                    case assembly::Operand::Stack:
+                        encode_rm(opcodes.to_register, (int)destination.value, source);
+                        break;
+                }
+            }
+
+            void encode_instruction(const assembly::Instruction& instruction) {
+                const assembly::Operand& source = instruction.source;
+                const assembly::Operand& destination = instruction.destination;
+                switch (instruction.type) {
+                    case assembly::Instruction::Mov:
+                        if (source.type == assembly::Operand::Immediate) {
+                            if (destination.type == assembly::Operand::Register) {
+                                // mov imm32, r32: B8+rd id
+                                prefix(0, destination);
+                                code += (char)(0xB8 + (destination.value & 7));
+                            } else {
+                                encode_rm(0xC7, 0, destination);
+                            }
+                            append_u32(code, (std::uint32_t)source.value);
+                        } else if (source.type == assembly::Operand::Register) {
+                            encode_rm(0x89, (int)source.value, destination);
+                        } else {
+                            encode_rm(0x8B, (int)destination.value, source);
+                        }
+                        break;
+                    case assembly::Instruction::Neg:
+                        encode_rm(0xF7, 3, destination);
+                        break;
+                    case assembly::Instruction::Not:
+                        encode_rm(0xF7, 2, destination);
+                        break;
+                    case assembly::Instruction::Add:
+                        encode_alu(ADD_OPCODES, source, destination);
+                        break;
+                    case assembly::Instruction::Sub:
+                        encode_alu(SUB_OPCODES, source, destination);
+                        break;
+                    case assembly::Instruction::Cmp:
+                        encode_alu(CMP_OPCODES, source, destination);
+                        break;
+                    case assembly::Instruction::Imul:
+                        // The destination is always a register.
+                        if (source.type == assembly::Operand::Immediate) {
+                            bool byte = fits_in_byte(source.value);
+                            encode_rm(byte ? 0x6B : 0x69, (int)destination.value, destination);
+                            if (byte) {
+                                code += (char)source.value;
+                            } else {
+                                append_u32(code, (std::uint32_t)source.value);
+                            }
+                        } else {
+                            encode_rm_0f(0xAF, (int)destination.value, source);
+                        }
+                        break;
+                    case assembly::Instruction::Idiv:
+                        encode_rm(0xF7, 7, source);
+                        break;
+                    case assembly::Instruction::Cdq:
+                        code += (char)0x99;
+                        break;
+                    case assembly::Instruction::Jmp:
+                    case assembly::Instruction::JmpCC:
+                        jumps.push_back(PendingJump { (std::uint32_t)code.size(),
+                            (std::uint32_t)source.value,
+                            instruction.type == assembly::Instruction::JmpCC,
+                            instruction.condition, false });
+                        break;
+                    case assembly::Instruction::SetCC:
+                        encode_rm_0f((std::uint8_t)(0x90 + instruction.condition), 0, destination);
+                        break;
+                    case assembly::Instruction::Label:
+                        if (source.value >= (std::int64_t)labels.size()) {
+                            labels.resize(source.value + 1);
+                        }
+                        labels[source.value] = LabelPlace { (std::uint32_t)code.size(),
+                            (std::uint32_t)jumps.size() };
+                        break;
+                    case assembly::Instruction::Ret:
+                        if (frame) {
+                            // mov %rbp, %rsp; pop %rbp
+                            code += "\x48\x89\xEC\x5D";
+                        }
+                        code += (char)0xC3;
+                        break;
+                }
+            }
+
+            std::string code;
+            bool frame;
+            std::vector<PendingJump> jumps;
+            std::vector<std::uint32_t> jump_bytes_before;
+            // Indexed by label; labels are numbered across the program.
+            std::vector<LabelPlace> labels;
+    };
+}
+
+assembly::Program generate_assembly(const tacky::Program& program) {
+    TraceScope trace("codegen");
+    AllocationStage stage(CodegenStage);
+    assembly::Program generated;
+    generated.functions.reserve(program.functions.size());
+    std::vector<std::uint32_t> slots;
+    std::uint32_t label_base = 0;
+    for (const tacky::Function& function : program.functions) {
+        assembly::Function& out = *generated.functions.insert(generated.functions.end(),
+            assembly::Function { function.name.str(), {}, 0 });
+        FunctionGenerator(function, out, slots, label_base).generate();
+        label_base += function.labels;
+    }
+    return generated;
+}
+
+void write_assembly(DebugWriter& out, const assembly::Program& program,
+  const std::string& source_name) {
+    TraceScope trace("emit assembly");
+    AllocationStage stage(CodegenStage);
+    static const char* const MNEMONICS[] = {
+        "movl", "negl", "notl", "addl", "subl", "imull", "cmpl", "idivl", "cdq", "jmp", "j",
+        "set", "", "ret"
+    };
+    if (!source_name.empty()) {
+        out.write("\t.file\t");
+        write_quoted(out, source_name);
+        out.write_char('\n');
+    }
+    out.write("\t.text\n");
+    for (const assembly::Function& function : program.functions) {
+        bool frame = function.stack_size > 0;
+        out.write("\t.globl\t");
+        out.write(function.name);
+        out.write("\n\t.type\t");
+        out.write(function.name);
+        out.write(", @function\n");
+        out.write(function.name);
+        out.write(":\n");
+        if (frame) {
+            out.write("\tpushq\t%rbp\n\tmovq\t%rsp, %rbp\n\tsubq\t$");
+            out.write_unsigned(function.stack_size);
+            out.write(", %rsp\n");
+        }
+        for (const assembly::Instruction& instruction : function.instructions) {
+            if (instruction.type == assembly::Instruction::Label) {
+                write_label(out, instruction.source.value);
+                out.write(":\n");
+                continue;
+            }
+            if (instruction.type == assembly::Instruction::Ret && frame) {
+                out.write("\tmovq\t%rbp, %rsp\n\tpopq\t%rbp\n");
+            }
+            out.write_char('\t');
+            out.write(MNEMONICS[instruction.type]);
+            switch (instruction.type) {
+                case assembly::Instruction::Mov:
+                case assembly::Instruction::Add:
+                case assembly::Instruction::Sub:
+                case assembly::Instruction::Imul:
+                case assembly::Instruction::Cmp:
+                    out.write_char('\t');
+                    write_operand(out, instruction.source);
+                    out.write(", ");
+                    write_operand(out, instruction.destination);
+                    break;
+                case assembly::Instruction::Neg:
+                case assembly::Instruction::Not:
+                    out.write_char('\t');
+                    write_operand(out, instruction.destination);
+                    break;
+                case assembly::Instruction::Idiv:
+                    out.write_char('\t');
+                    write_operand(out, instruction.source);
+                    break;
+                case assembly::Instruction::Jmp:
+                    out.write_char('\t');
+                    write_label(out, instruction.source.value);
+                    break;
+                case assembly::Instruction::JmpCC:
+                    out.write(condition_suffix(instruction.condition));
+                    out.write_char('\t');
+                    write_label(out, instruction.source.value);
+                    break;
+                case assembly::Instruction::SetCC:
+                    out.write(condition_suffix(instruction.condition));
+                    out.write_char('\t');
+                    write_operand(out, instruction.destination, true);
+                    break;
+                default:
+                    break;
+            }
+            out.write_char('\n');
+        }
+        out.write("\t.size\t");
+        out.write(function.name);
+        out.write(", .-");
+        out.write(function.name);
+        out.write_char('\n');
+    }
+    out.write("\t.section\t.note.GNU-stack,\"\",@progbits\n");
+}
+
+// Functions are laid out back to back, unaligned, as the assembler lays
+// out the text write_assembly prints.
+ObjectFile encode_object(const assembly::Program& program, const std::string& source_name) {
+    TraceScope trace("encode");
+    AllocationStage stage(CodegenStage);
+    ObjectFile object;
+    object.source_name = source_name;
+    object.symbols.reserve(program.functions.size());
+    FunctionEncoder encoder;
+    for (const assembly::Function& function : program.functions) {
+        std::uint64_t start = object.text.size();
+        encoder.encode(function, object.text);
+        object.symbols.push_back(ObjectSymbol { function.name, true, true, true, start,
+            object.text.size() - start });
+    }
+    return object;
+}
+
+std::size_t instruction_count(const assembly::Program& program) {
+    std::size_t count = 0;
+    for (const assembly::Function& function : program.functions) {
+        count += function.instructions.size();
+    }
+    return count;
+}
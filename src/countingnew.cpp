@@ -0,0 +1,63 @@
+#include <cynophobia/allocations.hpp>
+
+#include <cstdlib>
+#include <new>
+
+// Replaces the global allocation functions for the whole program, so this
+// file is built as an object library (cynoallocations) and linked only
+// into programs that want allocation counts; see allocations.hpp.
+
+extern bool allocation_counting_linked;
+
+namespace {
+    const bool linked = (allocation_counting_linked = true);
+
+    void* counted_allocation(std::size_t size) {
+        note_allocation(size);
+        void* allocation = std::malloc(size == 0 ? 1 : size);
+        if (allocation == nullptr) {
+            throw std::bad_alloc();
+        }
+        return allocation;
+    }
+}
+
+void* operator new(std::size_t size) {
+    return counted_allocation(size);
+}
+
+void* operator new[](std::size_t size) {
+    return counted_allocation(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return counted_allocation(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return counted_allocation(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void operator delete(void* allocation) noexcept {
+    std::free(allocation);
+}
+
+void operator delete[](void* allocation) noexcept {
+    std::free(allocation);
+}
+
+void operator delete(void* allocation, std::size_t) noexcept {
+    std::free(allocation);
+}
+
+void operator delete[](void* allocation, std::size_t) noexcept {
+    std::free(allocation);
+}
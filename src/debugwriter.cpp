@@ -0,0 +1,285 @@
+#include <cynophobia/debugwriter.hpp>
+#include <cynophobia/shared.hpp>
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+    const std::size_t FD_BUFFER_SIZE = 1 << 16;
+    // The least spare room a string is given at a time.
+    const std::size_t SMALLEST_STRING_ROOM = 256;
+}
+
+DebugWriter::DebugWriter(int fd) :
+    fd(fd), out(nullptr), write_failed(false), out_size(0),
+    fd_buffer(new char[FD_BUFFER_SIZE]), buffer(fd_buffer.get()), capacity(FD_BUFFER_SIZE),
+    used(0) {}
+
+DebugWriter::DebugWriter(std::string& out) :
+    fd(-1), out(&out), write_failed(false), out_size(out.size()),
+    buffer(nullptr), capacity(0), used(0) {}
+
+DebugWriter::~DebugWriter() {
+    flush();
+}
+
+void DebugWriter::write(const char* text) {
+    write(text, std::strlen(text));
+}
+
+void DebugWriter::write_unsigned(unsigned long long value) {
+    char digits[20];
+    std::size_t count = 0;
+    do {
+        digits[sizeof(digits) - ++count] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    write(digits + sizeof(digits) - count, count);
+}
+
+void DebugWriter::write_u16(std::uint16_t value) {
+    char bytes[2] = { (char)(value & 0xFF), (char)((value >> 8) & 0xFF) };
+    write(bytes, 2);
+}
+
+void DebugWriter::write_u32(std::uint32_t value) {
+    char bytes[4] = { (char)(value & 0xFF), (char)((value >> 8) & 0xFF),
+        (char)((value >> 16) & 0xFF), (char)((value >> 24) & 0xFF) };
+    write(bytes, 4);
+}
+
+void DebugWriter::write_u64(std::uint64_t value) {
+    write_u32((std::uint32_t)value);
+    write_u32((std::uint32_t)(value >> 32));
+}
+
+bool DebugWriter::flush() {
+    if (out) {
+        out_size += used;
+        out->resize(out_size);
+        buffer = nullptr;
+        capacity = 0;
+    } else {
+        emit(buffer, used);
+    }
+    used = 0;
+    return !write_failed;
+}
+
+// Too big for what is left of the buffer. A string grows its spare room,
+// at least doubling it. Otherwise flush, then buffer it or, if it would
+// not fit at all, skip the copy.
+void DebugWriter::write_through(const char* text, std::size_t size) {
+    if (out) {
+        std::size_t room = capacity * 2 > used + size ? capacity * 2 : used + size;
+        if (room < SMALLEST_STRING_ROOM) {
+            room = SMALLEST_STRING_ROOM;
+        }
+        out->resize(out_size + room);
+        buffer = &(*out)[out_size];
+        capacity = room;
+        std::memcpy(buffer + used, text, size);
+        used += size;
+        return;
+    }
+    flush();
+    if (size >= capacity) {
+        emit(text, size);
+    } else {
+        write(text, size);
+    }
+}
+
+void DebugWriter::emit(const char* text, std::size_t size) {
+    while (size > 0 && !write_failed) {
+#ifdef _WIN32
+        int written = _write(fd, text, (unsigned int)size);
+#else
+        ssize_t written = ::write(fd, text, size);
+#endif
+        if (written <= 0) {
+            write_failed = true;
+            break;
+        }
+        text += written;
+        size -= (std::size_t)written;
+    }
+}
+
+void write_debug(DebugWriter& writer, const FilePosition& position) {
+    writer.write("{'line': ");
+    writer.write_unsigned(position.line);
+    writer.write(", 'column': ");
+    writer.write_unsigned(position.column);
+    writer.write_char('}');
+}
+
+void write_debug(DebugWriter& writer, const Token& token) {
+    writer.write("{'position': ");
+    write_debug(writer, token.position);
+    writer.write(", 'text': \"");
+    writer.write(token.text);
+    writer.write("\",'token_type': '");
+    writer.write(token_type_name(token.token_type));
+    writer.write("'}");
+}
+
+void write_debug(DebugWriter& writer, const UnknownToken& unknown_token) {
+    writer.write("{'position': ");
+    write_debug(writer, unknown_token.position);
+    writer.write(",'text': '");
+    writer.write(unknown_token.text);
+    writer.write("'}");
+}
+
+void write_debug(DebugWriter& writer, const LexerOutput& lexer_output) {
+    writer.write("{'open_failed': ");
+    writer.write(lexer_output.open_failed ? "true" : "false");
+    writer.write(",'read_failed': ");
+    writer.write(lexer_output.read_failed ? "true" : "false");
+    writer.write(",'tokens':[");
+    for (std::size_t i = 0; i < lexer_output.tokens.size(); i++) {
+        if (i != 0) {
+            writer.write_char(',');
+        }
+        write_debug(writer, lexer_output.tokens[i]);
+    }
+    writer.write("],'unknown_tokens':[");
+    for (std::size_t i = 0; i < lexer_output.unknown_tokens.size(); i++) {
+        if (i != 0) {
+            writer.write_char(',');
+        }
+        write_debug(writer, lexer_output.unknown_tokens[i]);
+    }
+    writer.write("]}");
+}
+
+void write_debug(DebugWriter& writer, const ParserOutput::Error& error) {
+    writer.write("{'position': ");
+    write_debug(writer, error.position);
+    writer.write(",'message': ");
+    writer.write(error.message);
+    writer.write_char('}');
+}
+
+namespace {
+    const char LEXER_DUMP_MAGIC[8] = { 'C', 'Y', 'N', 'O', 'T', 'O', 'K', '1' };
+    const std::size_t LEXER_DUMP_HEADER = 8 + 4 + 1 + 4 + 4 + 4;
+    const std::size_t LEXER_DUMP_TOKEN = 1 + 4 + 4 + 4 + 4;
+    const std::size_t LEXER_DUMP_UNKNOWN = 4 + 4 + 4 + 4;
+
+    // The source of a LexerOutput read back from a dump.
+    class DumpSource : public SourceBuffer {
+        public:
+            DumpSource(const char* data, std::size_t size) : text(data, size) {}
+
+            const char* data() const override { return text.data(); }
+            std::size_t size() const override { return text.size(); }
+
+        private:
+            const std::string text;
+    };
+
+    std::uint32_t read_u32(const char* p) {
+        return (std::uint32_t)(unsigned char)p[0]
+            | (std::uint32_t)(unsigned char)p[1] << 8
+            | (std::uint32_t)(unsigned char)p[2] << 16
+            | (std::uint32_t)(unsigned char)p[3] << 24;
+    }
+}
+
+void write_lexer_dump(DebugWriter& writer, const LexerOutput& lexer_output) {
+    const TokenBuffer& tokens = lexer_output.tokens;
+    std::uint32_t source_size = tokens.source() ? (std::uint32_t)tokens.source()->size() : 0;
+    writer.write(LEXER_DUMP_MAGIC, sizeof(LEXER_DUMP_MAGIC));
+    writer.write_u32(LEXER_DUMP_VERSION);
+    writer.write_u8((std::uint8_t)((lexer_output.open_failed ? 1 : 0)
+        | (lexer_output.read_failed ? 2 : 0)));
+    writer.write_u32(source_size);
+    writer.write_u32((std::uint32_t)tokens.size());
+    writer.write_u32((std::uint32_t)lexer_output.unknown_tokens.size());
+    if (source_size > 0) {
+        writer.write(tokens.source()->data(), source_size);
+    }
+    for (std::size_t i = 0; i < tokens.size(); i++) {
+        TextSpan span = tokens.span(i);
+        FilePosition position = tokens.position(i);
+        writer.write_u8((std::uint8_t)tokens.kind(i));
+        writer.write_u32(span.offset);
+        writer.write_u32(span.length);
+        writer.write_u32(position.line);
+        writer.write_u32(position.column);
+    }
+    for (const UnknownToken& unknown : lexer_output.unknown_tokens) {
+        writer.write_u32((std::uint32_t)(unknown.text.data - tokens.source()->data()));
+        writer.write_u32((std::uint32_t)unknown.text.size);
+        writer.write_u32(unknown.position.line);
+        writer.write_u32(unknown.position.column);
+    }
+}
+
+bool read_lexer_dump(const char* data, std::size_t size, LexerOutput& output,
+  std::size_t& consumed) {
+    if (size < LEXER_DUMP_HEADER
+        || std::memcmp(data, LEXER_DUMP_MAGIC, sizeof(LEXER_DUMP_MAGIC)) != 0
+        || read_u32(data + 8) != LEXER_DUMP_VERSION) {
+        return false;
+    }
+    std::uint8_t flags = (std::uint8_t)data[12];
+    std::uint64_t source_size = read_u32(data + 13);
+    std::uint64_t token_count = read_u32(data + 17);
+    std::uint64_t unknown_count = read_u32(data + 21);
+    std::uint64_t total = LEXER_DUMP_HEADER + source_size
+        + token_count * LEXER_DUMP_TOKEN + unknown_count * LEXER_DUMP_UNKNOWN;
+    if (total > size) {
+        return false;
+    }
+
+    const char* p = data + LEXER_DUMP_HEADER;
+    std::shared_ptr<const SourceBuffer> source
+        = std::make_shared<DumpSource>(p, (std::size_t)source_size);
+    p += source_size;
+
+    TokenBuffer tokens;
+    std::shared_ptr<SymbolTable> symbols = std::make_shared<SymbolTable>();
+    for (std::uint64_t i = 0; i < token_count; i++, p += LEXER_DUMP_TOKEN) {
+        std::uint8_t kind = (std::uint8_t)p[0];
+        TextSpan span = { read_u32(p + 1), read_u32(p + 5) };
+        if (kind > Token::GreaterEqual
+            || (std::uint64_t)span.offset + span.length > source_size) {
+            return false;
+        }
+        SymbolId symbol = kind == Token::Identifier
+            ? symbols->intern(source->data() + span.offset, span.length)
+            : NO_SYMBOL;
+        tokens.push_back((Token::TokenType)kind, span, symbol);
+    }
+    tokens.set_source(source);
+    tokens.set_symbols(std::move(symbols));
+
+    std::vector<UnknownToken> unknown_tokens;
+    for (std::uint64_t i = 0; i < unknown_count; i++, p += LEXER_DUMP_UNKNOWN) {
+        TextSpan span = { read_u32(p), read_u32(p + 4) };
+        if ((std::uint64_t)span.offset + span.length > source_size) {
+            return false;
+        }
+        unknown_tokens.push_back({ { read_u32(p + 8), read_u32(p + 12) },
+            tokens.text_of(span) });
+    }
+
+    output.tokens = std::move(tokens);
+    output.unknown_tokens = std::move(unknown_tokens);
+    output.open_failed = (flags & 1) != 0;
+    output.read_failed = (flags & 2) != 0;
+    consumed = (std::size_t)total;
+    return true;
+}
@@ -1,194 +1,507 @@
+#include <cynophobia/allocations.hpp>
+#include <cynophobia/charclass.hpp>
 #include <cynophobia/charstream.hpp>
+#include <cynophobia/debugwriter.hpp>
+#include <cynophobia/keywords.hpp>
 #include <cynophobia/lexer.hpp>
 #include <cynophobia/shared.hpp>
+#include <cynophobia/trace.hpp>
  
-#include <tuple>
-#include <unordered_set>
-#include <unordered_map>
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <thread>
 #include <utility>
 
+#ifdef _WIN32
+#define STDOUT_FILENO 1
+#else
+#include <unistd.h>
+#endif
 
 
-std::unordered_set<char> charset_digits() {
-    std::unordered_set<char> 
-        res{'0', '1', '2', '3', '4', '5', '6', '7', '8', '9'};
-    return res; 
-}
 
-bool all_digits(std::string s) {
-    auto digit_chars = charset_digits(); 
-    for (const char& c : s) {
-        if (digit_chars.find(c) == digit_chars.end()) {
-            return false;
+namespace {
+    // What one call to lex_step consumed.
+    struct LexStep {
+        enum Kind {
+            NOTHING,     // the stream had no character to give
+            WHITESPACE,
+            TOKEN,
+            UNKNOWN
+        };
+        Kind kind;
+        Token::TokenType token_type;
+        // Everything consumed, including whitespace.
+        TextSpan span;
+        // STREAM_GOOD to carry on; otherwise the stream ended or failed
+        // while or before taking this step.
+        FallibleCharStream::StreamStatus status;
+    };
+
+    // Takes the next character as well if it is second, which makes the
+    // step a pair_type token; otherwise the step stays what it was.
+    template <typename Stream>
+    void take_pair(BasicPositionedStream<Stream>& pfs, LexStep& step, char second,
+      Token::TokenType pair_type) {
+        char peek_char;
+        FallibleCharStream::StreamStatus peek_status = pfs.peek_next_char(peek_char);
+        if (peek_status == FallibleCharStream::STREAM_ERROR) {
+            step.status = peek_status;
+            return;
+        }
+        if (peek_status == FallibleCharStream::STREAM_GOOD && peek_char == second) {
+            char take_char;
+            if (pfs.get_next_char(take_char) == FallibleCharStream::STREAM_ERROR) {
+                step.status = FallibleCharStream::STREAM_ERROR;
+            }
+            step.kind = LexStep::TOKEN;
+            step.token_type = pair_type;
         }
     }
-    return true; 
-}
 
-std::unordered_set<char> charset_wordchars() {
-    auto base = charset_digits();
-    base.insert('_');
-    for (char c = 'a'; c <= 'z'; c++) {
-        base.insert(c);
+    // Lexes one token, unknown token or whitespace run. Instantiated once
+    // per concrete stream type so that the per-character calls below
+    // inline; FallibleCharStream itself is the type-erased case.
+    template <typename Stream>
+    LexStep lex_step(BasicPositionedStream<Stream>& pfs) {
+        LexStep step = { LexStep::NOTHING, Token::Semicolon, { 0, 0 },
+            FallibleCharStream::STREAM_GOOD };
+        char next_char; 
+        pfs.begin_text();
+        FallibleCharStream::StreamStatus next_status = pfs.get_next_char(next_char);  
+        if (next_status != FallibleCharStream::STREAM_GOOD) {
+            step.span = pfs.end_text();
+            step.status = next_status;
+            return step; 
+        } 
+
+        switch (next_char) {
+            // non-alphabetic characters 
+#define TOKEN_ONE_CHAR(x,y)                                     \
+    case x: {                                                   \
+        step.kind = LexStep::TOKEN;                             \
+        step.token_type = y;                                    \
+        break;                                                  \
     }
-    for (char c = 'A'; c <= 'Z'; c++) {
-        base.insert(c);
+            TOKEN_ONE_CHAR('(', Token::OpenParen)
+            TOKEN_ONE_CHAR(')', Token::CloseParen)
+            TOKEN_ONE_CHAR('{', Token::OpenBrace) 
+            TOKEN_ONE_CHAR('}', Token::CloseBrace) 
+            TOKEN_ONE_CHAR(';', Token::Semicolon)  
+            TOKEN_ONE_CHAR('~', Token::Tilde)
+            TOKEN_ONE_CHAR('+', Token::Plus)
+            TOKEN_ONE_CHAR('*', Token::Asterisk)
+            TOKEN_ONE_CHAR('/', Token::Slash)
+            TOKEN_ONE_CHAR('%', Token::Percent)
+#undef TOKEN_ONE_CHAR
+            // A one-character token, or a two-character one when the
+            // second character follows.
+#define TOKEN_PAIR(x,y,second,pair)                             \
+    case x: {                                                   \
+        step.kind = LexStep::TOKEN;                             \
+        step.token_type = y;                                    \
+        take_pair(pfs, step, second, pair);                     \
+        break;                                                  \
+    }
+            TOKEN_PAIR('-', Token::Hyphen, '-', Token::Decrement)
+            TOKEN_PAIR('!', Token::Bang, '=', Token::BangEqual)
+            TOKEN_PAIR('<', Token::Less, '=', Token::LessEqual)
+            TOKEN_PAIR('>', Token::Greater, '=', Token::GreaterEqual)
+#undef TOKEN_PAIR
+            // Only tokens doubled, so far.
+#define TOKEN_DOUBLED(x,pair)                                   \
+    case x: {                                                   \
+        step.kind = LexStep::UNKNOWN;                           \
+        take_pair(pfs, step, x, pair);                          \
+        break;                                                  \
+    }
+            TOKEN_DOUBLED('&', Token::LogicalAnd)
+            TOKEN_DOUBLED('|', Token::LogicalOr)
+            TOKEN_DOUBLED('=', Token::EqualEqual)
+#undef TOKEN_DOUBLED
+            default: {
+                unsigned char next_class = charclass::of(next_char);
+                if (next_class & charclass::WHITESPACE) {
+                    // [ \t\n\v\f\r]+
+                    step.kind = LexStep::WHITESPACE;
+                    step.status = pfs.template take_while_class<charclass::WHITESPACE>();
+                } else if (next_class & charclass::WORD_START) { 
+                    // [a-zA-Z_]\w*
+                    step.status = pfs.template take_while_class<charclass::WORD>();
+                    TextSpan taken_wordchars = pfs.end_text(); 
+
+                    step.kind = LexStep::TOKEN;
+                    step.token_type = Token::Identifier; 
+                    keywords::classify(pfs.text_at(taken_wordchars),
+                        taken_wordchars.length, step.token_type);
+                } else if (next_class & charclass::DIGIT) {
+                    // [0-9]+\b; a digit run running into word
+                    // characters is one unknown token.
+                    step.status = pfs.template take_while_class<charclass::DIGIT>();
+                    step.kind = LexStep::TOKEN;
+                    step.token_type = Token::Constant;
+                    char follow_char;
+                    if (step.status == FallibleCharStream::STREAM_GOOD
+                        && pfs.peek_next_char(follow_char) == FallibleCharStream::STREAM_GOOD
+                        && charclass::is(follow_char, charclass::WORD)) {
+                        step.kind = LexStep::UNKNOWN;
+                        step.status = pfs.template take_while_class<charclass::WORD>();
+                    }
+                } else {
+                    // characters we don't recognize yet
+                    step.kind = LexStep::UNKNOWN;
+                }
+                break; 
+            }
+        }
+        step.span = pfs.end_text();
+        return step;
     }
-    return base; 
 }
 
+// Gives unknown tokens their text and position, now that the source is
+// complete.
+LexerOutput finish_output(TokenBuffer tokens, const std::vector<TextSpan>& unknown_spans,
+  bool read_failed, bool open_failed, bool debug) {
+    std::vector<UnknownToken> unknown_tokens = {};
+    for (TextSpan unknown : unknown_spans) {
+        unknown_tokens.push_back({ tokens.position_of(unknown.offset), tokens.text_of(unknown) });
+    }
 
+    LexerOutput output = { std::move(tokens), unknown_tokens, read_failed, open_failed };
+    if (debug) { 
+        // Straight to the descriptor, after anything already in stdout.
+        fflush(stdout);
+        DebugWriter writer(STDOUT_FILENO);
+        write_debug(writer, output);
+    }
+    return output;
+}
 
-LexerOutput lex(FallibleCharStream& fcs, bool debug) {
+template <typename Stream>
+LexerOutput lex(Stream& fcs, bool debug) {
+    TraceScope trace("lex");
+    AllocationStage stage(LexStage);
     bool was_open = fcs.was_opened();
-    PositionedStream pfs(fcs); 
+    BasicPositionedStream<Stream> pfs(fcs); 
   
-    std::vector<Token> tokens = {};
-    std::vector<UnknownToken> unknown_tokens = {};
+    TokenBuffer tokens;
+    std::shared_ptr<SymbolTable> symbols = std::make_shared<SymbolTable>();
+    std::vector<TextSpan> unknown_spans = {};
 
-    const std::unordered_set<char> wordchars = charset_wordchars();
-    const std::unordered_set<char> digitchars = charset_digits();
-
-    bool read_failed = false;
-    if (was_open) { 
+    bool read_failed = pfs.read_failed();
+    if (was_open && !read_failed) { 
         while (true) {  
-            bool extra_getchars_exit = false; 
-            FallibleCharStream::StreamStatus next_status;
-            char next_char; 
-            FilePosition next_position = pfs.get_next_position();
-            std::tie(next_char, next_status) = pfs.get_next_char();  
-            
-            if (next_status != FallibleCharStream::STREAM_GOOD) {
-                read_failed = (next_status == FallibleCharStream::STREAM_ERROR); 
+            LexStep step = lex_step(pfs);
+            if (step.kind == LexStep::TOKEN) {
+                SymbolId symbol = step.token_type == Token::Identifier
+                    ? symbols->intern(pfs.text_at(step.span), step.span.length)
+                    : NO_SYMBOL;
+                tokens.push_back(step.token_type, step.span, symbol);
+            } else if (step.kind == LexStep::UNKNOWN) {
+                unknown_spans.push_back(step.span);
+            }
+            if (step.status != FallibleCharStream::STREAM_GOOD) {
+                read_failed = (step.status == FallibleCharStream::STREAM_ERROR); 
                 break; 
-            } 
-
-            switch (next_char) {
-                // non-alphabetic characters 
-#define TOKEN_ONE_CHAR(x,y)                                     \
-    case x: {                                                   \
-        tokens.push_back({next_position, std::string(1,x), y}); \
-        break;                                                  \
+            }
+        }
     }
-                TOKEN_ONE_CHAR('(', Token::OpenParen)
-                TOKEN_ONE_CHAR(')', Token::CloseParen)
-                TOKEN_ONE_CHAR('{', Token::OpenBrace) 
-                TOKEN_ONE_CHAR('}', Token::CloseBrace) 
-                TOKEN_ONE_CHAR(';', Token::Semicolon)  
-#undef TOKEN_ONE_CHAR
-                // whitespace characters 
-                case '\n': break;
-                case '\r': break;
-                case '\v': break;
-                case '\f': break;
-                case ' ':  break;
-                case '\t': break; 
-                    
-
-                // non-range-check alphabetic characters
-                case '_': {
-                    FallibleCharStream::StreamStatus take_wordchars_result; 
-                    std::string taken_wordchars; 
-                    std::tie(taken_wordchars, take_wordchars_result) 
-                        = pfs.get_while_in(wordchars);
-                    if (take_wordchars_result != FallibleCharStream::STREAM_GOOD) {
-                        read_failed = (take_wordchars_result ==
-                        FallibleCharStream::STREAM_ERROR); 
-                        extra_getchars_exit = true; 
-                    } else {
-                        taken_wordchars.insert(taken_wordchars.begin(), next_char);  
-                        tokens.push_back({ next_position, taken_wordchars, 
-                        Token::Identifier });
-                    }
-                    break; 
-                }
-                // maybe-alphabetic characters
-                default: {
-                    // [a-zA-Z]
-                    if (('a' <= next_char && next_char <= 'z') || 
-                        ('A' <= next_char && next_char <= 'Z')) { 
-                        FallibleCharStream::StreamStatus take_wordchars_result; 
-                        std::string taken_wordchars; 
-                        std::tie(taken_wordchars, take_wordchars_result) 
-                            = pfs.get_while_in(wordchars);
-                        if (take_wordchars_result !=
-                        FallibleCharStream::STREAM_GOOD) {
-                            read_failed = (take_wordchars_result ==
-                                FallibleCharStream::STREAM_ERROR); 
-                            extra_getchars_exit = true; 
-                        }
-                        taken_wordchars.insert(taken_wordchars.begin(), next_char); 
-
-                        Token::TokenType token_type = Token::Identifier; 
-
-                        std::unordered_map<std::string, Token::TokenType> keyword_tokens =
-                        { { "int", Token::Int }, 
-                        { "void",  Token::Void }, 
-                        { "return", Token::Return }, }; 
-
-                        auto keyword_it = keyword_tokens.find(taken_wordchars);
-                        if (keyword_it != keyword_tokens.end()) {
-                            token_type = keyword_it->second; 
-                        } 
-
-                        tokens.push_back( { next_position, taken_wordchars, token_type }); 
-                        break; 
-                    } else if ( '0' <= next_char && next_char <= '9') {
-                        FallibleCharStream::StreamStatus take_wordchars_result; 
-                        std::string taken_wordchars; 
-                        std::tie(taken_wordchars, take_wordchars_result) 
-                            = pfs.get_while_in(wordchars);
-                        if (take_wordchars_result !=
-                        FallibleCharStream::STREAM_GOOD) {
-                            read_failed = (take_wordchars_result ==
-                                FallibleCharStream::STREAM_ERROR); 
-                            extra_getchars_exit = true; 
-                        }
-                        taken_wordchars.insert(
-                            taken_wordchars.begin(), next_char);  
-                        if (all_digits(taken_wordchars)) {   
-                            tokens.push_back({next_position, taken_wordchars,
-                            Token::Constant});
-                        } else {
-                            unknown_tokens.push_back({next_position, taken_wordchars
-                            });
-                        }
-                        break; 
-                    } else {
-
-                        std::string token_text(1, next_char);
-                        unknown_tokens.push_back({next_position, token_text});
-                        // characters we don't recognize yet
-                    }
-                    break; 
-                }
-                
+
+    tokens.set_source(pfs.text_source());
+    tokens.set_symbols(std::move(symbols));
+    return finish_output(std::move(tokens), unknown_spans, read_failed, !was_open, debug);
+}
+
+namespace {
+    // How many step starts to remember at the beginning of each chunk, for
+    // falling back into step with the serial lexer (see lex_parallel).
+    const std::size_t RESYNC_WINDOW = 64;
+
+    struct LexedChunk {
+        std::size_t begin;
+        // No step starts at or past limit, but the last one may run past it.
+        std::size_t limit;
+        // Where the step after the last one would start.
+        std::size_t stop;
+        // Spans are offsets into the whole source.
+        TokenBuffer tokens;
+        std::vector<TextSpan> unknown_spans;
+        std::vector<std::uint32_t> step_starts;
+    };
+
+    // Lexes chunk.begin up to chunk.limit as if the serial lexer had
+    // just finished a step at chunk.begin.
+    void lex_chunk(const std::shared_ptr<const SourceBuffer>& source, LexedChunk& chunk) {
+        TraceScope trace("lex chunk");
+        AllocationStage stage(LexStage);
+        SliceCharStream slice_fcs(source, chunk.begin);
+        BufferCharStream& fcs = slice_fcs;
+        BasicPositionedStream<BufferCharStream> pfs(fcs);
+        chunk.tokens = TokenBuffer();
+        chunk.unknown_spans.clear();
+        chunk.step_starts.clear();
+
+        std::size_t offset = chunk.begin;
+        while (offset < chunk.limit) {
+            if (chunk.step_starts.size() < RESYNC_WINDOW) {
+                chunk.step_starts.push_back((std::uint32_t)offset);
             }
-            if (extra_getchars_exit) {
-                break; 
+            LexStep step = lex_step(pfs);
+            TextSpan span = { (std::uint32_t)(chunk.begin + step.span.offset), step.span.length };
+            if (step.kind == LexStep::TOKEN) {
+                chunk.tokens.push_back(step.token_type, span);
+            } else if (step.kind == LexStep::UNKNOWN) {
+                chunk.unknown_spans.push_back(span);
+            }
+            offset = span.offset + span.length;
+            if (step.status != FallibleCharStream::STREAM_GOOD) {
+                break;
             }
         }
+        chunk.stop = offset;
     }
 
-    LexerOutput output = { tokens, unknown_tokens, read_failed, !was_open };
-    if (debug) { 
-        printf("%s", output.debug_string().c_str());
+    // Chunks start just after a line break near each even split point,
+    // where the serial lexer is almost always between tokens. Where there
+    // is none nearby the split point is used as is.
+    std::size_t chunk_boundary(const char* text, std::size_t size, std::size_t target) {
+        std::size_t search_end = size - target > 4096 ? target + 4096 : size;
+        for (std::size_t i = target; i < search_end; i++) {
+            if (charclass::is(text[i], charclass::LINE_BREAK)) {
+                return i + 1;
+            }
+        }
+        return target;
     }
 
-    return output;
+    // Lexes chunks of source concurrently, then stitches them together in
+    // order. Each chunk is lexed assuming a token starts at its first
+    // character. Where the previous chunk's last step actually ran on past
+    // that point (a token, or later a comment or string literal, crossing
+    // the boundary), the chunk's output is kept from the first step start
+    // it shares with the serial lexer; if there is none among its first
+    // RESYNC_WINDOW steps, the chunk is lexed again from where the serial
+    // lexer would be.
+    LexerOutput lex_parallel(std::shared_ptr<const SourceBuffer> source, bool debug,
+      unsigned int jobs, std::size_t min_chunk_size) {
+        std::size_t size = source->size();
+        std::size_t chunk_count = jobs;
+        if (min_chunk_size > 0 && size / min_chunk_size < chunk_count) {
+            chunk_count = size / min_chunk_size;
+        }
+        if (size > MAX_SOURCE_SIZE) {
+            // Spans could not address it; refuse it as a failed read.
+            TokenBuffer tokens;
+            tokens.set_source(std::move(source));
+            tokens.set_symbols(std::make_shared<SymbolTable>());
+            return finish_output(std::move(tokens), {}, true, false, debug);
+        }
+        if (chunk_count <= 1) {
+            SliceCharStream slice_fcs(source, 0);
+            BufferCharStream& fcs = slice_fcs;
+            return lex(fcs, debug);
+        }
+
+        std::vector<LexedChunk> chunks(chunk_count);
+        std::size_t begin = 0;
+        for (std::size_t k = 0; k < chunk_count; k++) {
+            chunks[k].begin = begin;
+            begin = k + 1 == chunk_count ? size
+                : chunk_boundary(source->data(), size, size / chunk_count * (k + 1));
+            if (begin < chunks[k].begin) {
+                begin = chunks[k].begin;
+            }
+            chunks[k].limit = begin;
+        }
+
+        std::vector<std::thread> workers;
+        for (std::size_t k = 1; k < chunk_count; k++) {
+            workers.push_back(std::thread(lex_chunk, std::cref(source), std::ref(chunks[k])));
+        }
+        lex_chunk(source, chunks[0]);
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+
+        // Interning is left to this serial pass so that ids come out in
+        // the same order as lex_string's.
+        TraceScope trace("merge chunks");
+        AllocationStage stage(LexStage);
+        TokenBuffer tokens;
+        std::shared_ptr<SymbolTable> symbols = std::make_shared<SymbolTable>();
+        std::vector<TextSpan> unknown_spans = {};
+        std::size_t resume = 0;
+        for (LexedChunk& chunk : chunks) {
+            if (resume >= chunk.limit) {
+                // Swallowed whole by a step from an earlier chunk.
+                continue;
+            }
+            if (resume != chunk.begin
+                && std::find(chunk.step_starts.begin(), chunk.step_starts.end(),
+                    (std::uint32_t)resume) == chunk.step_starts.end()) {
+                chunk.begin = resume;
+                lex_chunk(source, chunk);
+            }
+            for (std::size_t i = 0; i < chunk.tokens.size(); i++) {
+                TextSpan span = chunk.tokens.span(i);
+                if (span.offset >= resume) {
+                    Token::TokenType token_type = chunk.tokens.kind(i);
+                    SymbolId symbol = token_type == Token::Identifier
+                        ? symbols->intern(source->data() + span.offset, span.length)
+                        : NO_SYMBOL;
+                    tokens.push_back(token_type, span, symbol);
+                }
+            }
+            for (TextSpan unknown : chunk.unknown_spans) {
+                if (unknown.offset >= resume) {
+                    unknown_spans.push_back(unknown);
+                }
+            }
+            resume = chunk.stop;
+        }
 
+        tokens.set_source(std::move(source));
+        tokens.set_symbols(std::move(symbols));
+        return finish_output(std::move(tokens), unknown_spans, false, false, debug);
+    }
 }
  
 
 LexerOutput lex_file(const Config& config) { 
-    FileCharStream file_fcs(config.filename);
-    FallibleCharStream& fcs = file_fcs; 
+    MappedCharStream file_fcs(config.filename);
+    BufferCharStream& fcs = file_fcs; 
 
     return lex(fcs, config.debug); 
 }
 
 LexerOutput lex_string(std::string program_string, bool debug) {
-    StringCharStream string_fcs(program_string);
-    FallibleCharStream& fcs = string_fcs; 
+    StringCharStream string_fcs(std::move(program_string));
+    BufferCharStream& fcs = string_fcs; 
     return lex(fcs, debug); 
-}
\ No newline at end of file
+}
+
+LexerOutput lex_stream(FallibleCharStream& fcs, bool debug) {
+    return lex(fcs, debug); 
+}
+
+LexerOutput lex_file_parallel(const Config& config, unsigned int jobs,
+  std::size_t min_chunk_size) {
+    MappedCharStream file_fcs(config.filename);
+    if (!file_fcs.was_opened()) {
+        BufferCharStream& fcs = file_fcs; 
+        return lex(fcs, config.debug); 
+    }
+    return lex_parallel(file_fcs.contiguous_source(), config.debug, jobs, min_chunk_size);
+}
+
+LexerOutput lex_source(std::shared_ptr<const SourceBuffer> source, bool debug,
+  unsigned int jobs) {
+    return lex_parallel(std::move(source), debug, jobs, PARALLEL_LEX_MIN_CHUNK);
+}
+
+LexerOutput lex_fd(int fd, bool debug, unsigned int jobs) {
+    if (fd < 0) {
+        FdCharStream fcs(fd);
+        return lex(fcs, debug);
+    }
+    std::string text;
+    bool read_ok = read_whole_fd(fd, text);
+    LexerOutput output = lex_parallel(std::make_shared<OwnedString>(std::move(text)),
+        debug && read_ok, jobs, PARALLEL_LEX_MIN_CHUNK);
+    if (!read_ok) {
+        output.read_failed = true;
+        if (debug) {
+            fflush(stdout);
+            DebugWriter writer(STDOUT_FILENO);
+            write_debug(writer, output);
+        }
+    }
+    return output;
+}
+
+LexerOutput lex_string_parallel(std::string program_string, bool debug,
+  unsigned int jobs, std::size_t min_chunk_size) {
+    return lex_parallel(std::make_shared<OwnedString>(std::move(program_string)),
+        debug, jobs, min_chunk_size);
+}
+TokenSource::TokenSource(FallibleCharStream& fcs, std::size_t lookahead) :
+    pfs(fcs),
+    ring(lookahead > 0 ? lookahead : 1),
+    head(0),
+    count(0),
+    finished(!fcs.was_opened() || pfs.read_failed()),
+    input_read_failed(pfs.read_failed()),
+    input_open_failed(!fcs.was_opened()),
+    line(0),
+    line_start(0),
+    after_cr(false) {}
+
+const Token* TokenSource::peek_token(std::size_t k) {
+    if (k >= ring.size()) {
+        return nullptr;
+    }
+    fill(k);
+    if (k >= count) {
+        return nullptr;
+    }
+    return &ring[(head + k) % ring.size()].token;
+}
+
+const Token* TokenSource::next_token() {
+    fill(0);
+    if (count == 0) {
+        return nullptr;
+    }
+    const Token* token = &ring[head].token;
+    head = (head + 1) % ring.size();
+    count--;
+    return token;
+}
+
+void TokenSource::fill(std::size_t k) {
+    AllocationStage stage(LexStage);
+    while (count <= k && !finished) {
+        LexStep step = lex_step(pfs);
+        FilePosition position = consume_line_breaks(step.span);
+        if (step.kind == LexStep::TOKEN) {
+            Slot& slot = ring[(head + count) % ring.size()];
+            slot.text.assign(pfs.text_at(step.span), step.span.length);
+            SymbolId symbol = step.token_type == Token::Identifier
+                ? symbol_table.intern(slot.text.data(), slot.text.size())
+                : NO_SYMBOL;
+            slot.token = { position, { slot.text.data(), slot.text.size() },
+                step.token_type, symbol };
+            count++;
+        } else if (step.kind == LexStep::UNKNOWN) {
+            unknown_text.push_back(std::string(pfs.text_at(step.span), step.span.length));
+            unknown.push_back({ position,
+                { unknown_text.back().data(), unknown_text.back().size() } });
+        }
+        pfs.release_text();
+        if (step.status != FallibleCharStream::STREAM_GOOD) {
+            finished = true;
+            input_read_failed = (step.status == FallibleCharStream::STREAM_ERROR);
+        }
+    }
+}
+
+// Returns the position of the start of span, then moves the line tracking
+// past it, with the same rules as LineIndex.
+FilePosition TokenSource::consume_line_breaks(TextSpan span) {
+    FilePosition start = { line, span.offset - line_start };
+    const char* text = pfs.text_at(span);
+    const char* end = text + span.length;
+    charclass::for_each<charclass::LINE_BREAK>(text, end, [&](const char* p) {
+        bool crlf = *p == '\n' && (p == text ? after_cr : p[-1] == '\r');
+        if (!crlf) {
+            line++;
+        }
+        line_start = span.offset + (std::uint32_t)(p - text) + 1;
+    });
+    if (span.length > 0) {
+        after_cr = end[-1] == '\r';
+    }
+    return start;
+}
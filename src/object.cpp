@@ -0,0 +1,212 @@
+#include <cynophobia/debugwriter.hpp>
+#include <cynophobia/object.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace {
+    // From the System V gABI.
+    const std::uint16_t ET_REL = 1;
+    const std::uint16_t EM_X86_64 = 62;
+    const std::uint32_t SHT_PROGBITS = 1;
+    const std::uint32_t SHT_SYMTAB = 2;
+    const std::uint32_t SHT_STRTAB = 3;
+    const std::uint32_t SHT_RELA = 4;
+    const std::uint64_t SHF_ALLOC = 0x2;
+    const std::uint64_t SHF_EXECINSTR = 0x4;
+    const std::uint64_t SHF_INFO_LINK = 0x40;
+    const std::uint8_t STB_LOCAL = 0;
+    const std::uint8_t STB_GLOBAL = 1;
+    const std::uint8_t STT_NOTYPE = 0;
+    const std::uint8_t STT_FUNC = 2;
+    const std::uint8_t STT_FILE = 4;
+    const std::uint16_t SHN_UNDEF = 0;
+    const std::uint16_t SHN_ABS = 0xFFF1;
+
+    const std::uint64_t HEADER_SIZE = 64;
+    const std::uint64_t SECTION_HEADER_SIZE = 64;
+    const std::uint64_t SYMBOL_SIZE = 24;
+    const std::uint64_t RELOCATION_SIZE = 24;
+
+    // NUL-terminated names back to back, starting with the empty name.
+    class StringTable {
+        public:
+            StringTable() : table(1, '\0') {}
+
+            std::uint32_t add(const std::string& name) {
+                if (name.empty()) {
+                    return 0;
+                }
+                std::uint32_t offset = (std::uint32_t)table.size();
+                table += name;
+                table += '\0';
+                return offset;
+            }
+
+            const std::string& str() const { return table; }
+
+        private:
+            std::string table;
+    };
+
+    struct Section {
+        std::uint32_t name;
+        std::uint32_t type;
+        std::uint64_t flags;
+        std::uint64_t offset;
+        std::uint64_t size;
+        std::uint32_t link;
+        std::uint32_t info;
+        std::uint64_t alignment;
+        std::uint64_t entry_size;
+    };
+
+    struct Symbol {
+        std::uint32_t name;
+        std::uint8_t info;
+        std::uint16_t section;
+        std::uint64_t value;
+        std::uint64_t size;
+    };
+
+    std::uint64_t align_to(std::uint64_t offset, std::uint64_t alignment) {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+
+    void pad_to(DebugWriter& out, std::uint64_t& written, std::uint64_t offset) {
+        for (; written < offset; written++) {
+            out.write_char('\0');
+        }
+    }
+}
+
+void write_elf_object(DebugWriter& out, const ObjectFile& object) {
+    const bool has_relocations = !object.relocations.empty();
+    const std::uint16_t text_index = 1;
+    const std::uint16_t rela_index = 2;
+    const std::uint16_t note_index = has_relocations ? 3 : 2;
+    const std::uint16_t symtab_index = note_index + 1;
+    const std::uint16_t strtab_index = note_index + 2;
+    const std::uint16_t shstrtab_index = note_index + 3;
+
+    // Locals, the file symbol first, then globals.
+    StringTable names;
+    std::vector<Symbol> symbols(1, Symbol { 0, 0, SHN_UNDEF, 0, 0 });
+    if (!object.source_name.empty()) {
+        symbols.push_back(Symbol { names.add(object.source_name),
+            (std::uint8_t)((STB_LOCAL << 4) | STT_FILE), SHN_ABS, 0, 0 });
+    }
+    std::vector<std::uint32_t> symbol_indices(object.symbols.size());
+    std::uint32_t first_global = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        bool globals = pass == 1;
+        if (globals) {
+            first_global = (std::uint32_t)symbols.size();
+        }
+        for (std::size_t i = 0; i < object.symbols.size(); i++) {
+            const ObjectSymbol& symbol = object.symbols[i];
+            if (symbol.global != globals) {
+                continue;
+            }
+            symbol_indices[i] = (std::uint32_t)symbols.size();
+            std::uint8_t binding = symbol.global ? STB_GLOBAL : STB_LOCAL;
+            std::uint8_t type = symbol.function ? STT_FUNC : STT_NOTYPE;
+            symbols.push_back(Symbol { names.add(symbol.name),
+                (std::uint8_t)((binding << 4) | type),
+                symbol.defined ? text_index : SHN_UNDEF,
+                symbol.defined ? symbol.offset : 0,
+                symbol.size });
+        }
+    }
+
+    StringTable section_names;
+    std::vector<Section> sections(1, Section {});
+    std::uint64_t offset = HEADER_SIZE;
+    sections.push_back(Section { section_names.add(".text"), SHT_PROGBITS,
+        SHF_ALLOC | SHF_EXECINSTR, offset, object.text.size(), 0, 0, 16, 0 });
+    offset += object.text.size();
+    if (has_relocations) {
+        offset = align_to(offset, 8);
+        sections.push_back(Section { section_names.add(".rela.text"), SHT_RELA,
+            SHF_INFO_LINK, offset, object.relocations.size() * RELOCATION_SIZE,
+            symtab_index, text_index, 8, RELOCATION_SIZE });
+        offset += sections.back().size;
+    }
+    sections.push_back(Section { section_names.add(".note.GNU-stack"), SHT_PROGBITS,
+        0, offset, 0, 0, 0, 1, 0 });
+    offset = align_to(offset, 8);
+    sections.push_back(Section { section_names.add(".symtab"), SHT_SYMTAB, 0, offset,
+        symbols.size() * SYMBOL_SIZE, strtab_index, first_global, 8, SYMBOL_SIZE });
+    offset += sections.back().size;
+    sections.push_back(Section { section_names.add(".strtab"), SHT_STRTAB, 0, offset,
+        names.str().size(), 0, 0, 1, 0 });
+    offset += sections.back().size;
+    std::uint32_t shstrtab_name = section_names.add(".shstrtab");
+    sections.push_back(Section { shstrtab_name, SHT_STRTAB, 0, offset,
+        section_names.str().size(), 0, 0, 1, 0 });
+    offset += sections.back().size;
+    std::uint64_t section_headers = align_to(offset, 8);
+
+    const unsigned char identification[16] = {
+        0x7F, 'E', 'L', 'F',
+        2,  // ELFCLASS64
+        1,  // ELFDATA2LSB
+        1,  // EV_CURRENT
+        0,  // ELFOSABI_SYSV
+    };
+    out.write((const char*)identification, sizeof(identification));
+    out.write_u16(ET_REL);
+    out.write_u16(EM_X86_64);
+    out.write_u32(1);
+    out.write_u64(0);  // entry point
+    out.write_u64(0);  // program headers
+    out.write_u64(section_headers);
+    out.write_u32(0);  // flags
+    out.write_u16((std::uint16_t)HEADER_SIZE);
+    out.write_u16(0);
+    out.write_u16(0);
+    out.write_u16((std::uint16_t)SECTION_HEADER_SIZE);
+    out.write_u16((std::uint16_t)sections.size());
+    out.write_u16(shstrtab_index);
+    std::uint64_t written = HEADER_SIZE;
+
+    out.write(object.text);
+    written += object.text.size();
+    if (has_relocations) {
+        pad_to(out, written, sections[rela_index].offset);
+        for (const ObjectRelocation& relocation : object.relocations) {
+            out.write_u64(relocation.offset);
+            out.write_u64(((std::uint64_t)symbol_indices[relocation.symbol] << 32)
+                | relocation.type);
+            out.write_u64((std::uint64_t)relocation.addend);
+        }
+        written += sections[rela_index].size;
+    }
+    pad_to(out, written, sections[symtab_index].offset);
+    for (const Symbol& symbol : symbols) {
+        out.write_u32(symbol.name);
+        out.write_u8(symbol.info);
+        out.write_u8(0);  // default visibility
+        out.write_u16(symbol.section);
+        out.write_u64(symbol.value);
+        out.write_u64(symbol.size);
+    }
+    out.write(names.str());
+    out.write(section_names.str());
+    written += sections[symtab_index].size + names.str().size() + section_names.str().size();
+    pad_to(out, written, section_headers);
+    for (const Section& section : sections) {
+        out.write_u32(section.name);
+        out.write_u32(section.type);
+        out.write_u64(section.flags);
+        out.write_u64(0);  // address
+        out.write_u64(section.offset);
+        out.write_u64(section.size);
+        out.write_u32(section.link);
+        out.write_u32(section.info);
+        out.write_u64(section.alignment);
+        out.write_u64(section.entry_size);
+    }
+}
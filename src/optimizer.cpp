@@ -0,0 +1,692 @@
+#include <cynophobia/allocations.hpp>
+#include <cynophobia/optimizer.hpp>
+#include <cynophobia/tacky.hpp>
+#include <cynophobia/trace.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace {
+    const std::uint32_t NONE = 0xFFFFFFFFu;
+
+    const char* const PASS_NAMES[] = {
+        "constant_folding", "unreachable_code", "copy_propagation", "dead_stores"
+    };
+
+    typedef std::uint64_t Word;
+
+    bool test_bit(const Word* set, std::uint32_t bit) {
+        return (set[bit >> 6] >> (bit & 63)) & 1;
+    }
+
+    void set_bit(Word* set, std::uint32_t bit) {
+        set[bit >> 6] |= (Word)1 << (bit & 63);
+    }
+
+    void clear_bit(Word* set, std::uint32_t bit) {
+        set[bit >> 6] &= ~((Word)1 << (bit & 63));
+    }
+
+    bool is_jump(tacky::Opcode opcode) {
+        return opcode == tacky::Jump || opcode == tacky::JumpIfZero
+            || opcode == tacky::JumpIfNotZero;
+    }
+
+    bool ends_block(tacky::Opcode opcode) {
+        return is_jump(opcode) || opcode == tacky::Return;
+    }
+
+    bool is_temporary(tacky::Value value) {
+        return value != tacky::NO_VALUE && !tacky::is_constant(value);
+    }
+
+    // An operation on constants, wrapping as two's complement int does.
+    // False for what would trap at run time, which is left to do so.
+    bool fold(tacky::Opcode opcode, std::int32_t a, std::int32_t b, std::int32_t& result) {
+        std::uint32_t unsigned_a = (std::uint32_t)a;
+        std::uint32_t unsigned_b = (std::uint32_t)b;
+        switch (opcode) {
+            case tacky::Complement: result = (std::int32_t)~unsigned_a; break;
+            case tacky::Negate: result = (std::int32_t)(0u - unsigned_a); break;
+            case tacky::Not: result = a == 0; break;
+            case tacky::Add: result = (std::int32_t)(unsigned_a + unsigned_b); break;
+            case tacky::Subtract: result = (std::int32_t)(unsigned_a - unsigned_b); break;
+            case tacky::Multiply: result = (std::int32_t)(unsigned_a * unsigned_b); break;
+            case tacky::Divide:
+            case tacky::Remainder:
+                if (b == 0 || (a == -2147483647 - 1 && b == -1)) {
+                    return false;
+                }
+                result = opcode == tacky::Divide ? a / b : a % b;
+                break;
+            case tacky::Equal: result = a == b; break;
+            case tacky::NotEqual: result = a != b; break;
+            case tacky::Less: result = a < b; break;
+            case tacky::LessOrEqual: result = a <= b; break;
+            case tacky::Greater: result = a > b; break;
+            case tacky::GreaterOrEqual: result = a >= b; break;
+            default: return false;
+        }
+        return true;
+    }
+
+    // Optimizes one function at a time, keeping its graph and dataflow
+    // sets in arrays reused from function to function.
+    class FunctionOptimizer {
+        public:
+            explicit FunctionOptimizer(OptimizerStats& stats) : stats(stats) {}
+
+            void optimize(tacky::Function& function) {
+                bool changed;
+                do {
+                    changed = run(ConstantFolding, &FunctionOptimizer::fold_constants, function);
+                    changed |= run(UnreachableCode, &FunctionOptimizer::remove_unreachable_code,
+                        function);
+                    changed |= run(CopyPropagation, &FunctionOptimizer::propagate_copies, function);
+                    changed |= run(DeadStores, &FunctionOptimizer::remove_dead_stores, function);
+                    stats.rounds++;
+                } while (changed);
+            }
+
+        private:
+            typedef std::size_t (FunctionOptimizer::*Pass)(tacky::Function& function);
+
+            // Instructions [begin, end); successors are block indices or NONE.
+            struct Block {
+                std::uint32_t begin;
+                std::uint32_t end;
+                std::uint32_t successors[2];
+            };
+
+            bool run(OptimizationPass pass, Pass method, tacky::Function& function) {
+                TraceClock::time_point start = TraceClock::now();
+                std::size_t changes = (this->*method)(function);
+                PassStats& pass_stats = stats.passes[pass];
+                pass_stats.runs++;
+                pass_stats.seconds += std::chrono::duration<double>(
+                    TraceClock::now() - start).count();
+                pass_stats.changes += changes;
+                return changes > 0;
+            }
+
+            // Drops the instructions marked in removed.
+            void compact(tacky::Function& function) {
+                std::vector<tacky::Instruction>& code = function.instructions;
+                std::size_t kept = 0;
+                for (std::size_t i = 0; i < code.size(); i++) {
+                    if (!removed[i]) {
+                        code[kept++] = code[i];
+                    }
+                }
+                code.resize(kept);
+            }
+
+            // A block starts at the first instruction, at each label and
+            // after each jump or return.
+            void build_graph(const tacky::Function& function) {
+                const std::vector<tacky::Instruction>& code = function.instructions;
+                std::uint32_t size = (std::uint32_t)code.size();
+                blocks.clear();
+                label_blocks.assign(function.labels, NONE);
+                for (std::uint32_t i = 0; i < size;) {
+                    Block block = { i, 0, { NONE, NONE } };
+                    if (code[i].opcode == tacky::Label) {
+                        label_blocks[code[i].dst] = (std::uint32_t)blocks.size();
+                    }
+                    i++;
+                    while (i < size && code[i].opcode != tacky::Label
+                        && !ends_block(code[i - 1].opcode)) {
+                        i++;
+                    }
+                    block.end = i;
+                    blocks.push_back(block);
+                }
+                std::uint32_t count = (std::uint32_t)blocks.size();
+                for (std::uint32_t b = 0; b < count; b++) {
+                    const tacky::Instruction& last = code[blocks[b].end - 1];
+                    std::uint32_t next = b + 1 < count ? b + 1 : NONE;
+                    std::uint32_t* successors = blocks[b].successors;
+                    switch (last.opcode) {
+                        case tacky::Return:
+                            break;
+                        case tacky::Jump:
+                            successors[0] = label_blocks[last.dst];
+                            break;
+                        case tacky::JumpIfZero:
+                        case tacky::JumpIfNotZero:
+                            successors[0] = next;
+                            successors[1] = label_blocks[last.dst];
+                            break;
+                        default:
+                            successors[0] = next;
+                            break;
+                    }
+                }
+                predecessor_offsets.assign(count + 1, 0);
+                for (const Block& block : blocks) {
+                    for (std::uint32_t successor : block.successors) {
+                        if (successor != NONE) {
+                            predecessor_offsets[successor + 1]++;
+                        }
+                    }
+                }
+                for (std::uint32_t b = 0; b < count; b++) {
+                    predecessor_offsets[b + 1] += predecessor_offsets[b];
+                }
+                predecessors.resize(predecessor_offsets[count]);
+                cursor.assign(predecessor_offsets.begin(), predecessor_offsets.end() - 1);
+                for (std::uint32_t b = 0; b < count; b++) {
+                    for (std::uint32_t successor : blocks[b].successors) {
+                        if (successor != NONE) {
+                            predecessors[cursor[successor]++] = b;
+                        }
+                    }
+                }
+            }
+
+            //// Constant folding
+
+            // Folds operations on constants in one scan from the front. A
+            // temporary the scan has just set to a constant counts as one
+            // until a label that another live path reaches, so a chain of
+            // operations folds in one round rather than one per link.
+            std::size_t fold_constants(tacky::Function& function) {
+                std::vector<tacky::Instruction>& code = function.instructions;
+                removed.assign(code.size(), 0);
+                find_backward_targets(function);
+                label_entries.assign(function.labels, 0);
+                known_epochs.assign(function.temporaries, 0);
+                known_values.resize(function.temporaries);
+                epoch = 1;
+                // Whether a path from the entry reaches here along which
+                // the known temporaries are known, and the label the last
+                // such path jumped to.
+                bool live = true;
+                std::uint32_t jumped_to = NONE;
+                std::size_t changes = 0;
+                bool any_removed = false;
+                for (std::size_t i = 0; i < code.size(); i++) {
+                    tacky::Instruction& instruction = code[i];
+                    tacky::Opcode opcode = instruction.opcode;
+                    if (opcode == tacky::Label) {
+                        enter_label(instruction.dst, live, jumped_to);
+                        continue;
+                    }
+                    std::int32_t a;
+                    std::int32_t b = 0;
+                    std::int32_t result;
+                    bool unary = opcode >= tacky::Complement && opcode <= tacky::Not;
+                    bool folded = false;
+                    if ((unary && constant_of(function, instruction.a, live, a))
+                        || (tacky::is_binary(opcode) && constant_of(function, instruction.a, live, a)
+                            && constant_of(function, instruction.b, live, b))) {
+                        if (fold(opcode, a, b, result)) {
+                            instruction = tacky::Instruction { tacky::Copy, instruction.dst,
+                                function.constant(result), tacky::NO_VALUE };
+                            changes++;
+                        }
+                    } else if ((opcode == tacky::JumpIfZero || opcode == tacky::JumpIfNotZero)
+                        && constant_of(function, instruction.a, live, a)) {
+                        if ((a == 0) == (opcode == tacky::JumpIfZero)) {
+                            instruction = tacky::Instruction { tacky::Jump, instruction.dst,
+                                tacky::NO_VALUE, tacky::NO_VALUE };
+                        } else {
+                            removed[i] = 1;
+                            any_removed = true;
+                            folded = true;
+                        }
+                        changes++;
+                    }
+                    if (live && !folded) {
+                        step_constants(function, instruction, live, jumped_to);
+                    }
+                }
+                if (any_removed) {
+                    compact(function);
+                }
+                return changes;
+            }
+
+            // Marks the labels a jump after them goes to: what is known on
+            // the way in says nothing about what comes round again.
+            void find_backward_targets(const tacky::Function& function) {
+                label_flags.assign(function.labels, 0);
+                for (const tacky::Instruction& instruction : function.instructions) {
+                    if (instruction.opcode == tacky::Label) {
+                        label_flags[instruction.dst] |= LABEL_SEEN;
+                    } else if (is_jump(instruction.opcode)
+                        && (label_flags[instruction.dst] & LABEL_SEEN)) {
+                        label_flags[instruction.dst] |= BACKWARD_TARGET;
+                    }
+                }
+            }
+
+            // What is known carries through a label that only the path it
+            // was learned on reaches: falling through from live code no
+            // jump joins, or the one live jump to it having ended that code.
+            void enter_label(std::uint32_t label, bool& live, std::uint32_t& jumped_to) {
+                std::uint32_t jumps = label_entries[label];
+                bool backward = (label_flags[label] & BACKWARD_TARGET) != 0;
+                if (!live && jumps == 0 && !backward) {
+                    return;
+                }
+                bool only_path = !backward && (live ? jumps == 0 : jumps == 1 && jumped_to == label);
+                if (!only_path) {
+                    epoch++;
+                }
+                live = true;
+                jumped_to = NONE;
+            }
+
+            bool constant_of(const tacky::Function& function, tacky::Value value, bool live,
+              std::int32_t& result) {
+                if (tacky::is_constant(value)) {
+                    result = function.constant_value(value);
+                    return true;
+                }
+                if (live && is_temporary(value) && known_epochs[value] == epoch) {
+                    result = known_values[value];
+                    return true;
+                }
+                return false;
+            }
+
+            void step_constants(const tacky::Function& function, const tacky::Instruction& instruction,
+              bool& live, std::uint32_t& jumped_to) {
+                tacky::Opcode opcode = instruction.opcode;
+                std::int32_t value;
+                if (is_jump(opcode)) {
+                    label_entries[instruction.dst]++;
+                    if (opcode == tacky::Jump) {
+                        live = false;
+                        jumped_to = instruction.dst;
+                    }
+                } else if (opcode == tacky::Return) {
+                    live = false;
+                } else if (opcode == tacky::Copy && constant_of(function, instruction.a, true, value)) {
+                    known_values[instruction.dst] = value;
+                    known_epochs[instruction.dst] = epoch;
+                } else if (tacky::writes_dst(opcode)) {
+                    known_epochs[instruction.dst] = 0;
+                }
+            }
+
+            //// Unreachable-code elimination
+
+            // Drops blocks the entry cannot reach, then jumps to the block
+            // that follows anyway, then labels no jump goes to.
+            std::size_t remove_unreachable_code(tacky::Function& function) {
+                std::vector<tacky::Instruction>& code = function.instructions;
+                if (code.empty()) {
+                    return 0;
+                }
+                build_graph(function);
+                std::uint32_t count = (std::uint32_t)blocks.size();
+                reachable.assign(count, 0);
+                reachable[0] = 1;
+                worklist.assign(1, 0);
+                while (!worklist.empty()) {
+                    std::uint32_t b = worklist.back();
+                    worklist.pop_back();
+                    for (std::uint32_t successor : blocks[b].successors) {
+                        if (successor != NONE && !reachable[successor]) {
+                            reachable[successor] = 1;
+                            worklist.push_back(successor);
+                        }
+                    }
+                }
+
+                removed.assign(code.size(), 0);
+                std::size_t changes = 0;
+                std::uint32_t next = NONE;
+                for (std::uint32_t b = count; b-- > 0;) {
+                    const Block& block = blocks[b];
+                    if (!reachable[b]) {
+                        std::memset(&removed[block.begin], 1, block.end - block.begin);
+                        changes += block.end - block.begin;
+                        continue;
+                    }
+                    const tacky::Instruction& last = code[block.end - 1];
+                    if (is_jump(last.opcode) && next != NONE && label_blocks[last.dst] == next) {
+                        removed[block.end - 1] = 1;
+                        changes++;
+                    }
+                    next = b;
+                }
+
+                label_uses.assign(function.labels, 0);
+                for (std::size_t i = 0; i < code.size(); i++) {
+                    if (!removed[i] && is_jump(code[i].opcode)) {
+                        label_uses[code[i].dst]++;
+                    }
+                }
+                for (std::size_t i = 0; i < code.size(); i++) {
+                    if (!removed[i] && code[i].opcode == tacky::Label && label_uses[code[i].dst] == 0) {
+                        removed[i] = 1;
+                        changes++;
+                    }
+                }
+                if (changes > 0) {
+                    compact(function);
+                }
+                return changes;
+            }
+
+            //// Copy propagation
+
+            // Forward dataflow over the copies that reach each point: a
+            // copy x = y reaches until x or y is written again, and a join
+            // keeps the copies that reach along every path.
+            std::size_t propagate_copies(tacky::Function& function) {
+                std::vector<tacky::Instruction>& code = function.instructions;
+                copy_of.assign(code.size(), NONE);
+                copy_dst.clear();
+                copy_src.clear();
+                for (std::size_t i = 0; i < code.size(); i++) {
+                    if (code[i].opcode == tacky::Copy) {
+                        copy_of[i] = (std::uint32_t)copy_dst.size();
+                        copy_dst.push_back(code[i].dst);
+                        copy_src.push_back(code[i].a);
+                    }
+                }
+                std::uint32_t copies = (std::uint32_t)copy_dst.size();
+                if (copies == 0) {
+                    return 0;
+                }
+                index_copies(function.temporaries);
+                build_graph(function);
+
+                std::uint32_t count = (std::uint32_t)blocks.size();
+                words = (copies + 63) / 64;
+                out_sets.assign((std::size_t)count * words, ~(Word)0);
+                in_sets.assign((std::size_t)count * words, 0);
+                current.resize(words);
+                bool changed = true;
+                while (changed) {
+                    changed = false;
+                    for (std::uint32_t b = 0; b < count; b++) {
+                        meet_predecessors(b);
+                        std::memcpy(&in_sets[(std::size_t)b * words], current.data(),
+                            words * sizeof(Word));
+                        for (std::uint32_t i = blocks[b].begin; i < blocks[b].end; i++) {
+                            step_copies(function, i);
+                        }
+                        Word* out = &out_sets[(std::size_t)b * words];
+                        if (std::memcmp(out, current.data(), words * sizeof(Word)) != 0) {
+                            std::memcpy(out, current.data(), words * sizeof(Word));
+                            changed = true;
+                        }
+                    }
+                }
+
+                // Rewrites with the copies as the dataflow saw them: a copy
+                // whose source has since been rewritten still stands for
+                // its original source.
+                removed.assign(code.size(), 0);
+                std::size_t changes = 0;
+                bool any_removed = false;
+                for (std::uint32_t b = 0; b < count; b++) {
+                    std::memcpy(current.data(), &in_sets[(std::size_t)b * words],
+                        words * sizeof(Word));
+                    for (std::uint32_t i = blocks[b].begin; i < blocks[b].end; i++) {
+                        tacky::Instruction& instruction = code[i];
+                        if (instruction.opcode == tacky::Copy && redundant(function, copy_of[i])) {
+                            removed[i] = 1;
+                            any_removed = true;
+                            changes++;
+                            continue;
+                        }
+                        changes += replace(instruction.a) + replace(instruction.b);
+                        step_copies(function, i);
+                    }
+                }
+                if (any_removed) {
+                    compact(function);
+                }
+                return changes;
+            }
+
+            // For each temporary, the copies that mention it, and the copies
+            // into it, as offsets into one array each.
+            void index_copies(std::uint32_t temporaries) {
+                mention_offsets.assign(temporaries + 1, 0);
+                into_offsets.assign(temporaries + 1, 0);
+                std::uint32_t copies = (std::uint32_t)copy_dst.size();
+                for (std::uint32_t c = 0; c < copies; c++) {
+                    mention_offsets[copy_dst[c] + 1]++;
+                    into_offsets[copy_dst[c] + 1]++;
+                    if (is_temporary(copy_src[c]) && copy_src[c] != copy_dst[c]) {
+                        mention_offsets[copy_src[c] + 1]++;
+                    }
+                }
+                for (std::uint32_t t = 0; t < temporaries; t++) {
+                    mention_offsets[t + 1] += mention_offsets[t];
+                    into_offsets[t + 1] += into_offsets[t];
+                }
+                mentions.resize(mention_offsets[temporaries]);
+                into.resize(into_offsets[temporaries]);
+                cursor.assign(mention_offsets.begin(), mention_offsets.end() - 1);
+                for (std::uint32_t c = 0; c < copies; c++) {
+                    mentions[cursor[copy_dst[c]]++] = c;
+                    if (is_temporary(copy_src[c]) && copy_src[c] != copy_dst[c]) {
+                        mentions[cursor[copy_src[c]]++] = c;
+                    }
+                }
+                cursor.assign(into_offsets.begin(), into_offsets.end() - 1);
+                for (std::uint32_t c = 0; c < copies; c++) {
+                    into[cursor[copy_dst[c]]++] = c;
+                }
+            }
+
+            // The entry block starts with nothing reaching it.
+            void meet_predecessors(std::uint32_t b) {
+                std::uint32_t first = predecessor_offsets[b];
+                std::uint32_t last = predecessor_offsets[b + 1];
+                if (b == 0 || first == last) {
+                    std::fill(current.begin(), current.end(), 0);
+                    return;
+                }
+                std::memcpy(current.data(), &out_sets[(std::size_t)predecessors[first] * words],
+                    words * sizeof(Word));
+                for (std::uint32_t p = first + 1; p < last; p++) {
+                    const Word* out = &out_sets[(std::size_t)predecessors[p] * words];
+                    for (std::size_t w = 0; w < words; w++) {
+                        current[w] &= out[w];
+                    }
+                }
+            }
+
+            bool same_value(const tacky::Function& function, tacky::Value a, tacky::Value b) {
+                if (tacky::is_constant(a) && tacky::is_constant(b)) {
+                    return function.constant_value(a) == function.constant_value(b);
+                }
+                return a == b;
+            }
+
+            // Whether copy c only restates what reaching copies already say.
+            bool redundant(const tacky::Function& function, std::uint32_t c) {
+                tacky::Value dst = copy_dst[c];
+                tacky::Value src = copy_src[c];
+                if (src == dst) {
+                    return true;
+                }
+                for (std::uint32_t k = into_offsets[dst]; k < into_offsets[dst + 1]; k++) {
+                    if (test_bit(current.data(), into[k])
+                        && same_value(function, copy_src[into[k]], src)) {
+                        return true;
+                    }
+                }
+                if (is_temporary(src)) {
+                    for (std::uint32_t k = into_offsets[src]; k < into_offsets[src + 1]; k++) {
+                        if (test_bit(current.data(), into[k]) && copy_src[into[k]] == dst) {
+                            return true;
+                        }
+                    }
+                }
+                return false;
+            }
+
+            void kill_copies(tacky::Value temporary) {
+                for (std::uint32_t k = mention_offsets[temporary];
+                  k < mention_offsets[temporary + 1]; k++) {
+                    clear_bit(current.data(), mentions[k]);
+                }
+            }
+
+            void step_copies(const tacky::Function& function, std::uint32_t i) {
+                const tacky::Instruction& instruction = function.instructions[i];
+                if (instruction.opcode == tacky::Copy) {
+                    std::uint32_t c = copy_of[i];
+                    if (!redundant(function, c)) {
+                        kill_copies(copy_dst[c]);
+                        set_bit(current.data(), c);
+                    }
+                } else if (tacky::writes_dst(instruction.opcode)) {
+                    kill_copies(instruction.dst);
+                }
+            }
+
+            // Replaces a use with the source of the copy into it that
+            // reaches here, if there is one.
+            std::size_t replace(tacky::Value& value) {
+                if (!is_temporary(value)) {
+                    return 0;
+                }
+                for (std::uint32_t k = into_offsets[value]; k < into_offsets[value + 1]; k++) {
+                    if (test_bit(current.data(), into[k])) {
+                        value = copy_src[into[k]];
+                        return 1;
+                    }
+                }
+                return 0;
+            }
+
+            //// Dead-store elimination
+
+            // Backward liveness of temporaries; a write to a temporary no
+            // path reads again is dropped. Nothing TACKY writes to has any
+            // other effect.
+            std::size_t remove_dead_stores(tacky::Function& function) {
+                std::vector<tacky::Instruction>& code = function.instructions;
+                if (code.empty() || function.temporaries == 0) {
+                    return 0;
+                }
+                build_graph(function);
+                std::uint32_t count = (std::uint32_t)blocks.size();
+                words = (function.temporaries + 63) / 64;
+                in_sets.assign((std::size_t)count * words, 0);
+                current.resize(words);
+                bool changed = true;
+                while (changed) {
+                    changed = false;
+                    for (std::uint32_t b = count; b-- > 0;) {
+                        join_successors(b);
+                        for (std::uint32_t i = blocks[b].end; i-- > blocks[b].begin;) {
+                            step_liveness(code[i]);
+                        }
+                        Word* in = &in_sets[(std::size_t)b * words];
+                        if (std::memcmp(in, current.data(), words * sizeof(Word)) != 0) {
+                            std::memcpy(in, current.data(), words * sizeof(Word));
+                            changed = true;
+                        }
+                    }
+                }
+
+                removed.assign(code.size(), 0);
+                std::size_t changes = 0;
+                for (std::uint32_t b = 0; b < count; b++) {
+                    join_successors(b);
+                    for (std::uint32_t i = blocks[b].end; i-- > blocks[b].begin;) {
+                        const tacky::Instruction& instruction = code[i];
+                        if (tacky::writes_dst(instruction.opcode)
+                            && !test_bit(current.data(), instruction.dst)) {
+                            removed[i] = 1;
+                            changes++;
+                            continue;
+                        }
+                        step_liveness(instruction);
+                    }
+                }
+                if (changes > 0) {
+                    compact(function);
+                }
+                return changes;
+            }
+
+            void join_successors(std::uint32_t b) {
+                std::fill(current.begin(), current.end(), 0);
+                for (std::uint32_t successor : blocks[b].successors) {
+                    if (successor == NONE) {
+                        continue;
+                    }
+                    const Word* in = &in_sets[(std::size_t)successor * words];
+                    for (std::size_t w = 0; w < words; w++) {
+                        current[w] |= in[w];
+                    }
+                }
+            }
+
+            void step_liveness(const tacky::Instruction& instruction) {
+                if (tacky::writes_dst(instruction.opcode)) {
+                    clear_bit(current.data(), instruction.dst);
+                }
+                if (is_temporary(instruction.a)) {
+                    set_bit(current.data(), instruction.a);
+                }
+                if (is_temporary(instruction.b)) {
+                    set_bit(current.data(), instruction.b);
+                }
+            }
+
+            OptimizerStats& stats;
+
+            std::vector<Block> blocks;
+            std::vector<std::uint32_t> label_blocks;
+            std::vector<std::uint32_t> predecessor_offsets;
+            std::vector<std::uint32_t> predecessors;
+            std::vector<std::uint32_t> cursor;
+            std::vector<std::uint8_t> removed;
+            std::vector<std::uint8_t> reachable;
+            std::vector<std::uint32_t> worklist;
+            std::vector<std::uint32_t> label_uses;
+
+            // Temporaries known to hold a constant while folding: those
+            // whose epoch is the current one.
+            enum LabelFlag { LABEL_SEEN = 1, BACKWARD_TARGET = 2 };
+            std::vector<std::uint8_t> label_flags;
+            std::vector<std::uint32_t> label_entries;
+            std::vector<std::int32_t> known_values;
+            std::vector<std::uint32_t> known_epochs;
+            std::uint32_t epoch;
+
+            std::vector<std::uint32_t> copy_of;
+            std::vector<tacky::Value> copy_dst;
+            std::vector<tacky::Value> copy_src;
+            std::vector<std::uint32_t> mention_offsets;
+            std::vector<std::uint32_t> mentions;
+            std::vector<std::uint32_t> into_offsets;
+            std::vector<std::uint32_t> into;
+
+            // Dataflow sets, words to a block.
+            std::size_t words;
+            std::vector<Word> in_sets;
+            std::vector<Word> out_sets;
+            std::vector<Word> current;
+    };
+}
+
+const char* pass_name(OptimizationPass pass) {
+    return PASS_NAMES[pass];
+}
+
+void optimize_program(tacky::Program& program, OptimizerStats& stats) {
+    TraceScope trace("optimize");
+    AllocationStage stage(OptimizeStage);
+    FunctionOptimizer optimizer(stats);
+    for (tacky::Function& function : program.functions) {
+        optimizer.optimize(function);
+    }
+}
@@ -1,147 +1,433 @@
+#include <cynophobia/allocations.hpp>
+#include <cynophobia/arena.hpp>
+#include <cynophobia/parser.hpp>
 #include <cynophobia/shared.hpp>
+#include <cynophobia/trace.hpp>
 
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
 
+
+// Why parsing stopped. The message is only copied into the output's arena
+// once parsing is over.
+struct ParseError {
+    FilePosition position;
+    std::string  message;
+};
+
+// Either a parsed T or the error that stopped parsing. Results are held by
+// value; tree nodes are passed by index.
 template<typename T>
 class ParseResult {
     public: 
-    size_t next_index;
     bool is_error; 
     union {
-        std::unique_ptr<T> result;
-        ParserOutput::Error error;
+        T result;
+        ParseError error;
     };
     
     // These constructors are defined mostly for brace-initializers to be
     // possible.
-        ParseResult(size_t next_index, ParserOutput::Error parse_error) : 
-            next_index(next_index), is_error(true) {
-            error = parse_error;
+        ParseResult(ParseError parse_error) : is_error(true) {
+            new (&error) ParseError(std::move(parse_error));
         }
 
-        ParseResult(size_t next_index, std::unique_ptr<T> parse_result) :
-            next_index(next_index), is_error(false) {
-            result = std::move(parse_result);
+        ParseResult(T parse_result) : is_error(false) {
+            new (&result) T(std::move(parse_result));
         } 
 
     // This constructor is here so I can soundly return a ParseResult from a
     // function and then store it in a variable.
-        ParseResult(ParseResult&& other) noexcept : 
-            next_index(other.next_index), is_error(other.is_error) {
+        ParseResult(ParseResult&& other) noexcept : is_error(other.is_error) {
             if (other.is_error) {
-                error = other.error;
+                new (&error) ParseError(std::move(other.error));
             } else {
-                result = std::move(other.result); 
+                new (&result) T(std::move(other.result)); 
             }
         }
 
         ~ParseResult() {
             if (is_error) {
-                error.~ParserOutput::Error();
+                error.~ParseError();
             } else {
-                result.~unique_ptr();
+                result.~T();
             }
         }
 };
 
-FilePosition next_char_position(FilePosition current_position, 
-    char next_char, char next_next_char) {
-        switch (next_char) {
-            case '\n':
-                return current_position.start_next_line();
-            case '\v':
-                return current_position.start_next_line();
-            case '\f':
-                return current_position.start_next_line();
-            case '\r':
-                if (next_next_char == (char)0 || (next_next_char != '\n')) {
-                    return current_position.next_column();
-                } else {
-                    return current_position.start_next_line();
-                }
-            default:
-                return current_position.next_column();
+// The parser's non-owning view of the tokens left to parse. Kinds and text
+// are read straight out of the TokenBuffer. The tree refers to tokens by
+// their place in a table of only the tokens it keeps, which goes to the
+// Program's arena once parsing is done.
+class TokenCursor {
+    public:
+        explicit TokenCursor(TokenSpan span) :
+            tokens(*span.tokens), begin(span.begin), end(span.end),
+            index(span.begin) {}
+
+        bool at_end() const { return index >= end; }
+        Token::TokenType kind() const { return tokens.kind(index); }
+        TextView text() const { return tokens.text(index); }
+        // Of the token just advanced past.
+        SymbolId previous_symbol() const { return tokens.symbol(index - 1); }
+        void advance() { index++; }
+
+        // Adds the current token to the kept ones.
+        parsing::TokenIndex keep() {
+            kept_tokens.push_back(tokens.span(index));
+            return (parsing::TokenIndex)(kept_tokens.size() - 1);
         }
-    }
 
-// If current_index is past the end of the tokens vector,
-// returns end of file token. 
-// Possible tradeoff: this implementation will require
-// callers to be aware that this function will not catch
-// the 'out of bounds' argument.
-FilePosition get_current_position(const std::vector<Token> tokens,
-  size_t current_index) {
-    if (current_index >= tokens.size()) {
-        if (tokens.size() == 0) {
-            return { 0, 0 };
+        const std::vector<TextSpan>& kept() const { return kept_tokens; }
+
+        FilePosition position_of(parsing::TokenIndex token) const {
+            return tokens.position_of(kept_tokens[token].offset);
         }
-        
-        Token last_token = tokens[tokens.size() - 1];
-        FilePosition end = last_token.position;
-        std::string text = last_token.text;
-        for (size_t i = 0; i < text.size(); i++) {
-            end = next_char_position(end, text[i], (i + 1 >= text.size()) ? (char)0 : text[i + 1]); 
+
+        // Past the end of the span, the position just past its last token.
+        FilePosition position() const {
+            if (!at_end()) {
+                return tokens.position(index);
+            }
+            if (end == begin) {
+                return { 0, 0 };
+            }
+            TextSpan last_token = tokens.span(end - 1);
+            return tokens.position_of(last_token.offset + last_token.length);
         }
-        return end;
-    } else {
-        return tokens[current_index].position;   
-    }
-  }
 
+    private:
+        const TokenBuffer& tokens;
+        const std::size_t begin;
+        const std::size_t end;
+        std::size_t index;
+        std::vector<TextSpan> kept_tokens;
+};
 
-// If starting_index is beyond tokens, will return an error.
-//  
-ParseResult<parsing::Expression> parse_expression(
-    const std::vector<Token> tokens,
-    size_t starting_index
-) {
-    if (starting_index >= tokens.size()) {
-        return { starting_index, { get_current_position(tokens, starting_index), "reached end of file, expected token"}};
-    } 
-    Token at_position = tokens[starting_index];
-    switch (at_position.token_type) {
-        case Token::Constant: {
-                std::unique_ptr<parsing::Expression> expression(new parsing::Expression {{ tokens[starting_index] } });
-                return { (size_t)(starting_index + 1), std::move(expression) };
-            }
-        default:    
-            return { starting_index, { get_current_position(tokens, starting_index), "expected constant token, found other token \"" + at_position.text + "\""}};
+ParseError error_at(const TokenCursor& cursor, std::string message) {
+    return { cursor.position(), std::move(message) };
+}
+
+namespace {
+    // Binary operators by binding power, loosest first; 0 for any token
+    // that is not one.
+    int precedence(Token::TokenType kind, parsing::BinaryOperator& binary_operator) {
+        switch (kind) {
+            case Token::Asterisk: binary_operator = parsing::Multiply; return 50;
+            case Token::Slash: binary_operator = parsing::Divide; return 50;
+            case Token::Percent: binary_operator = parsing::Remainder; return 50;
+            case Token::Plus: binary_operator = parsing::Add; return 45;
+            case Token::Hyphen: binary_operator = parsing::Subtract; return 45;
+            case Token::Less: binary_operator = parsing::Less; return 35;
+            case Token::LessEqual: binary_operator = parsing::LessOrEqual; return 35;
+            case Token::Greater: binary_operator = parsing::Greater; return 35;
+            case Token::GreaterEqual: binary_operator = parsing::GreaterOrEqual; return 35;
+            case Token::EqualEqual: binary_operator = parsing::Equal; return 30;
+            case Token::BangEqual: binary_operator = parsing::NotEqual; return 30;
+            case Token::LogicalAnd: binary_operator = parsing::And; return 10;
+            case Token::LogicalOr: binary_operator = parsing::Or; return 5;
+            default: return 0;
+        }
+    }
+
+    bool unary_operator(Token::TokenType kind, parsing::UnaryOperator& unary_operator) {
+        switch (kind) {
+            case Token::Tilde: unary_operator = parsing::Complement; return true;
+            case Token::Hyphen: unary_operator = parsing::Negate; return true;
+            case Token::Bang: unary_operator = parsing::Not; return true;
+            default: return false;
+        }
     }
 }
 
-ParseResult<parsing::Statement> parse_statement(
-    const std::vector<Token> tokens,
-    size_t starting_index
+// <exp> ::= <factor> | <exp> <binop> <exp>
+// <factor> ::= <int> | <unop> <factor> | "(" <exp> ")"
+//
+// Precedence climbing without recursion: operators waiting for their
+// right-hand side and subtrees waiting for their operator are kept on
+// two explicit stacks, reused from one expression to the next. Nesting
+// costs heap rather than native stack, and is capped at max_nesting
+// pending operators and parentheses; the time taken is linear in the
+// tokens whatever the depth. A node is appended once its children are,
+// so the function's nodes come out in post-order.
+class ExpressionParser {
+    public:
+        explicit ExpressionParser(std::size_t max_nesting) : max_nesting(max_nesting) {}
+
+        ParseResult<parsing::NodeIndex> parse(TokenCursor& cursor, std::vector<parsing::Node>& nodes) {
+            operators.clear();
+            operands.clear();
+            std::size_t open_parentheses = 0;
+            while (true) {
+                // Unary operators and open parentheses, up to a constant.
+                while (true) {
+                    if (cursor.at_end()) {
+                        return error_at(cursor, "reached end of file, expected expression");
+                    }
+                    Pending pending = { Pending::Parenthesis, 0, 0, 0 };
+                    parsing::UnaryOperator unary;
+                    if (unary_operator(cursor.kind(), unary)) {
+                        pending = Pending { Pending::Unary, 0, unary, cursor.keep() };
+                    } else if (cursor.kind() != Token::OpenParen) {
+                        break;
+                    } else {
+                        open_parentheses++;
+                    }
+                    if (operators.size() >= max_nesting) {
+                        return nested_too_deep(cursor);
+                    }
+                    operators.push_back(pending);
+                    cursor.advance();
+                }
+                if (cursor.kind() != Token::Constant) {
+                    return error_at(cursor, "expected expression, found other token with text: \""
+                        + cursor.text().str() + "\"");
+                }
+                operands.push_back(append(nodes, parsing::Node {
+                    parsing::Node::IntConstant, 0, cursor.keep(), parsing::NO_NODE, parsing::NO_NODE }));
+                cursor.advance();
+
+                // The unary operators before it, and any parentheses it closes.
+                while (true) {
+                    while (!operators.empty() && operators.back().kind == Pending::Unary) {
+                        reduce(nodes);
+                    }
+                    if (open_parentheses == 0 || cursor.at_end() || cursor.kind() != Token::CloseParen) {
+                        break;
+                    }
+                    while (operators.back().kind != Pending::Parenthesis) {
+                        reduce(nodes);
+                    }
+                    operators.pop_back();
+                    open_parentheses--;
+                    cursor.advance();
+                }
+
+                parsing::BinaryOperator binary = parsing::Add;
+                int binding = cursor.at_end() ? 0 : precedence(cursor.kind(), binary);
+                if (binding == 0) {
+                    if (open_parentheses > 0) {
+                        return cursor.at_end()
+                            ? error_at(cursor, "reached end of file, expected \")\"")
+                            : error_at(cursor, "expected \")\", found other token with text: \""
+                                + cursor.text().str() + "\"");
+                    }
+                    while (!operators.empty()) {
+                        reduce(nodes);
+                    }
+                    return operands.back();
+                }
+                // Left-associative: what binds at least as tightly is done.
+                while (!operators.empty() && operators.back().kind == Pending::Binary
+                    && operators.back().precedence >= binding) {
+                    reduce(nodes);
+                }
+                if (operators.size() >= max_nesting) {
+                    return nested_too_deep(cursor);
+                }
+                operators.push_back(Pending { Pending::Binary, binding, binary, cursor.keep() });
+                cursor.advance();
+            }
+        }
+
+    private:
+        struct Pending {
+            enum Kind { Unary, Binary, Parenthesis };
+            Kind kind;
+            int precedence;
+            // A parsing::UnaryOperator or parsing::BinaryOperator.
+            int operation;
+            parsing::TokenIndex token;
+        };
+
+        ParseError nested_too_deep(const TokenCursor& cursor) const {
+            return error_at(cursor, "expression nested more than " + std::to_string(max_nesting)
+                + " levels deep");
+        }
+
+        static parsing::NodeIndex append(std::vector<parsing::Node>& nodes, const parsing::Node& node) {
+            nodes.push_back(node);
+            return (parsing::NodeIndex)(nodes.size() - 1);
+        }
+
+        // Applies the operator on top of the stack to the operands on top
+        // of theirs.
+        void reduce(std::vector<parsing::Node>& nodes) {
+            Pending pending = operators.back();
+            operators.pop_back();
+            if (pending.kind == Pending::Unary) {
+                parsing::NodeIndex& operand = operands.back();
+                operand = append(nodes, parsing::Node { parsing::Node::Unary,
+                    (std::uint8_t)pending.operation, pending.token, operand, parsing::NO_NODE });
+                return;
+            }
+            parsing::NodeIndex right = operands.back();
+            operands.pop_back();
+            parsing::NodeIndex& left = operands.back();
+            left = append(nodes, parsing::Node { parsing::Node::Binary,
+                (std::uint8_t)pending.operation, pending.token, left, right });
+        }
+
+        std::vector<Pending> operators;
+        std::vector<parsing::NodeIndex> operands;
+        const std::size_t max_nesting;
+};
+
+// <statement> ::= "return" <exp> ";"
+ParseResult<parsing::NodeIndex> parse_statement(
+    TokenCursor& cursor,
+    ExpressionParser& expressions,
+    std::vector<parsing::Node>& nodes
 ) {
-    if (starting_index >= tokens.size()) {
-        return { starting_index, { get_current_position(tokens, starting_index), "reached end of file, expected token"}};
+    if (cursor.at_end()) {
+        return error_at(cursor, "reached end of file, expected token");
     } 
-    Token at_position = tokens[starting_index];
-    switch (at_position.token_type) {
+    switch (cursor.kind()) {
         case Token::Return: { 
-                ParseResult<parsing::Expression> return_value = parse_expression(tokens, (size_t) (starting_index + 1));
+                parsing::TokenIndex return_token = cursor.keep();
+                cursor.advance();
+                ParseResult<parsing::NodeIndex> return_value = expressions.parse(cursor, nodes);
                 if (return_value.is_error) {
-                    return { starting_index, return_value.error };
-                } else {
-                    if (return_value.next_index >= tokens.size()) {
-                        return { starting_index, { get_current_position(tokens, starting_index), "reached end of file, after expression expected token"}};
-                    } 
-                    Token after_expression = tokens[return_value.next_index];
-                    switch (after_expression.token_type) {
-                        case Token::Semicolon: {
-                            parsing::ReturnStatement return_statement { at_position, std::move(return_value.result) , after_expression };
-                            std::unique_ptr<parsing::Statement> statement{new parsing::Statement { std::move(return_statement)}};
-                            return { return_value.next_index + 1, std::move(statement) };
-                        }
-                        default: 
-                            return { starting_index, { get_current_position(tokens, starting_index), "reached end of file, after expression expected semicolon"}};
-                    
-                    }
+                    return std::move(return_value.error);
+                }
+                if (cursor.at_end()) {
+                    return ParseError { cursor.position_of(return_token), "reached end of file, after expression expected token" };
+                } 
+                switch (cursor.kind()) {
+                    case Token::Semicolon:
+                        cursor.advance();
+                        nodes.push_back(parsing::Node {
+                            parsing::Node::Return, 0, return_token, return_value.result, parsing::NO_NODE });
+                        return (parsing::NodeIndex)(nodes.size() - 1);
+                    default: 
+                        return ParseError { cursor.position_of(return_token), "reached end of file, after expression expected semicolon" };
                 }
             }
         default:    
-            return { starting_index, { get_current_position(tokens, starting_index), "expected constant token, found other token with text: \"" + at_position.text + "\""}};
+            return error_at(cursor, "expected constant token, found other token with text: \"" + cursor.text().str() + "\"");
     }
 }
 
+// Consumes one token of the given type, or explains what was found instead.
+// Only a kept token gets a TokenIndex; punctuation gets 0.
+ParseResult<parsing::TokenIndex> expect_token(
+    TokenCursor& cursor,
+    Token::TokenType token_type,
+    const char* description,
+    bool keep = false
+) {
+    if (cursor.at_end()) {
+        return error_at(cursor, std::string("reached end of file, expected ") + description);
+    } 
+    if (cursor.kind() != token_type) {
+        return error_at(cursor, std::string("expected ") + description + ", found other token with text: \"" + cursor.text().str() + "\"");
+    }
+    parsing::TokenIndex token = keep ? cursor.keep() : 0;
+    cursor.advance();
+    return token;
+}
 
+// <function> ::= "int" <identifier> "(" "void" ")" "{" <statement> "}"
+//
+// The function's nodes are built up in nodes and then copied to the arena
+// as one array.
+ParseResult<parsing::Function> parse_function(
+    TokenCursor& cursor,
+    Arena& arena,
+    ExpressionParser& expressions,
+    std::vector<parsing::Node>& nodes
+) {
+    ParseResult<parsing::TokenIndex> return_type = expect_token(cursor, Token::Int, "int", true);
+    if (return_type.is_error) {
+        return std::move(return_type.error);
+    }
+    ParseResult<parsing::TokenIndex> identifier = expect_token(cursor, Token::Identifier, "function name", true);
+    if (identifier.is_error) {
+        return std::move(identifier.error);
+    }
+    SymbolId symbol = cursor.previous_symbol();
+    const Token::TokenType before_body[] = { Token::OpenParen, Token::Void, Token::CloseParen, Token::OpenBrace };
+    const char* const before_body_descriptions[] = { "\"(\"", "void", "\")\"", "\"{\"" };
+    for (size_t i = 0; i < 4; i++) {
+        ParseResult<parsing::TokenIndex> punctuation = expect_token(cursor, before_body[i], before_body_descriptions[i]);
+        if (punctuation.is_error) {
+            return std::move(punctuation.error);
+        }
+    }
+    nodes.clear();
+    ParseResult<parsing::NodeIndex> statement = parse_statement(cursor, expressions, nodes);
+    if (statement.is_error) {
+        return std::move(statement.error);
+    }
+    ParseResult<parsing::TokenIndex> close_brace = expect_token(cursor, Token::CloseBrace, "\"}\"");
+    if (close_brace.is_error) {
+        return std::move(close_brace.error);
+    }
+    return parsing::Function { return_type.result, identifier.result, symbol,
+        arena.copy_array(nodes.data(), nodes.size()), (std::uint32_t)nodes.size() };
+}
+
+// <program> ::= <function> { <function> }
+ParserOutput parse_program(
+    TokenSpan tokens,
+    std::shared_ptr<Arena> arena,
+    std::size_t max_nesting
+) {
+    TraceScope trace("parse");
+    AllocationStage stage(ParseStage);
+    if (!arena) {
+        arena = std::make_shared<Arena>();
+    }
+    TokenCursor cursor(tokens);
+    ExpressionParser expressions(max_nesting);
+    std::vector<parsing::Node> nodes;
+    std::unique_ptr<parsing::Program> program(new parsing::Program {});
+    do {
+        ParseResult<parsing::Function> function = parse_function(cursor, *arena, expressions, nodes);
+        if (function.is_error) {
+            TextView message = arena->copy(function.error.message);
+            return ParserOutput(ParserOutput::Error { function.error.position, message },
+                std::move(arena));
+        }
+        program->functions.push_back(function.result);
+    } while (!cursor.at_end());
+    const std::vector<TextSpan>& kept = cursor.kept();
+    program->tokens = arena->copy_array(kept.data(), kept.size());
+    program->token_count = (std::uint32_t)kept.size();
+    program->source = tokens.tokens->source();
+    program->arena = std::move(arena);
+    return ParserOutput(std::move(program));
+}
+
+ParserOutput parse_program(
+    const TokenBuffer& tokens,
+    std::shared_ptr<Arena> arena,
+    std::size_t max_nesting
+) {
+    return parse_program(TokenSpan { &tokens, 0, tokens.size() }, std::move(arena), max_nesting);
+}
+
+ParserOutput parse_program(
+    TokenSpan tokens,
+    std::size_t max_nesting
+) {
+    return parse_program(tokens, nullptr, max_nesting);
+}
 
+ParserOutput parse_program(
+    const TokenBuffer& tokens,
+    std::size_t max_nesting
+) {
+    return parse_program(TokenSpan { &tokens, 0, tokens.size() }, nullptr, max_nesting);
+}
+
+std::size_t node_count(const parsing::Program& program) {
+    std::size_t count = 1;
+    for (const parsing::Function& function : program.functions) {
+        count += 1 + function.node_count;
+    }
+    return count;
+}
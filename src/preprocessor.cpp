@@ -0,0 +1,1853 @@
+#include <cynophobia/allocations.hpp>
+#include <cynophobia/charclass.hpp>
+#include <cynophobia/charstream.hpp>
+#include <cynophobia/debugwriter.hpp>
+#include <cynophobia/preprocessor.hpp>
+#include <cynophobia/symbols.hpp>
+#include <cynophobia/trace.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+std::string PreprocessorError::debug_string() const {
+    return filename + ":" + std::to_string(line) + ": error: " + message;
+}
+
+namespace {
+    // gcc's limit.
+    const unsigned int MAX_INCLUDE_DEPTH = 200;
+
+    struct PPToken {
+        enum Kind : std::uint8_t {
+            Identifier,
+            Number,
+            Character,
+            String,
+            Punctuator,
+            HeaderName,   // <name>, only right after #include
+            Other,        // any other character, or an unterminated literal
+            Placemarker   // an empty argument next to ##; never output
+        };
+        Kind kind;
+        // Whitespace or a comment came before it.
+        bool space_before;
+        // First on its line, so a # here starts a directive.
+        bool line_start;
+        // Physical line in its file, from 1.
+        std::uint32_t line;
+        // The macros it must not be expanded by (see Hidesets).
+        std::uint32_t hideset;
+        // Interned name of an Identifier, NO_SYMBOL for anything else.
+        SymbolId symbol;
+        TextView text;
+    };
+
+    // Names the preprocessor looks for. They are interned first, in this
+    // order, so each one's SymbolId is its enumerator.
+    enum Name : SymbolId {
+        Define, Undef, Include, If, Ifdef, Ifndef, Elif, Else, Endif, Line,
+        Error, Warning, Pragma, Once, Defined, VaArgs, NAME_COUNT
+    };
+
+    const char* const NAME_TEXT[] = {
+        "define", "undef", "include", "if", "ifdef", "ifndef", "elif", "else", "endif",
+        "line", "error", "warning", "pragma", "once", "defined", "__VA_ARGS__"
+    };
+
+    // Longest first, so the first match is the maximal munch.
+    const char* const PUNCTUATORS[] = {
+        "%:%:", "...", "<<=", ">>=",
+        "->", "++", "--", "<<", ">>", "<=", ">=", "==", "!=", "&&", "||", "*=", "/=",
+        "%=", "+=", "-=", "&=", "^=", "|=", "##", "<:", ":>", "<%", "%>", "%:",
+        "[", "]", "(", ")", "{", "}", ".", "&", "*", "+", "-", "~", "!", "/", "%",
+        "<", ">", "^", "|", "?", ":", ";", "=", ",", "#"
+    };
+
+    bool spelled(const PPToken& token, const char* text) {
+        return token.text.size == std::strlen(text)
+            && std::memcmp(token.text.data, text, token.text.size) == 0;
+    }
+
+    // %: and %:%: are the digraphs of # and ##.
+    bool is_hash(const PPToken& token) {
+        return token.kind == PPToken::Punctuator && (spelled(token, "#") || spelled(token, "%:"));
+    }
+
+    bool is_hashhash(const PPToken& token) {
+        return token.kind == PPToken::Punctuator
+            && (spelled(token, "##") || spelled(token, "%:%:"));
+    }
+
+    bool is_identifier_char(char c) {
+        return charclass::is(c, charclass::WORD) || c == '$' || (unsigned char)c >= 0x80;
+    }
+
+    bool is_digit(char c) {
+        return charclass::is(c, charclass::DIGIT);
+    }
+
+    bool is_punctuator_prefix(const char* text, std::size_t size) {
+        for (const char* punctuator : PUNCTUATORS) {
+            if (std::strncmp(punctuator, text, size) == 0 && std::strlen(punctuator) >= size) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::string spell(const PPToken* begin, const PPToken* end) {
+        std::string text;
+        for (const PPToken* token = begin; token != end; token++) {
+            if (token != begin && token->space_before) {
+                text += ' ';
+            }
+            text.append(token->text.data, token->text.size);
+        }
+        return text;
+    }
+
+    // Walks source text with line splices (backslash-newline) removed, as
+    // translation phase 2 would, counting physical lines.
+    class Scanner {
+        public:
+            Scanner(const char* begin, const char* end) :
+                p(begin), end(end), start(begin), line(1), spliced(false) {}
+
+            bool at_end() {
+                skip_splices();
+                return p == end;
+            }
+
+            // The character k places ahead, or '\0' past the end.
+            char look(std::size_t k = 0) {
+                if ((std::size_t)(end - p) > k && std::memchr(p, '\\', k + 1) == nullptr) {
+                    return p[k];
+                }
+                skip_splices();
+                const char* q = p;
+                while (q != end) {
+                    std::size_t splice = splice_length(q);
+                    if (splice > 0) {
+                        q += splice;
+                    } else if (k == 0) {
+                        return *q;
+                    } else {
+                        q++;
+                        k--;
+                    }
+                }
+                return '\0';
+            }
+
+            void advance() {
+                skip_splices();
+                if (p != end) {
+                    if (*p == '\n' || (*p == '\r' && (p + 1 == end || p[1] != '\n'))) {
+                        line++;
+                    }
+                    p++;
+                }
+            }
+
+            void begin_token() {
+                skip_splices();
+                start = p;
+                spliced = false;
+            }
+
+            // The text since begin_token, spliced back together if it had
+            // to be.
+            TextView token_text(std::deque<std::string>& pool) {
+                if (!spliced) {
+                    return { start, (std::size_t)(p - start) };
+                }
+                std::string text;
+                for (const char* q = start; q != p; ) {
+                    std::size_t splice = splice_length(q);
+                    if (splice > 0) {
+                        q += splice;
+                    } else {
+                        text += *q++;
+                    }
+                }
+                pool.push_back(std::move(text));
+                return { pool.back().data(), pool.back().size() };
+            }
+
+            std::uint32_t current_line() const { return line; }
+
+        private:
+            std::size_t splice_length(const char* q) const {
+                if (*q != '\\' || q + 1 == end) {
+                    return 0;
+                }
+                if (q[1] == '\n') {
+                    return 2;
+                }
+                if (q[1] == '\r') {
+                    return q + 2 != end && q[2] == '\n' ? 3 : 2;
+                }
+                return 0;
+            }
+
+            void skip_splices() {
+                while (p != end && *p == '\\') {
+                    std::size_t splice = splice_length(p);
+                    if (splice == 0) {
+                        break;
+                    }
+                    p += splice;
+                    line++;
+                    spliced = true;
+                }
+            }
+
+            const char* p;
+            const char* const end;
+            const char* start;
+            std::uint32_t line;
+            bool spliced;
+    };
+
+    // Consumes a character or string literal whose opening quote is next.
+    // An unterminated one takes the rest of the line, as an Other token.
+    PPToken::Kind scan_literal(Scanner& scanner, char quote) {
+        scanner.advance();
+        while (true) {
+            char c = scanner.look();
+            if (scanner.at_end() || c == '\n' || c == '\r') {
+                return PPToken::Other;
+            }
+            scanner.advance();
+            if (c == quote) {
+                return quote == '"' ? PPToken::String : PPToken::Character;
+            }
+            if (c == '\\' && !scanner.at_end()) {
+                char escaped = scanner.look();
+                if (escaped == '\n' || escaped == '\r') {
+                    return PPToken::Other;
+                }
+                scanner.advance();
+            }
+        }
+    }
+
+    // Splits text into preprocessing tokens (C17 5.1.1.2, phases 1 to 3):
+    // comments become whitespace, and line breaks only set line_start.
+    // Returns the line of an unterminated comment, or 0.
+    std::uint32_t tokenize(const char* text, std::size_t size, SymbolTable& symbols,
+      std::deque<std::string>& pool, std::vector<PPToken>& tokens) {
+        Scanner scanner(text, text + size);
+        bool line_start = true;
+        bool space = false;
+        // 1 after a # that starts a line, 2 after #include, where <...> is
+        // a header name.
+        int include_state = 0;
+        std::uint32_t unterminated_comment = 0;
+        while (!scanner.at_end()) {
+            char c = scanner.look();
+            if (c == '\n' || c == '\r') {
+                scanner.advance();
+                line_start = true;
+                space = false;
+                include_state = 0;
+                continue;
+            }
+            if (c == ' ' || c == '\t' || c == '\v' || c == '\f') {
+                scanner.advance();
+                space = true;
+                continue;
+            }
+            if (c == '/' && scanner.look(1) == '/') {
+                while (!scanner.at_end() && (c = scanner.look()) != '\n' && c != '\r') {
+                    scanner.advance();
+                }
+                space = true;
+                continue;
+            }
+            if (c == '/' && scanner.look(1) == '*') {
+                std::uint32_t comment_line = scanner.current_line();
+                scanner.advance();
+                scanner.advance();
+                while (true) {
+                    if (scanner.at_end()) {
+                        unterminated_comment = comment_line;
+                        break;
+                    }
+                    if (scanner.look() == '*' && scanner.look(1) == '/') {
+                        scanner.advance();
+                        scanner.advance();
+                        break;
+                    }
+                    scanner.advance();
+                }
+                space = true;
+                continue;
+            }
+
+            PPToken token = { PPToken::Other, space, line_start, scanner.current_line(), 0,
+                NO_SYMBOL, { "", 0 } };
+            scanner.begin_token();
+            std::size_t header_end = 0;
+            if (include_state == 2 && c == '<') {
+                for (std::size_t k = 1; ; k++) {
+                    char h = scanner.look(k);
+                    if (h == '>') {
+                        header_end = k + 1;
+                        break;
+                    }
+                    if (h == '\0' || h == '\n' || h == '\r') {
+                        break;
+                    }
+                }
+            }
+            if (header_end > 0) {
+                for (std::size_t k = 0; k < header_end; k++) {
+                    scanner.advance();
+                }
+                token.kind = PPToken::HeaderName;
+            } else if (is_identifier_char(c) && !is_digit(c)) {
+                std::size_t length = 0;
+                char first = c;
+                char second = '\0';
+                while (is_identifier_char(c = scanner.look())) {
+                    if (length == 1) {
+                        second = c;
+                    }
+                    scanner.advance();
+                    length++;
+                }
+                // Encoding prefixes: L'x', u"x", u8"x" and so on.
+                bool prefix = (length == 1 && (first == 'L' || first == 'u' || first == 'U'))
+                    || (length == 2 && first == 'u' && second == '8');
+                if (prefix && (c == '"' || (c == '\'' && length == 1))) {
+                    token.kind = scan_literal(scanner, c);
+                } else {
+                    token.kind = PPToken::Identifier;
+                }
+            } else if (is_digit(c) || (c == '.' && is_digit(scanner.look(1)))) {
+                // pp-number: [.]?[0-9]([0-9a-zA-Z_.]|[eEpP][+-])*
+                char previous = c;
+                scanner.advance();
+                while (true) {
+                    c = scanner.look();
+                    if (is_identifier_char(c) || c == '.'
+                        || ((c == '+' || c == '-') && std::strchr("eEpP", previous) != nullptr)) {
+                        scanner.advance();
+                        previous = c;
+                    } else {
+                        break;
+                    }
+                }
+                token.kind = PPToken::Number;
+            } else if (c == '"' || c == '\'') {
+                token.kind = scan_literal(scanner, c);
+            } else {
+                token.kind = PPToken::Other;
+                for (const char* punctuator : PUNCTUATORS) {
+                    if (punctuator[0] != c) {
+                        continue;
+                    }
+                    std::size_t length = std::strlen(punctuator);
+                    std::size_t k = 1;
+                    while (k < length && scanner.look(k) == punctuator[k]) {
+                        k++;
+                    }
+                    if (k == length) {
+                        for (k = 0; k < length; k++) {
+                            scanner.advance();
+                        }
+                        token.kind = PPToken::Punctuator;
+                        break;
+                    }
+                }
+                if (token.kind == PPToken::Other) {
+                    scanner.advance();
+                }
+            }
+            if (token.kind == PPToken::Other && (c == '"' || c == '\'')) {
+                // The rest of an unterminated literal's line.
+                while (!scanner.at_end() && (c = scanner.look()) != '\n' && c != '\r') {
+                    scanner.advance();
+                }
+            }
+            token.text = scanner.token_text(pool);
+            if (token.kind == PPToken::Identifier) {
+                token.symbol = symbols.intern(token.text.data, token.text.size);
+            }
+
+            if (line_start && is_hash(token)) {
+                include_state = 1;
+            } else if (include_state == 1 && token.symbol == Include) {
+                include_state = 2;
+            } else {
+                include_state = 0;
+            }
+            tokens.push_back(token);
+            line_start = false;
+            space = false;
+        }
+        return unterminated_comment;
+    }
+
+    // Sets of macro names, for Prosser's expansion algorithm: a token that
+    // came out of expanding a macro carries that macro in its hideset and
+    // is not expanded by it again. Sets are interned, so equal sets have
+    // equal ids; 0 is the empty set, which almost every token has.
+    class Hidesets {
+        public:
+            Hidesets() : sets(1) {}
+
+            bool contains(std::uint32_t set, SymbolId symbol) const {
+                const std::vector<SymbolId>& members = sets[set];
+                return std::binary_search(members.begin(), members.end(), symbol);
+            }
+
+            std::uint32_t add(std::uint32_t set, SymbolId symbol) {
+                std::uint64_t key = (std::uint64_t)set << 32 | symbol;
+                auto found = added.find(key);
+                if (found != added.end()) {
+                    return found->second;
+                }
+                std::vector<SymbolId> members = sets[set];
+                members.insert(std::lower_bound(members.begin(), members.end(), symbol), symbol);
+                std::uint32_t id = intern(members);
+                added.emplace(key, id);
+                return id;
+            }
+
+            std::uint32_t unite(std::uint32_t a, std::uint32_t b) {
+                if (a == b || b == 0) {
+                    return a;
+                } else if (a == 0) {
+                    return b;
+                }
+                std::uint64_t key = (std::uint64_t)a << 32 | b;
+                auto found = united.find(key);
+                if (found != united.end()) {
+                    return found->second;
+                }
+                std::vector<SymbolId> members;
+                std::set_union(sets[a].begin(), sets[a].end(), sets[b].begin(), sets[b].end(),
+                    std::back_inserter(members));
+                std::uint32_t id = intern(members);
+                united.emplace(key, id);
+                return id;
+            }
+
+            std::uint32_t intersect(std::uint32_t a, std::uint32_t b) {
+                if (a == b) {
+                    return a;
+                } else if (a == 0 || b == 0) {
+                    return 0;
+                }
+                std::vector<SymbolId> members;
+                std::set_intersection(sets[a].begin(), sets[a].end(),
+                    sets[b].begin(), sets[b].end(), std::back_inserter(members));
+                return intern(members);
+            }
+
+        private:
+            std::uint32_t intern(const std::vector<SymbolId>& members) {
+                std::string key((const char*)members.data(), members.size() * sizeof(SymbolId));
+                auto found = ids.find(key);
+                if (found != ids.end()) {
+                    return found->second;
+                }
+                std::uint32_t id = (std::uint32_t)sets.size();
+                sets.push_back(members);
+                ids.emplace(std::move(key), id);
+                return id;
+            }
+
+            std::vector<std::vector<SymbolId>> sets;
+            std::unordered_map<std::string, std::uint32_t> ids;
+            std::unordered_map<std::uint64_t, std::uint32_t> added;
+            std::unordered_map<std::uint64_t, std::uint32_t> united;
+    };
+
+    struct Macro {
+        enum Kind : std::uint8_t {
+            Undefined,
+            ObjectLike,
+            FunctionLike,
+            FileName,     // __FILE__
+            LineNumber    // __LINE__
+        };
+        Kind kind;
+        bool variadic;
+        // __VA_ARGS__ last when variadic.
+        std::vector<SymbolId> parameters;
+        std::vector<PPToken> body;
+        // For each body token, the parameter it names, or -1.
+        std::vector<int> parameter_of;
+    };
+
+    struct SourceFile {
+        std::string path;
+        // Searched first by #include "..." in this file; empty for the
+        // working directory.
+        std::string directory;
+        std::shared_ptr<const SourceBuffer> buffer;
+        std::vector<PPToken> tokens;
+        std::uint32_t unterminated_comment;
+        // The macro guarding the whole file (see find_include_guard).
+        SymbolId guard;
+        bool pragma_once;
+        bool included;
+    };
+
+    // The macro G when the file is #ifndef G or #if !defined G, then
+    // anything without an #else or #elif at the outer level, then the
+    // matching #endif with nothing after it. Once G is defined, including
+    // the file again yields nothing.
+    SymbolId find_include_guard(const std::vector<PPToken>& tokens) {
+        std::size_t size = tokens.size();
+        auto ends_line = [&](std::size_t i) { return i == size || tokens[i].line_start; };
+        auto is_name = [&](std::size_t i, SymbolId name) {
+            return i < size && !tokens[i].line_start && tokens[i].symbol == name;
+        };
+        auto is_text = [&](std::size_t i, const char* text) {
+            return i < size && !tokens[i].line_start && spelled(tokens[i], text);
+        };
+        auto is_identifier = [&](std::size_t i) {
+            return i < size && !tokens[i].line_start && tokens[i].kind == PPToken::Identifier;
+        };
+        if (size == 0 || !is_hash(tokens[0])) {
+            return NO_SYMBOL;
+        }
+
+        SymbolId guard = NO_SYMBOL;
+        std::size_t i = 0;
+        if (is_name(1, Ifndef) && is_identifier(2) && ends_line(3)) {
+            guard = tokens[2].symbol;
+            i = 3;
+        } else if (is_name(1, If) && is_text(2, "!") && is_name(3, Defined)) {
+            if (is_identifier(4) && ends_line(5)) {
+                guard = tokens[4].symbol;
+                i = 5;
+            } else if (is_text(4, "(") && is_identifier(5) && is_text(6, ")") && ends_line(7)) {
+                guard = tokens[5].symbol;
+                i = 7;
+            }
+        }
+        if (guard == NO_SYMBOL) {
+            return NO_SYMBOL;
+        }
+
+        int depth = 0;
+        for (; i < size; i++) {
+            if (!tokens[i].line_start || !is_hash(tokens[i]) || !is_identifier(i + 1)) {
+                continue;
+            }
+            SymbolId directive = tokens[i + 1].symbol;
+            if (directive == If || directive == Ifdef || directive == Ifndef) {
+                depth++;
+            } else if ((directive == Else || directive == Elif) && depth == 0) {
+                return NO_SYMBOL;
+            } else if (directive == Endif) {
+                if (depth > 0) {
+                    depth--;
+                    continue;
+                }
+                std::size_t next = i + 2;
+                while (!ends_line(next)) {
+                    next++;
+                }
+                return next == size ? guard : NO_SYMBOL;
+            }
+        }
+        return NO_SYMBOL;
+    }
+
+    // Where the next token comes from: tokens pushed back by macro
+    // expansion first, then a file's tokens, if any.
+    class Reader {
+        public:
+            explicit Reader(const std::vector<PPToken>* file_tokens) :
+                file_tokens(file_tokens), next(0), line(0) {}
+
+            const PPToken* peek() const {
+                if (!pending.empty()) {
+                    return &pending.back();
+                } else if (file_tokens && next < file_tokens->size()) {
+                    return &(*file_tokens)[next];
+                }
+                return nullptr;
+            }
+
+            PPToken take() {
+                if (!pending.empty()) {
+                    PPToken token = pending.back();
+                    pending.pop_back();
+                    return token;
+                }
+                line = (*file_tokens)[next].line;
+                return (*file_tokens)[next++];
+            }
+
+            // Reads tokens, first to last, before anything else.
+            void push(const std::vector<PPToken>& tokens) {
+                pending.insert(pending.end(), tokens.rbegin(), tokens.rend());
+            }
+
+            bool expanding() const { return !pending.empty(); }
+
+            const std::vector<PPToken>* const file_tokens;
+            // Into file_tokens.
+            std::size_t next;
+            // Of the last token taken from the file.
+            std::uint32_t line;
+
+        private:
+            // Next token last.
+            std::vector<PPToken> pending;
+    };
+
+    // Evaluates a #if expression once its macros are expanded and defined
+    // is replaced (C17 6.10.1): integer arithmetic in intmax_t and
+    // uintmax_t, in which any identifier left is 0.
+    class Condition {
+        public:
+            Condition(const std::vector<PPToken>& tokens) : tokens(tokens), index(0) {}
+
+            // False, with message set, for a malformed expression.
+            bool evaluate(bool& result, std::string& error) {
+                Value value = { 0, false };
+                if (tokens.empty()) {
+                    error = "#if with no expression";
+                    return false;
+                }
+                bool ok = conditional(value, true);
+                if (ok && index < tokens.size()) {
+                    message = "missing binary operator before token \""
+                        + tokens[index].text.str() + "\"";
+                    ok = false;
+                }
+                error = message;
+                result = value.bits != 0;
+                return ok;
+            }
+
+        private:
+            struct Value {
+                std::uint64_t bits;
+                bool is_unsigned;
+            };
+
+            static Value signed_value(std::int64_t value) {
+                return { (std::uint64_t)value, false };
+            }
+
+            bool at(const char* text) const {
+                return index < tokens.size() && tokens[index].kind == PPToken::Punctuator
+                    && spelled(tokens[index], text);
+            }
+
+            bool fail(const std::string& text) {
+                if (message.empty()) {
+                    message = text;
+                }
+                return false;
+            }
+
+            // Where live is false the value is never used, so dividing by
+            // zero there is no error (1 || 1 / 0).
+            bool conditional(Value& value, bool live) {
+                if (!binary(value, 1, live)) {
+                    return false;
+                }
+                if (!at("?")) {
+                    return true;
+                }
+                index++;
+                bool condition = value.bits != 0;
+                Value if_true;
+                Value if_false;
+                if (!conditional(if_true, live && condition)) {
+                    return false;
+                }
+                if (!at(":")) {
+                    return fail("'?' without following ':'");
+                }
+                index++;
+                if (!conditional(if_false, live && !condition)) {
+                    return false;
+                }
+                value = condition ? if_true : if_false;
+                value.is_unsigned = if_true.is_unsigned || if_false.is_unsigned;
+                return true;
+            }
+
+            int precedence() const {
+                static const char* const LEVELS[][4] = {
+                    { "||" }, { "&&" }, { "|" }, { "^" }, { "&" }, { "==", "!=" },
+                    { "<", ">", "<=", ">=" }, { "<<", ">>" }, { "+", "-" }, { "*", "/", "%" }
+                };
+                for (int level = 0; level < 10; level++) {
+                    for (const char* op : LEVELS[level]) {
+                        if (op && at(op)) {
+                            return level + 1;
+                        }
+                    }
+                }
+                return 0;
+            }
+
+            bool binary(Value& value, int min_precedence, bool live) {
+                if (!unary(value, live)) {
+                    return false;
+                }
+                while (true) {
+                    int level = precedence();
+                    if (level < min_precedence || level == 0) {
+                        return true;
+                    }
+                    std::string op = tokens[index++].text.str();
+                    bool right_live = live;
+                    if (op == "&&") {
+                        right_live = live && value.bits != 0;
+                    } else if (op == "||") {
+                        right_live = live && value.bits == 0;
+                    }
+                    Value right;
+                    if (!binary(right, level + 1, right_live) || !apply(op, value, right, live)) {
+                        return false;
+                    }
+                }
+            }
+
+            bool apply(const std::string& op, Value& left, const Value& right, bool live) {
+                if (op == "&&" || op == "||") {
+                    bool result = op == "&&" ? left.bits != 0 && right.bits != 0
+                        : left.bits != 0 || right.bits != 0;
+                    left = signed_value(result);
+                    return true;
+                }
+                if (op == "<<" || op == ">>") {
+                    // The type of the left operand; shifting by too much
+                    // or a negative amount is undefined in C, 0 or -1 here.
+                    std::int64_t amount = (std::int64_t)right.bits;
+                    bool leftward = (op == "<<") == (right.is_unsigned || amount >= 0);
+                    std::uint64_t distance = right.is_unsigned || amount >= 0
+                        ? right.bits : (std::uint64_t)0 - right.bits;
+                    bool negative = !left.is_unsigned && (std::int64_t)left.bits < 0;
+                    if (distance >= 64) {
+                        left.bits = !leftward && negative ? ~(std::uint64_t)0 : 0;
+                    } else if (leftward) {
+                        left.bits <<= distance;
+                    } else if (negative) {
+                        left.bits = ~(~left.bits >> distance);
+                    } else {
+                        left.bits >>= distance;
+                    }
+                    return true;
+                }
+
+                bool is_unsigned = left.is_unsigned || right.is_unsigned;
+                std::uint64_t a = left.bits;
+                std::uint64_t b = right.bits;
+                std::int64_t sa = (std::int64_t)a;
+                std::int64_t sb = (std::int64_t)b;
+                if (op == "==" || op == "!=" || op == "<" || op == ">" || op == "<=" || op == ">=") {
+                    bool less = is_unsigned ? a < b : sa < sb;
+                    bool greater = is_unsigned ? a > b : sa > sb;
+                    bool result = op == "==" ? a == b : op == "!=" ? a != b
+                        : op == "<" ? less : op == ">" ? greater
+                        : op == "<=" ? !greater : !less;
+                    left = signed_value(result);
+                    return true;
+                }
+                std::uint64_t result = 0;
+                if (op == "+") {
+                    result = a + b;
+                } else if (op == "-") {
+                    result = a - b;
+                } else if (op == "*") {
+                    result = a * b;
+                } else if (op == "/" || op == "%") {
+                    if (b == 0) {
+                        if (live) {
+                            return fail("division by zero in #if");
+                        }
+                    } else if (is_unsigned) {
+                        result = op == "/" ? a / b : a % b;
+                    } else if (sa == INT64_MIN && sb == -1) {
+                        result = op == "/" ? a : 0;
+                    } else {
+                        result = (std::uint64_t)(op == "/" ? sa / sb : sa % sb);
+                    }
+                } else if (op == "&") {
+                    result = a & b;
+                } else if (op == "^") {
+                    result = a ^ b;
+                } else if (op == "|") {
+                    result = a | b;
+                }
+                left = { result, is_unsigned };
+                return true;
+            }
+
+            bool unary(Value& value, bool live) {
+                if (index == tokens.size()) {
+                    return fail("#if with no expression");
+                }
+                if (at("+") || at("-") || at("~") || at("!")) {
+                    char op = tokens[index++].text.data[0];
+                    if (!unary(value, live)) {
+                        return false;
+                    }
+                    if (op == '-') {
+                        value.bits = (std::uint64_t)0 - value.bits;
+                    } else if (op == '~') {
+                        value.bits = ~value.bits;
+                    } else if (op == '!') {
+                        value = signed_value(value.bits == 0);
+                    }
+                    return true;
+                }
+                if (at("(")) {
+                    index++;
+                    if (!conditional(value, live)) {
+                        return false;
+                    }
+                    if (!at(")")) {
+                        return fail("missing ')' in expression");
+                    }
+                    index++;
+                    return true;
+                }
+                const PPToken& token = tokens[index++];
+                if (token.kind == PPToken::Number) {
+                    return integer(token, value);
+                } else if (token.kind == PPToken::Character) {
+                    return character(token, value);
+                } else if (token.kind == PPToken::Identifier) {
+                    value = signed_value(0);
+                    return true;
+                }
+                return fail("token \"" + token.text.str() + "\" is not valid in preprocessor expressions");
+            }
+
+            bool integer(const PPToken& token, Value& value) {
+                const char* p = token.text.data;
+                const char* end = p + token.text.size;
+                unsigned int base = 10;
+                if (end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+                    base = 16;
+                    p += 2;
+                } else if (end - p > 2 && p[0] == '0' && (p[1] == 'b' || p[1] == 'B')) {
+                    base = 2;
+                    p += 2;
+                } else if (p[0] == '0') {
+                    base = 8;
+                }
+                std::uint64_t bits = 0;
+                bool overflow = false;
+                for (; p != end; p++) {
+                    char c = *p;
+                    unsigned int digit = is_digit(c) ? (unsigned int)(c - '0')
+                        : (c >= 'a' && c <= 'f') ? (unsigned int)(c - 'a' + 10)
+                        : (c >= 'A' && c <= 'F') ? (unsigned int)(c - 'A' + 10) : 16;
+                    if (digit >= base) {
+                        break;
+                    }
+                    overflow = overflow || bits > (UINT64_MAX - digit) / base;
+                    bits = bits * base + digit;
+                }
+                // Suffixes: u and l or ll, either way round, in any case.
+                std::string suffix(p, end);
+                std::string lower = suffix;
+                std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+                bool is_unsigned = lower.find('u') != std::string::npos;
+                std::string length = lower;
+                length.erase(std::remove(length.begin(), length.end(), 'u'), length.end());
+                bool valid_suffix = (lower.size() - length.size() <= 1)
+                    && (length.empty() || length == "l"
+                        || (length == "ll" && suffix.find("lL") == std::string::npos
+                            && suffix.find("Ll") == std::string::npos));
+                if (suffix.find_first_of(".eEpP") != std::string::npos && base != 16) {
+                    return fail("floating constant in preprocessor expression");
+                }
+                if (!valid_suffix) {
+                    return fail("invalid integer constant \"" + token.text.str() + "\" in #if");
+                }
+                if (overflow) {
+                    return fail("integer constant \"" + token.text.str() + "\" is too large");
+                }
+                value = { bits, is_unsigned || bits > (std::uint64_t)INT64_MAX };
+                return true;
+            }
+
+            // An int, as on x86-64: plain char is signed, and each further
+            // character of a multi-character constant shifts in 8 bits.
+            bool character(const PPToken& token, Value& value) {
+                const char* p = token.text.data;
+                const char* end = p + token.text.size - 1;
+                bool wide = *p != '\'';
+                while (*p != '\'') {
+                    p++;
+                }
+                p++;
+                std::uint32_t bits = 0;
+                std::size_t count = 0;
+                while (p < end) {
+                    std::uint32_t c = (unsigned char)*p++;
+                    if (c == '\\' && p < end) {
+                        c = (unsigned char)*p++;
+                        const char* simple = std::strchr("n\nt\tv\vb\br\rf\fa\a", (int)c);
+                        if (simple && c != 0 && (simple - "n\nt\tv\vb\br\rf\fa\a") % 2 == 0) {
+                            c = (unsigned char)simple[1];
+                        } else if (c == 'x') {
+                            c = 0;
+                            while (p < end && std::isxdigit((unsigned char)*p)) {
+                                char h = *p++;
+                                c = c * 16 + (std::uint32_t)(is_digit(h) ? h - '0'
+                                    : (h | 0x20) - 'a' + 10);
+                            }
+                        } else if (c >= '0' && c <= '7') {
+                            c -= '0';
+                            for (int digits = 1; digits < 3 && p < end && *p >= '0' && *p <= '7'; digits++) {
+                                c = c * 8 + (std::uint32_t)(*p++ - '0');
+                            }
+                        }
+                    }
+                    bits = wide ? c : bits << 8 | (c & 0xFF);
+                    count++;
+                }
+                if (count == 0) {
+                    return fail("empty character constant");
+                }
+                std::int64_t result = !wide && count == 1 ? (std::int64_t)(signed char)bits
+                    : (std::int64_t)(std::int32_t)bits;
+                value = signed_value(result);
+                return true;
+            }
+
+            const std::vector<PPToken>& tokens;
+            std::size_t index;
+            std::string message;
+    };
+
+    // One file being preprocessed, as far as #line and conditionals go.
+    struct Inclusion {
+        struct Conditional {
+            std::uint32_t line;
+            // Some group of it was taken already.
+            bool taken;
+            bool seen_else;
+        };
+
+        SourceFile* file;
+        // __FILE__, and what errors are reported against.
+        std::string presumed_name;
+        // Presumed line minus physical line, after #line.
+        std::int64_t line_offset;
+        std::vector<Conditional> conditionals;
+    };
+
+    std::string directory_of(const std::string& path) {
+        std::size_t slash = path.rfind('/');
+        return slash == std::string::npos ? std::string()
+            : slash == 0 ? std::string("/") : path.substr(0, slash);
+    }
+
+    // Lexically, so the same file reached as a.h and ./a.h is one file.
+    std::string normalize_path(std::string path) {
+        std::size_t dot;
+        while ((dot = path.find("/./")) != std::string::npos) {
+            path.erase(dot, 2);
+        }
+        while (path.size() > 2 && path.compare(0, 2, "./") == 0) {
+            path.erase(0, 2);
+        }
+        return path;
+    }
+
+    std::string quote(const std::string& text) {
+        std::string quoted = "\"";
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                quoted += '\\';
+            }
+            quoted += c;
+        }
+        return quoted + "\"";
+    }
+
+    // What __DATE__ and __TIME__ say for the whole run.
+    struct BuildTime {
+        std::string date;
+        std::string time;
+
+        BuildTime() {
+            std::time_t now = std::time(nullptr);
+            char text[32];
+            if (std::strftime(text, sizeof(text), "\"%b %e %Y\"", std::localtime(&now)) > 0) {
+                date = text;
+            } else {
+                date = "\"??? ?? ????\"";
+            }
+            if (std::strftime(text, sizeof(text), "\"%H:%M:%S\"", std::localtime(&now)) > 0) {
+                time = text;
+            } else {
+                time = "\"??:??:??\"";
+            }
+        }
+    };
+
+    class Preprocessor {
+        public:
+            Preprocessor(const PreprocessorOptions& options, PreprocessorOutput& output) :
+                options(options), output(output), current(nullptr), file_reader(nullptr),
+                depth(0), writer(output.text), line_has_tokens(false) {
+                for (const char* name : NAME_TEXT) {
+                    symbols.intern(name, std::strlen(name));
+                }
+                static const BuildTime build_time;
+                define_text("__STDC__ 1");
+                define_text("__STDC_VERSION__ 201710L");
+                define_text("__STDC_HOSTED__ 1");
+                define_text("__DATE__ " + build_time.date);
+                define_text("__TIME__ " + build_time.time);
+                slot("__FILE__").kind = Macro::FileName;
+                slot("__LINE__").kind = Macro::LineNumber;
+                for (const std::string& definition : options.definitions) {
+                    std::string text = definition;
+                    std::size_t equals = text.find('=');
+                    if (equals == std::string::npos) {
+                        text += " 1";
+                    } else {
+                        text[equals] = ' ';
+                    }
+                    define_text(text);
+                }
+            }
+
+            // Reads and tokenizes a file, or finds it already read; null
+            // if it cannot be opened.
+            SourceFile* load(const std::string& path) {
+                std::string normal = normalize_path(path);
+                auto found = files_by_path.find(normal);
+                if (found != files_by_path.end()) {
+                    return found->second;
+                }
+                std::shared_ptr<const MappedFile> mapped = std::make_shared<MappedFile>(normal);
+                if (!mapped->was_opened()) {
+                    return nullptr;
+                }
+                return add_file(normal, mapped);
+            }
+
+            SourceFile* add_file(const std::string& path, std::shared_ptr<const SourceBuffer> buffer) {
+                files.push_back(SourceFile());
+                SourceFile& file = files.back();
+                file.path = path;
+                file.directory = directory_of(path);
+                file.buffer = std::move(buffer);
+                file.unterminated_comment = tokenize(file.buffer->data(), file.buffer->size(),
+                    symbols, pool, file.tokens);
+                file.guard = find_include_guard(file.tokens);
+                file.pragma_once = false;
+                file.included = false;
+                files_by_path.emplace(path, &file);
+                output.files_read++;
+                output.bytes_read += file.buffer->size();
+                return &file;
+            }
+
+            void run(SourceFile& file) {
+                run_file(file);
+                if (line_has_tokens) {
+                    writer.write_char('\n');
+                }
+                writer.flush();
+            }
+
+        private:
+            Preprocessor(const Preprocessor&);
+            Preprocessor& operator=(const Preprocessor&);
+
+            void error(std::uint32_t line, const std::string& message) {
+                if (current) {
+                    output.errors.push_back({ current->presumed_name,
+                        (unsigned int)(line + current->line_offset), message });
+                } else {
+                    output.errors.push_back({ "<command-line>", 1, message });
+                }
+            }
+
+            Macro& slot(SymbolId symbol) {
+                if (symbol >= macros.size()) {
+                    macros.resize(symbols.size() > symbol ? symbols.size() : symbol + 1);
+                }
+                return macros[symbol];
+            }
+
+            Macro& slot(const char* name) {
+                return slot(symbols.intern(name, std::strlen(name)));
+            }
+
+            const Macro* macro_for(SymbolId symbol) const {
+                return symbol < macros.size() && macros[symbol].kind != Macro::Undefined
+                    ? &macros[symbol] : nullptr;
+            }
+
+            TextView keep(std::string text) {
+                pool.push_back(std::move(text));
+                return { pool.back().data(), pool.back().size() };
+            }
+
+            void define_text(const std::string& text) {
+                TextView kept = keep(text);
+                std::vector<PPToken> tokens;
+                tokenize(kept.data, kept.size, symbols, pool, tokens);
+                define(tokens.data(), tokens.data() + tokens.size(), 0);
+            }
+
+            void run_file(SourceFile& file) {
+                Inclusion inclusion = { &file, file.path, 0, {} };
+                Inclusion* outer = current;
+                Reader* outer_reader = file_reader;
+                Reader reader(&file.tokens);
+                current = &inclusion;
+                file_reader = &reader;
+                depth++;
+                // Before anything in it runs, for #pragma once in a file
+                // that includes itself.
+                file.included = true;
+                if (file.unterminated_comment > 0) {
+                    error(file.unterminated_comment, "unterminated comment");
+                }
+
+                while (const PPToken* next = reader.peek()) {
+                    if (!reader.expanding() && next->line_start && is_hash(*next)) {
+                        directive(reader);
+                        continue;
+                    }
+                    PPToken token = reader.take();
+                    if (!expand(reader, token)) {
+                        emit(token);
+                    }
+                }
+
+                for (const Inclusion::Conditional& conditional : inclusion.conditionals) {
+                    error(conditional.line, "unterminated conditional directive");
+                }
+                depth--;
+                current = outer;
+                file_reader = outer_reader;
+            }
+
+            // Writes a token with a space before it where it had one, or
+            // where it would otherwise run into the last token written.
+            void emit(const PPToken& token) {
+                if (line_has_tokens) {
+                    if (token.line_start) {
+                        writer.write_char('\n');
+                    } else if (token.space_before || could_paste(token)) {
+                        writer.write_char(' ');
+                    }
+                }
+                writer.write(token.text);
+                last_kind = token.kind;
+                last_text = token.text;
+                line_has_tokens = true;
+            }
+
+            bool could_paste(const PPToken& next) const {
+                char a = last_text.data[last_text.size - 1];
+                char b = next.text.data[0];
+                if (last_kind == PPToken::Identifier || last_kind == PPToken::Number) {
+                    return is_identifier_char(b)
+                        || (last_kind == PPToken::Number && (b == '.'
+                            || ((b == '+' || b == '-') && std::strchr("eEpP", a) != nullptr)))
+                        || (last_kind == PPToken::Identifier
+                            && (next.kind == PPToken::String || next.kind == PPToken::Character));
+                }
+                if (last_kind != PPToken::Punctuator) {
+                    return false;
+                }
+                if ((a == '.' && is_digit(b)) || (a == '/' && (b == '/' || b == '*'))) {
+                    return true;
+                }
+                char joined[8];
+                std::size_t size = last_text.size < 7 ? last_text.size : 7;
+                std::memcpy(joined, last_text.data, size);
+                joined[size] = b;
+                return next.kind == PPToken::Punctuator && is_punctuator_prefix(joined, size + 1);
+            }
+
+            // Replaces a macro name with its expansion, pushed back onto
+            // the reader to be rescanned. False if name is not a macro
+            // here: not defined, hidden, or function-like without a (.
+            bool expand(Reader& reader, const PPToken& name) {
+                if (name.kind != PPToken::Identifier) {
+                    return false;
+                }
+                const Macro* macro = macro_for(name.symbol);
+                if (!macro || hidesets.contains(name.hideset, name.symbol)) {
+                    return false;
+                }
+
+                std::vector<PPToken> result;
+                std::uint32_t hideset = 0;
+                if (macro->kind == Macro::FileName || macro->kind == Macro::LineNumber) {
+                    PPToken token = name;
+                    if (macro->kind == Macro::FileName) {
+                        token.kind = PPToken::String;
+                        token.text = keep(quote(current->presumed_name));
+                    } else {
+                        token.kind = PPToken::Number;
+                        token.text = keep(std::to_string(file_reader->line + current->line_offset));
+                    }
+                    token.symbol = NO_SYMBOL;
+                    result.push_back(token);
+                } else if (macro->kind == Macro::ObjectLike) {
+                    std::vector<std::vector<PPToken>> no_arguments;
+                    substitute(*macro, no_arguments, result);
+                    hideset = hidesets.add(name.hideset, name.symbol);
+                } else {
+                    const PPToken* next = reader.peek();
+                    if (!next || next->kind != PPToken::Punctuator || !spelled(*next, "(")) {
+                        return false;
+                    }
+                    std::vector<std::vector<PPToken>> arguments;
+                    std::uint32_t close_hideset = 0;
+                    if (!collect_arguments(reader, *macro, name, arguments, close_hideset)) {
+                        return true;
+                    }
+                    substitute(*macro, arguments, result);
+                    hideset = hidesets.add(hidesets.intersect(name.hideset, close_hideset),
+                        name.symbol);
+                }
+
+                for (PPToken& token : result) {
+                    token.hideset = hidesets.unite(token.hideset, hideset);
+                }
+                if (!result.empty()) {
+                    result[0].space_before = name.space_before;
+                    result[0].line_start = name.line_start;
+                }
+                reader.push(result);
+                return true;
+            }
+
+            bool collect_arguments(Reader& reader, const Macro& macro, const PPToken& name,
+              std::vector<std::vector<PPToken>>& arguments, std::uint32_t& close_hideset) {
+                reader.take();
+                arguments.assign(1, std::vector<PPToken>());
+                int nesting = 0;
+                while (true) {
+                    if (!reader.peek()) {
+                        error(name.line, "unterminated argument list invoking macro \""
+                            + symbols.str(name.symbol) + "\"");
+                        return false;
+                    }
+                    PPToken token = reader.take();
+                    if (token.line_start) {
+                        token.line_start = false;
+                        token.space_before = true;
+                    }
+                    if (token.kind == PPToken::Punctuator) {
+                        if (spelled(token, "(")) {
+                            nesting++;
+                        } else if (spelled(token, ")")) {
+                            if (nesting == 0) {
+                                close_hideset = token.hideset;
+                                break;
+                            }
+                            nesting--;
+                        } else if (spelled(token, ",") && nesting == 0
+                            && !(macro.variadic && arguments.size() == macro.parameters.size())) {
+                            arguments.push_back(std::vector<PPToken>());
+                            continue;
+                        }
+                    }
+                    arguments.back().push_back(token);
+                }
+
+                std::size_t wanted = macro.parameters.size();
+                if (wanted == 0 && arguments.size() == 1 && arguments[0].empty()) {
+                    arguments.clear();
+                } else if (macro.variadic && arguments.size() + 1 == wanted) {
+                    arguments.push_back(std::vector<PPToken>());
+                }
+                if (arguments.size() != wanted) {
+                    std::string macro_name = "macro \"" + symbols.str(name.symbol) + "\" ";
+                    error(name.line, arguments.size() < wanted
+                        ? macro_name + "requires " + std::to_string(wanted)
+                            + " arguments, but only " + std::to_string(arguments.size()) + " given"
+                        : macro_name + "passed " + std::to_string(arguments.size())
+                            + " arguments, but takes just " + std::to_string(wanted));
+                    return false;
+                }
+                return true;
+            }
+
+            // The replacement list with its parameters replaced (C17
+            // 6.10.3.1 to 6.10.3.3), not yet rescanned.
+            void substitute(const Macro& macro, const std::vector<std::vector<PPToken>>& arguments,
+              std::vector<PPToken>& result) {
+                std::vector<std::vector<PPToken>> expanded(arguments.size());
+                std::vector<bool> is_expanded(arguments.size(), false);
+                const std::vector<PPToken>& body = macro.body;
+                for (std::size_t i = 0; i < body.size(); i++) {
+                    const PPToken& token = body[i];
+                    int parameter = macro.parameter_of[i];
+                    if (macro.kind == Macro::FunctionLike && is_hash(token)) {
+                        result.push_back(stringize(arguments[macro.parameter_of[++i]], token));
+                    } else if (is_hashhash(token)) {
+                        const PPToken& right = body[++i];
+                        int right_parameter = macro.parameter_of[i];
+                        if (right_parameter < 0) {
+                            PPToken operand = right;
+                            if (macro.kind == Macro::FunctionLike && is_hash(right)) {
+                                operand = stringize(arguments[macro.parameter_of[++i]], right);
+                            }
+                            paste(result, operand);
+                            continue;
+                        }
+                        const std::vector<PPToken>& argument = arguments[right_parameter];
+                        // gcc's , ## __VA_ARGS__, which drops the comma when
+                        // there are no variable arguments.
+                        bool comma = macro.variadic
+                            && right_parameter + 1 == (int)macro.parameters.size()
+                            && !result.empty() && spelled(result.back(), ",");
+                        if (comma && argument.empty()) {
+                            result.pop_back();
+                        } else if (comma) {
+                            append(result, argument, right.space_before);
+                        } else if (!argument.empty()) {
+                            paste(result, argument[0]);
+                            result.insert(result.end(), argument.begin() + 1, argument.end());
+                        }
+                    } else if (parameter >= 0) {
+                        bool pasted = i + 1 < body.size() && is_hashhash(body[i + 1]);
+                        if (pasted) {
+                            if (arguments[parameter].empty()) {
+                                PPToken placemarker = token;
+                                placemarker.kind = PPToken::Placemarker;
+                                placemarker.text = { "", 0 };
+                                placemarker.symbol = NO_SYMBOL;
+                                result.push_back(placemarker);
+                            } else {
+                                append(result, arguments[parameter], token.space_before);
+                            }
+                        } else {
+                            if (!is_expanded[parameter]) {
+                                expanded[parameter] = expand_all(arguments[parameter]);
+                                is_expanded[parameter] = true;
+                            }
+                            append(result, expanded[parameter], token.space_before);
+                        }
+                    } else {
+                        result.push_back(token);
+                    }
+                }
+                result.erase(std::remove_if(result.begin(), result.end(), [](const PPToken& token) {
+                    return token.kind == PPToken::Placemarker;
+                }), result.end());
+            }
+
+            static void append(std::vector<PPToken>& result, const std::vector<PPToken>& tokens,
+              bool space_before) {
+                std::size_t first = result.size();
+                result.insert(result.end(), tokens.begin(), tokens.end());
+                if (first < result.size()) {
+                    result[first].space_before = space_before;
+                }
+            }
+
+            PPToken stringize(const std::vector<PPToken>& argument, const PPToken& hash) {
+                std::string text = "\"";
+                for (std::size_t i = 0; i < argument.size(); i++) {
+                    const PPToken& token = argument[i];
+                    if (i > 0 && token.space_before) {
+                        text += ' ';
+                    }
+                    bool literal = token.kind == PPToken::String || token.kind == PPToken::Character;
+                    for (std::size_t k = 0; k < token.text.size; k++) {
+                        char c = token.text.data[k];
+                        if (literal && (c == '"' || c == '\\')) {
+                            text += '\\';
+                        }
+                        text += c;
+                    }
+                }
+                text += '"';
+                PPToken token = hash;
+                token.kind = PPToken::String;
+                token.text = keep(text);
+                token.symbol = NO_SYMBOL;
+                token.hideset = 0;
+                return token;
+            }
+
+            // Pastes right onto the last token of result (C17 6.10.3.3).
+            void paste(std::vector<PPToken>& result, const PPToken& right) {
+                if (result.empty() || result.back().kind == PPToken::Placemarker) {
+                    if (!result.empty()) {
+                        bool space_before = result.back().space_before;
+                        result.back() = right;
+                        result.back().space_before = space_before;
+                    } else {
+                        result.push_back(right);
+                    }
+                    return;
+                }
+                if (right.kind == PPToken::Placemarker) {
+                    return;
+                }
+                PPToken& left = result.back();
+                TextView joined = keep(left.text.str() + right.text.str());
+                std::vector<PPToken> tokens;
+                std::deque<std::string> spliced;
+                tokenize(joined.data, joined.size, symbols, spliced, tokens);
+                if (tokens.size() != 1 || tokens[0].text.size != joined.size) {
+                    error(file_reader->line, "pasting \"" + left.text.str() + "\" and \""
+                        + right.text.str() + "\" does not give a valid preprocessing token");
+                    result.push_back(right);
+                    return;
+                }
+                left.kind = tokens[0].kind;
+                left.symbol = tokens[0].symbol;
+                left.text = joined;
+            }
+
+            // Expands tokens on their own, as an argument is before it is
+            // substituted (C17 6.10.3.1).
+            std::vector<PPToken> expand_all(const std::vector<PPToken>& tokens) {
+                Reader reader(nullptr);
+                reader.push(tokens);
+                std::vector<PPToken> result;
+                while (reader.peek()) {
+                    PPToken token = reader.take();
+                    if (!expand(reader, token)) {
+                        result.push_back(token);
+                    }
+                }
+                return result;
+            }
+
+            // Handles the directive whose # is the reader's next token.
+            void directive(Reader& reader) {
+                const std::vector<PPToken>& tokens = *reader.file_tokens;
+                std::size_t hash = reader.next;
+                std::size_t end = hash + 1;
+                while (end < tokens.size() && !tokens[end].line_start) {
+                    end++;
+                }
+                reader.next = end;
+                reader.line = tokens[end - 1].line;
+                std::uint32_t line = tokens[hash].line;
+                const PPToken* begin = tokens.data() + hash + 1;
+                const PPToken* last = tokens.data() + end;
+                if (begin == last) {
+                    return;
+                }
+                const PPToken& name = *begin++;
+                if (line_has_tokens) {
+                    writer.write_char('\n');
+                    line_has_tokens = false;
+                }
+
+                if (name.kind == PPToken::Number) {
+                    // A line marker, # 12 "file.c" 1, from preprocessed input.
+                    line_directive(begin - 1, last, reader.line, true);
+                    return;
+                }
+                SymbolId directive = name.kind == PPToken::Identifier ? name.symbol : NO_SYMBOL;
+                std::vector<Inclusion::Conditional>& conditionals = current->conditionals;
+                switch (directive) {
+                    case Define:
+                        define(begin, last, line);
+                        break;
+                    case Undef:
+                        if (begin == last || begin->kind != PPToken::Identifier) {
+                            error(line, "macro names must be identifiers");
+                        } else if (begin->symbol < macros.size()) {
+                            macros[begin->symbol] = Macro();
+                        }
+                        break;
+                    case Include:
+                        include(begin, last, line);
+                        break;
+                    case If:
+                    case Ifdef:
+                    case Ifndef: {
+                        bool taken;
+                        if (directive == If) {
+                            taken = condition(begin, last, line);
+                        } else if (begin == last || begin->kind != PPToken::Identifier) {
+                            error(line, std::string("no macro name given in #")
+                                + NAME_TEXT[directive] + " directive");
+                            taken = false;
+                        } else {
+                            taken = (macro_for(begin->symbol) != nullptr) == (directive == Ifdef);
+                        }
+                        conditionals.push_back({ line, taken, false });
+                        if (!taken) {
+                            skip_group(reader);
+                        }
+                        break;
+                    }
+                    case Elif:
+                    case Else: {
+                        if (conditionals.empty()) {
+                            error(line, std::string("#") + NAME_TEXT[directive] + " without #if");
+                            break;
+                        }
+                        Inclusion::Conditional& conditional = conditionals.back();
+                        if (conditional.seen_else) {
+                            error(line, std::string("#") + NAME_TEXT[directive] + " after #else");
+                        }
+                        conditional.seen_else = conditional.seen_else || directive == Else;
+                        if (conditional.taken) {
+                            skip_group(reader);
+                        } else if (directive == Else || condition(begin, last, line)) {
+                            conditional.taken = true;
+                        } else {
+                            skip_group(reader);
+                        }
+                        break;
+                    }
+                    case Endif:
+                        if (conditionals.empty()) {
+                            error(line, "#endif without #if");
+                        } else {
+                            conditionals.pop_back();
+                        }
+                        break;
+                    case Line:
+                        line_directive(begin, last, reader.line, false);
+                        break;
+                    case Error:
+                        error(line, "#error " + spell(begin, last));
+                        break;
+                    case Warning:
+                        // No warnings are reported at all yet.
+                        break;
+                    case Pragma:
+                        if (last - begin == 1 && begin->symbol == Once) {
+                            current->file->pragma_once = true;
+                        } else {
+                            // Left for the compiler, as gcc -E does.
+                            writer.write("#pragma ");
+                            writer.write(spell(begin, last));
+                            writer.write_char('\n');
+                        }
+                        break;
+                    default:
+                        error(line, "invalid preprocessing directive #" + name.text.str());
+                        break;
+                }
+            }
+
+            // Skips to the #elif, #else or #endif that ends the group the
+            // reader is in, leaving it as the next token.
+            void skip_group(Reader& reader) {
+                const std::vector<PPToken>& tokens = *reader.file_tokens;
+                int nesting = 0;
+                for (; reader.next < tokens.size(); reader.next++) {
+                    std::size_t i = reader.next;
+                    if (!tokens[i].line_start || !is_hash(tokens[i]) || i + 1 == tokens.size()
+                        || tokens[i + 1].line_start || tokens[i + 1].kind != PPToken::Identifier) {
+                        continue;
+                    }
+                    SymbolId directive = tokens[i + 1].symbol;
+                    if (directive == If || directive == Ifdef || directive == Ifndef) {
+                        nesting++;
+                    } else if (directive == Endif && nesting > 0) {
+                        nesting--;
+                    } else if ((directive == Endif || directive == Elif || directive == Else)
+                        && nesting == 0) {
+                        return;
+                    }
+                }
+            }
+
+            void define(const PPToken* begin, const PPToken* end, std::uint32_t line) {
+                if (begin == end) {
+                    error(line, "no macro name given in #define directive");
+                    return;
+                } else if (begin->kind != PPToken::Identifier) {
+                    error(line, "macro names must be identifiers");
+                    return;
+                } else if (begin->symbol == Defined) {
+                    error(line, "\"defined\" cannot be used as a macro name");
+                    return;
+                }
+                SymbolId name = begin->symbol;
+                Macro macro;
+                macro.kind = Macro::ObjectLike;
+                macro.variadic = false;
+                const PPToken* p = begin + 1;
+                if (p != end && spelled(*p, "(") && !p->space_before) {
+                    macro.kind = Macro::FunctionLike;
+                    p++;
+                    bool closed = p != end && spelled(*p, ")");
+                    while (!closed) {
+                        if (p == end) {
+                            error(line, "missing ')' in macro parameter list");
+                            return;
+                        } else if (spelled(*p, "...")) {
+                            macro.variadic = true;
+                            macro.parameters.push_back(VaArgs);
+                        } else if (p->kind != PPToken::Identifier || p->symbol == VaArgs) {
+                            error(line, "expected parameter name, found \"" + p->text.str() + "\"");
+                            return;
+                        } else if (std::find(macro.parameters.begin(), macro.parameters.end(),
+                            p->symbol) != macro.parameters.end()) {
+                            error(line, "duplicate macro parameter \"" + p->text.str() + "\"");
+                            return;
+                        } else {
+                            macro.parameters.push_back(p->symbol);
+                        }
+                        p++;
+                        if (p != end && spelled(*p, ")")) {
+                            closed = true;
+                        } else if (p == end || macro.variadic || !spelled(*p, ",")) {
+                            error(line, "expected ',' or ')' in macro parameter list");
+                            return;
+                        } else {
+                            p++;
+                        }
+                    }
+                    p++;
+                }
+
+                macro.body.assign(p, end);
+                for (const PPToken& token : macro.body) {
+                    auto parameter = std::find(macro.parameters.begin(), macro.parameters.end(),
+                        token.symbol);
+                    macro.parameter_of.push_back(token.kind == PPToken::Identifier
+                        && parameter != macro.parameters.end()
+                        ? (int)(parameter - macro.parameters.begin()) : -1);
+                }
+                if (!macro.body.empty()) {
+                    macro.body[0].space_before = false;
+                    if (is_hashhash(macro.body.front()) || is_hashhash(macro.body.back())) {
+                        error(line, "'##' cannot appear at either end of a macro expansion");
+                        return;
+                    }
+                }
+                for (std::size_t i = 0; macro.kind == Macro::FunctionLike && i < macro.body.size(); i++) {
+                    if (is_hash(macro.body[i])
+                        && (i + 1 == macro.body.size() || macro.parameter_of[i + 1] < 0)) {
+                        error(line, "'#' is not followed by a macro parameter");
+                        return;
+                    }
+                }
+                slot(name) = std::move(macro);
+            }
+
+            void include(const PPToken* begin, const PPToken* end, std::uint32_t line) {
+                std::string name;
+                bool angled = false;
+                std::vector<PPToken> expanded;
+                if (begin != end && (begin->kind == PPToken::HeaderName
+                    || (begin->kind == PPToken::String && begin->text.data[0] == '"'))) {
+                    angled = begin->kind == PPToken::HeaderName;
+                    name.assign(begin->text.data + 1, begin->text.size - 2);
+                } else {
+                    expanded = expand_all(std::vector<PPToken>(begin, end));
+                    if (!expanded.empty() && expanded[0].kind == PPToken::String
+                        && expanded[0].text.data[0] == '"') {
+                        name.assign(expanded[0].text.data + 1, expanded[0].text.size - 2);
+                    } else if (!expanded.empty() && spelled(expanded[0], "<")) {
+                        auto close = std::find_if(expanded.begin(), expanded.end(),
+                            [](const PPToken& token) { return spelled(token, ">"); });
+                        if (close != expanded.end()) {
+                            angled = true;
+                            std::string spelling = spell(expanded.data(),
+                                expanded.data() + (close - expanded.begin()) + 1);
+                            name = spelling.substr(1, spelling.size() - 2);
+                        }
+                    }
+                    if (!angled && name.empty()) {
+                        error(line, "#include expects \"FILENAME\" or <FILENAME>");
+                        return;
+                    }
+                }
+                if (depth >= MAX_INCLUDE_DEPTH) {
+                    error(line, "#include nested depth " + std::to_string(depth)
+                        + " exceeds maximum of " + std::to_string(MAX_INCLUDE_DEPTH));
+                    return;
+                }
+
+                SourceFile* file = find_include(name, angled);
+                if (!file) {
+                    error(line, name + ": No such file or directory");
+                    return;
+                }
+                if ((file->pragma_once && file->included)
+                    || (file->guard != NO_SYMBOL && macro_for(file->guard))) {
+                    output.includes_skipped++;
+                    return;
+                }
+                run_file(*file);
+            }
+
+            // Resolutions are cached by spelling and by the directory "..."
+            // looks in first, so asking again touches no file at all.
+            SourceFile* find_include(const std::string& name, bool angled) {
+                const std::string& directory = current->file->directory;
+                std::string key = angled ? "<" + name : directory + "\"" + name;
+                auto found = resolved.find(key);
+                if (found != resolved.end()) {
+                    return found->second;
+                }
+
+                SourceFile* file = nullptr;
+                if (!name.empty() && name[0] == '/') {
+                    file = load(name);
+                } else {
+                    if (!angled) {
+                        file = load(directory.empty() ? name : directory + "/" + name);
+                    }
+                    for (std::size_t i = 0; !file && i < options.include_directories.size(); i++) {
+                        const std::string& search = options.include_directories[i];
+                        file = load(search.empty() ? name : search + "/" + name);
+                    }
+                }
+                resolved.emplace(key, file);
+                return file;
+            }
+
+            bool condition(const PPToken* begin, const PPToken* end, std::uint32_t line) {
+                // defined is evaluated before anything is expanded.
+                std::vector<PPToken> tokens;
+                for (const PPToken* p = begin; p != end; p++) {
+                    if (p->kind != PPToken::Identifier || p->symbol != Defined) {
+                        tokens.push_back(*p);
+                        continue;
+                    }
+                    bool parenthesized = p + 1 != end && spelled(p[1], "(");
+                    const PPToken* operand = p + (parenthesized ? 2 : 1);
+                    if (operand >= end || operand->kind != PPToken::Identifier) {
+                        error(line, "operator \"defined\" requires an identifier");
+                        return false;
+                    }
+                    if (parenthesized && (operand + 1 == end || !spelled(operand[1], ")"))) {
+                        error(line, "missing ')' after \"defined\"");
+                        return false;
+                    }
+                    PPToken value = *p;
+                    value.kind = PPToken::Number;
+                    value.text = macro_for(operand->symbol) ? TextView { "1", 1 } : TextView { "0", 1 };
+                    value.symbol = NO_SYMBOL;
+                    tokens.push_back(value);
+                    p = operand + (parenthesized ? 1 : 0);
+                }
+
+                bool result = false;
+                std::string message;
+                if (!Condition(expand_all(tokens)).evaluate(result, message)) {
+                    error(line, message);
+                    return false;
+                }
+                return result;
+            }
+
+            // #line 12 "name", or a line marker. end_line is the physical
+            // line the directive ends on.
+            void line_directive(const PPToken* begin, const PPToken* end, std::uint32_t end_line,
+              bool marker) {
+                std::vector<PPToken> tokens = marker ? std::vector<PPToken>(begin, end)
+                    : expand_all(std::vector<PPToken>(begin, end));
+                std::uint64_t number = 0;
+                bool valid = !tokens.empty() && tokens[0].kind == PPToken::Number;
+                for (std::size_t k = 0; valid && k < tokens[0].text.size; k++) {
+                    char c = tokens[0].text.data[k];
+                    valid = is_digit(c) && number < 0x7FFFFFFF;
+                    number = number * 10 + (std::uint64_t)(c - '0');
+                }
+                if (!valid) {
+                    error(end_line, "\"" + (tokens.empty() ? std::string() : tokens[0].text.str())
+                        + "\" after #line is not a positive integer");
+                    return;
+                }
+                if (tokens.size() > 1) {
+                    const PPToken& file_name = tokens[1];
+                    if (file_name.kind != PPToken::String || file_name.text.data[0] != '"') {
+                        error(end_line, "invalid filename \"" + file_name.text.str() + "\"");
+                        return;
+                    }
+                    std::string presumed;
+                    for (std::size_t k = 1; k + 1 < file_name.text.size; k++) {
+                        char c = file_name.text.data[k];
+                        if (c == '\\' && k + 2 < file_name.text.size) {
+                            c = file_name.text.data[++k];
+                        }
+                        presumed += c;
+                    }
+                    current->presumed_name = presumed;
+                }
+                current->line_offset = (std::int64_t)number - (std::int64_t)(end_line + 1);
+            }
+
+            const PreprocessorOptions& options;
+            PreprocessorOutput& output;
+
+            SymbolTable symbols;
+            // Indexed by SymbolId.
+            std::vector<Macro> macros;
+            Hidesets hidesets;
+            // Text of tokens that are not in any file as they are spelled.
+            std::deque<std::string> pool;
+
+            std::deque<SourceFile> files;
+            std::unordered_map<std::string, SourceFile*> files_by_path;
+            std::unordered_map<std::string, SourceFile*> resolved;
+
+            Inclusion* current;
+            Reader* file_reader;
+            unsigned int depth;
+
+            DebugWriter writer;
+            bool line_has_tokens;
+            PPToken::Kind last_kind;
+            TextView last_text;
+    };
+
+    PreprocessorOutput preprocess(const std::string& filename,
+      std::shared_ptr<const SourceBuffer> text, const PreprocessorOptions& options) {
+        TraceScope trace("preprocess", filename.c_str());
+        AllocationStage stage(PreprocessStage);
+        PreprocessorOutput output = {};
+        {
+            Preprocessor preprocessor(options, output);
+            SourceFile* file = text ? preprocessor.add_file(filename, std::move(text))
+                : preprocessor.load(filename);
+            if (file) {
+                preprocessor.run(*file);
+            } else {
+                output.open_failed = true;
+            }
+        }
+        return output;
+    }
+}
+
+PreprocessorOutput preprocess_file(const std::string& filename,
+  const PreprocessorOptions& options) {
+    return preprocess(filename, nullptr, options);
+}
+
+PreprocessorOutput preprocess_string(std::string text, const std::string& filename,
+  const PreprocessorOptions& options) {
+    return preprocess(filename, std::make_shared<OwnedString>(std::move(text)), options);
+}
@@ -0,0 +1,336 @@
+#include <cynophobia/server.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+    // Anything larger is not a command line.
+    const std::uint32_t MAX_ARGUMENTS = 1 << 16;
+    const std::uint32_t MAX_STRING = 1 << 20;
+
+    void put_u32(char* bytes, std::uint32_t value) {
+        bytes[0] = (char)(value & 0xFF);
+        bytes[1] = (char)((value >> 8) & 0xFF);
+        bytes[2] = (char)((value >> 16) & 0xFF);
+        bytes[3] = (char)((value >> 24) & 0xFF);
+    }
+
+    std::uint32_t get_u32(const char* bytes) {
+        return (std::uint32_t)(unsigned char)bytes[0]
+            | (std::uint32_t)(unsigned char)bytes[1] << 8
+            | (std::uint32_t)(unsigned char)bytes[2] << 16
+            | (std::uint32_t)(unsigned char)bytes[3] << 24;
+    }
+
+    bool send_all(int fd, const char* bytes, std::size_t size) {
+        while (size > 0) {
+            ssize_t count = send(fd, bytes, size, MSG_NOSIGNAL);
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                return false;
+            }
+            bytes += count;
+            size -= (std::size_t)count;
+        }
+        return true;
+    }
+
+    bool receive_all(int fd, char* bytes, std::size_t size) {
+        while (size > 0) {
+            ssize_t count = recv(fd, bytes, size, 0);
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                return false;
+            }
+            bytes += count;
+            size -= (std::size_t)count;
+        }
+        return true;
+    }
+
+    bool send_string(int fd, const std::string& text) {
+        char size[4];
+        put_u32(size, (std::uint32_t)text.size());
+        return send_all(fd, size, 4) && send_all(fd, text.data(), text.size());
+    }
+
+    bool receive_string(int fd, std::string& text) {
+        char size[4];
+        if (!receive_all(fd, size, 4) || get_u32(size) > MAX_STRING) {
+            return false;
+        }
+        text.resize(get_u32(size));
+        return text.empty() || receive_all(fd, &text[0], text.size());
+    }
+
+    bool make_address(const std::string& path, sockaddr_un& address) {
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+            return false;
+        }
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        return true;
+    }
+
+    int connect_to(const sockaddr_un& address) {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && connect(fd, (const sockaddr*)&address, sizeof(address)) != 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+}
+
+CompileServer::CompileServer(RequestHandler handler) :
+    handler(std::move(handler)), listen_fd(-1), active(0),
+    receive_timeout_ms(DEFAULT_RECEIVE_TIMEOUT_MS) {
+    if (pipe(wake_fds) != 0) {
+        wake_fds[0] = wake_fds[1] = -1;
+    }
+}
+
+CompileServer::~CompileServer() {
+    if (listen_fd >= 0) {
+        close(listen_fd);
+    }
+    if (wake_fds[0] >= 0) {
+        close(wake_fds[0]);
+        close(wake_fds[1]);
+    }
+}
+
+bool CompileServer::listen(const std::string& socket_path) {
+    sockaddr_un address;
+    if (listen_fd >= 0 || wake_fds[0] < 0 || !make_address(socket_path, address)) {
+        return false;
+    }
+    // Never take over from a server that is still answering.
+    int live = connect_to(address);
+    if (live >= 0) {
+        close(live);
+        return false;
+    }
+    unlink(socket_path.c_str());
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    // Created owner-only, rather than made so after others could connect.
+    mode_t previous_umask = umask(077);
+    bool bound = listen_fd >= 0
+        && bind(listen_fd, (const sockaddr*)&address, sizeof(address)) == 0;
+    umask(previous_umask);
+    if (!bound
+        || chmod(socket_path.c_str(), 0600) != 0
+        || ::listen(listen_fd, 64) != 0) {
+        if (listen_fd >= 0) {
+            close(listen_fd);
+            listen_fd = -1;
+        }
+        return false;
+    }
+    path = socket_path;
+    return true;
+}
+
+void CompileServer::run() {
+    while (listen_fd >= 0) {
+        pollfd fds[2] = { { listen_fd, POLLIN, 0 }, { wake_fds[0], POLLIN, 0 } };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (fds[1].revents != 0) {
+            break;
+        }
+        int connection = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (connection < 0) {
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            active++;
+        }
+        std::thread([this, connection]() {
+            serve(connection);
+            // Notified under the lock: once active is 0 the server may go.
+            std::lock_guard<std::mutex> guard(lock);
+            active--;
+            idle.notify_all();
+        }).detach();
+    }
+
+    std::unique_lock<std::mutex> guard(lock);
+    idle.wait(guard, [this]() { return active == 0; });
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        listen_fd = -1;
+        unlink(path.c_str());
+    }
+}
+
+void CompileServer::stop() {
+    char byte = 0;
+    if (write(wake_fds[1], &byte, 1) != 1) {
+        // Already woken, or never started.
+    }
+}
+
+void CompileServer::serve(int connection) {
+    ucred peer;
+    socklen_t peer_size = sizeof(peer);
+    timeval timeout = { (time_t)(receive_timeout_ms / 1000),
+        (suseconds_t)(receive_timeout_ms % 1000 * 1000) };
+    if (getsockopt(connection, SOL_SOCKET, SO_PEERCRED, &peer, &peer_size) != 0
+        || peer.uid != geteuid()
+        || setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0) {
+        close(connection);
+        return;
+    }
+
+    char header[8];
+    char control[CMSG_SPACE(sizeof(int) * 2)];
+    iovec io = { header, sizeof(header) };
+    msghdr message;
+    std::memset(&message, 0, sizeof(message));
+    message.msg_iov = &io;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t count;
+    do {
+        count = recvmsg(connection, &message, MSG_CMSG_CLOEXEC);
+    } while (count < 0 && errno == EINTR);
+    int fds[2] = { -1, -1 };
+    for (cmsghdr* c = count > 0 ? CMSG_FIRSTHDR(&message) : nullptr; c; c = CMSG_NXTHDR(&message, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS
+            && c->cmsg_len == CMSG_LEN(sizeof(fds))) {
+            std::memcpy(fds, CMSG_DATA(c), sizeof(fds));
+        }
+    }
+
+    ServerRequest request;
+    request.in_fd = fds[0];
+    request.out_fd = fds[1];
+    bool ok = count > 0 && fds[0] >= 0 && fds[1] >= 0
+        && receive_all(connection, header + count, sizeof(header) - (std::size_t)count)
+        && get_u32(header) == SERVER_PROTOCOL_VERSION
+        && get_u32(header + 4) <= MAX_ARGUMENTS
+        && receive_string(connection, request.directory);
+    if (ok) {
+        request.arguments.resize(get_u32(header + 4));
+        for (std::string& argument : request.arguments) {
+            ok = ok && receive_string(connection, argument);
+        }
+    }
+    if (ok) {
+        char exit_code[4];
+        put_u32(exit_code, (std::uint32_t)handler(request));
+        send_all(connection, exit_code, 4);
+    }
+    for (int fd : fds) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    close(connection);
+}
+
+ForwardStatus forward_to_server(const std::string& path, const std::string& directory,
+  const std::vector<std::string>& arguments, int in_fd, int out_fd, int& exit_code) {
+    sockaddr_un address;
+    int connection = make_address(path, address) ? connect_to(address) : -1;
+    if (connection < 0) {
+        return NO_SERVER;
+    }
+
+    char header[8];
+    put_u32(header, SERVER_PROTOCOL_VERSION);
+    put_u32(header + 4, (std::uint32_t)arguments.size());
+    int fds[2] = { in_fd, out_fd };
+    char control[CMSG_SPACE(sizeof(fds))];
+    std::memset(control, 0, sizeof(control));
+    iovec io = { header, sizeof(header) };
+    msghdr message;
+    std::memset(&message, 0, sizeof(message));
+    message.msg_iov = &io;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    cmsghdr* c = CMSG_FIRSTHDR(&message);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(fds));
+    std::memcpy(CMSG_DATA(c), fds, sizeof(fds));
+
+    ssize_t count;
+    do {
+        count = sendmsg(connection, &message, MSG_NOSIGNAL);
+    } while (count < 0 && errno == EINTR);
+    if (count <= 0) {
+        close(connection);
+        return NO_SERVER;
+    }
+
+    bool ok = send_all(connection, header + count, sizeof(header) - (std::size_t)count)
+        && send_string(connection, directory);
+    for (const std::string& argument : arguments) {
+        ok = ok && send_string(connection, argument);
+    }
+    char reply[4];
+    ok = ok && receive_all(connection, reply, 4);
+    close(connection);
+    if (!ok) {
+        return CONNECTION_LOST;
+    }
+    exit_code = (int)get_u32(reply);
+    return FORWARDED;
+}
+
+#else
+
+CompileServer::CompileServer(RequestHandler handler) :
+    handler(std::move(handler)), listen_fd(-1), active(0),
+    receive_timeout_ms(DEFAULT_RECEIVE_TIMEOUT_MS) {
+    wake_fds[0] = wake_fds[1] = -1;
+}
+
+CompileServer::~CompileServer() {}
+
+bool CompileServer::listen(const std::string&) {
+    return false;
+}
+
+void CompileServer::run() {}
+
+void CompileServer::stop() {}
+
+void CompileServer::serve(int) {}
+
+ForwardStatus forward_to_server(const std::string&, const std::string&,
+  const std::vector<std::string>&, int, int, int&) {
+    return NO_SERVER;
+}
+
+#endif
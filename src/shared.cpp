@@ -1,5 +1,8 @@
+#include <cynophobia/charclass.hpp>
+#include <cynophobia/debugwriter.hpp>
 #include <cynophobia/shared.hpp>
 
+#include <algorithm>
 #include <memory>
 #include <sstream>
 #include <string>
@@ -9,10 +12,29 @@
 #include <unordered_map>
 #include <vector>
 
+std::string TextView::str() const {
+    return std::string(data, size);
+}
+
+bool operator==(const TextView& view, const std::string& s) {
+    return view.size == s.size() && s.compare(0, s.size(), view.data, view.size) == 0;
+}
+
+bool operator!=(const TextView& view, const std::string& s) {
+    return !(view == s);
+}
+
+std::ostream& operator<<(std::ostream& os, const TextView& view) {
+    return os.write(view.data, view.size);
+}
+
 std::string FilePosition::debug_string() const {
-    std::ostringstream oss;
-    oss << "{'line': " << line << ", 'column': " << column << "}";
-    return oss.str();
+    std::string out;
+    {
+        DebugWriter writer(out);
+        write_debug(writer, *this);
+    }
+    return out;
 }
 
 FilePosition FilePosition::next_column() {
@@ -23,19 +45,49 @@ FilePosition FilePosition::start_next_line() {
     return { line + 1, 0 }; 
 }
 
-std::string Token::debug_string() const  {
-    std::ostringstream oss;
-    oss << "{'position': " << position.debug_string();
-    oss << ", 'text': \"" << text << "\"," ;
-    oss << "'token_type': ";
+namespace {
+    // Records the start of the line after each line break; a \r directly
+    // followed by \n is part of that \n's line break instead.
+    struct LineStartCollector {
+        const char* text;
+        const char* end;
+        std::vector<std::uint32_t>* line_starts;
+
+        void operator()(const char* p) const {
+            if (*p == '\r' && p + 1 != end && p[1] == '\n') {
+                return;
+            }
+            line_starts->push_back((std::uint32_t)(p + 1 - text));
+        }
+    };
+}
+
+void LineIndex::build(const char* text, std::size_t size) {
+    line_starts.assign(1, 0);
+    LineStartCollector collect = { text, text + size, &line_starts };
+    charclass::for_each<charclass::LINE_BREAK>(text, text + size, collect);
+}
 
+FilePosition LineIndex::position(std::uint32_t offset) const {
+    std::vector<std::uint32_t>::const_iterator line_start
+        = std::upper_bound(line_starts.begin(), line_starts.end(), offset) - 1;
+    return { (unsigned int)(line_start - line_starts.begin()),
+        (unsigned int)(offset - *line_start) };
+}
 
+FilePosition TokenBuffer::position_of(std::uint32_t offset) const {
+    if (!lines_built) {
+        lines.build(source_buffer->data(), source_buffer->size());
+        lines_built = true;
+    }
+    return lines.position(offset);
+}
 
+const char* token_type_name(Token::TokenType token_type) {
     switch (token_type) { 
 #define SELF_PRINT(x)            \
-case x:                          \
-    oss << "'" << #x << "'";     \
-    break;
+case Token::x:                   \
+    return #x;
         SELF_PRINT(Semicolon)
         SELF_PRINT(Identifier)
         SELF_PRINT(Constant) 
@@ -46,48 +98,100 @@ case x:                          \
         SELF_PRINT(CloseParen)  
         SELF_PRINT(OpenBrace)  
         SELF_PRINT(CloseBrace)
+        SELF_PRINT(Auto)
+        SELF_PRINT(Break)
+        SELF_PRINT(Case)
+        SELF_PRINT(Char)
+        SELF_PRINT(Const)
+        SELF_PRINT(Continue)
+        SELF_PRINT(Default)
+        SELF_PRINT(Do)
+        SELF_PRINT(Double)
+        SELF_PRINT(Else)
+        SELF_PRINT(Enum)
+        SELF_PRINT(Extern)
+        SELF_PRINT(Float)
+        SELF_PRINT(For)
+        SELF_PRINT(Goto)
+        SELF_PRINT(If)
+        SELF_PRINT(Inline)
+        SELF_PRINT(Long)
+        SELF_PRINT(Register)
+        SELF_PRINT(Restrict)
+        SELF_PRINT(Short)
+        SELF_PRINT(Signed)
+        SELF_PRINT(Sizeof)
+        SELF_PRINT(Static)
+        SELF_PRINT(Struct)
+        SELF_PRINT(Switch)
+        SELF_PRINT(Typedef)
+        SELF_PRINT(Union)
+        SELF_PRINT(Unsigned)
+        SELF_PRINT(Volatile)
+        SELF_PRINT(While)
+        SELF_PRINT(Alignas)
+        SELF_PRINT(Alignof)
+        SELF_PRINT(Atomic)
+        SELF_PRINT(Bool)
+        SELF_PRINT(Complex)
+        SELF_PRINT(Generic)
+        SELF_PRINT(Imaginary)
+        SELF_PRINT(Noreturn)
+        SELF_PRINT(StaticAssert)
+        SELF_PRINT(ThreadLocal)
+        SELF_PRINT(Tilde)
+        SELF_PRINT(Hyphen)
+        SELF_PRINT(Decrement)
+        SELF_PRINT(Plus)
+        SELF_PRINT(Asterisk)
+        SELF_PRINT(Slash)
+        SELF_PRINT(Percent)
+        SELF_PRINT(Bang)
+        SELF_PRINT(LogicalAnd)
+        SELF_PRINT(LogicalOr)
+        SELF_PRINT(EqualEqual)
+        SELF_PRINT(BangEqual)
+        SELF_PRINT(Less)
+        SELF_PRINT(Greater)
+        SELF_PRINT(LessEqual)
+        SELF_PRINT(GreaterEqual)
 #undef SELF_PRINT
     }  
-    
-    oss << "}";
-    return oss.str();
+    return "";
 }
 
+std::string Token::debug_string() const  {
+    std::string out;
+    {
+        DebugWriter writer(out);
+        write_debug(writer, *this);
+    }
+    return out;
+}
 
 std::string UnknownToken::debug_string() const {
-    std::ostringstream oss;
-    oss << "{'position': " << position.debug_string();
-    oss << ",'text': '" << text << "'}"; 
-    return oss.str();
+    std::string out;
+    {
+        DebugWriter writer(out);
+        write_debug(writer, *this);
+    }
+    return out;
 }
 
 std::string LexerOutput::debug_string() const {
-    std::ostringstream oss;
-    oss << "{'open_failed': " << (open_failed ? "true" : "false");
-    oss << ",'read_failed': " << (read_failed ? "true" : "false");
-    oss << ",'tokens':[";
+    std::string out;
     {
-        bool first = true; 
-        for (const Token& t : tokens) {
-            if (!first) {
-                oss << ",";
-            }
-            oss << t.debug_string();
-            first = false; 
-        }
+        DebugWriter writer(out);
+        write_debug(writer, *this);
     }
+    return out;
+}
 
-    oss << "],'unknown_tokens':[";
+std::string debug_string(const ParserOutput::Error& error) {
+    std::string out;
     {
-        bool first = true;
-        for (const UnknownToken& u : unknown_tokens) {
-            if (!first) {
-                oss << ",";
-            }
-            oss << u.debug_string();
-            first = false;
-        }
+        DebugWriter writer(out);
+        write_debug(writer, error);
     }
-    oss << "]}";
-    return oss.str();
-}
\ No newline at end of file
+    return out;
+}
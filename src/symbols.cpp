@@ -0,0 +1,72 @@
+#include <cynophobia/symbols.hpp>
+
+#include <cstring>
+
+namespace {
+    // FNV-1a; identifiers are short.
+    std::uint32_t hash_text(const char* text, std::size_t size) {
+        std::uint32_t hash = 2166136261u;
+        for (std::size_t i = 0; i < size; i++) {
+            hash ^= (unsigned char)text[i];
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
+    const std::size_t INITIAL_SLOTS = 256;
+}
+
+SymbolTable::SymbolTable() : offsets(1, 0), slots(INITIAL_SLOTS, 0) {}
+
+// The slot holding text, or the empty slot where it would go.
+std::size_t SymbolTable::slot_of(const char* text, std::size_t size,
+  std::uint32_t hash) const {
+    std::size_t mask = slots.size() - 1;
+    for (std::size_t slot = hash & mask; ; slot = (slot + 1) & mask) {
+        std::uint32_t entry = slots[slot];
+        if (entry == 0) {
+            return slot;
+        }
+        SymbolId symbol = entry - 1;
+        if (hashes[symbol] == hash && text_size(symbol) == size
+            && std::memcmp(this->text(symbol), text, size) == 0) {
+            return slot;
+        }
+    }
+}
+
+SymbolId SymbolTable::intern(const char* text, std::size_t size) {
+    std::uint32_t hash = hash_text(text, size);
+    std::size_t slot = slot_of(text, size, hash);
+    if (slots[slot] != 0) {
+        return slots[slot] - 1;
+    }
+
+    SymbolId symbol = (SymbolId)hashes.size();
+    pool.append(text, size);
+    offsets.push_back((std::uint32_t)pool.size());
+    hashes.push_back(hash);
+    slots[slot] = symbol + 1;
+    if (hashes.size() * 2 > slots.size()) {
+        grow();
+    }
+    return symbol;
+}
+
+SymbolId SymbolTable::find(const char* text, std::size_t size) const {
+    std::uint32_t entry = slots[slot_of(text, size, hash_text(text, size))];
+    return entry == 0 ? NO_SYMBOL : entry - 1;
+}
+
+void SymbolTable::grow() {
+    std::vector<std::uint32_t> grown(slots.size() * 2, 0);
+    std::size_t mask = grown.size() - 1;
+    for (SymbolId symbol = 0; symbol < hashes.size(); symbol++) {
+        std::size_t slot = hashes[symbol] & mask;
+        while (grown[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        grown[slot] = symbol + 1;
+    }
+    slots.swap(grown);
+}
@@ -0,0 +1,209 @@
+#include <cynophobia/allocations.hpp>
+#include <cynophobia/debugwriter.hpp>
+#include <cynophobia/shared.hpp>
+#include <cynophobia/tacky.hpp>
+#include <cynophobia/trace.hpp>
+
+#include <cstdint>
+#include <vector>
+
+static_assert(tacky::Complement + parsing::Not == tacky::Not
+    && tacky::Add + parsing::GreaterOrEqual == tacky::GreaterOrEqual,
+    "parsing operators line up with the opcodes they lower to");
+
+namespace {
+    // A Constant token's digits, wrapped to int as converting it would.
+    std::int32_t constant_value(TextView text) {
+        std::uint64_t value = 0;
+        for (std::size_t i = 0; i < text.size; i++) {
+            value = value * 10 + (std::uint64_t)(text.data[i] - '0');
+        }
+        return (std::int32_t)(std::uint32_t)value;
+    }
+
+    // Lowers a function's nodes in one scan from the front: they are in
+    // post-order, so each node's operands are lowered before it is, as
+    // C evaluates them. The scratch arrays are reused from one function
+    // to the next.
+    class FunctionLowering {
+        public:
+            void lower(tacky::Function& out, const parsing::Program& program,
+              const parsing::Function& function) {
+                const parsing::Node* nodes = function.nodes;
+                std::uint32_t count = function.node_count;
+                if (count == 2) {
+                    // return <constant> needs no scratch at all.
+                    out.emit(tacky::Return, tacky::NO_VALUE,
+                        out.constant(constant_value(program.text(nodes[0].token))));
+                    return;
+                }
+                // values[i] is what node i evaluates to. Until an && or ||
+                // node is reached, it holds the label the node jumps to
+                // once its answer is known.
+                values.assign(count, tacky::NO_VALUE);
+                // The && or || node whose right operand starts at node i,
+                // whose left operand must be tested before it.
+                right_of.assign(count, parsing::NO_NODE);
+                for (std::uint32_t i = 0; i < count; i++) {
+                    if (is_logical(nodes[i])) {
+                        right_of[nodes[i].first + 1] = i;
+                    }
+                }
+                for (std::uint32_t i = 0; i < count; i++) {
+                    if (right_of[i] != parsing::NO_NODE) {
+                        const parsing::Node& logical = nodes[right_of[i]];
+                        tacky::Value short_circuit = out.label();
+                        out.emit(jump_of(logical), short_circuit, values[logical.first]);
+                        values[right_of[i]] = short_circuit;
+                    }
+                    const parsing::Node& node = nodes[i];
+                    switch (node.kind) {
+                        case parsing::Node::IntConstant:
+                            values[i] = out.constant(constant_value(program.text(node.token)));
+                            break;
+                        case parsing::Node::Unary: {
+                            tacky::Value dst = out.temporary();
+                            out.emit((tacky::Opcode)(tacky::Complement + node.operation), dst,
+                                values[node.first]);
+                            values[i] = dst;
+                            break;
+                        }
+                        case parsing::Node::Binary: {
+                            tacky::Value dst = out.temporary();
+                            if (is_logical(node)) {
+                                // a && b: 1 unless either is 0; a || b: 0 unless either is not.
+                                std::int32_t decided = node.operation == parsing::Or;
+                                tacky::Value short_circuit = values[i];
+                                tacky::Value end = out.label();
+                                out.emit(jump_of(node), short_circuit, values[node.second]);
+                                out.emit(tacky::Copy, dst, out.constant(!decided));
+                                out.emit(tacky::Jump, end);
+                                out.emit(tacky::Label, short_circuit);
+                                out.emit(tacky::Copy, dst, out.constant(decided));
+                                out.emit(tacky::Label, end);
+                            } else {
+                                out.emit((tacky::Opcode)(tacky::Add + node.operation), dst,
+                                    values[node.first], values[node.second]);
+                            }
+                            values[i] = dst;
+                            break;
+                        }
+                        case parsing::Node::Return:
+                            out.emit(tacky::Return, tacky::NO_VALUE, values[node.first]);
+                            break;
+                    }
+                }
+            }
+
+        private:
+            static bool is_logical(const parsing::Node& node) {
+                return node.kind == parsing::Node::Binary
+                    && (node.operation == parsing::And || node.operation == parsing::Or);
+            }
+
+            static tacky::Opcode jump_of(const parsing::Node& logical) {
+                return logical.operation == parsing::And ? tacky::JumpIfZero : tacky::JumpIfNotZero;
+            }
+
+            std::vector<tacky::Value> values;
+            std::vector<parsing::NodeIndex> right_of;
+    };
+
+    void write_value(DebugWriter& writer, const tacky::Function& function, tacky::Value value) {
+        if (!tacky::is_constant(value)) {
+            writer.write_char('t');
+            writer.write_unsigned(value);
+            return;
+        }
+        std::int32_t constant = function.constant_value(value);
+        if (constant < 0) {
+            writer.write_char('-');
+            writer.write_unsigned(0 - (unsigned long long)constant);
+        } else {
+            writer.write_unsigned((unsigned long long)constant);
+        }
+    }
+
+    void write_label(DebugWriter& writer, tacky::Value label) {
+        writer.write_char('L');
+        writer.write_unsigned(label);
+    }
+
+    const char* const OPERATORS[] = {
+        "", "", "~", "-", "!", " + ", " - ", " * ", " / ", " % ",
+        " == ", " != ", " < ", " <= ", " > ", " >= "
+    };
+}
+
+tacky::Program lower_program(const parsing::Program& program) {
+    TraceScope trace("tacky");
+    AllocationStage stage(TackyStage);
+    FunctionLowering lowering;
+    tacky::Program lowered;
+    lowered.source = program.source;
+    lowered.functions.resize(program.functions.size());
+    for (std::size_t i = 0; i < program.functions.size(); i++) {
+        const parsing::Function& function = program.functions[i];
+        tacky::Function& out = lowered.functions[i];
+        out.name = program.text(function.identifier);
+        out.temporaries = 0;
+        out.labels = 0;
+        out.constants.reserve(1);
+        out.instructions.reserve(1);
+        lowering.lower(out, program, function);
+    }
+    return lowered;
+}
+
+std::size_t instruction_count(const tacky::Program& program) {
+    std::size_t count = 0;
+    for (const tacky::Function& function : program.functions) {
+        count += function.instructions.size();
+    }
+    return count;
+}
+
+void write_debug(DebugWriter& writer, const tacky::Program& program) {
+    for (const tacky::Function& function : program.functions) {
+        writer.write(function.name);
+        writer.write(":\n");
+        for (const tacky::Instruction& instruction : function.instructions) {
+            if (instruction.opcode == tacky::Label) {
+                write_label(writer, instruction.dst);
+                writer.write(":\n");
+                continue;
+            }
+            writer.write("    ");
+            switch (instruction.opcode) {
+                case tacky::Return:
+                    writer.write("return ");
+                    write_value(writer, function, instruction.a);
+                    break;
+                case tacky::Jump:
+                    writer.write("goto ");
+                    write_label(writer, instruction.dst);
+                    break;
+                case tacky::JumpIfZero:
+                case tacky::JumpIfNotZero:
+                    writer.write(instruction.opcode == tacky::JumpIfZero ? "if !" : "if ");
+                    write_value(writer, function, instruction.a);
+                    writer.write(" goto ");
+                    write_label(writer, instruction.dst);
+                    break;
+                default:
+                    write_value(writer, function, instruction.dst);
+                    writer.write(" = ");
+                    if (tacky::is_binary(instruction.opcode)) {
+                        write_value(writer, function, instruction.a);
+                        writer.write(OPERATORS[instruction.opcode]);
+                        write_value(writer, function, instruction.b);
+                    } else {
+                        writer.write(OPERATORS[instruction.opcode]);
+                        write_value(writer, function, instruction.a);
+                    }
+                    break;
+            }
+            writer.write_char('\n');
+        }
+    }
+}
@@ -0,0 +1,93 @@
+#include <cynophobia/trace.hpp>
+
+#include <cstdio>
+#include <string>
+#include <utility>
+
+namespace {
+    // Small, stable numbers for the timeline instead of native thread ids.
+    unsigned int thread_number() {
+        static std::atomic<unsigned int> next_thread(1);
+        thread_local unsigned int number = next_thread++;
+        return number;
+    }
+
+    void write_microseconds(DebugWriter& writer, TraceClock::duration duration) {
+        char text[32];
+        int size = snprintf(text, sizeof(text), "%.3f",
+            std::chrono::duration<double, std::micro>(duration).count());
+        writer.write(text, (std::size_t)size);
+    }
+
+    void write_json_string(DebugWriter& writer, const char* text) {
+        writer.write_char('"');
+        for (; *text; text++) {
+            unsigned char c = (unsigned char)*text;
+            if (c == '"' || c == '\\') {
+                writer.write_char('\\');
+                writer.write_char((char)c);
+            } else if (c < 0x20) {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                writer.write(escaped, 6);
+            } else {
+                writer.write_char((char)c);
+            }
+        }
+        writer.write_char('"');
+    }
+}
+
+std::atomic<bool> Tracer::is_enabled(false);
+
+Tracer& Tracer::instance() {
+    static Tracer tracer;
+    return tracer;
+}
+
+bool Tracer::start() {
+    std::lock_guard<std::mutex> guard(lock);
+    if (is_enabled.load()) {
+        return false;
+    }
+    events.clear();
+    origin = TraceClock::now();
+    is_enabled.store(true);
+    return true;
+}
+
+void Tracer::record(const char* name, const char* detail,
+  TraceClock::time_point start, TraceClock::time_point end) {
+    Event event = { name, detail ? detail : "", thread_number(), start, end };
+    std::lock_guard<std::mutex> guard(lock);
+    // Spans still open when the last trace finished are dropped.
+    if (is_enabled.load() && start >= origin) {
+        events.push_back(std::move(event));
+    }
+}
+
+void Tracer::finish(DebugWriter& writer) {
+    std::lock_guard<std::mutex> guard(lock);
+    is_enabled.store(false);
+    writer.write("{\"traceEvents\": [");
+    for (std::size_t i = 0; i < events.size(); i++) {
+        const Event& event = events[i];
+        writer.write(i == 0 ? "\n" : ",\n");
+        writer.write("{\"name\": ");
+        write_json_string(writer, event.name);
+        writer.write(", \"ph\": \"X\", \"pid\": 1, \"tid\": ");
+        writer.write_unsigned(event.thread);
+        writer.write(", \"ts\": ");
+        write_microseconds(writer, event.start - origin);
+        writer.write(", \"dur\": ");
+        write_microseconds(writer, event.end - event.start);
+        if (!event.detail.empty()) {
+            writer.write(", \"args\": {\"detail\": ");
+            write_json_string(writer, event.detail.c_str());
+            writer.write_char('}');
+        }
+        writer.write_char('}');
+    }
+    writer.write("\n]}\n");
+    events.clear();
+}
@@ -0,0 +1,165 @@
+// Built into cynoallocationtester, the one test program that links the
+// counting operator new.
+#define CATCH_CONFIG_MAIN
+#include <catch2/catch.hpp>
+#include <cynophobia/allocations.hpp>
+#include <cynophobia/arena.hpp>
+#include <cynophobia/charstream.hpp>
+#include <cynophobia/lexer.hpp>
+#include <cynophobia/parser.hpp>
+#include <cynophobia/tacky.hpp>
+
+#include <memory>
+#include <string>
+
+// Allocation budgets for the hot paths. The lexer and parser should
+// allocate per buffer growth or arena block, not per token or tree node,
+// and lowering only for each function's arrays; these fail the build when
+// a change starts allocating in a per-token, per-node or per-instruction
+// loop.
+namespace {
+    const double LEX_ALLOCATIONS_PER_TOKEN = 0.01;
+    const double PARSE_ALLOCATIONS_PER_NODE = 0.01;
+    // Its instructions and its constants.
+    const double TACKY_ALLOCATIONS_PER_FUNCTION = 2.0;
+
+    std::string generate_program(int functions) {
+        std::string program;
+        for (int i = 0; i < functions; i++) {
+            program += "int function_" + std::to_string(i) + "(void) {\n    return "
+                + std::to_string(i) + ";\n}\n";
+        }
+        return program;
+    }
+
+    // Function, return statement and constant expression per function.
+    std::size_t count_nodes(const parsing::Program& program) {
+        return 1 + program.functions.size() * 3;
+    }
+}
+
+TEST_CASE( "Counting allocator is linked into the tests", "[allocations]" ) {
+    REQUIRE( counting_allocations() );
+    AllocationCount before = total_allocations();
+    std::string* allocated = new std::string(100, 'x');
+    AllocationCount after = total_allocations();
+    delete allocated;
+    REQUIRE( (after - before).allocations >= 2 );
+    REQUIRE( (after - before).bytes >= 100 + sizeof(std::string) );
+}
+
+TEST_CASE( "Allocations are attributed to the stage that made them", "[allocations]" ) {
+    std::string program = generate_program(100);
+    AllocationCount lex_before = allocations_in(LexStage);
+    AllocationCount parse_before = allocations_in(ParseStage);
+    LexerOutput lexer_output = lex_string(program, false);
+    AllocationCount lex_after = allocations_in(LexStage);
+    REQUIRE( (lex_after - lex_before).allocations > 0 );
+    REQUIRE( (allocations_in(ParseStage) - parse_before).allocations == 0 );
+
+    {
+        AllocationStage stage(CodegenStage);
+        AllocationCount codegen_before = allocations_in(CodegenStage);
+        ParserOutput parser_output = parse_program(lexer_output.tokens);
+        REQUIRE( !parser_output.is_error );
+        // The parser's own stage wins inside it, and ours comes back after.
+        REQUIRE( (allocations_in(ParseStage) - parse_before).allocations > 0 );
+        REQUIRE( (allocations_in(CodegenStage) - codegen_before).allocations == 0 );
+        std::string* allocated = new std::string(100, 'x');
+        delete allocated;
+        REQUIRE( (allocations_in(CodegenStage) - codegen_before).allocations >= 1 );
+    }
+    REQUIRE( (allocations_in(LexStage) - lex_after).allocations == 0 );
+}
+
+TEST_CASE( "Lexing stays within its allocation budget per token", "[allocations]" ) {
+    std::string program = generate_program(20000);
+
+    AllocationCount before = total_allocations();
+    LexerOutput lexer_output = lex_string(program, false);
+    AllocationCount used = total_allocations() - before;
+    double per_token = (double)used.allocations / lexer_output.tokens.size();
+    INFO( used.allocations << " allocations for " << lexer_output.tokens.size() << " tokens" );
+    REQUIRE( lexer_output.tokens.size() == 20000 * 10 );
+    REQUIRE( per_token <= LEX_ALLOCATIONS_PER_TOKEN );
+
+    before = total_allocations();
+    LexerOutput parallel_output = lex_string_parallel(program, false, 4, 4096);
+    used = total_allocations() - before;
+    INFO( used.allocations << " allocations lexing in parallel" );
+    REQUIRE( (double)used.allocations / parallel_output.tokens.size() <= LEX_ALLOCATIONS_PER_TOKEN );
+
+    StringCharStream stream(program);
+    before = total_allocations();
+    std::size_t tokens = 0;
+    {
+        TokenSource source(stream, 8);
+        while (source.next_token() != nullptr) {
+            tokens++;
+        }
+    }
+    used = total_allocations() - before;
+    INFO( used.allocations << " allocations pulling tokens" );
+    REQUIRE( tokens == 20000 * 10 );
+    REQUIRE( (double)used.allocations / tokens <= LEX_ALLOCATIONS_PER_TOKEN );
+}
+
+TEST_CASE( "Parsing stays within its allocation budget per node", "[allocations]" ) {
+    LexerOutput lexer_output = lex_string(generate_program(20000), false);
+
+    AllocationCount before = total_allocations();
+    ParserOutput parser_output = parse_program(lexer_output.tokens);
+    AllocationCount used = total_allocations() - before;
+    REQUIRE( !parser_output.is_error );
+    std::size_t nodes = count_nodes(*parser_output.program);
+    INFO( used.allocations << " allocations for " << nodes << " nodes" );
+    REQUIRE( (double)used.allocations / nodes <= PARSE_ALLOCATIONS_PER_NODE );
+}
+
+TEST_CASE( "Lowering to TACKY allocates per function, not per instruction", "[allocations]" ) {
+    LexerOutput lexer_output = lex_string(generate_program(20000), false);
+    ParserOutput parser_output = parse_program(lexer_output.tokens);
+    REQUIRE( !parser_output.is_error );
+
+    AllocationCount before = total_allocations();
+    tacky::Program program = lower_program(*parser_output.program);
+    AllocationCount used = total_allocations() - before;
+    INFO( used.allocations << " allocations for " << program.functions.size() << " functions" );
+    REQUIRE( program.functions.size() == 20000 );
+    REQUIRE( (double)(used.allocations - 1) / program.functions.size()
+        <= TACKY_ALLOCATIONS_PER_FUNCTION );
+}
+
+TEST_CASE( "A reset arena uses its blocks again rather than allocating", "[allocations][arena]" ) {
+    Arena arena;
+    for (int i = 0; i < 10000; i++) {
+        arena.copy("twenty characters...", 20);
+    }
+    arena.allocate(3 << 20, 64);
+    arena.reset();
+
+    AllocationCount before = total_allocations();
+    for (int i = 0; i < 10000; i++) {
+        arena.copy("twenty characters...", 20);
+    }
+    arena.allocate(3 << 20, 64);
+    REQUIRE( (total_allocations() - before).allocations == 0 );
+}
+
+TEST_CASE( "A recycled arena parses the next file without allocating per node", "[allocations][arena]" ) {
+    ArenaPool pool(2, 64 << 20);
+    LexerOutput lexer_output = lex_string(generate_program(2000), false);
+    {
+        ParserOutput parser_output = parse_program(lexer_output.tokens, pool.acquire());
+        REQUIRE( !parser_output.is_error );
+    }
+
+    AllocationCount before = total_allocations();
+    {
+        ParserOutput parser_output = parse_program(lexer_output.tokens, pool.acquire());
+        REQUIRE( !parser_output.is_error );
+    }
+    AllocationCount used = total_allocations() - before;
+    INFO( used.allocations << " allocations" );
+    REQUIRE( used.allocations < 50 );
+}
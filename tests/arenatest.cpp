@@ -0,0 +1,130 @@
+#include <catch2/catch.hpp>
+#include <cynophobia/arena.hpp>
+#include <cynophobia/lexer.hpp>
+#include <cynophobia/parser.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+    struct Pair {
+        std::uint64_t first;
+        std::uint8_t second;
+    };
+
+    std::string generate_program(int functions) {
+        std::string program;
+        for (int i = 0; i < functions; i++) {
+            program += "int function_" + std::to_string(i) + "(void) { return -("
+                + std::to_string(i) + " + 1) * 2; }\n";
+        }
+        return program;
+    }
+}
+
+TEST_CASE( "Arena allocations are aligned, distinct and kept until reset", "[arena]" ) {
+    Arena arena;
+    REQUIRE( arena.bytes_reserved() == 0 );
+    std::vector<Pair*> pairs;
+    for (std::uint64_t i = 0; i < 10000; i++) {
+        // Unaligned text in between.
+        TextView text = arena.copy(std::to_string(i));
+        REQUIRE( text == std::to_string(i) );
+        Pair* pair = arena.make<Pair>(Pair { i, (std::uint8_t)i });
+        REQUIRE( (std::uintptr_t)pair % alignof(Pair) == 0 );
+        pairs.push_back(pair);
+    }
+    for (std::uint64_t i = 0; i < pairs.size(); i++) {
+        REQUIRE( pairs[i]->first == i );
+        REQUIRE( pairs[i]->second == (std::uint8_t)i );
+    }
+    REQUIRE( arena.copy("", 0).size == 0 );
+
+    // Larger than any block is made to measure.
+    char* large = (char*)arena.allocate(3 << 20, 64);
+    REQUIRE( (std::uintptr_t)large % 64 == 0 );
+    std::memset(large, 1, 3 << 20);
+    REQUIRE( arena.bytes_used() >= 10000 * sizeof(Pair) + (3 << 20) );
+    REQUIRE( arena.bytes_reserved() >= arena.bytes_used() );
+
+    std::size_t reserved = arena.bytes_reserved();
+    arena.reset();
+    REQUIRE( arena.bytes_used() == 0 );
+    for (std::uint64_t i = 0; i < 10000; i++) {
+        arena.copy(std::string(20, 'x'));
+    }
+    arena.allocate(3 << 20, 64);
+    // The blocks are used again rather than allocated anew.
+    REQUIRE( arena.bytes_reserved() == reserved );
+}
+
+TEST_CASE( "Pooled arenas come back reset once nothing holds them", "[arena]" ) {
+    ArenaPool pool(2, 1 << 20);
+    std::shared_ptr<Arena> arena = pool.acquire();
+    Arena* first = arena.get();
+    arena->allocate(1000, 8);
+    std::shared_ptr<Arena> held = arena;
+    arena.reset();
+    // Still held, so another is made.
+    std::shared_ptr<Arena> second = pool.acquire();
+    REQUIRE( second.get() != first );
+    second.reset();
+    held.reset();
+
+    // The last given back comes out first, reset but keeping its block.
+    std::shared_ptr<Arena> again = pool.acquire();
+    REQUIRE( again.get() == first );
+    REQUIRE( again->bytes_used() == 0 );
+    REQUIRE( again->bytes_reserved() > 0 );
+
+    // Grown too big to keep, so it is freed rather than pooled.
+    again->allocate(2 << 20, 8);
+    again.reset();
+    std::shared_ptr<Arena> other = pool.acquire();
+    std::shared_ptr<Arena> another = pool.acquire();
+    REQUIRE( other->bytes_reserved() < (1 << 20) );
+    REQUIRE( another->bytes_reserved() < (1 << 20) );
+}
+
+TEST_CASE( "A parsed tree lives in its arena and the Program holds it", "[arena][parser]" ) {
+    ArenaPool pool(2, 64 << 20);
+    LexerOutput lexer_output = lex_string(generate_program(2000), false);
+    std::unique_ptr<parsing::Program> program;
+    Arena* arena = nullptr;
+    {
+        ParserOutput parser_output = parse_program(lexer_output.tokens, pool.acquire());
+        REQUIRE( !parser_output.is_error );
+        arena = parser_output.arena.get();
+        REQUIRE( parser_output.program->arena.get() == arena );
+        REQUIRE( arena->bytes_used() >= (node_count(*parser_output.program) - 2001) * sizeof(parsing::Node) );
+        program = std::move(parser_output.program);
+    }
+    // Not recycled while the Program is alive.
+    std::shared_ptr<Arena> meanwhile = pool.acquire();
+    REQUIRE( meanwhile.get() != arena );
+    meanwhile.reset();
+    const parsing::Function& last = program->functions[1999];
+    REQUIRE( program->text(last.identifier) == "function_1999" );
+    REQUIRE( program->text(last.nodes[last.nodes[last.body().first].second].token) == "2" );
+    program.reset();
+
+    // The next translation unit gets the same arena back, and its blocks
+    // take the whole tree.
+    std::size_t reserved = arena->bytes_reserved();
+    {
+        ParserOutput parser_output = parse_program(lexer_output.tokens, pool.acquire());
+        REQUIRE( !parser_output.is_error );
+        REQUIRE( parser_output.arena.get() == arena );
+        REQUIRE( node_count(*parser_output.program) == 1 + 2000 * 8 );
+    }
+    REQUIRE( arena->bytes_reserved() == reserved );
+
+    LexerOutput invalid_output = lex_string("int main(void) { return 1 +; }", false);
+    ParserOutput error_output = parse_program(invalid_output.tokens, pool.acquire());
+    REQUIRE( error_output.is_error );
+    REQUIRE( error_output.error.message == "expected expression, found other token with text: \";\"" );
+    REQUIRE( error_output.arena->bytes_used() >= error_output.error.message.size );
+}
@@ -0,0 +1,216 @@
+#include <catch2/catch.hpp>
+#include <cynophobia/cache.hpp>
+
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+    void remove_tree(const std::string& path) {
+        DIR* directory = opendir(path.c_str());
+        if (!directory) {
+            unlink(path.c_str());
+            return;
+        }
+        while (struct dirent* entry = readdir(directory)) {
+            std::string name = entry->d_name;
+            if (name != "." && name != "..") {
+                remove_tree(path + "/" + name);
+            }
+        }
+        closedir(directory);
+        rmdir(path.c_str());
+    }
+
+    // mtimes can be coarse; keep LRU order unambiguous.
+    void tick() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+}
+
+TEST_CASE( "Cache keys depend on the input and the configuration", "[cache]" ) {
+    std::string source = "int main(void) { return 2; }";
+    CacheKey key = cache_key(source.data(), source.size(), "tokens 1");
+    CacheKey same = cache_key(source.data(), source.size(), "tokens 1");
+    CacheKey other_config = cache_key(source.data(), source.size(), "tokens 2");
+    CacheKey other_source = cache_key(source.data(), source.size() - 1, "tokens 1");
+
+    REQUIRE( key.hex() == same.hex() );
+    REQUIRE( key.hex().size() == 32 );
+    REQUIRE( key.hex() != other_config.hex() );
+    REQUIRE( key.hex() != other_source.hex() );
+}
+
+TEST_CASE( "Cached results load back and are counted", "[cache]" ) {
+    std::string directory = "cynotester_cache_roundtrip";
+    remove_tree(directory);
+    {
+        ResultCache cache(directory, DEFAULT_CACHE_SIZE);
+        REQUIRE( cache.usable() );
+        CacheKey key = cache_key("abc", 3, "test");
+        std::string bytes;
+
+        REQUIRE( !cache.load(key, "tokens", bytes) );
+        REQUIRE( cache.store(key, "tokens", std::string("cached\0result", 13)) );
+        REQUIRE( cache.load(key, "tokens", bytes) );
+        REQUIRE( bytes == std::string("cached\0result", 13) );
+        REQUIRE( !cache.load(key, "ast", bytes) );
+
+        CacheStats stats;
+        REQUIRE( cache.read_stats(stats) );
+        REQUIRE( stats.hits == 1 );
+        REQUIRE( stats.misses == 2 );
+        REQUIRE( stats.stores == 1 );
+        REQUIRE( stats.bytes == 13 );
+        REQUIRE( stats.debug_string()
+            == "{\"hits\": 1, \"misses\": 2, \"stores\": 1, \"evictions\": 0, \"bytes\": 13}" );
+    }
+    {
+        // Storing over an entry counts only the change in size.
+        ResultCache cache(directory, DEFAULT_CACHE_SIZE);
+        CacheKey key = cache_key("abc", 3, "test");
+        REQUIRE( cache.store(key, "tokens", std::string(13, 'x')) );
+        REQUIRE( cache.store(key, "tokens", "short") );
+    }
+    CacheStats stats;
+    REQUIRE( ResultCache(directory, DEFAULT_CACHE_SIZE).read_stats(stats) );
+    REQUIRE( stats.stores == 3 );
+    REQUIRE( stats.bytes == 5 );
+    remove_tree(directory);
+}
+
+TEST_CASE( "The least recently used entries are evicted first", "[cache]" ) {
+    std::string directory = "cynotester_cache_eviction";
+    remove_tree(directory);
+    {
+        ResultCache cache(directory, 250);
+        std::string entry(100, 'x');
+        std::string bytes;
+        CacheKey first = cache_key("1", 1, "test");
+        CacheKey second = cache_key("2", 1, "test");
+        CacheKey third = cache_key("3", 1, "test");
+
+        REQUIRE( cache.store(first, "tokens", entry) );
+        tick();
+        REQUIRE( cache.store(second, "tokens", entry) );
+        tick();
+        REQUIRE( cache.load(first, "tokens", bytes) );
+        tick();
+        // 300 bytes: the second entry is now the oldest.
+        REQUIRE( cache.store(third, "tokens", entry) );
+
+        CacheStats stats;
+        REQUIRE( cache.read_stats(stats) );
+        REQUIRE( stats.evictions == 1 );
+        REQUIRE( stats.bytes == 200 );
+        REQUIRE( cache.load(first, "tokens", bytes) );
+        REQUIRE( cache.load(third, "tokens", bytes) );
+        REQUIRE( !cache.load(second, "tokens", bytes) );
+        REQUIRE( !cache.store(second, "tokens", std::string(300, 'x')) );
+    }
+    remove_tree(directory);
+}
+
+TEST_CASE( "Counts reach the stats file once per instance", "[cache]" ) {
+    std::string directory = "cynotester_cache_counts";
+    remove_tree(directory);
+    {
+        CacheKey key = cache_key("abc", 3, "test");
+        std::string bytes;
+        for (int run = 0; run < 3; run++) {
+            ResultCache cache(directory, DEFAULT_CACHE_SIZE);
+            for (int i = 0; i < 10; i++) {
+                cache.load(key, "tokens", bytes);
+            }
+            // Loads alone leave the stats file as it was.
+            struct stat info;
+            REQUIRE( (stat((directory + "/stats").c_str(), &info) == 0) == (run > 0) );
+        }
+
+        std::ifstream file(directory + "/stats");
+        std::string line;
+        int lines = 0;
+        while (std::getline(file, line)) {
+            lines++;
+        }
+        REQUIRE( lines == 3 );
+        CacheStats stats;
+        REQUIRE( ResultCache(directory, DEFAULT_CACHE_SIZE).read_stats(stats) );
+        REQUIRE( stats.misses == 30 );
+    }
+    remove_tree(directory);
+}
+
+TEST_CASE( "Eviction removes what a crash left half written", "[cache]" ) {
+    std::string directory = "cynotester_cache_orphans";
+    remove_tree(directory);
+    {
+        ResultCache cache(directory, 150);
+        std::string stale = directory + "/objects/tmp.stale1";
+        std::string fresh = directory + "/objects/tmp.fresh1";
+        std::ofstream(stale) << "half an entry";
+        std::ofstream(fresh) << "being written";
+        struct timespec times[2] = { { time(nullptr) - 2 * 60 * 60, 0 },
+            { time(nullptr) - 2 * 60 * 60, 0 } };
+        REQUIRE( utimensat(AT_FDCWD, stale.c_str(), times, 0) == 0 );
+
+        REQUIRE( cache.store(cache_key("1", 1, "test"), "tokens", std::string(100, 'x')) );
+        REQUIRE( cache.store(cache_key("2", 1, "test"), "tokens", std::string(100, 'x')) );
+        struct stat info;
+        REQUIRE( stat(stale.c_str(), &info) != 0 );
+        REQUIRE( stat(fresh.c_str(), &info) == 0 );
+        CacheStats stats;
+        REQUIRE( cache.read_stats(stats) );
+        REQUIRE( stats.evictions == 1 );
+    }
+    remove_tree(directory);
+}
+
+TEST_CASE( "Concurrent users of one cache see whole entries", "[cache]" ) {
+    std::string directory = "cynotester_cache_threads";
+    remove_tree(directory);
+    {
+        const int THREADS = 4;
+        const int ROUNDS = 25;
+        std::vector<std::thread> threads;
+        std::vector<int> bad(THREADS, 0);
+        for (int t = 0; t < THREADS; t++) {
+            threads.emplace_back([&, t]() {
+                // Separate instances, as separate processes would have.
+                ResultCache cache(directory, DEFAULT_CACHE_SIZE);
+                for (int round = 0; round < ROUNDS; round++) {
+                    std::string name = std::to_string(round % 5);
+                    CacheKey key = cache_key(name.data(), name.size(), "test");
+                    std::string expected(1000, name[0]);
+                    std::string bytes;
+                    if (cache.load(key, "tokens", bytes)) {
+                        bad[t] += bytes != expected;
+                    } else {
+                        cache.store(key, "tokens", expected);
+                    }
+                }
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+
+        CacheStats stats;
+        REQUIRE( ResultCache(directory, DEFAULT_CACHE_SIZE).read_stats(stats) );
+        REQUIRE( bad == std::vector<int>(THREADS, 0) );
+        REQUIRE( stats.hits + stats.misses == THREADS * ROUNDS );
+        REQUIRE( stats.stores == stats.misses );
+        REQUIRE( stats.hits >= THREADS * ROUNDS - THREADS * 5 );
+    }
+    remove_tree(directory);
+}
+
+#endif
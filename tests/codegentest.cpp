@@ -0,0 +1,296 @@
+#include <catch2/catch.hpp>
+#include <cynophobia/codegen.hpp>
+#include <cynophobia/debugwriter.hpp>
+#include <cynophobia/lexer.hpp>
+#include <cynophobia/object.hpp>
+#include <cynophobia/optimizer.hpp>
+#include <cynophobia/parser.hpp>
+#include <cynophobia/tacky.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#endif
+
+namespace {
+    assembly::Program generate(const std::string& source) {
+        LexerOutput lexer_output = lex_string(source, false);
+        ParserOutput parser_output = parse_program(lexer_output.tokens);
+        REQUIRE( !parser_output.is_error );
+        return generate_assembly(lower_program(*parser_output.program));
+    }
+
+    std::string assembly_text(const assembly::Program& program) {
+        std::string text;
+        {
+            DebugWriter writer(text);
+            write_assembly(writer, program, "test.c");
+        }
+        return text;
+    }
+
+    std::string object_bytes(const ObjectFile& object) {
+        std::string bytes;
+        {
+            DebugWriter writer(bytes);
+            write_elf_object(writer, object);
+        }
+        return bytes;
+    }
+}
+
+TEST_CASE( "Chapter 1 programs compile to mov and ret", "[codegen]" ) {
+    assembly::Program program = generate(
+        "int main(void) { return 2; } int wraps(void) { return 4294967295; }");
+    REQUIRE( instruction_count(program) == 4 );
+    REQUIRE( assembly_text(program) ==
+        "\t.file\t\"test.c\"\n"
+        "\t.text\n"
+        "\t.globl\tmain\n"
+        "\t.type\tmain, @function\n"
+        "main:\n"
+        "\tmovl\t$2, %eax\n"
+        "\tret\n"
+        "\t.size\tmain, .-main\n"
+        "\t.globl\twraps\n"
+        "\t.type\twraps, @function\n"
+        "wraps:\n"
+        "\tmovl\t$-1, %eax\n"
+        "\tret\n"
+        "\t.size\twraps, .-wraps\n"
+        "\t.section\t.note.GNU-stack,\"\",@progbits\n" );
+
+    ObjectFile object = encode_object(program, "test.c");
+    REQUIRE( object.text == std::string("\xB8\x02\x00\x00\x00\xC3\xB8\xFF\xFF\xFF\xFF\xC3", 12) );
+    REQUIRE( object.symbols.size() == 2 );
+    REQUIRE( object.symbols[1].name == "wraps" );
+    REQUIRE( object.symbols[1].offset == 6 );
+    REQUIRE( object.symbols[1].size == 6 );
+    REQUIRE( object.relocations.empty() );
+
+    std::string bytes = object_bytes(object);
+    REQUIRE( bytes.compare(0, 4, "\x7F" "ELF") == 0 );
+    REQUIRE( bytes[4] == 2 );       // 64-bit
+    REQUIRE( bytes[16] == 1 );      // relocatable
+    REQUIRE( bytes[18] == 62 );     // x86-64
+    REQUIRE( bytes.compare(64, object.text.size(), object.text) == 0 );
+}
+
+#ifndef _WIN32
+namespace {
+    int run(const std::string& command) {
+        int status = std::system(command.c_str());
+        return status != -1 && WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    }
+
+    std::string read_file(const char* path) {
+        std::ifstream file(path, std::ios::binary);
+        std::stringstream contents;
+        contents << file.rdbuf();
+        return contents.str();
+    }
+
+    bool has_toolchain() {
+        return run("cc --version > /dev/null 2>&1") == 0
+            && run("objcopy --version > /dev/null 2>&1") == 0
+            && run("nm --version > /dev/null 2>&1") == 0;
+    }
+
+    void write_object(const char* path, const ObjectFile& object) {
+        std::ofstream(path, std::ios::binary) << object_bytes(object);
+    }
+}
+
+TEST_CASE( "Encoded objects match what the assembler makes of the .s", "[codegen][toolchain]" ) {
+    if (!has_toolchain()) {
+        WARN( "no cc, objcopy and nm to check objects against" );
+        return;
+    }
+    assembly::Program program = generate(
+        "int helper(void) { return 300; } int main(void) { return 42; }");
+    std::ofstream("cynotester_codegen.s", std::ios::binary) << assembly_text(program);
+    write_object("cynotester_direct.o", encode_object(program, "test.c"));
+
+    REQUIRE( run("cc -c cynotester_codegen.s -o cynotester_assembled.o") == 0 );
+    REQUIRE( run("objcopy -O binary --only-section=.text cynotester_direct.o cynotester_direct.bin") == 0 );
+    REQUIRE( run("objcopy -O binary --only-section=.text cynotester_assembled.o cynotester_assembled.bin") == 0 );
+    REQUIRE( read_file("cynotester_direct.bin") == read_file("cynotester_assembled.bin") );
+    REQUIRE( run("nm -S cynotester_direct.o > cynotester_direct.nm") == 0 );
+    REQUIRE( run("nm -S cynotester_assembled.o > cynotester_assembled.nm") == 0 );
+    REQUIRE( read_file("cynotester_direct.nm") == read_file("cynotester_assembled.nm") );
+
+    REQUIRE( run("cc cynotester_direct.o -o cynotester_direct") == 0 );
+    REQUIRE( run("./cynotester_direct") == 42 );
+
+    const char* const files[] = {
+        "cynotester_codegen.s", "cynotester_direct.o", "cynotester_assembled.o",
+        "cynotester_direct.bin", "cynotester_assembled.bin", "cynotester_direct.nm",
+        "cynotester_assembled.nm", "cynotester_direct"
+    };
+    for (const char* file : files) {
+        std::remove(file);
+    }
+}
+
+TEST_CASE( "Every instruction form encodes as the assembler encodes it", "[codegen][toolchain]" ) {
+    if (!has_toolchain()) {
+        WARN( "no cc, objcopy and nm to check objects against" );
+        return;
+    }
+    tacky::Program tacky_program;
+    tacky_program.functions.resize(2);
+    tacky::Function& function = tacky_program.functions[0];
+    function.name = TextView { "forms", 5 };
+    function.temporaries = 0;
+    function.labels = 0;
+    // Enough temporaries that later slots need 32-bit displacements.
+    std::vector<tacky::Value> t;
+    for (int i = 0; i < 40; i++) {
+        t.push_back(function.temporary());
+        function.emit(tacky::Copy, t[i], function.constant(i * 1000 - 20000));
+    }
+    tacky::Value top = function.label();
+    tacky::Value far = function.label();
+    tacky::Value near = function.label();
+    function.emit(tacky::Label, top);
+    const tacky::Value operands[] = {
+        t[1], t[39], function.constant(5), function.constant(-300), function.constant(1 << 20)
+    };
+    for (int opcode = tacky::Add; opcode <= tacky::GreaterOrEqual; opcode++) {
+        for (tacky::Value a : operands) {
+            for (tacky::Value b : operands) {
+                function.emit((tacky::Opcode)opcode, t[2 + opcode % 30], a, b);
+            }
+        }
+        // The destination is also the right operand.
+        function.emit((tacky::Opcode)opcode, t[3], t[4], t[3]);
+    }
+    for (int opcode = tacky::Complement; opcode <= tacky::Not; opcode++) {
+        function.emit((tacky::Opcode)opcode, t[5], operands[opcode % 5]);
+        function.emit((tacky::Opcode)opcode, t[38], t[38]);
+    }
+    function.emit(tacky::JumpIfZero, far, t[6]);
+    function.emit(tacky::JumpIfNotZero, near, function.constant(0));
+    function.emit(tacky::Label, near);
+    for (int i = 0; i < 30; i++) {
+        function.emit(tacky::Copy, t[i], t[39 - i]);
+    }
+    function.emit(tacky::Label, far);
+    function.emit(tacky::JumpIfNotZero, top, t[7]);
+    function.emit(tacky::Jump, near);
+    function.emit(tacky::Return, tacky::NO_VALUE, t[8]);
+
+    tacky::Function& small = tacky_program.functions[1];
+    small.name = TextView { "main", 4 };
+    small.temporaries = 0;
+    small.labels = 0;
+    tacky::Value x = small.temporary();
+    tacky::Value done = small.label();
+    small.emit(tacky::Remainder, x, small.constant(47), small.constant(5));
+    small.emit(tacky::JumpIfNotZero, done, x);
+    small.emit(tacky::Return, tacky::NO_VALUE, small.constant(1));
+    small.emit(tacky::Label, done);
+    small.emit(tacky::Return, tacky::NO_VALUE, x);
+
+    assembly::Program program = generate_assembly(tacky_program);
+    std::ofstream("cynotester_forms.s", std::ios::binary) << assembly_text(program);
+    write_object("cynotester_forms_direct.o", encode_object(program, "test.c"));
+
+    REQUIRE( run("cc -c cynotester_forms.s -o cynotester_forms_assembled.o") == 0 );
+    REQUIRE( run("objcopy -O binary --only-section=.text cynotester_forms_direct.o cynotester_forms_direct.bin") == 0 );
+    REQUIRE( run("objcopy -O binary --only-section=.text cynotester_forms_assembled.o cynotester_forms_assembled.bin") == 0 );
+    std::string direct = read_file("cynotester_forms_direct.bin");
+    REQUIRE( direct.size() > 1000 );
+    REQUIRE( direct == read_file("cynotester_forms_assembled.bin") );
+    REQUIRE( run("nm -S cynotester_forms_direct.o > cynotester_forms_direct.nm") == 0 );
+    REQUIRE( run("nm -S cynotester_forms_assembled.o > cynotester_forms_assembled.nm") == 0 );
+    REQUIRE( read_file("cynotester_forms_direct.nm") == read_file("cynotester_forms_assembled.nm") );
+
+    REQUIRE( run("cc cynotester_forms_direct.o -o cynotester_forms") == 0 );
+    REQUIRE( run("./cynotester_forms") == 2 );
+
+    const char* const files[] = {
+        "cynotester_forms.s", "cynotester_forms_direct.o", "cynotester_forms_assembled.o",
+        "cynotester_forms_direct.bin", "cynotester_forms_assembled.bin",
+        "cynotester_forms_direct.nm", "cynotester_forms_assembled.nm", "cynotester_forms"
+    };
+    for (const char* file : files) {
+        std::remove(file);
+    }
+}
+
+TEST_CASE( "Relocations against local and undefined symbols link", "[codegen][toolchain]" ) {
+    if (!has_toolchain()) {
+        WARN( "no cc to link with" );
+        return;
+    }
+    // main: sub $8, %rsp; call helper; mov %eax, %edi; call exit
+    // helper: mov $7, %eax; ret
+    ObjectFile object;
+    object.text = std::string(
+        "\x48\x83\xEC\x08" "\xE8\x00\x00\x00\x00" "\x89\xC7" "\xE8\x00\x00\x00\x00"
+        "\xB8\x07\x00\x00\x00\xC3", 22);
+    object.symbols.push_back(ObjectSymbol { "main", true, true, true, 0, 16 });
+    object.symbols.push_back(ObjectSymbol { "exit", false, true, false, 0, 0 });
+    object.symbols.push_back(ObjectSymbol { "helper", true, false, true, 16, 6 });
+    object.relocations.push_back(ObjectRelocation { 5, 2, R_X86_64_PLT32, -4 });
+    object.relocations.push_back(ObjectRelocation { 12, 1, R_X86_64_PLT32, -4 });
+    write_object("cynotester_relocated.o", object);
+
+    REQUIRE( run("cc cynotester_relocated.o -o cynotester_relocated") == 0 );
+    REQUIRE( run("./cynotester_relocated") == 7 );
+    std::remove("cynotester_relocated.o");
+    std::remove("cynotester_relocated");
+}
+
+TEST_CASE( "Chapter 2 to 4 expressions run as C evaluates them", "[codegen][toolchain][chapter4]" ) {
+    if (run("cc --version > /dev/null 2>&1") != 0) {
+        WARN( "no cc to link with" );
+        return;
+    }
+    struct Case {
+        const char* expression;
+        int status;
+    };
+    // Exit statuses are the low byte of what main returns.
+    const Case cases[] = {
+        { "~12", 243 },
+        { "-(-5)", 5 },
+        { "!0 + !7", 1 },
+        { "2 + 3 * 4 - 20 / 3 % 4", 12 },
+        { "(10 - 3) * -2 + 20", 6 },
+        { "-7 / 2 + -7 % 2 * 10", 243 },
+        { "(3 != 4) + (4 <= 3) * 8 + (5 > 1) * 16 + (2 >= 2) * 32 + (1 == 1) * 64", 113 },
+        { "1 < 2 && 3 >= 3 || 0", 1 },
+        { "0 || 5 == 5 != 0", 1 },
+        // The right operand would trap if it were evaluated.
+        { "0 && 1 / 0", 0 },
+        { "1 || 1 / 0", 1 },
+    };
+    for (const Case& test : cases) {
+        for (int optimized = 0; optimized < 2; optimized++) {
+            LexerOutput lexer_output = lex_string(
+                std::string("int main(void) { return ") + test.expression + "; }", false);
+            ParserOutput parser_output = parse_program(lexer_output.tokens);
+            REQUIRE( !parser_output.is_error );
+            tacky::Program program = lower_program(*parser_output.program);
+            if (optimized) {
+                OptimizerStats stats = {};
+                optimize_program(program, stats);
+            }
+            write_object("cynotester_expression.o", encode_object(generate_assembly(program), "test.c"));
+            INFO( test.expression << (optimized ? " with -O" : "") );
+            REQUIRE( run("cc cynotester_expression.o -o cynotester_expression") == 0 );
+            REQUIRE( run("./cynotester_expression") == test.status );
+        }
+    }
+    std::remove("cynotester_expression.o");
+    std::remove("cynotester_expression");
+}
+#endif
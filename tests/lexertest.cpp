@@ -1,7 +1,19 @@
 #define CATCH_CONFIG_MAIN
 #include <catch2/catch.hpp> 
+#include <cynophobia/debugwriter.hpp>
+#include <cynophobia/keywords.hpp>
 #include <cynophobia/lexer.hpp> 
 
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <thread>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
 std::vector<Token::TokenType> get_tokentype_sequence 
     (const LexerOutput& lexer_output) {
         std::vector<Token::TokenType> token_types = {};
@@ -18,7 +30,7 @@ std::vector<std::string> get_tokentext_sequence
     (const LexerOutput& lexer_output) { 
         std::vector<std::string> token_types = {};
         for (const Token& token : lexer_output.tokens) {
-            token_types.push_back(token.text); 
+            token_types.push_back(token.text.str()); 
         }
         return token_types;
     }
@@ -27,7 +39,7 @@ std::vector<std::string> get_unknown_tokens
     (const LexerOutput& lexer_output) { 
         std::vector<std::string> unknown_tokens = {};
         for (const UnknownToken& unknown_token : lexer_output.unknown_tokens) {
-            unknown_tokens.push_back(unknown_token.text); 
+            unknown_tokens.push_back(unknown_token.text.str()); 
         }
         return unknown_tokens;
     }
@@ -106,4 +118,410 @@ TEST_CASE( "Lexing an invalid parse but with valid chapter 1 tokens", "[lexer][c
     REQUIRE( get_tokentype_sequence(lexer_output) == expected_tokentype_sequence ); 
     REQUIRE( get_tokentext_sequence(lexer_output) == expected_tokentext_sequence );   
     REQUIRE ( get_unknown_tokens(lexer_output) == expected_unknown_tokens ); 
-}
\ No newline at end of file
+}
+TEST_CASE( "Lexing chapter 2 to 4 operators", "[lexer][chapter4]" ) {
+    std::string program = "~--x-1+*/%!&&||==!=<><=>=!==& | =-";
+    LexerOutput lexer_output = lex_string(program, false);
+
+    const std::vector<Token::TokenType> expected_tokentype_sequence = {
+        Token::Tilde, Token::Decrement, Token::Identifier, Token::Hyphen, Token::Constant,
+        Token::Plus, Token::Asterisk, Token::Slash, Token::Percent, Token::Bang,
+        Token::LogicalAnd, Token::LogicalOr, Token::EqualEqual, Token::BangEqual, Token::Less,
+        Token::Greater, Token::LessEqual, Token::GreaterEqual, Token::BangEqual, Token::Hyphen
+    };
+    REQUIRE( get_tokentype_sequence(lexer_output) == expected_tokentype_sequence );
+    REQUIRE( get_unknown_tokens(lexer_output) == std::vector<std::string>{ "=", "&", "|", "=" } );
+    REQUIRE( lexer_output.tokens[1].text == "--" );
+    REQUIRE( lexer_output.tokens[17].text == ">=" );
+
+    // Lexed through a stream, pairs come out the same.
+    StringCharStream stream(program);
+    REQUIRE( lex_stream(stream, false).debug_string() == lexer_output.debug_string() );
+}
+
+TEST_CASE( "Lexing a mapped file matches lexing the same string", "[lexer][chapter1]" ) {
+    std::string program = "int main(void) {\r\n  return 2;\n}\n_tail";
+    std::string filename = "cynotester_mapped_input.c";
+    {
+        std::ofstream out(filename, std::ios::binary);
+        out << program;
+    }
+    LexerOutput file_output = lex_file({ filename, false });
+    LexerOutput string_output = lex_string(program, false);
+    std::remove(filename.c_str());
+
+    REQUIRE( !file_output.open_failed );
+    REQUIRE( file_output.debug_string() == string_output.debug_string() );
+    REQUIRE( get_tokentext_sequence(file_output).back() == "_tail" );
+}
+
+TEST_CASE( "Lexing through the type-erased stream path matches lex_string", "[lexer][chapter1]" ) {
+    // Long enough that the copied token text spans several TextPool blocks.
+    std::string program;
+    for (int i = 0; i < 20000; i++) {
+        program += "int main_" + std::to_string(i) + "(void) { return 100; }\n";
+    }
+    std::string filename = "cynotester_stream_input.c";
+    {
+        std::ofstream out(filename, std::ios::binary);
+        out << program;
+    }
+    FileCharStream file_stream(filename);
+    LexerOutput stream_output = lex_stream(file_stream, false);
+    LexerOutput string_output = lex_string(program, false);
+    std::remove(filename.c_str());
+
+    REQUIRE( stream_output.tokens.size() == string_output.tokens.size() );
+    REQUIRE( stream_output.debug_string() == string_output.debug_string() );
+}
+
+TEST_CASE( "Vectorized run scanning agrees with the classification table", "[lexer][charclass]" ) {
+    // Every byte value at every offset in and around a vector block.
+    std::string buffer(200, 'a');
+    for (int c = 0; c < 256; c++) {
+        for (std::size_t stop = 0; stop < 70; stop++) {
+            std::string input = buffer;
+            input[stop] = (char)c;
+            const char* begin = input.data();
+            const char* end = begin + input.size();
+            REQUIRE( charclass::scan<charclass::WORD>(begin, end)
+                == charclass::scan_scalar<charclass::WORD>(begin, end) );
+            std::string digits(input.size(), '7');
+            digits[stop] = (char)c;
+            REQUIRE( charclass::scan<charclass::DIGIT>(digits.data(), digits.data() + digits.size())
+                == charclass::scan_scalar<charclass::DIGIT>(digits.data(), digits.data() + digits.size()) );
+            std::string spaces(input.size(), ' ');
+            spaces[stop] = (char)c;
+            REQUIRE( charclass::scan<charclass::WHITESPACE>(spaces.data(), spaces.data() + spaces.size())
+                == charclass::scan_scalar<charclass::WHITESPACE>(spaces.data(), spaces.data() + spaces.size()) );
+        }
+    }
+}
+
+TEST_CASE( "Lexing whitespace runs keeps line and column tracking", "[lexer][chapter1]" ) {
+    std::string program = "int\r\n\r\t main \v\f(void)\r{ 12ab 3 }";
+    StringCharStream string_stream(program);
+    LexerOutput buffer_output = lex_string(program, false);
+    LexerOutput stream_output = lex_stream(string_stream, false);
+
+    REQUIRE( buffer_output.debug_string() == stream_output.debug_string() );
+    REQUIRE( buffer_output.tokens[1].position.line == 2 );
+    REQUIRE( buffer_output.tokens[1].position.column == 2 );
+    REQUIRE( get_unknown_tokens(buffer_output) == std::vector<std::string>{ "12ab" } );
+}
+
+TEST_CASE( "Pulling tokens from a TokenSource matches lex_string", "[lexer][tokensource]" ) {
+    std::string program;
+    for (int i = 0; i < 300; i++) {
+        program += "int f" + std::to_string(i) + "(void)\r\n{\r\treturn " + std::to_string(i)
+            + ";\v}\r" + (i % 7 == 0 ? " 9lives $ " : "") + "\n";
+    }
+    std::string filename = "tokensource_test.c";
+    {
+        std::ofstream out(filename, std::ios::binary);
+        out << program;
+    }
+    LexerOutput expected = lex_string(program, false);
+
+    FileCharStream file_stream(filename);
+    StringCharStream string_stream(program);
+    FallibleCharStream* streams[] = { &file_stream, &string_stream };
+    for (FallibleCharStream* stream : streams) {
+        TokenSource source(*stream, 4);
+        REQUIRE( source.peek_token(4) == nullptr );
+        for (std::size_t i = 0; i < expected.tokens.size(); i++) {
+            for (std::size_t k = 0; k < 4; k++) {
+                const Token* ahead = source.peek_token(k);
+                if (i + k < expected.tokens.size()) {
+                    REQUIRE( ahead != nullptr );
+                    REQUIRE( ahead->debug_string() == expected.tokens[i + k].debug_string() );
+                } else {
+                    REQUIRE( ahead == nullptr );
+                }
+            }
+            const Token* token = source.next_token();
+            REQUIRE( token != nullptr );
+            REQUIRE( token->debug_string() == expected.tokens[i].debug_string() );
+        }
+        REQUIRE( source.next_token() == nullptr );
+        REQUIRE( source.unknown_tokens().size() == expected.unknown_tokens.size() );
+        for (std::size_t i = 0; i < expected.unknown_tokens.size(); i++) {
+            REQUIRE( source.unknown_tokens()[i].debug_string()
+                == expected.unknown_tokens[i].debug_string() );
+        }
+        REQUIRE_FALSE( source.read_failed() );
+        REQUIRE_FALSE( source.open_failed() );
+    }
+    std::remove(filename.c_str());
+}
+
+#ifndef _WIN32
+TEST_CASE( "Lexing a pipe in blocks matches lex_string", "[lexer][pipe]" ) {
+    // Several FdCharStream blocks, written in pieces that split tokens.
+    std::string program;
+    for (int i = 0; i < 8000; i++) {
+        program += "int pipe_" + std::to_string(i) + "(void)\r\n{ return " + std::to_string(i)
+            + "; }" + (i % 1000 == 0 ? " 3x " : "") + "\n";
+    }
+    REQUIRE( program.size() > 3 * FdCharStream::BLOCK_SIZE );
+    LexerOutput expected = lex_string(program, false);
+
+    auto lex_pipe = [&](std::function<void(int)> read_end) {
+        int fds[2];
+        REQUIRE( pipe(fds) == 0 );
+        std::thread writer([&]() {
+            for (std::size_t at = 0; at < program.size(); at += 4093) {
+                std::size_t size = std::min<std::size_t>(4093, program.size() - at);
+                if (write(fds[1], program.data() + at, size) != (ssize_t)size) {
+                    break;
+                }
+            }
+            close(fds[1]);
+        });
+        read_end(fds[0]);
+        writer.join();
+        close(fds[0]);
+    };
+
+    lex_pipe([&](int fd) {
+        LexerOutput fd_output = lex_fd(fd, false, 3);
+        REQUIRE( !fd_output.read_failed );
+        REQUIRE( fd_output.debug_string() == expected.debug_string() );
+    });
+    lex_pipe([&](int fd) {
+        FdCharStream stream(fd);
+        LexerOutput stream_output = lex_stream(stream, false);
+        REQUIRE( stream_output.debug_string() == expected.debug_string() );
+    });
+    lex_pipe([&](int fd) {
+        FdCharStream stream(fd);
+        TokenSource source(stream, 4);
+        std::size_t count = 0;
+        while (const Token* token = source.next_token()) {
+            REQUIRE( token->debug_string() == expected.tokens[count].debug_string() );
+            count++;
+        }
+        REQUIRE( count == expected.tokens.size() );
+        REQUIRE( source.unknown_tokens().size() == 8 );
+    });
+
+    FileCharStream missing("cynotester_no_such_file.c");
+    REQUIRE( !missing.was_opened() );
+    REQUIRE( lex_stream(missing, false).open_failed );
+    REQUIRE( lex_fd(-1, false).open_failed );
+}
+#endif
+
+TEST_CASE( "Parallel lexing matches serial lexing byte for byte", "[lexer][parallel]" ) {
+    std::string with_lines;
+    for (int i = 0; i < 200; i++) {
+        with_lines += "int f" + std::to_string(i) + "(void) {\r\n\treturn " + std::to_string(i * 7919)
+            + (i % 9 == 0 ? "x @ " : "") + ";\v}\n";
+    }
+    // Without whitespace every chunk boundary falls inside or between
+    // tokens at random, and long tokens cross several chunks.
+    std::string without_whitespace;
+    for (int i = 0; i < 300; i++) {
+        without_whitespace += i % 5 == 0 ? std::string(40, 'w') + ";" : "a1;12ab(" + std::to_string(i) + ")";
+    }
+    const std::vector<std::string> programs = { with_lines, without_whitespace, "", "int", "\r" };
+    for (const std::string& program : programs) {
+        std::string expected = lex_string(program, false).debug_string();
+        for (unsigned int jobs = 2; jobs <= 6; jobs++) {
+            for (std::size_t min_chunk_size : { (std::size_t)1, (std::size_t)7, (std::size_t)300 }) {
+                INFO( "jobs " << jobs << ", min_chunk_size " << min_chunk_size );
+                REQUIRE( lex_string_parallel(program, false, jobs, min_chunk_size).debug_string()
+                    == expected );
+            }
+        }
+    }
+
+    std::string filename = "parallel_lex_test.c";
+    {
+        std::ofstream out(filename, std::ios::binary);
+        out << with_lines;
+    }
+    REQUIRE( lex_file_parallel({ filename, false }, 4, 64).debug_string()
+        == lex_string(with_lines, false).debug_string() );
+    REQUIRE( lex_file_parallel({ "does_not_exist.c", false }, 4).open_failed );
+    std::remove(filename.c_str());
+}
+
+namespace {
+    // Claims more bytes than a span can address; lexing must not read them.
+    class OversizeSource : public SourceBuffer {
+        public:
+            const char* data() const override { return "int"; }
+            std::size_t size() const override { return MAX_SOURCE_SIZE + 1; }
+    };
+}
+
+TEST_CASE( "Sources too large for 32-bit spans are refused", "[lexer][parallel]" ) {
+    for (unsigned int jobs : { 1u, 4u }) {
+        LexerOutput output = lex_source(std::make_shared<OversizeSource>(), false, jobs);
+        REQUIRE( output.read_failed );
+        REQUIRE( output.tokens.size() == 0 );
+    }
+
+    // Sparse where the filesystem allows, so this writes a single byte.
+    std::string filename = "cynotester_oversize.c";
+    {
+        std::ofstream out(filename, std::ios::binary);
+        out.seekp((std::streamoff)MAX_SOURCE_SIZE);
+        out.put(' ');
+    }
+    REQUIRE( lex_file({ filename, false }).open_failed );
+    REQUIRE( lex_file_parallel({ filename, false }, 4).open_failed );
+    std::remove(filename.c_str());
+}
+
+TEST_CASE( "Identifiers are interned with dense symbol ids", "[lexer][symbols]" ) {
+    SymbolTable table;
+    for (int i = 0; i < 5000; i++) {
+        std::string name = "name" + std::to_string(i);
+        REQUIRE( table.intern(name.data(), name.size()) == (SymbolId)i );
+    }
+    for (int i = 0; i < 5000; i++) {
+        std::string name = "name" + std::to_string(i);
+        REQUIRE( table.intern(name.data(), name.size()) == (SymbolId)i );
+        REQUIRE( table.str((SymbolId)i) == name );
+    }
+    REQUIRE( table.size() == 5000 );
+    REQUIRE( table.find("name", 4) == NO_SYMBOL );
+
+    std::string program;
+    for (int i = 0; i < 400; i++) {
+        program += "int f" + std::to_string(i % 50) + "(void) { return main; }\n";
+    }
+    LexerOutput output = lex_string(program, false);
+    const SymbolTable& symbols = *output.tokens.symbols();
+    REQUIRE( symbols.size() == 51 );
+    for (const Token& token : output.tokens) {
+        if (token.token_type == Token::Identifier) {
+            REQUIRE( token.symbol != NO_SYMBOL );
+            REQUIRE( token.text == symbols.str(token.symbol) );
+        } else {
+            REQUIRE( token.symbol == NO_SYMBOL );
+        }
+    }
+
+    LexerOutput parallel_output = lex_string_parallel(program, false, 4, 16);
+    REQUIRE( parallel_output.tokens.size() == output.tokens.size() );
+    for (std::size_t i = 0; i < output.tokens.size(); i++) {
+        REQUIRE( parallel_output.tokens.symbol(i) == output.tokens.symbol(i) );
+    }
+}
+
+TEST_CASE( "Binary lexer dumps read back to the same output", "[lexer][dump]" ) {
+    const std::vector<std::string> programs = {
+        "int main(void) {\r\n  return 2;\v}",
+        "int 12ab main @ ( void\r) $",
+        "",
+    };
+    std::string dumps;
+    {
+        DebugWriter writer(dumps);
+        for (const std::string& program : programs) {
+            write_lexer_dump(writer, lex_string(program, false));
+        }
+    }
+
+    std::size_t offset = 0;
+    for (const std::string& program : programs) {
+        LexerOutput expected = lex_string(program, false);
+        LexerOutput read_back = {};
+        std::size_t consumed = 0;
+        REQUIRE( read_lexer_dump(dumps.data() + offset, dumps.size() - offset, read_back, consumed) );
+        REQUIRE( read_back.debug_string() == expected.debug_string() );
+        for (std::size_t i = 0; i < expected.tokens.size(); i++) {
+            REQUIRE( read_back.tokens.symbol(i) == expected.tokens.symbol(i) );
+        }
+        offset += consumed;
+    }
+    REQUIRE( offset == dumps.size() );
+
+    LexerOutput truncated = {};
+    std::size_t consumed = 0;
+    REQUIRE_FALSE( read_lexer_dump(dumps.data(), 30, truncated, consumed) );
+    REQUIRE_FALSE( read_lexer_dump("not a dump at all, not at all", 29, truncated, consumed) );
+}
+
+TEST_CASE( "Debug writers append to strings in place", "[lexer][dump]" ) {
+    // Small enough to make for one diagnostic on any thread's stack.
+    REQUIRE( sizeof(DebugWriter) <= 64 );
+    std::string text = "before:";
+    std::string expected = text;
+    {
+        DebugWriter writer(text);
+        for (unsigned int i = 0; i < 1000; i++) {
+            writer.write_unsigned(i);
+            writer.write_char(',');
+            expected += std::to_string(i) + ",";
+        }
+        REQUIRE( writer.flush() );
+        REQUIRE( text == expected );
+        std::string large(100000, 'x');
+        writer.write(large);
+        writer.write_char('!');
+        expected += large + "!";
+    }
+    REQUIRE( text == expected );
+}
+
+TEST_CASE( "Line index positions match incremental position tracking", "[lexer][positions]" ) {
+    // Random mixes of line breaks, including \r\n pairs that straddle
+    // vector blocks and a \r at the very end.
+    const char alphabet[] = { 'a', ' ', '\n', '\r', '\v', '\f' };
+    unsigned int state = 12345;
+    for (int round = 0; round < 200; round++) {
+        std::string text;
+        std::size_t size = round % 97;
+        for (std::size_t i = 0; i < size; i++) {
+            state = state * 1103515245u + 12345u;
+            text.push_back(alphabet[(state >> 16) % sizeof(alphabet)]);
+        }
+        if (round % 5 == 0) {
+            text.push_back('\r');
+        }
+
+        LineIndex lines;
+        lines.build(text.data(), text.size());
+        FilePosition expected = { 0, 0 };
+        for (std::size_t i = 0; i <= text.size(); i++) {
+            FilePosition actual = lines.position((std::uint32_t)i);
+            REQUIRE( actual.line == expected.line );
+            REQUIRE( actual.column == expected.column );
+            if (i == text.size()) {
+                break;
+            }
+            char c = text[i];
+            bool crlf = c == '\r' && i + 1 < text.size() && text[i + 1] == '\n';
+            if ((c == '\n' || c == '\v' || c == '\f' || c == '\r') && !crlf) {
+                expected = expected.start_next_line();
+            } else {
+                expected = expected.next_column();
+            }
+        }
+    }
+}
+
+TEST_CASE( "Lexing every C17 keyword and near misses", "[lexer][keywords]" ) {
+    std::string program;
+    std::vector<Token::TokenType> expected_tokentype_sequence = {};
+    for (const keywords::Keyword& keyword : keywords::LIST) {
+        program += std::string(keyword.text) + " ";
+        expected_tokentype_sequence.push_back(keyword.token_type);
+    }
+    // Same hash inputs or prefixes as keywords, but not keywords.
+    const std::vector<std::string> near_misses = {
+        "Int", "intt", "in", "i", "_Bool_", "_bool", "retur", "returns",
+        "dO", "_Static_assertx", "_Thread_locaL", "whilee", "a_Atomic"
+    };
+    for (const std::string& word : near_misses) {
+        program += word + " ";
+        expected_tokentype_sequence.push_back(Token::Identifier);
+    }
+    LexerOutput lexer_output = lex_string(program, false);
+
+    REQUIRE( get_tokentype_sequence(lexer_output) == expected_tokentype_sequence );
+}
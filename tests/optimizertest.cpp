@@ -0,0 +1,344 @@
+#include <catch2/catch.hpp>
+#include <cynophobia/codegen.hpp>
+#include <cynophobia/debugwriter.hpp>
+#include <cynophobia/object.hpp>
+#include <cynophobia/optimizer.hpp>
+#include <cynophobia/tacky.hpp>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#endif
+
+namespace {
+    tacky::Program one_function() {
+        tacky::Program program;
+        program.functions.resize(1);
+        tacky::Function& function = program.functions[0];
+        function.name = TextView { "main", 4 };
+        function.temporaries = 0;
+        function.labels = 0;
+        return program;
+    }
+
+    OptimizerStats optimize(tacky::Program& program) {
+        OptimizerStats stats = {};
+        optimize_program(program, stats);
+        return stats;
+    }
+
+    std::string debug_text(const tacky::Program& program) {
+        std::string text;
+        {
+            DebugWriter writer(text);
+            write_debug(writer, program);
+        }
+        return text;
+    }
+
+    std::int32_t value_of(const tacky::Function& function, const std::vector<std::int32_t>& temporaries,
+      tacky::Value value) {
+        return tacky::is_constant(value) ? function.constant_value(value) : temporaries[value];
+    }
+
+    // What the function returns, with int arithmetic wrapping as the
+    // generated code's does. Temporaries start at 0; jumps only go
+    // forward in the programs run here, so it always ends.
+    std::int32_t interpret(const tacky::Function& function) {
+        std::vector<std::int32_t> temporaries(function.temporaries, 0);
+        std::vector<std::size_t> labels(function.labels, 0);
+        const std::vector<tacky::Instruction>& code = function.instructions;
+        for (std::size_t i = 0; i < code.size(); i++) {
+            if (code[i].opcode == tacky::Label) {
+                labels[code[i].dst] = i;
+            }
+        }
+        for (std::size_t i = 0; i < code.size(); i++) {
+            const tacky::Instruction& instruction = code[i];
+            std::uint32_t a = 0;
+            std::uint32_t b = 0;
+            if (instruction.a != tacky::NO_VALUE) {
+                a = (std::uint32_t)value_of(function, temporaries, instruction.a);
+            }
+            if (instruction.b != tacky::NO_VALUE) {
+                b = (std::uint32_t)value_of(function, temporaries, instruction.b);
+            }
+            std::int32_t result = 0;
+            switch (instruction.opcode) {
+                case tacky::Return: return (std::int32_t)a;
+                case tacky::Copy: result = (std::int32_t)a; break;
+                case tacky::Complement: result = (std::int32_t)~a; break;
+                case tacky::Negate: result = (std::int32_t)(0u - a); break;
+                case tacky::Not: result = a == 0; break;
+                case tacky::Add: result = (std::int32_t)(a + b); break;
+                case tacky::Subtract: result = (std::int32_t)(a - b); break;
+                case tacky::Multiply: result = (std::int32_t)(a * b); break;
+                case tacky::Divide: result = (std::int32_t)a / (std::int32_t)b; break;
+                case tacky::Remainder: result = (std::int32_t)a % (std::int32_t)b; break;
+                case tacky::Equal: result = a == b; break;
+                case tacky::NotEqual: result = a != b; break;
+                case tacky::Less: result = (std::int32_t)a < (std::int32_t)b; break;
+                case tacky::LessOrEqual: result = (std::int32_t)a <= (std::int32_t)b; break;
+                case tacky::Greater: result = (std::int32_t)a > (std::int32_t)b; break;
+                case tacky::GreaterOrEqual: result = (std::int32_t)a >= (std::int32_t)b; break;
+                case tacky::Jump: i = labels[instruction.dst]; continue;
+                case tacky::JumpIfZero:
+                    if (a == 0) {
+                        i = labels[instruction.dst];
+                    }
+                    continue;
+                case tacky::JumpIfNotZero:
+                    if (a != 0) {
+                        i = labels[instruction.dst];
+                    }
+                    continue;
+                case tacky::Label: continue;
+            }
+            temporaries[instruction.dst] = result;
+        }
+        return 0;
+    }
+
+    // A function of straight-line arithmetic, copies, forward jumps and
+    // early returns over a handful of temporaries. Divisors are constants
+    // from 1 to 7, so nothing traps.
+    tacky::Program random_program(std::mt19937& random) {
+        tacky::Program program = one_function();
+        tacky::Function& function = program.functions[0];
+        const std::uint32_t temporary_count = 6;
+        const std::uint32_t label_count = 6;
+        for (std::uint32_t t = 0; t < temporary_count; t++) {
+            function.emit(tacky::Copy, function.temporary(),
+                function.constant((std::int32_t)(random() % 200) - 100));
+        }
+        for (std::uint32_t l = 0; l < label_count; l++) {
+            function.label();
+        }
+        auto temporary = [&]() { return (tacky::Value)(random() % temporary_count); };
+        auto operand = [&]() {
+            return random() % 4 == 0
+                ? function.constant((std::int32_t)(random() % 20) - 10) : temporary();
+        };
+        std::uint32_t next_label = 0;
+        for (int i = 0; i < 40; i++) {
+            unsigned int choice = random() % 16;
+            if (choice < 3) {
+                function.emit(tacky::Copy, temporary(), operand());
+            } else if (choice < 5) {
+                function.emit((tacky::Opcode)(tacky::Complement + random() % 3), temporary(),
+                    operand());
+            } else if (choice < 9) {
+                tacky::Opcode opcode = (tacky::Opcode)(tacky::Add + random() % 11);
+                tacky::Value b = opcode == tacky::Divide || opcode == tacky::Remainder
+                    ? function.constant((std::int32_t)(random() % 7) + 1) : operand();
+                function.emit(opcode, temporary(), operand(), b);
+            } else if (choice < 12 && next_label < label_count) {
+                tacky::Value label = next_label + random() % (label_count - next_label);
+                if (random() % 3 == 0) {
+                    function.emit(tacky::Jump, label);
+                } else {
+                    function.emit(random() % 2 ? tacky::JumpIfZero : tacky::JumpIfNotZero, label,
+                        operand());
+                }
+            } else if (choice < 14 && next_label < label_count) {
+                function.emit(tacky::Label, next_label++);
+            } else if (choice == 14) {
+                function.emit(tacky::Return, tacky::NO_VALUE, operand());
+            }
+        }
+        while (next_label < label_count) {
+            function.emit(tacky::Label, next_label++);
+        }
+        function.emit(tacky::Return, tacky::NO_VALUE, temporary());
+        return program;
+    }
+}
+
+TEST_CASE( "Constant expressions fold into the return", "[optimizer]" ) {
+    tacky::Program program = one_function();
+    tacky::Function& function = program.functions[0];
+    tacky::Value t0 = function.temporary();
+    tacky::Value t1 = function.temporary();
+    tacky::Value t2 = function.temporary();
+    function.emit(tacky::Add, t0, function.constant(2147483647), function.constant(1));
+    function.emit(tacky::Multiply, t1, t0, function.constant(-1));
+    function.emit(tacky::Less, t2, t1, function.constant(0));
+    function.emit(tacky::Return, tacky::NO_VALUE, t2);
+
+    OptimizerStats stats = optimize(program);
+    // INT_MIN * -1 wraps back to INT_MIN.
+    REQUIRE( debug_text(program) == "main:\n    return 1\n" );
+    // Folding sees through the temporaries it has just folded, which
+    // leaves copy propagation only the return to rewrite.
+    REQUIRE( stats.passes[ConstantFolding].changes == 3 );
+    REQUIRE( stats.passes[CopyPropagation].changes == 1 );
+    REQUIRE( stats.passes[DeadStores].changes == 3 );
+    REQUIRE( stats.rounds == 2 );
+    REQUIRE( stats.passes[ConstantFolding].runs == stats.rounds );
+    REQUIRE( std::string(pass_name(DeadStores)) == "dead_stores" );
+}
+
+TEST_CASE( "A chain of constant branches folds in one round", "[optimizer]" ) {
+    tacky::Program program = one_function();
+    tacky::Function& function = program.functions[0];
+    tacky::Value value = function.temporary();
+    function.emit(tacky::Copy, value, function.constant(1));
+    // value = value + (0 || value), as lowering emits it, a thousand times over.
+    for (int i = 0; i < 1000; i++) {
+        tacky::Value result = function.temporary();
+        tacky::Value sum = function.temporary();
+        tacky::Value short_circuit = function.label();
+        tacky::Value end = function.label();
+        function.emit(tacky::JumpIfNotZero, short_circuit, function.constant(0));
+        function.emit(tacky::JumpIfNotZero, short_circuit, value);
+        function.emit(tacky::Copy, result, function.constant(0));
+        function.emit(tacky::Jump, end);
+        function.emit(tacky::Label, short_circuit);
+        function.emit(tacky::Copy, result, function.constant(1));
+        function.emit(tacky::Label, end);
+        function.emit(tacky::Add, sum, value, result);
+        value = sum;
+    }
+    function.emit(tacky::Return, tacky::NO_VALUE, value);
+
+    OptimizerStats stats = optimize(program);
+    REQUIRE( debug_text(program) == "main:\n    return 1001\n" );
+    REQUIRE( stats.rounds == 2 );
+}
+
+TEST_CASE( "Division that would trap is left to trap", "[optimizer]" ) {
+    tacky::Program program = one_function();
+    tacky::Function& function = program.functions[0];
+    tacky::Value t0 = function.temporary();
+    tacky::Value t1 = function.temporary();
+    function.emit(tacky::Divide, t0, function.constant(-2147483647 - 1), function.constant(-1));
+    function.emit(tacky::Remainder, t1, t0, function.constant(0));
+    function.emit(tacky::Return, tacky::NO_VALUE, t1);
+
+    optimize(program);
+    REQUIRE( debug_text(program) ==
+        "main:\n"
+        "    t0 = -2147483648 / -1\n"
+        "    t1 = t0 % 0\n"
+        "    return t1\n" );
+}
+
+TEST_CASE( "Constant branches and the code they skip are removed", "[optimizer]" ) {
+    tacky::Program program = one_function();
+    tacky::Function& function = program.functions[0];
+    tacky::Value t0 = function.temporary();
+    tacky::Value skip = function.label();
+    tacky::Value end = function.label();
+    function.emit(tacky::JumpIfNotZero, skip, function.constant(5));
+    function.emit(tacky::Copy, t0, function.constant(1));
+    function.emit(tacky::Return, tacky::NO_VALUE, t0);
+    function.emit(tacky::Label, skip);
+    function.emit(tacky::JumpIfZero, end, function.constant(5));
+    function.emit(tacky::Jump, end);
+    function.emit(tacky::Label, end);
+    function.emit(tacky::Return, tacky::NO_VALUE, function.constant(2));
+
+    OptimizerStats stats = optimize(program);
+    REQUIRE( debug_text(program) == "main:\n    return 2\n" );
+    REQUIRE( stats.passes[UnreachableCode].changes == 6 );
+}
+
+TEST_CASE( "Copies propagate only where they reach on every path", "[optimizer]" ) {
+    tacky::Program program = one_function();
+    tacky::Function& function = program.functions[0];
+    tacky::Value x = function.temporary();
+    tacky::Value y = function.temporary();
+    tacky::Value z = function.temporary();
+    tacky::Value sum = function.temporary();
+    tacky::Value other = function.label();
+    tacky::Value end = function.label();
+    // Division by zero does not fold, so nothing is known about z, and
+    // both branches stay. x = 4 reaches the end along both; y = 3 does not.
+    function.emit(tacky::Divide, z, function.constant(9), function.constant(0));
+    function.emit(tacky::Copy, x, function.constant(4));
+    function.emit(tacky::Multiply, y, z, z);
+    function.emit(tacky::JumpIfZero, other, z);
+    function.emit(tacky::Copy, y, function.constant(3));
+    function.emit(tacky::Copy, x, function.constant(4));
+    function.emit(tacky::Jump, end);
+    function.emit(tacky::Label, other);
+    function.emit(tacky::Negate, z, z);
+    function.emit(tacky::Label, end);
+    function.emit(tacky::Add, sum, x, y);
+    function.emit(tacky::Return, tacky::NO_VALUE, sum);
+
+    optimize(program);
+    REQUIRE( debug_text(program) ==
+        "main:\n"
+        "    t2 = 9 / 0\n"
+        "    t1 = t2 * t2\n"
+        "    if !t2 goto L0\n"
+        "    t1 = 3\n"
+        "    goto L1\n"
+        "L0:\n"
+        "L1:\n"
+        "    t3 = 4 + t1\n"
+        "    return t3\n" );
+}
+
+TEST_CASE( "Optimized random programs compute what they did before", "[optimizer]" ) {
+    std::mt19937 random(1234);
+    OptimizerStats stats = {};
+    for (int i = 0; i < 2000; i++) {
+        tacky::Program program = random_program(random);
+        const tacky::Function& function = program.functions[0];
+        std::int32_t expected = interpret(function);
+        std::size_t before = function.instructions.size();
+        optimize_program(program, stats);
+        INFO( debug_text(program) );
+        REQUIRE( interpret(function) == expected );
+        REQUIRE( function.instructions.size() <= before );
+    }
+    for (int pass = 0; pass < OPTIMIZATION_PASS_COUNT; pass++) {
+        REQUIRE( stats.passes[pass].changes > 0 );
+    }
+}
+
+#ifndef _WIN32
+namespace {
+    int run(const std::string& command) {
+        int status = std::system(command.c_str());
+        return status != -1 && WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    }
+}
+
+TEST_CASE( "Random programs run the same compiled with and without -O", "[optimizer][toolchain]" ) {
+    if (run("cc --version > /dev/null 2>&1") != 0) {
+        WARN( "no cc to link with" );
+        return;
+    }
+    std::mt19937 random(99);
+    for (int i = 0; i < 6; i++) {
+        tacky::Program program = random_program(random);
+        int expected = (int)((std::uint32_t)interpret(program.functions[0]) & 0xFF);
+        for (int optimized = 0; optimized < 2; optimized++) {
+            if (optimized) {
+                optimize(program);
+            }
+            std::string bytes;
+            {
+                DebugWriter writer(bytes);
+                write_elf_object(writer, encode_object(generate_assembly(program), "random.c"));
+            }
+            std::ofstream("cynotester_random.o", std::ios::binary) << bytes;
+            INFO( debug_text(program) );
+            REQUIRE( run("cc cynotester_random.o -o cynotester_random") == 0 );
+            REQUIRE( run("./cynotester_random") == expected );
+        }
+    }
+    std::remove("cynotester_random.o");
+    std::remove("cynotester_random");
+}
+#endif
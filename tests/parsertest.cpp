@@ -0,0 +1,196 @@
+#include <catch2/catch.hpp> 
+#include <cynophobia/lexer.hpp> 
+#include <cynophobia/parser.hpp> 
+
+TEST_CASE( "Parsing a valid chapter 1 program", "[parser][chapter1]" ) {
+    LexerOutput lexer_output = lex_string("int main(void) { return 100; }", false); 
+    ParserOutput parser_output = parse_program(lexer_output.tokens);
+
+    REQUIRE( !parser_output.is_error );
+    REQUIRE( parser_output.program->functions.size() == 1 );
+    const parsing::Function& function = parser_output.program->functions[0];
+    const parsing::Program& program = *parser_output.program;
+    REQUIRE( program.text(function.identifier) == "main" );
+    REQUIRE( function.symbol == lexer_output.tokens.symbols()->find("main", 4) );
+    REQUIRE( function.node_count == 2 );
+    REQUIRE( function.body().kind == parsing::Node::Return );
+    REQUIRE( program.text(function.body().token) == "return" );
+    REQUIRE( function.nodes[function.body().first].kind == parsing::Node::IntConstant );
+    REQUIRE( program.text(function.nodes[function.body().first].token) == "100" );
+}
+
+TEST_CASE( "Parsing invalid chapter 1 programs reports an error", "[parser][chapter1]" ) {
+    const std::vector<std::string> invalid_programs = {
+        "",
+        "int main(void) { return 100 }",
+        "int main(void) { return; }",
+        "int main(void) { return 100; } foo",
+        "int main(void) { return 100;",
+        "main(void) { return 100; }",
+        "int main() { return 100; }",
+    };
+    for (const std::string& program : invalid_programs) {
+        LexerOutput lexer_output = lex_string(program, false); 
+        ParserOutput parser_output = parse_program(lexer_output.tokens);
+        INFO( program );
+        REQUIRE( parser_output.is_error );
+    }
+}
+
+TEST_CASE( "Parsing a borrowed token span outlives the lexer output", "[parser][chapter1]" ) {
+    std::unique_ptr<parsing::Program> program;
+    {
+        LexerOutput lexer_output = lex_string(
+            "int first(void) { return 1; } int second(void) { return 2; }", false);
+        LexerOutput moved_output = std::move(lexer_output);
+        const TokenBuffer& tokens = moved_output.tokens;
+        ParserOutput parser_output = parse_program(TokenSpan { &tokens, 10, tokens.size() });
+        REQUIRE( !parser_output.is_error );
+        program = std::move(parser_output.program);
+
+        ParserOutput truncated = parse_program(TokenSpan { &tokens, 0, 9 });
+        REQUIRE( truncated.is_error );
+        REQUIRE( truncated.error.position.column == 27 );
+    }
+    REQUIRE( program->functions.size() == 1 );
+    const parsing::Function& function = program->functions[0];
+    REQUIRE( program->text(function.identifier) == "second" );
+    REQUIRE( program->text(function.nodes[function.body().first].token) == "2" );
+}
+
+namespace {
+    // Prefix form, e.g. (+ 1 (* 2 3)); only for shallow trees.
+    std::string prefix_form(const parsing::Program& program, const parsing::Function& function,
+      parsing::NodeIndex index) {
+        static const char* const UNARY[] = { "~", "-", "!" };
+        static const char* const BINARY[] = {
+            "+", "-", "*", "/", "%", "==", "!=", "<", "<=", ">", ">=", "&&", "||"
+        };
+        const parsing::Node& node = function.nodes[index];
+        switch (node.kind) {
+            case parsing::Node::IntConstant:
+                return program.text(node.token).str();
+            case parsing::Node::Unary:
+                return std::string("(") + UNARY[node.operation] + " "
+                    + prefix_form(program, function, node.first) + ")";
+            case parsing::Node::Binary:
+                return std::string("(") + BINARY[node.operation] + " "
+                    + prefix_form(program, function, node.first) + " "
+                    + prefix_form(program, function, node.second) + ")";
+            case parsing::Node::Return:
+                return "(return " + prefix_form(program, function, node.first) + ")";
+        }
+        return "";
+    }
+
+    ParserOutput parse_return(const std::string& expression, std::size_t max_nesting = DEFAULT_MAX_NESTING) {
+        LexerOutput lexer_output = lex_string("int main(void) { return " + expression + "; }", false);
+        return parse_program(lexer_output.tokens, max_nesting);
+    }
+
+    std::string parsed_form(const std::string& expression) {
+        ParserOutput parser_output = parse_return(expression);
+        INFO( expression );
+        REQUIRE( !parser_output.is_error );
+        const parsing::Function& function = parser_output.program->functions[0];
+        return prefix_form(*parser_output.program, function, function.body().first);
+    }
+}
+
+TEST_CASE( "Expressions parse by C precedence and associativity", "[parser][chapter4]" ) {
+    REQUIRE( parsed_form("1 + 2 * 3") == "(+ 1 (* 2 3))" );
+    REQUIRE( parsed_form("1 - 2 - 3") == "(- (- 1 2) 3)" );
+    REQUIRE( parsed_form("(1 - 2) * -3") == "(* (- 1 2) (- 3))" );
+    REQUIRE( parsed_form("-~!4 % 5") == "(% (- (~ (! 4))) 5)" );
+    REQUIRE( parsed_form("-(1 + 2)") == "(- (+ 1 2))" );
+    REQUIRE( parsed_form("((((7))))") == "7" );
+    REQUIRE( parsed_form("1 || 2 && 3 == 4 < 5 + 6") == "(|| 1 (&& 2 (== 3 (< 4 (+ 5 6)))))" );
+    REQUIRE( parsed_form("1 <= 2 != 3 >= 4 > 5 / 6") == "(!= (<= 1 2) (> (>= 3 4) (/ 5 6)))" );
+}
+
+TEST_CASE( "Malformed expressions report an error", "[parser][chapter4]" ) {
+    const std::vector<std::string> invalid_expressions = {
+        "-", "1 +", "(1", "1)", "()", "--1", "1 2", "* 2", "(1 + 2))", "~(1 ~ 2)"
+    };
+    for (const std::string& expression : invalid_expressions) {
+        INFO( expression );
+        REQUIRE( parse_return(expression).is_error );
+    }
+    ParserOutput unclosed = parse_return("(1 + 2");
+    REQUIRE( unclosed.error.message == "expected \")\", found other token with text: \";\"" );
+}
+
+TEST_CASE( "Deep nesting parses without recursion, up to a limit", "[parser][chapter4]" ) {
+    // Each level stays pending until its innermost operand arrives, so
+    // these sit just under the default limit.
+    const int depth = 20000;
+    std::string deep = std::string(3 * depth, '(') + "1" + std::string(3 * depth, ')');
+    std::string negated;
+    for (int i = 0; i < depth; i++) {
+        negated += "-~!";
+    }
+    negated += "1";
+    std::string chained;
+    for (int i = 0; i < depth; i++) {
+        chained += "2 * (1 - ";
+    }
+    chained += "3" + std::string(depth, ')');
+
+    REQUIRE( parsed_form(deep) == "1" );
+    {
+        ParserOutput parser_output = parse_return(negated);
+        REQUIRE( !parser_output.is_error );
+        REQUIRE( node_count(*parser_output.program) == 3 + 3 * depth + 1 );
+    }
+    {
+        // The tree is freed without recursing either.
+        ParserOutput parser_output = parse_return(chained);
+        REQUIRE( !parser_output.is_error );
+        REQUIRE( node_count(*parser_output.program) == 3 + 4 * depth + 1 );
+    }
+
+    ParserOutput too_deep = parse_return("(((1)))", 2);
+    REQUIRE( too_deep.is_error );
+    REQUIRE( too_deep.error.message == "expression nested more than 2 levels deep" );
+    REQUIRE( too_deep.error.position.column == 26 );
+    REQUIRE( !parse_return("((1))", 2).is_error );
+    REQUIRE( parse_return(std::string(DEFAULT_MAX_NESTING + 1, '-') + "1").is_error );
+}
+
+TEST_CASE( "A function's nodes are one array in post-order", "[parser][chapter4]" ) {
+    ParserOutput parser_output = parse_return("-(1 + 2 * 3) || !4");
+    REQUIRE( !parser_output.is_error );
+    const parsing::Program& program = *parser_output.program;
+    const parsing::Function& function = program.functions[0];
+    const parsing::Node::Kind kinds[] = {
+        parsing::Node::IntConstant, parsing::Node::IntConstant, parsing::Node::IntConstant,
+        parsing::Node::Binary, parsing::Node::Binary, parsing::Node::Unary,
+        parsing::Node::IntConstant, parsing::Node::Unary, parsing::Node::Binary,
+        parsing::Node::Return
+    };
+    const char* const texts[] = { "1", "2", "3", "*", "+", "-", "4", "!", "||", "return" };
+    REQUIRE( function.node_count == 10 );
+    for (std::uint32_t i = 0; i < function.node_count; i++) {
+        const parsing::Node& node = function.nodes[i];
+        INFO( i );
+        REQUIRE( node.kind == kinds[i] );
+        REQUIRE( program.text(node.token) == texts[i] );
+        // Children come first, and a right operand's subtree starts just
+        // after the left operand.
+        if (node.kind != parsing::Node::IntConstant) {
+            REQUIRE( node.first < i );
+        }
+        if (node.kind == parsing::Node::Binary) {
+            REQUIRE( node.second < i );
+            REQUIRE( node.second > node.first );
+        }
+    }
+    REQUIRE( function.nodes[8].first == 5 );
+    REQUIRE( function.nodes[8].second == 7 );
+    REQUIRE( function.nodes[4].operation == parsing::Add );
+    // Only the tokens the tree refers to are kept: no parentheses or
+    // punctuation.
+    REQUIRE( program.text(function.type) == "int" );
+    REQUIRE( function.identifier == 1 );
+    REQUIRE( program.token_count == 12 );
+}
@@ -0,0 +1,243 @@
+#include <catch2/catch.hpp>
+#include <cynophobia/lexer.hpp>
+#include <cynophobia/preprocessor.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    PreprocessorOutput preprocess(const std::string& text) {
+        return preprocess_string(text, "test.c", PreprocessorOptions());
+    }
+
+    // The text without whitespace outside literals, which is all the
+    // standard's examples pin down.
+    std::string squeeze(const std::string& text) {
+        std::string squeezed;
+        char quote = 0;
+        for (std::size_t i = 0; i < text.size(); i++) {
+            char c = text[i];
+            if (quote) {
+                squeezed += c;
+                if (c == '\\' && i + 1 < text.size()) {
+                    squeezed += text[++i];
+                } else if (c == quote) {
+                    quote = 0;
+                }
+            } else if (c == '"' || c == '\'') {
+                quote = c;
+                squeezed += c;
+            } else if (c != ' ' && c != '\n') {
+                squeezed += c;
+            }
+        }
+        return squeezed;
+    }
+
+    std::string expand(const std::string& text) {
+        PreprocessorOutput output = preprocess(text);
+        for (const PreprocessorError& error : output.errors) {
+            INFO( error.debug_string() );
+        }
+        REQUIRE( output.errors.empty() );
+        return squeeze(output.text);
+    }
+}
+
+TEST_CASE( "Macros expand as in the examples of C17 6.10.3.5", "[preprocessor]" ) {
+    // EXAMPLE 3
+    REQUIRE( expand(
+        "#define x 3\n"
+        "#define f(a) f(x * (a))\n"
+        "#undef x\n"
+        "#define x 2\n"
+        "#define g f\n"
+        "#define z z[0]\n"
+        "#define h g(~\n"
+        "#define m(a) a(w)\n"
+        "#define w 0,1\n"
+        "#define t(a) a\n"
+        "#define p() int\n"
+        "#define q(x) x\n"
+        "#define r(x,y) x ## y\n"
+        "#define str(x) # x\n"
+        "f(y+1) + f(f(z)) % t(t(g)(0) + t)(1);\n"
+        "g(x+(3,4)-w) | h 5) & m\n"
+        "    (f)^m(m);\n"
+        "p() i[q()] = { q(1), r(2,3), r(4,), r(,5), r(,) };\n"
+        "char c[2][6] = { str(hello), str() };\n") == squeeze(
+        "f(2 * (y+1)) + f(2 * (f(2 * (z[0])))) % f(2 * (0)) + t(1);"
+        "f(2 * (2+(3,4)-0,1)) | f(2 * (~ 5)) & f(2 * (0,1))^m(0,1);"
+        "int i[] = { 1, 23, 4, 5, };"
+        "char c[2][6] = { \"hello\", \"\" };") );
+
+    // EXAMPLE 4
+    PreprocessorOutput stringized = preprocess(
+        "#define str(s) # s\n"
+        "#define xstr(s) str(s)\n"
+        "#define debug(s, t) printf(\"x\" # s \"= %d, x\" # t \"= %s\", \\\n"
+        "    x ## s, x ## t)\n"
+        "#define INCFILE(n) vers ## n\n"
+        "#define glue(a, b) a ## b\n"
+        "#define xglue(a, b) glue(a, b)\n"
+        "#define HIGHLOW \"hello\"\n"
+        "#define LOW LOW \", world\"\n"
+        "debug(1, 2);\n"
+        "fputs(str(strncmp(\"abc\\0d\", \"abc\", '\\4') // this goes away\n"
+        "    == 0) str(: @\\n), s);\n"
+        "xstr(INCFILE(2).h)\n"
+        "glue(HIGH, LOW);\n"
+        "xglue(HIGH, LOW)\n");
+    REQUIRE( stringized.errors.empty() );
+    REQUIRE( stringized.text ==
+        "printf(\"x\" \"1\" \"= %d, x\" \"2\" \"= %s\", x1, x2);\n"
+        "fputs(\"strncmp(\\\"abc\\\\0d\\\", \\\"abc\\\", '\\\\4') == 0\" \": @\\n\", s);\n"
+        "\"vers2.h\"\n"
+        "\"hello\";\n"
+        "\"hello\" \", world\"\n" );
+
+    // EXAMPLE 5
+    REQUIRE( expand(
+        "#define t(x,y,z) x ## y ## z\n"
+        "int j[] = { t(1,2,3), t(,4,5), t(6,,7), t(8,9,),\n"
+        "    t(10,,), t(,11,), t(,,12), t(,,) };\n") == squeeze(
+        "int j[] = { 123, 45, 67, 89, 10, 11, 12, };") );
+
+    // EXAMPLE 7
+    REQUIRE( expand(
+        "#define debug(...) fprintf(stderr, __VA_ARGS__)\n"
+        "#define showlist(...) puts(#__VA_ARGS__)\n"
+        "#define report(test, ...) ((test)?puts(#test):\\\n"
+        "    printf(__VA_ARGS__))\n"
+        "debug(\"Flag\");\n"
+        "debug(\"X = %d\\n\", x);\n"
+        "showlist(The first, second, and third items.);\n"
+        "report(x>y, \"x is %d but y is %d\", x, y);\n") == squeeze(
+        "fprintf(stderr, \"Flag\");"
+        "fprintf(stderr, \"X = %d\\n\", x);"
+        "puts(\"The first, second, and third items.\");"
+        "((x>y)?puts(\"x>y\"): printf(\"x is %d but y is %d\", x, y));") );
+}
+
+TEST_CASE( "Expansions never paste tokens that were apart", "[preprocessor]" ) {
+    REQUIRE( preprocess("#define MINUS -\n-MINUS x\n#define EMPTY\n+EMPTY+ a EMPTY b\n").text
+        == "- - x\n+ + a b\n" );
+    REQUIRE( preprocess("#define f(x) x\nf(a)f(b) f(1)f(.5)\n").text == "a b 1 .5\n" );
+}
+
+TEST_CASE( "Conditional inclusion evaluates C integer expressions", "[preprocessor]" ) {
+    PreprocessorOutput output = preprocess(
+        "#define A 3\n"
+        "#if A * 2 == 6 && defined(A) && !defined B\n"
+        "yes1\n"
+        "#else\n"
+        "no1\n"
+        "#endif\n"
+        "#if 0\n"
+        "#if garbage (\n"
+        "#endif\n"
+        "no2 don't\n"
+        "#elif -1 < 0u\n"
+        "no3\n"
+        "#elif (2 || 1 / 0) && '\\377' < 0 && 0x10 == 16 && (1 ? 2 : (1/0)) == 2\n"
+        "yes2\n"
+        "#else\n"
+        "no4\n"
+        "#endif\n"
+        "#ifndef A\n"
+        "no5\n"
+        "#elif UNDEFINED_IS_ZERO + 1 && (-1 >> 70) == -1 && 18446744073709551615 == -1\n"
+        "yes3\n"
+        "#endif\n");
+    REQUIRE( output.errors.empty() );
+    REQUIRE( output.text == "yes1\nyes2\nyes3\n" );
+}
+
+TEST_CASE( "__LINE__ and __FILE__ follow #line", "[preprocessor]" ) {
+    PreprocessorOutput output = preprocess(
+        "__LINE__ __FILE__\n"
+        "#line 100 \"renamed.c\"\n"
+        "__LINE__ __FILE__\n"
+        "\n"
+        "#define LINE __LINE__\n"
+        "LINE\n"
+        "#error stop  here\n");
+    REQUIRE( output.text == "1 \"test.c\"\n100 \"renamed.c\"\n103\n" );
+    REQUIRE( output.errors.size() == 1 );
+    REQUIRE( output.errors[0].debug_string() == "renamed.c:104: error: #error stop here" );
+}
+
+TEST_CASE( "Preprocessing errors carry their file and line", "[preprocessor]" ) {
+    PreprocessorOutput output = preprocess(
+        "#define f(a, b) a\n"
+        "f(1)\n"
+        "#if 1 / 0\n"
+        "#endif\n"
+        "#include \"cynotester_missing.h\"\n"
+        "#bogus\n"
+        "#define g(x) #y\n"
+        "#ifdef f\n");
+    REQUIRE( output.errors.size() == 6 );
+    REQUIRE( output.errors[0].debug_string()
+        == "test.c:2: error: macro \"f\" requires 2 arguments, but only 1 given" );
+    REQUIRE( output.errors[1].debug_string() == "test.c:3: error: division by zero in #if" );
+    REQUIRE( output.errors[2].debug_string()
+        == "test.c:5: error: cynotester_missing.h: No such file or directory" );
+    REQUIRE( output.errors[3].debug_string() == "test.c:6: error: invalid preprocessing directive #bogus" );
+    REQUIRE( output.errors[4].debug_string()
+        == "test.c:7: error: '#' is not followed by a macro parameter" );
+    REQUIRE( output.errors[5].debug_string() == "test.c:8: error: unterminated conditional directive" );
+
+    REQUIRE( preprocess_file("cynotester_no_such_file.c", PreprocessorOptions()).open_failed );
+}
+
+#ifndef _WIN32
+TEST_CASE( "Guarded headers are read once and skipped from the cache", "[preprocessor]" ) {
+    mkdir("cynotester_pp", 0700);
+    const char* const files[][2] = {
+        { "cynotester_pp/guarded.h", "#ifndef GUARDED_H\n#define GUARDED_H\nint guarded;\n#endif\n" },
+        { "cynotester_pp/once.h", "#pragma once\nint once;\n" },
+        { "cynotester_pp/plain.h", "int plain;\n" },
+        { "cynotester_pp/nested.h", "#include \"guarded.h\"\nint nested;\n" },
+        { "cynotester_pp_main.c",
+            "#include <guarded.h>\n"
+            "#include \"cynotester_pp/guarded.h\"\n"
+            "#include <once.h>\n"
+            "#include <once.h>\n"
+            "#include <plain.h>\n"
+            "#include <plain.h>\n"
+            "#include <nested.h>\n"
+            "#define HEADER <plain.h>\n"
+            "#include HEADER\n"
+            "int main(void) { return GUARDED; }\n" }
+    };
+    for (const auto& file : files) {
+        std::ofstream(file[0], std::ios::binary) << file[1];
+    }
+
+    PreprocessorOptions options;
+    options.include_directories.push_back("cynotester_pp");
+    options.definitions.push_back("GUARDED=2");
+    PreprocessorOutput output = preprocess_file("cynotester_pp_main.c", options);
+    REQUIRE( output.errors.empty() );
+    REQUIRE( output.text == "int guarded;\nint once;\nint plain;\nint plain;\nint nested;\n"
+        "int plain;\nint main(void) { return 2; }\n" );
+    REQUIRE( output.files_read == 5 );
+    REQUIRE( output.includes_skipped == 3 );
+
+    LexerOutput lexer_output = lex_string(output.text, false);
+    REQUIRE( lexer_output.unknown_tokens.empty() );
+    REQUIRE( lexer_output.tokens.size() == 28 );
+
+    for (const auto& file : files) {
+        std::remove(file[0]);
+    }
+    rmdir("cynotester_pp");
+}
+#endif
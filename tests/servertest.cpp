@@ -0,0 +1,157 @@
+#include <catch2/catch.hpp>
+#include <cynophobia/server.hpp>
+
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+    std::string read_all(int fd) {
+        std::string text;
+        char buffer[256];
+        ssize_t count;
+        while ((count = read(fd, buffer, sizeof(buffer))) > 0) {
+            text.append(buffer, (std::size_t)count);
+        }
+        return text;
+    }
+
+    // A private directory for a test's sockets, removed with whatever is
+    // left in it however the test ends.
+    class SocketDirectory {
+        public:
+            SocketDirectory() {
+                char pattern[] = "/tmp/cynotester_server.XXXXXX";
+                if (mkdtemp(pattern)) {
+                    path = pattern;
+                }
+            }
+
+            ~SocketDirectory() {
+                DIR* directory = path.empty() ? nullptr : opendir(path.c_str());
+                if (!directory) {
+                    return;
+                }
+                while (struct dirent* entry = readdir(directory)) {
+                    std::string name = entry->d_name;
+                    if (name != "." && name != "..") {
+                        unlink((path + "/" + name).c_str());
+                    }
+                }
+                closedir(directory);
+                rmdir(path.c_str());
+            }
+
+            bool created() const { return !path.empty(); }
+            std::string socket(const std::string& name) const { return path + "/" + name; }
+
+        private:
+            std::string path;
+    };
+
+    // Runs a server on its own thread. Stopped and joined however the test
+    // ends, so a failed REQUIRE unwinds instead of destroying a joinable
+    // thread.
+    class ServingThread {
+        public:
+            explicit ServingThread(CompileServer& to_run) :
+                server(to_run), thread([&to_run]() { to_run.run(); }) {}
+
+            ~ServingThread() { stop(); }
+
+            void stop() {
+                if (thread.joinable()) {
+                    server.stop();
+                    thread.join();
+                }
+            }
+
+        private:
+            CompileServer& server;
+            std::thread thread;
+    };
+}
+
+TEST_CASE( "Forwarded command lines run in the server and write to the client", "[server]" ) {
+    SocketDirectory directory;
+    REQUIRE( directory.created() );
+    std::string socket_path = directory.socket("server.sock");
+    CompileServer server([](const ServerRequest& request) {
+        std::string text = request.directory;
+        for (const std::string& argument : request.arguments) {
+            text += "|" + argument;
+        }
+        // Catch2 assertions are not thread-safe; report through the code.
+        bool written = write(request.out_fd, text.data(), text.size()) == (ssize_t)text.size();
+        return written ? (int)request.arguments.size() + 250 : 0;
+    });
+    REQUIRE( server.listen(socket_path) );
+    ServingThread serving(server);
+
+    // A live server keeps its socket.
+    CompileServer second([](const ServerRequest&) { return 0; });
+    REQUIRE( !second.listen(socket_path) );
+
+    for (int round = 0; round < 3; round++) {
+        int pipe_fds[2];
+        REQUIRE( pipe(pipe_fds) == 0 );
+        int exit_code = -1;
+        std::vector<std::string> arguments = { "a.c", std::string("b\0c", 3), "" };
+        ForwardStatus status = forward_to_server(socket_path, "/work", arguments,
+            STDIN_FILENO, pipe_fds[1], exit_code);
+        close(pipe_fds[1]);
+        std::string output = read_all(pipe_fds[0]);
+        close(pipe_fds[0]);
+
+        REQUIRE( status == FORWARDED );
+        REQUIRE( exit_code == 253 );
+        REQUIRE( output == std::string("/work|a.c|b\0c|", 14) );
+    }
+
+    serving.stop();
+    int exit_code = -1;
+    REQUIRE( forward_to_server(socket_path, "/work", {}, STDIN_FILENO, STDOUT_FILENO, exit_code)
+        == NO_SERVER );
+    REQUIRE( access(socket_path.c_str(), F_OK) != 0 );
+}
+
+TEST_CASE( "A client that sends nothing does not keep the server running", "[server]" ) {
+    SocketDirectory directory;
+    REQUIRE( directory.created() );
+    std::string socket_path = directory.socket("idle.sock");
+    bool handled = false;
+    CompileServer server([&](const ServerRequest&) { handled = true; return 0; });
+    server.set_receive_timeout(100);
+    REQUIRE( server.listen(socket_path) );
+    struct stat info;
+    REQUIRE( stat(socket_path.c_str(), &info) == 0 );
+    REQUIRE( (info.st_mode & 0777) == 0600 );
+    ServingThread serving(server);
+
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+    int idle = socket(AF_UNIX, SOCK_STREAM, 0);
+    REQUIRE( connect(idle, (const sockaddr*)&address, sizeof(address)) == 0 );
+    // The server hangs up once the client has taken too long; a server
+    // that waited forever fails this after five seconds rather than hang.
+    timeval patience = { 5, 0 };
+    REQUIRE( setsockopt(idle, SOL_SOCKET, SO_RCVTIMEO, &patience, sizeof(patience)) == 0 );
+    char byte;
+    REQUIRE( read(idle, &byte, 1) == 0 );
+    close(idle);
+
+    serving.stop();
+    REQUIRE( !handled );
+}
+
+#endif
@@ -0,0 +1,114 @@
+#include <catch2/catch.hpp>
+#include <cynophobia/debugwriter.hpp>
+#include <cynophobia/lexer.hpp>
+#include <cynophobia/parser.hpp>
+#include <cynophobia/tacky.hpp>
+
+#include <memory>
+#include <string>
+
+namespace {
+    std::string debug_text(const tacky::Program& program) {
+        std::string text;
+        {
+            DebugWriter writer(text);
+            write_debug(writer, program);
+        }
+        return text;
+    }
+}
+
+TEST_CASE( "Chapter 1 programs lower to a return of a constant", "[tacky]" ) {
+    tacky::Program program;
+    {
+        LexerOutput lexer_output = lex_string(
+            "int main(void) { return 2; } int big(void) { return 2147483648; }", false);
+        ParserOutput parser_output = parse_program(lexer_output.tokens);
+        REQUIRE( !parser_output.is_error );
+        program = lower_program(*parser_output.program);
+    }
+    // The names outlive the lexer and parser.
+    REQUIRE( program.functions.size() == 2 );
+    REQUIRE( program.functions[0].name == "main" );
+    REQUIRE( instruction_count(program) == 2 );
+    const tacky::Instruction& instruction = program.functions[1].instructions[0];
+    REQUIRE( instruction.opcode == tacky::Return );
+    REQUIRE( tacky::is_constant(instruction.a) );
+    REQUIRE( program.functions[1].constant_value(instruction.a) == -2147483647 - 1 );
+    REQUIRE( debug_text(program) == "main:\n    return 2\nbig:\n    return -2147483648\n" );
+}
+
+TEST_CASE( "TACKY functions build in place and print every opcode", "[tacky]" ) {
+    tacky::Program program;
+    program.functions.resize(1);
+    tacky::Function& function = program.functions[0];
+    function.name = TextView { "f", 1 };
+    function.temporaries = 0;
+    function.labels = 0;
+    tacky::Value t0 = function.temporary();
+    tacky::Value t1 = function.temporary();
+    tacky::Value end = function.label();
+    REQUIRE( !tacky::is_constant(t1) );
+    REQUIRE( !tacky::is_constant(tacky::NO_VALUE) );
+
+    function.emit(tacky::Copy, t0, function.constant(-7));
+    function.emit(tacky::Negate, t1, t0);
+    function.emit(tacky::Remainder, t0, t1, function.constant(3));
+    function.emit(tacky::JumpIfZero, end, t0);
+    function.emit(tacky::LessOrEqual, t1, t0, t1);
+    function.emit(tacky::Jump, end);
+    function.emit(tacky::Label, end);
+    function.emit(tacky::Return, tacky::NO_VALUE, t1);
+    REQUIRE( function.instructions.size() == 8 );
+    REQUIRE( function.constants.size() == 2 );
+    REQUIRE( tacky::writes_dst(tacky::Copy) );
+    REQUIRE( !tacky::writes_dst(tacky::Jump) );
+
+    REQUIRE( debug_text(program) ==
+        "f:\n"
+        "    t0 = -7\n"
+        "    t1 = -t0\n"
+        "    t0 = t1 % 3\n"
+        "    if !t0 goto L0\n"
+        "    t1 = t0 <= t1\n"
+        "    goto L0\n"
+        "L0:\n"
+        "    return t1\n" );
+}
+
+TEST_CASE( "Unary, binary and logical expressions lower to three-address code", "[tacky][chapter4]" ) {
+    LexerOutput lexer_output = lex_string(
+        "int main(void) { return -(1 + 2) * ~3 % !4; }"
+        "int logic(void) { return 1 && 2 || 3 < 4; }", false);
+    ParserOutput parser_output = parse_program(lexer_output.tokens);
+    REQUIRE( !parser_output.is_error );
+    tacky::Program program = lower_program(*parser_output.program);
+    // Operands are evaluated left to right; && and || skip the right
+    // operand once the left decides the result.
+    REQUIRE( debug_text(program) ==
+        "main:\n"
+        "    t0 = 1 + 2\n"
+        "    t1 = -t0\n"
+        "    t2 = ~3\n"
+        "    t3 = t1 * t2\n"
+        "    t4 = !4\n"
+        "    t5 = t3 % t4\n"
+        "    return t5\n"
+        "logic:\n"
+        "    if !1 goto L0\n"
+        "    if !2 goto L0\n"
+        "    t0 = 1\n"
+        "    goto L1\n"
+        "L0:\n"
+        "    t0 = 0\n"
+        "L1:\n"
+        "    if t0 goto L2\n"
+        "    t1 = 3 < 4\n"
+        "    if t1 goto L2\n"
+        "    t2 = 0\n"
+        "    goto L3\n"
+        "L2:\n"
+        "    t2 = 1\n"
+        "L3:\n"
+        "    return t2\n" );
+}
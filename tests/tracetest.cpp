@@ -0,0 +1,58 @@
+#include <catch2/catch.hpp>
+#include <cynophobia/lexer.hpp>
+#include <cynophobia/parser.hpp>
+#include <cynophobia/trace.hpp>
+
+#include <string>
+
+namespace {
+    std::size_t count_of(const std::string& text, const std::string& part) {
+        std::size_t count = 0;
+        for (std::size_t at = text.find(part); at != std::string::npos; at = text.find(part, at + 1)) {
+            count++;
+        }
+        return count;
+    }
+}
+
+TEST_CASE( "Tracing records lexer and parser spans only while started", "[trace]" ) {
+    std::string program;
+    for (int i = 0; i < 200; i++) {
+        program += "int f" + std::to_string(i) + "(void) { return " + std::to_string(i) + "; }\n";
+    }
+    lex_string(program, false);
+    REQUIRE( !Tracer::enabled() );
+
+    REQUIRE( Tracer::instance().start() );
+    REQUIRE( !Tracer::instance().start() );
+    LexerOutput lexer_output = lex_string_parallel(program, false, 3, 1024);
+    ParserOutput parser_output = parse_program(lexer_output.tokens);
+    {
+        TraceScope scope("outer \"quoted\"", "a\\b");
+    }
+    std::string trace;
+    {
+        DebugWriter writer(trace);
+        Tracer::instance().finish(writer);
+    }
+    REQUIRE( !Tracer::enabled() );
+    REQUIRE( !parser_output.is_error );
+
+    REQUIRE( trace.compare(0, 17, "{\"traceEvents\": [") == 0 );
+    REQUIRE( count_of(trace, "\"name\": \"lex chunk\"") == 3 );
+    REQUIRE( count_of(trace, "\"name\": \"merge chunks\"") == 1 );
+    REQUIRE( count_of(trace, "\"name\": \"parse\"") == 1 );
+    REQUIRE( count_of(trace, "\"ph\": \"X\"") == 6 );
+    REQUIRE( count_of(trace, "{\"name\": \"outer \\\"quoted\\\"\"") == 1 );
+    REQUIRE( count_of(trace, "\"args\": {\"detail\": \"a\\\\b\"}") == 1 );
+
+    // Nothing from before start() or after finish() carries over.
+    lex_string(program, false);
+    REQUIRE( Tracer::instance().start() );
+    std::string empty;
+    {
+        DebugWriter writer(empty);
+        Tracer::instance().finish(writer);
+    }
+    REQUIRE( empty == "{\"traceEvents\": [\n]}\n" );
+}